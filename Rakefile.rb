@@ -7,6 +7,7 @@ QBC = CTarget.new()
 QBC.name = 'qbc'
 QBC.include 'lib'
 QBC.compile_files("lib/qbc.cpp", \
+		  "lib/binary.cpp", \
 		  "lib/core.cpp", \
 		  "lib/function.cpp", \
 		  "lib/instruction.cpp", \
@@ -14,6 +15,7 @@ QBC.compile_files("lib/qbc.cpp", \
 		  "lib/qbparse.c", \
 		  "lib/qblex.c", \
 		  "lib/stmt.cpp", \
+		  "lib/string.cpp", \
 		  "lib/type.cpp", \
 		 )
 QBC.obj_dir = 'o/qbc'
@@ -24,9 +26,11 @@ QBI = CTarget.new()
 QBI.name = 'qbi'
 QBI.include 'lib'
 QBI.compile_files("lib/qbi.cpp", \
+		  "lib/binary.cpp", \
 		  "lib/core.cpp", \
 		  "lib/function.cpp", \
 		  "lib/module.cpp", \
+		  "lib/string.cpp", \
 		  "lib/type.cpp", \
 		 )
 QBI.obj_dir = 'o/qbi'
@@ -36,18 +40,27 @@ QBRT = CTarget.new()
 QBRT.name = 'qbrt'
 QBRT.include 'lib'
 QBRT.compile_files("lib/qbrt.cpp", \
+		  "lib/array.cpp", \
+		  "lib/binary.cpp", \
 		  "lib/core.cpp", \
 		  "lib/function.cpp", \
 		  "lib/io.cpp", \
+		  "lib/ioring.cpp", \
+		  "lib/map.cpp", \
 		  "lib/module.cpp", \
 		  "lib/schedule.cpp", \
+		  "lib/string.cpp", \
+		  "lib/switch.cpp", \
+		  "lib/timer.cpp", \
 		  "lib/type.cpp", \
+		  "lib/vector.cpp", \
 		  )
 QBRT.obj_dir = 'o/qbrt'
 QBRT.link 'pthread'
 QBRT.debug!
 QBRT_DIRS = ["o","o/qbrt","o/qbrt/lib"]
-LIBQB = ['libqb/core.qb', 'libqb/io.qb', 'libqb/list.qb']
+LIBQB = ['libqb/array.qb', 'libqb/binary.qb', 'libqb/core.qb', 'libqb/io.qb' \
+	, 'libqb/list.qb', 'libqb/map.qb', 'libqb/set.qb', 'libqb/vector.qb']
 
 TESTQB = CTarget.new()
 TESTQB.name = 'testqb'
@@ -60,9 +73,46 @@ TESTQB.obj_dir = "o/testqb"
 TESTQB.debug!
 TESTQB_DIRS = ["o", "o/testqb", "o/testqb/lib", "o/testqb/testlib"]
 
+MAPBENCH = CTarget.new()
+MAPBENCH.name = 'mapbench'
+MAPBENCH.include 'lib'
+MAPBENCH.compile_files("bench/mapbench.cpp", \
+		  "lib/binary.cpp", \
+		  "lib/core.cpp", \
+		  "lib/function.cpp", \
+		  "lib/map.cpp", \
+		  "lib/module.cpp", \
+		  "lib/string.cpp", \
+		  "lib/type.cpp", \
+		  )
+MAPBENCH.obj_dir = 'o/mapbench'
+MAPBENCH_DIRS = ["o", "o/mapbench", "o/mapbench/lib", "o/mapbench/bench"]
+
+ARRAYBENCH = CTarget.new()
+ARRAYBENCH.name = 'arraybench'
+ARRAYBENCH.include 'lib'
+ARRAYBENCH.compile_files("bench/arraybench.cpp", \
+		  "lib/array.cpp", \
+		  "lib/binary.cpp", \
+		  "lib/core.cpp", \
+		  "lib/function.cpp", \
+		  "lib/module.cpp", \
+		  "lib/string.cpp", \
+		  "lib/type.cpp", \
+		  )
+ARRAYBENCH.obj_dir = 'o/arraybench'
+ARRAYBENCH_DIRS = ["o", "o/arraybench", "o/arraybench/lib", \
+	"o/arraybench/bench"]
+
+CONNBENCH = CTarget.new()
+CONNBENCH.name = 'connbench'
+CONNBENCH.compile_files("bench/connbench.cpp")
+CONNBENCH.obj_dir = 'o/connbench'
+CONNBENCH_DIRS = ["o", "o/connbench", "o/connbench/bench"]
+
 PROJECT = CProject.new()
 PROJECT.cc = CCompiler.new()
-PROJECT.targets = [QBC,QBI,QBRT,TESTQB]
+PROJECT.targets = [QBC,QBI,QBRT,TESTQB,MAPBENCH,ARRAYBENCH,CONNBENCH]
 
 
 directory 'o'
@@ -75,6 +125,14 @@ directory 'o/qbrt/lib'
 directory 'o/testqb'
 directory 'o/testqb/lib'
 directory 'o/testqb/testlib'
+directory 'o/mapbench'
+directory 'o/mapbench/lib'
+directory 'o/mapbench/bench'
+directory 'o/arraybench'
+directory 'o/arraybench/lib'
+directory 'o/arraybench/bench'
+directory 'o/connbench'
+directory 'o/connbench/bench'
 
 task :default => :all
 
@@ -109,6 +167,29 @@ task :testqb_deps do
 	TESTQB.all_dependencies.each { |d| puts d }
 end
 
+file "mapbench" => :compile_mapbench do
+	PROJECT.link(MAPBENCH)
+end
+task :compile_mapbench => MAPBENCH_DIRS + MAPBENCH.objects
+
+file "arraybench" => :compile_arraybench do
+	PROJECT.link(ARRAYBENCH)
+end
+task :compile_arraybench => ARRAYBENCH_DIRS + ARRAYBENCH.objects
+
+file "connbench" => :compile_connbench do
+	PROJECT.link(CONNBENCH)
+end
+task :compile_connbench => CONNBENCH_DIRS + CONNBENCH.objects
+
+# the server connbench drives
+file 'bench/connecho.qb' => ['bench/connecho.uqb', 'qbc'] + LIBQB do
+	Dir.chdir "bench/"
+	ENV['QBPATH'] = '../libqb'
+	sh "../qbc connecho"
+	Dir.chdir "../"
+end
+
 
 rule '.o' => [ proc { |o| PROJECT.dependencies( o ) } ] do |t|
 	PROJECT.compile( t.name )
@@ -150,26 +231,59 @@ task :unit => ['testqb'] do
 	sh "accertion/accert ./testqb"
 end
 
+# Benchmarks
+task :bench => ['mapbench', 'arraybench', 'connbench', 'qbrt', \
+		'bench/connecho.qb'] do
+	sh "./mapbench"
+	sh "./arraybench"
+	sh "./connbench"
+end
+
 
 TestFiles = ['hello.uqb',
 	'argc.uqb',
+	'arrays.uqb',
 	'arithmetic.uqb',
 	'badmath.uqb',
+	'binaries.uqb',
+	'binaryio.uqb',
+	'bitwise.uqb',
 	'bool.uqb',
+	'datagrams.uqb',
 	'echo.uqb',
 	'fact.uqb',
+	'fields.uqb',
+	'files.uqb',
+	'floats.uqb',
 	'fork_hello.uqb',
+	'listops.uqb',
 	'listprint.uqb',
+	'lists.uqb',
+	'maps.uqb',
 	'matchargs.uqb',
 	'maybe.uqb',
 	'missingmodule.uqb',
 	'multimethod.uqb',
 	'newproc.uqb',
+	'parallel.uqb',
 	'param_types.uqb',
 	'polymorph.uqb',
+	'readlines.uqb',
+	'sockets.uqb',
+	'stracc.uqb',
 	'struct.uqb',
+	'switch.uqb',
+	'timers.uqb',
+	'transfer.uqb',
+	'vectors.uqb',
 ]
 
+# failure traces end with the C++ source line that failed, which
+# moves with any edit to the runtime, so those numbers aren't compared
+def without_c_lines(output)
+	return output.gsub(/(\.cpp):\d+$/, '\1')
+end
+
 def test_uqb(file)
 	passed = false
 	Dir.chdir "T/"
@@ -191,7 +305,7 @@ def test_uqb(file)
 		output = `#{cmd}`
 	end
 	expected = File.read("T/DATA/#{mod}.output")
-	if (output != expected)
+	if (without_c_lines(output) != without_c_lines(expected))
 		puts "Expected output:\n#{expected}..."
 		puts "Actual output:\n#{output}..."
 		passed = false
@@ -202,7 +316,7 @@ def test_uqb(file)
 	return passed
 end
 
-task :T => ['qbc', 'qbrt'] do
+def test_all
 	failures = []
 	TestFiles.each do |t|
 		if not test_uqb t
@@ -217,3 +331,13 @@ task :T => ['qbc', 'qbrt'] do
 		puts failures
 	end
 end
+
+task :T => ['qbc', 'qbrt'] do
+	test_all
+end
+
+# the same tests with stream io on io_uring instead of epoll
+task :T_uring => ['qbc', 'qbrt'] do
+	ENV['QBRT_IO'] = 'uring'
+	test_all
+end
@@ -0,0 +1,87 @@
+/**
+ * Compare the packed array kernels against boxed values
+ *
+ * usage: arraybench [count]
+ */
+#include "qbrt/core.h"
+#include "qbrt/array.h"
+#include "qbrt/type.h"
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <time.h>
+
+using namespace std;
+
+#define ROUNDS	20
+
+
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double start, double result)
+{
+	double ms((now() - start) * 1000.0 / ROUNDS);
+	cout << name << '\t' << ms << " ms\t" << result << endl;
+}
+
+int main(int argc, const char **argv)
+{
+	int count(argc > 1 ? atoi(argv[1]) : 1000000);
+
+	vector< qbrt_value > boxed(count);
+	Array *a(Array::create(ARRAY_FLOAT, count));
+	srand(1);
+	for (int i(0); i<count; ++i) {
+		double x(rand() / (double) RAND_MAX);
+		qbrt_value::fp(boxed[i], x);
+		a->data.fp[i] = x;
+	}
+
+	double start(now());
+	double total(0);
+	for (int r(0); r<ROUNDS; ++r) {
+		total = 0;
+		for (int i(0); i<count; ++i) {
+			if (boxed[i].type->id == VT_FLOAT) {
+				total += boxed[i].data.fp;
+			}
+		}
+	}
+	report("boxed sum", start, total);
+
+	qbrt_value result;
+	start = now();
+	for (int r(0); r<ROUNDS; ++r) {
+		a->sum(result);
+	}
+	report("array sum", start, result.data.fp);
+
+	start = now();
+	for (int r(0); r<ROUNDS; ++r) {
+		total = 0;
+		for (int i(0); i<count; ++i) {
+			total += boxed[i].data.fp * boxed[i].data.fp;
+		}
+	}
+	report("boxed dot", start, total);
+
+	start = now();
+	for (int r(0); r<ROUNDS; ++r) {
+		Array::dot(result, *a, *a);
+	}
+	report("array dot", start, result.data.fp);
+
+	qbrt_value half;
+	qbrt_value::fp(half, 0.5);
+	start = now();
+	for (int r(0); r<ROUNDS; ++r) {
+		Array::compare(ARRAY_LT, *a, half)->sum(result);
+	}
+	report("array lt", start, result.data.i);
+	return 0;
+}
@@ -0,0 +1,269 @@
+/**
+ * Drive many concurrent loopback connections through qbrt
+ *
+ * usage: connbench [connections] [rounds]
+ *
+ * Starts ./qbrt running bench/connecho, opens the connections to it
+ * and then each round writes a line on every connection and waits
+ * for all the echoes. It runs once with the server on epoll and once
+ * on io_uring so the two io engines can be compared. qbrt falls back
+ * to epoll if the kernel has no io_uring, then both rows match.
+ * Run it from the top of the tree.
+ */
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+#define MAX_EVENTS	256
+/** fds the server needs beyond one per connection */
+#define SPARE_FDS	64
+
+
+struct Conn
+{
+	int fd;
+	/** Bytes of this round's echo still to come */
+	uint32_t left;
+};
+
+/** What one run of the bench measured */
+struct Result
+{
+	double connect_ms;
+	double round_ms;
+	double lines_per_sec;
+};
+
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/** Raise the fd limit as far as it goes, return how many fit */
+static int raise_fd_limit()
+{
+	struct rlimit lim;
+	getrlimit(RLIMIT_NOFILE, &lim);
+	lim.rlim_cur = lim.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &lim);
+	getrlimit(RLIMIT_NOFILE, &lim);
+	return lim.rlim_cur;
+}
+
+/** Find a free loopback port by binding to port 0 */
+static int free_port()
+{
+	int fd(socket(AF_INET, SOCK_STREAM, 0));
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len(sizeof(addr));
+	bind(fd, (sockaddr *) &addr, len);
+	getsockname(fd, (sockaddr *) &addr, &len);
+	close(fd);
+	return ntohs(addr.sin_port);
+}
+
+/**
+ * Start the echo server listening on port, with QBRT_IO set to engine
+ * Return its pid once it says it's ready, or -1.
+ */
+static pid_t start_server(int port, const char *engine)
+{
+	int in[2], out[2];
+	if (pipe(in) < 0 || pipe(out) < 0) {
+		perror("pipe");
+		return -1;
+	}
+	pid_t pid(fork());
+	if (pid == 0) {
+		dup2(in[0], 0);
+		dup2(out[1], 1);
+		close(in[1]);
+		close(out[0]);
+		setenv("QBPATH", "libqb:bench", 1);
+		setenv("QBRT_IO", engine, 1);
+		execl("./qbrt", "qbrt", "connecho", (char *) NULL);
+		perror("exec ./qbrt");
+		_exit(1);
+	}
+	close(in[0]);
+	close(out[1]);
+
+	char addr[32];
+	int len(snprintf(addr, sizeof(addr), "127.0.0.1:%d\n", port));
+	if (write(in[1], addr, len) != len) {
+		perror("write address");
+	}
+	char ready[8];
+	ssize_t n(read(out[0], ready, sizeof(ready)));
+	close(in[1]);
+	close(out[0]);
+	if (n <= 0 || strncmp(ready, "ready", 5) != 0) {
+		cerr << "connecho didn't start, is bench/connecho.qb built?\n";
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+	return pid;
+}
+
+static int connect_to(int port)
+{
+	int fd(socket(AF_INET, SOCK_STREAM, 0));
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (sockaddr *) &addr, sizeof(addr)) < 0) {
+		perror("connect");
+		close(fd);
+		return -1;
+	}
+	int on(1);
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+}
+
+/** Write a line on every connection and wait for every echo */
+static bool round_trip(int epfd, vector< Conn > &conn, int round)
+{
+	char line[32];
+	int len(snprintf(line, sizeof(line), "round %d\n", round));
+	vector< Conn >::iterator it(conn.begin());
+	for (; it!=conn.end(); ++it) {
+		if (write(it->fd, line, len) != len) {
+			perror("write");
+			return false;
+		}
+		it->left = len;
+	}
+
+	size_t waiting(conn.size());
+	epoll_event events[MAX_EVENTS];
+	char buf[256];
+	while (waiting > 0) {
+		int ready(epoll_wait(epfd, events, MAX_EVENTS, 10000));
+		if (ready <= 0) {
+			cerr << "timed out waiting for " << waiting
+				<< " echoes\n";
+			return false;
+		}
+		for (int i(0); i<ready; ++i) {
+			Conn &c(*(Conn *) events[i].data.ptr);
+			ssize_t n(read(c.fd, buf, sizeof(buf)));
+			if (n < 0 && errno == EAGAIN) {
+				continue;
+			}
+			if (n <= 0 || (uint32_t) n > c.left) {
+				cerr << "bad echo\n";
+				return false;
+			}
+			c.left -= n;
+			if (c.left == 0) {
+				--waiting;
+			}
+		}
+	}
+	return true;
+}
+
+/** Run the bench against a server on one io engine */
+static bool run(const char *engine, int count, int rounds, Result &result)
+{
+	int port(free_port());
+	pid_t server(start_server(port, engine));
+	if (server < 0) {
+		return false;
+	}
+
+	double start(now());
+	int epfd(epoll_create(1));
+	Conn closed = { -1, 0 };
+	vector< Conn > conn(count, closed);
+	bool ok(true);
+	for (int i(0); i<count && ok; ++i) {
+		conn[i].fd = connect_to(port);
+		ok = conn[i].fd >= 0;
+		if (ok) {
+			epoll_event ev;
+			ev.events = EPOLLIN;
+			ev.data.ptr = &conn[i];
+			epoll_ctl(epfd, EPOLL_CTL_ADD, conn[i].fd, &ev);
+		}
+	}
+	result.connect_ms = (now() - start) * 1000.0;
+
+	start = now();
+	for (int r(0); r<rounds && ok; ++r) {
+		ok = round_trip(epfd, conn, r);
+	}
+	double elapsed(now() - start);
+	result.round_ms = elapsed * 1000.0 / rounds;
+	result.lines_per_sec = double(count) * rounds / elapsed;
+
+	vector< Conn >::iterator it(conn.begin());
+	for (; it!=conn.end(); ++it) {
+		if (it->fd >= 0) {
+			close(it->fd);
+		}
+	}
+	close(epfd);
+	kill(server, SIGTERM);
+	waitpid(server, NULL, 0);
+	return ok;
+}
+
+int main(int argc, const char **argv)
+{
+	int count(argc > 1 ? atoi(argv[1]) : 2000);
+	int rounds(argc > 2 ? atoi(argv[2]) : 50);
+
+	// each connection has an fd here and another in the server
+	int fit((raise_fd_limit() - SPARE_FDS) / 2);
+	if (count > fit) {
+		cerr << "fd limit only fits " << fit << " connections\n";
+		count = fit;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	const char *engine[] = { "epoll", "uring" };
+	Result result[2];
+	for (int e(0); e<2; ++e) {
+		if (!run(engine[e], count, rounds, result[e])) {
+			cerr << "connbench failed on " << engine[e] << endl;
+			return 1;
+		}
+	}
+
+	cout << "connections\t" << count << endl;
+	cout << "engine\tconnect ms\tround trip ms\tlines/s\n";
+	for (int e(0); e<2; ++e) {
+		cout << engine[e] << '\t' << result[e].connect_ms
+			<< '\t' << result[e].round_ms
+			<< '\t' << result[e].lines_per_sec << endl;
+	}
+	return 0;
+}
@@ -0,0 +1,155 @@
+/**
+ * Compare the HAMT map against the binary tree map it replaced
+ *
+ * usage: mapbench [count]
+ */
+#include "qbrt/core.h"
+#include "qbrt/map.h"
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <time.h>
+
+using namespace std;
+
+#define SORTED_TREE_MAX	5000
+
+
+/** The persistent unbalanced binary tree that Map used to be */
+struct TreeMap
+{
+	qbrt_value key;
+	qbrt_value value;
+	TreeMap *left;
+	TreeMap *right;
+
+	TreeMap(const qbrt_value &key, const qbrt_value &val)
+	: key(key)
+	, value(val)
+	, left(NULL)
+	, right(NULL)
+	{}
+};
+
+TreeMap * tree_insert(TreeMap *m, const qbrt_value &key
+		, const qbrt_value &val)
+{
+	if (!m) {
+		return new TreeMap(key, val);
+	}
+	TreeMap *copy = new TreeMap(*m);
+	int comparison(qbrt_compare(key, m->key));
+	if (comparison < 0) {
+		copy->left = tree_insert(copy->left, key, val);
+	} else if (comparison > 0) {
+		copy->right = tree_insert(copy->right, key, val);
+	} else {
+		copy->value = val;
+	}
+	return copy;
+}
+
+const qbrt_value * tree_find(const TreeMap *m, const qbrt_value &key)
+{
+	while (m) {
+		int comparison(qbrt_compare(key, m->key));
+		if (comparison < 0) {
+			m = m->left;
+		} else if (comparison > 0) {
+			m = m->right;
+		} else {
+			return &m->value;
+		}
+	}
+	return NULL;
+}
+
+
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void report(const char *name, const char *keys, double start
+		, int found, int count)
+{
+	double ms((now() - start) * 1000.0);
+	cout << name << '\t' << keys << '\t' << count << '\t' << ms << " ms";
+	if (found != count) {
+		cout << "\tFOUND " << found << " OF " << count;
+	}
+	cout << endl;
+}
+
+static void bench_tree(const char *keys, const vector< qbrt_value > &key)
+{
+	double start(now());
+	TreeMap *m(NULL);
+	for (size_t i(0); i<key.size(); ++i) {
+		m = tree_insert(m, key[i], key[i]);
+	}
+	report("tree insert", keys, start, key.size(), key.size());
+
+	start = now();
+	int found(0);
+	for (size_t i(0); i<key.size(); ++i) {
+		found += tree_find(m, key[i]) ? 1 : 0;
+	}
+	report("tree find", keys, start, found, key.size());
+}
+
+static void bench_hamt(const char *keys, const vector< qbrt_value > &key)
+{
+	double start(now());
+	Map *m(Map::create());
+	for (size_t i(0); i<key.size(); ++i) {
+		m = Map::insert(*m, key[i], key[i]);
+	}
+	report("hamt insert", keys, start, m->size(), key.size());
+
+	start = now();
+	Map *t(Map::transient(Map()));
+	for (size_t i(0); i<key.size(); ++i) {
+		t->insert_in_place(key[i], key[i]);
+	}
+	t->persist();
+	report("hamt transient", keys, start, t->size(), key.size());
+
+	start = now();
+	int found(0);
+	for (size_t i(0); i<key.size(); ++i) {
+		const qbrt_value *v(m->find(key[i]));
+		found += (v && qbrt_compare(*v, key[i]) == 0) ? 1 : 0;
+	}
+	report("hamt find", keys, start, found, key.size());
+}
+
+int main(int argc, const char **argv)
+{
+	int count(argc > 1 ? atoi(argv[1]) : 20000);
+
+	vector< qbrt_value > sorted(count);
+	vector< qbrt_value > shuffled(count);
+	for (int i(0); i<count; ++i) {
+		qbrt_value::i(sorted[i], i);
+		shuffled[i] = sorted[i];
+	}
+	srand(1);
+	for (int i(count - 1); i>0; --i) {
+		swap(shuffled[i], shuffled[rand() % (i + 1)]);
+	}
+
+	bench_tree("random", shuffled);
+	bench_hamt("random", shuffled);
+	// the tree copies its whole spine on each sorted insert
+	// so it runs out of memory long before the hamt slows down
+	vector< qbrt_value > few(sorted.begin()
+			, sorted.begin() + min(count, SORTED_TREE_MAX));
+	bench_tree("sorted", few);
+	bench_hamt("sorted", few);
+	bench_hamt("sorted", sorted);
+	return 0;
+}
@@ -224,6 +224,16 @@ stmt(A) ::= fork_block(B). {
 stmt(A) ::= CALL reg(B) reg(C). {
 	A = new call_stmt(B, C);
 }
+stmt(A) ::= CASE INT(B) LABEL(C). {
+	A = new case_stmt(B->intval(), C->strip_first());
+}
+stmt(A) ::= CASE HASHTAG(B) LABEL(C). {
+	A = new case_stmt(B->strip_first(), C->strip_first());
+}
+stmt(A) ::= CASE modtype(B) LABEL(C). {
+	A = new case_stmt(B, C->strip_first());
+	B = NULL;
+}
 stmt(A) ::= CFAILURE reg(C) HASHTAG(B). {
 	A = new cfailure_stmt(C, B->strip_first());
 }
@@ -248,6 +258,9 @@ stmt(A) ::= CMP_LTEQ reg(B) reg(C) reg(D). {
 stmt(A) ::= CONST reg(B) INT(C). {
 	A = new consti_stmt(B, C->intval());
 }
+stmt(A) ::= CONST reg(B) FLOAT(C). {
+	A = new constf_stmt(B, C->floatval());
+}
 stmt(A) ::= CONST reg(B) STR(C). {
 	A = new consts_stmt(B, C->strval());
 }
@@ -281,18 +294,54 @@ stmt(A) ::= IFFAIL reg(B) LABEL(C). {
 stmt(A) ::= IFNOTFAIL reg(B) LABEL(C). {
 	A = new iffail_stmt(false, B, C->strip_first());
 }
+stmt(A) ::= FADD reg(B) reg(C) reg(D). {
+	A = new binaryop_stmt('+', 'f', B, C, D);
+}
+stmt(A) ::= FDIV reg(B) reg(C) reg(D). {
+	A = new binaryop_stmt('/', 'f', B, C, D);
+}
+stmt(A) ::= FMULT reg(B) reg(C) reg(D). {
+	A = new binaryop_stmt('*', 'f', B, C, D);
+}
+stmt(A) ::= FSUB reg(B) reg(C) reg(D). {
+	A = new binaryop_stmt('-', 'f', B, C, D);
+}
+stmt(A) ::= FTOI reg(B) reg(C). {
+	A = new convert_stmt(OP_FTOI, B, C);
+}
 stmt(A) ::= IADD reg(B) reg(C) reg(D). {
 	A = new binaryop_stmt('+', 'i', B, C, D);
 }
+stmt(A) ::= IAND reg(B) reg(C) reg(D). {
+	A = new binaryop_stmt('&', 'i', B, C, D);
+}
 stmt(A) ::= IDIV reg(B) reg(C) reg(D). {
 	A = new binaryop_stmt('/', 'i', B, C, D);
 }
+stmt(A) ::= IMOD reg(B) reg(C) reg(D). {
+	A = new binaryop_stmt('%', 'i', B, C, D);
+}
 stmt(A) ::= IMULT reg(B) reg(C) reg(D). {
 	A = new binaryop_stmt('*', 'i', B, C, D);
 }
+stmt(A) ::= IOR reg(B) reg(C) reg(D). {
+	A = new binaryop_stmt('|', 'i', B, C, D);
+}
+stmt(A) ::= ISHL reg(B) reg(C) reg(D). {
+	A = new binaryop_stmt('<', 'i', B, C, D);
+}
+stmt(A) ::= ISHR reg(B) reg(C) reg(D). {
+	A = new binaryop_stmt('>', 'i', B, C, D);
+}
 stmt(A) ::= ISUB reg(B) reg(C) reg(D). {
 	A = new binaryop_stmt('-', 'i', B, C, D);
 }
+stmt(A) ::= ITOF reg(B) reg(C). {
+	A = new convert_stmt(OP_ITOF, B, C);
+}
+stmt(A) ::= IXOR reg(B) reg(C) reg(D). {
+	A = new binaryop_stmt('^', 'i', B, C, D);
+}
 stmt(A) ::= LABEL(B). {
 	A = new label_stmt(B->strip_first());
 }
@@ -325,6 +374,30 @@ stmt(A) ::= RECV reg(B). {
 stmt(A) ::= STRACC reg(B) reg(C). {
 	A = new stracc_stmt(B, C);
 }
+stmt(A) ::= CLIST reg(B). {
+	A = new clist_stmt(B);
+}
+stmt(A) ::= CONS reg(B) reg(C). {
+	A = new cons_stmt(B, C);
+}
+stmt(A) ::= CVECT reg(B). {
+	A = new cvect_stmt(B);
+}
+stmt(A) ::= SWITCH reg(B) LABEL(C). {
+	A = new switch_stmt(B, C->strip_first());
+}
+stmt(A) ::= VGET reg(B) reg(C) reg(D). {
+	A = new vget_stmt(B, C, D);
+}
+stmt(A) ::= VLEN reg(B) reg(C). {
+	A = new vlen_stmt(B, C);
+}
+stmt(A) ::= VPUSH reg(B) reg(C). {
+	A = new vpush_stmt(B, C);
+}
+stmt(A) ::= VSET reg(B) reg(C) reg(D). {
+	A = new vset_stmt(B, C, D);
+}
 stmt(A) ::= WAIT reg(B). {
 	A = new wait_stmt(B);
 }
@@ -0,0 +1,658 @@
+#include "qbrt/array.h"
+#include "qbrt/type.h"
+#include <stdlib.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define ARRAY_SIMD
+#endif
+
+using namespace std;
+
+/** Kernel bodies are inlined into callers built for each instruction set */
+#define KERNEL	static inline __attribute__((always_inline))
+#define ARRAY_ALIGN	32
+
+
+/**
+ * The ops take arguments by reference so the same code works
+ * for plain numbers and for GCC vector types
+ */
+struct AddOp
+{
+	template < typename X >
+	KERNEL void apply(X &out, const X &a, const X &b) { out = a + b; }
+};
+
+struct SubOp
+{
+	template < typename X >
+	KERNEL void apply(X &out, const X &a, const X &b) { out = a - b; }
+};
+
+struct MulOp
+{
+	template < typename X >
+	KERNEL void apply(X &out, const X &a, const X &b) { out = a * b; }
+};
+
+struct DivOp
+{
+	template < typename X >
+	KERNEL void apply(X &out, const X &a, const X &b) { out = a / b; }
+};
+
+struct MinOp
+{
+	template < typename X >
+	KERNEL void apply(X &out, const X &a, const X &b)
+	{
+		out = b < a ? b : a;
+	}
+};
+
+struct MaxOp
+{
+	template < typename X >
+	KERNEL void apply(X &out, const X &a, const X &b)
+	{
+		out = a < b ? b : a;
+	}
+};
+
+/** Comparisons set each mask item to 1 or 0 */
+struct LtOp
+{
+	template < typename M, typename X >
+	KERNEL void apply(M &mask, const X &a, const X &b)
+	{
+		mask = (a < b) & 1;
+	}
+};
+
+struct GtOp
+{
+	template < typename M, typename X >
+	KERNEL void apply(M &mask, const X &a, const X &b)
+	{
+		mask = (a > b) & 1;
+	}
+};
+
+struct EqOp
+{
+	template < typename M, typename X >
+	KERNEL void apply(M &mask, const X &a, const X &b)
+	{
+		mask = (a == b) & 1;
+	}
+};
+
+
+/**
+ * Kernel bodies
+ *
+ * V is the vector type and M the int vector the same size, or both
+ * are the item type for the scalar fallback. Arrays are aligned so
+ * whole vectors can be loaded directly, the tail is done one item
+ * at a time.
+ */
+template < typename V, typename T, typename Op >
+KERNEL void arith_body(T *out, const T *a, const T *b, uint32_t n)
+{
+	const uint32_t lanes(sizeof(V) / sizeof(T));
+	uint32_t i(0);
+	for (; i + lanes <= n; i += lanes) {
+		Op::apply(*(V *) (out + i), *(const V *) (a + i)
+				, *(const V *) (b + i));
+	}
+	for (; i<n; ++i) {
+		Op::apply(out[i], a[i], b[i]);
+	}
+}
+
+template < typename V, typename T, typename Op >
+KERNEL void arith_scalar_body(T *out, const T *a, T b, uint32_t n)
+{
+	const uint32_t lanes(sizeof(V) / sizeof(T));
+	const V bv(V() + b);
+	uint32_t i(0);
+	for (; i + lanes <= n; i += lanes) {
+		Op::apply(*(V *) (out + i), *(const V *) (a + i), bv);
+	}
+	for (; i<n; ++i) {
+		Op::apply(out[i], a[i], b);
+	}
+}
+
+template < typename V, typename M, typename T, typename Op >
+KERNEL void compare_body(int64_t *mask, const T *a, const T *b, uint32_t n)
+{
+	const uint32_t lanes(sizeof(V) / sizeof(T));
+	uint32_t i(0);
+	for (; i + lanes <= n; i += lanes) {
+		Op::apply(*(M *) (mask + i), *(const V *) (a + i)
+				, *(const V *) (b + i));
+	}
+	for (; i<n; ++i) {
+		Op::apply(mask[i], a[i], b[i]);
+	}
+}
+
+template < typename V, typename M, typename T, typename Op >
+KERNEL void compare_scalar_body(int64_t *mask, const T *a, T b, uint32_t n)
+{
+	const uint32_t lanes(sizeof(V) / sizeof(T));
+	const V bv(V() + b);
+	uint32_t i(0);
+	for (; i + lanes <= n; i += lanes) {
+		Op::apply(*(M *) (mask + i), *(const V *) (a + i), bv);
+	}
+	for (; i<n; ++i) {
+		Op::apply(mask[i], a[i], b);
+	}
+}
+
+/** Combine all the items with the op, n must be at least 1 */
+template < typename V, typename T, typename Op >
+KERNEL T reduce_body(const T *a, uint32_t n)
+{
+	const uint32_t lanes(sizeof(V) / sizeof(T));
+	T result(a[0]);
+	uint32_t i(1);
+	if (n >= lanes) {
+		V acc(*(const V *) a);
+		for (i=lanes; i + lanes <= n; i += lanes) {
+			Op::apply(acc, acc, *(const V *) (a + i));
+		}
+		const T *lane((const T *) &acc);
+		result = lane[0];
+		for (uint32_t j(1); j<lanes; ++j) {
+			Op::apply(result, result, lane[j]);
+		}
+	}
+	for (; i<n; ++i) {
+		Op::apply(result, result, a[i]);
+	}
+	return result;
+}
+
+template < typename V, typename T >
+KERNEL T dot_body(const T *a, const T *b, uint32_t n)
+{
+	const uint32_t lanes(sizeof(V) / sizeof(T));
+	V acc = V();
+	uint32_t i(0);
+	for (; i + lanes <= n; i += lanes) {
+		acc += *(const V *) (a + i) * *(const V *) (b + i);
+	}
+	const T *lane((const T *) &acc);
+	T result(0);
+	for (uint32_t j(0); j<lanes; ++j) {
+		result += lane[j];
+	}
+	for (; i<n; ++i) {
+		result += a[i] * b[i];
+	}
+	return result;
+}
+
+template < typename T >
+KERNEL void gather_body(T *out, const T *src, const int64_t *index
+		, uint32_t n)
+{
+	for (uint32_t i(0); i<n; ++i) {
+		out[i] = src[index[i]];
+	}
+}
+
+
+/**
+ * Kernels for each instruction set
+ *
+ * SSE2 is always there on x86-64 so it's the fallback when the cpu
+ * doesn't have AVX2. Other cpus get the scalar bodies.
+ */
+#ifdef ARRAY_SIMD
+
+template < typename T, int BYTES >
+struct SimdType
+{
+	typedef T V __attribute__((vector_size(BYTES)));
+	typedef int64_t M __attribute__((vector_size(BYTES)));
+};
+typedef SimdType< int64_t, 32 > Avx2Int;
+typedef SimdType< int64_t, 16 > Sse2Int;
+
+static bool has_avx2()
+{
+	static int avx2(-1);
+	if (avx2 < 0) {
+		avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+	}
+	return avx2;
+}
+
+#define AVX2	__attribute__((target("avx2")))
+
+template < typename T, typename Op >
+AVX2 static void arith_avx2(T *out, const T *a, const T *b, uint32_t n)
+{
+	arith_body< typename SimdType< T, 32 >::V, T, Op >(out, a, b, n);
+}
+
+template < typename T, typename Op >
+static void arith_sse2(T *out, const T *a, const T *b, uint32_t n)
+{
+	arith_body< typename SimdType< T, 16 >::V, T, Op >(out, a, b, n);
+}
+
+template < typename T, typename Op >
+AVX2 static void arith_scalar_avx2(T *out, const T *a, T b, uint32_t n)
+{
+	arith_scalar_body< typename SimdType< T, 32 >::V, T, Op >(out, a, b, n);
+}
+
+template < typename T, typename Op >
+static void arith_scalar_sse2(T *out, const T *a, T b, uint32_t n)
+{
+	arith_scalar_body< typename SimdType< T, 16 >::V, T, Op >(out, a, b, n);
+}
+
+template < typename T, typename Op >
+AVX2 static void compare_avx2(int64_t *mask, const T *a, const T *b
+		, uint32_t n)
+{
+	compare_body< typename SimdType< T, 32 >::V, Avx2Int::M, T, Op >(
+			mask, a, b, n);
+}
+
+template < typename T, typename Op >
+static void compare_sse2(int64_t *mask, const T *a, const T *b, uint32_t n)
+{
+	compare_body< typename SimdType< T, 16 >::V, Sse2Int::M, T, Op >(
+			mask, a, b, n);
+}
+
+template < typename T, typename Op >
+AVX2 static void compare_scalar_avx2(int64_t *mask, const T *a, T b
+		, uint32_t n)
+{
+	compare_scalar_body< typename SimdType< T, 32 >::V, Avx2Int::M
+		, T, Op >(mask, a, b, n);
+}
+
+template < typename T, typename Op >
+static void compare_scalar_sse2(int64_t *mask, const T *a, T b, uint32_t n)
+{
+	compare_scalar_body< typename SimdType< T, 16 >::V, Sse2Int::M
+		, T, Op >(mask, a, b, n);
+}
+
+template < typename T, typename Op >
+AVX2 static T reduce_avx2(const T *a, uint32_t n)
+{
+	return reduce_body< typename SimdType< T, 32 >::V, T, Op >(a, n);
+}
+
+template < typename T, typename Op >
+static T reduce_sse2(const T *a, uint32_t n)
+{
+	return reduce_body< typename SimdType< T, 16 >::V, T, Op >(a, n);
+}
+
+template < typename T >
+AVX2 static T dot_avx2(const T *a, const T *b, uint32_t n)
+{
+	return dot_body< typename SimdType< T, 32 >::V, T >(a, b, n);
+}
+
+template < typename T >
+static T dot_sse2(const T *a, const T *b, uint32_t n)
+{
+	return dot_body< typename SimdType< T, 16 >::V, T >(a, b, n);
+}
+
+AVX2 static void gather_avx2(int64_t *out, const int64_t *src
+		, const int64_t *index, uint32_t n)
+{
+	uint32_t i(0);
+	for (; i + 4 <= n; i += 4) {
+		__m256i idx(_mm256_load_si256((const __m256i *) (index + i)));
+		_mm256_store_si256((__m256i *) (out + i)
+			, _mm256_i64gather_epi64((const long long *) src, idx, 8));
+	}
+	gather_body(out + i, src, index + i, n - i);
+}
+
+AVX2 static void gather_avx2(double *out, const double *src
+		, const int64_t *index, uint32_t n)
+{
+	uint32_t i(0);
+	for (; i + 4 <= n; i += 4) {
+		__m256i idx(_mm256_load_si256((const __m256i *) (index + i)));
+		_mm256_store_pd(out + i, _mm256_i64gather_pd(src, idx, 8));
+	}
+	gather_body(out + i, src, index + i, n - i);
+}
+
+#endif
+
+
+template < typename T, typename Op >
+static void arith_kernel(T *out, const T *a, const T *b, uint32_t n)
+{
+#ifdef ARRAY_SIMD
+	if (has_avx2()) {
+		arith_avx2< T, Op >(out, a, b, n);
+	} else {
+		arith_sse2< T, Op >(out, a, b, n);
+	}
+#else
+	arith_body< T, T, Op >(out, a, b, n);
+#endif
+}
+
+template < typename T, typename Op >
+static void arith_scalar_kernel(T *out, const T *a, T b, uint32_t n)
+{
+#ifdef ARRAY_SIMD
+	if (has_avx2()) {
+		arith_scalar_avx2< T, Op >(out, a, b, n);
+	} else {
+		arith_scalar_sse2< T, Op >(out, a, b, n);
+	}
+#else
+	arith_scalar_body< T, T, Op >(out, a, b, n);
+#endif
+}
+
+template < typename T, typename Op >
+static void compare_kernel(int64_t *mask, const T *a, const T *b, uint32_t n)
+{
+#ifdef ARRAY_SIMD
+	if (has_avx2()) {
+		compare_avx2< T, Op >(mask, a, b, n);
+	} else {
+		compare_sse2< T, Op >(mask, a, b, n);
+	}
+#else
+	compare_body< T, int64_t, T, Op >(mask, a, b, n);
+#endif
+}
+
+template < typename T, typename Op >
+static void compare_scalar_kernel(int64_t *mask, const T *a, T b, uint32_t n)
+{
+#ifdef ARRAY_SIMD
+	if (has_avx2()) {
+		compare_scalar_avx2< T, Op >(mask, a, b, n);
+	} else {
+		compare_scalar_sse2< T, Op >(mask, a, b, n);
+	}
+#else
+	compare_scalar_body< T, int64_t, T, Op >(mask, a, b, n);
+#endif
+}
+
+template < typename T, typename Op >
+static T reduce_kernel(const T *a, uint32_t n)
+{
+#ifdef ARRAY_SIMD
+	if (has_avx2()) {
+		return reduce_avx2< T, Op >(a, n);
+	}
+	return reduce_sse2< T, Op >(a, n);
+#else
+	return reduce_body< T, T, Op >(a, n);
+#endif
+}
+
+template < typename T >
+static T dot_kernel(const T *a, const T *b, uint32_t n)
+{
+#ifdef ARRAY_SIMD
+	if (has_avx2()) {
+		return dot_avx2(a, b, n);
+	}
+	return dot_sse2(a, b, n);
+#else
+	return dot_body< T, T >(a, b, n);
+#endif
+}
+
+template < typename T >
+static void gather_kernel(T *out, const T *src, const int64_t *index
+		, uint32_t n)
+{
+#ifdef ARRAY_SIMD
+	if (has_avx2()) {
+		gather_avx2(out, src, index, n);
+		return;
+	}
+#endif
+	gather_body(out, src, index, n);
+}
+
+
+template < typename T >
+static void arith_op(uint8_t op, T *out, const T *a, const T *b, uint32_t n)
+{
+	switch (op) {
+		case ARRAY_ADD:
+			arith_kernel< T, AddOp >(out, a, b, n);
+			break;
+		case ARRAY_SUB:
+			arith_kernel< T, SubOp >(out, a, b, n);
+			break;
+		case ARRAY_MUL:
+			arith_kernel< T, MulOp >(out, a, b, n);
+			break;
+		case ARRAY_DIV:
+			arith_kernel< T, DivOp >(out, a, b, n);
+			break;
+	}
+}
+
+template < typename T >
+static void arith_scalar_op(uint8_t op, T *out, const T *a, T b, uint32_t n)
+{
+	switch (op) {
+		case ARRAY_ADD:
+			arith_scalar_kernel< T, AddOp >(out, a, b, n);
+			break;
+		case ARRAY_SUB:
+			arith_scalar_kernel< T, SubOp >(out, a, b, n);
+			break;
+		case ARRAY_MUL:
+			arith_scalar_kernel< T, MulOp >(out, a, b, n);
+			break;
+		case ARRAY_DIV:
+			arith_scalar_kernel< T, DivOp >(out, a, b, n);
+			break;
+	}
+}
+
+template < typename T >
+static void compare_op(uint8_t op, int64_t *mask, const T *a, const T *b
+		, uint32_t n)
+{
+	switch (op) {
+		case ARRAY_LT:
+			compare_kernel< T, LtOp >(mask, a, b, n);
+			break;
+		case ARRAY_GT:
+			compare_kernel< T, GtOp >(mask, a, b, n);
+			break;
+		case ARRAY_EQ:
+			compare_kernel< T, EqOp >(mask, a, b, n);
+			break;
+	}
+}
+
+template < typename T >
+static void compare_scalar_op(uint8_t op, int64_t *mask, const T *a, T b
+		, uint32_t n)
+{
+	switch (op) {
+		case ARRAY_LT:
+			compare_scalar_kernel< T, LtOp >(mask, a, b, n);
+			break;
+		case ARRAY_GT:
+			compare_scalar_kernel< T, GtOp >(mask, a, b, n);
+			break;
+		case ARRAY_EQ:
+			compare_scalar_kernel< T, EqOp >(mask, a, b, n);
+			break;
+	}
+}
+
+/** Get a number as a float, ints are converted */
+static inline double float_value(const qbrt_value &v)
+{
+	return v.type->id == VT_INT ? (double) v.data.i : v.data.fp;
+}
+
+
+Array * Array::create(uint8_t elem, uint32_t count)
+{
+	Array *a(new Array());
+	void *items;
+	// allocate at least one item so data is never null
+	if (posix_memalign(&items, ARRAY_ALIGN
+				, (count ? count : 1) * sizeof(int64_t)))
+	{
+		items = NULL;
+	}
+	a->data.i = (int64_t *) items;
+	a->count = count;
+	a->elem = elem;
+	return a;
+}
+
+void Array::get(qbrt_value &v, uint32_t i) const
+{
+	if (elem == ARRAY_INT) {
+		qbrt_value::i(v, data.i[i]);
+	} else {
+		qbrt_value::fp(v, data.fp[i]);
+	}
+}
+
+Array * Array::arith(uint8_t op, const Array &a, const Array &b)
+{
+	Array *result(create(a.elem, a.count));
+	if (a.elem == ARRAY_INT) {
+		arith_op(op, result->data.i, a.data.i, b.data.i, a.count);
+	} else {
+		arith_op(op, result->data.fp, a.data.fp, b.data.fp, a.count);
+	}
+	return result;
+}
+
+Array * Array::arith(uint8_t op, const Array &a, const qbrt_value &b)
+{
+	Array *result(create(a.elem, a.count));
+	if (a.elem == ARRAY_INT) {
+		arith_scalar_op(op, result->data.i, a.data.i, b.data.i
+				, a.count);
+	} else {
+		arith_scalar_op(op, result->data.fp, a.data.fp
+				, float_value(b), a.count);
+	}
+	return result;
+}
+
+Array * Array::compare(uint8_t op, const Array &a, const Array &b)
+{
+	Array *mask(create(ARRAY_INT, a.count));
+	if (a.elem == ARRAY_INT) {
+		compare_op(op, mask->data.i, a.data.i, b.data.i, a.count);
+	} else {
+		compare_op(op, mask->data.i, a.data.fp, b.data.fp, a.count);
+	}
+	return mask;
+}
+
+Array * Array::compare(uint8_t op, const Array &a, const qbrt_value &b)
+{
+	Array *mask(create(ARRAY_INT, a.count));
+	if (a.elem == ARRAY_INT) {
+		compare_scalar_op(op, mask->data.i, a.data.i, b.data.i
+				, a.count);
+	} else {
+		compare_scalar_op(op, mask->data.i, a.data.fp
+				, float_value(b), a.count);
+	}
+	return mask;
+}
+
+Array * Array::gather(const Array &src, const Array &index)
+{
+	Array *result(create(src.elem, index.count));
+	if (src.elem == ARRAY_INT) {
+		gather_kernel(result->data.i, src.data.i, index.data.i
+				, index.count);
+	} else {
+		gather_kernel(result->data.fp, src.data.fp, index.data.i
+				, index.count);
+	}
+	return result;
+}
+
+Array * Array::to_float(const Array &src)
+{
+	if (src.elem == ARRAY_FLOAT) {
+		return const_cast< Array * >(&src);
+	}
+	Array *result(create(ARRAY_FLOAT, src.count));
+	for (uint32_t i(0); i<src.count; ++i) {
+		result->data.fp[i] = (double) src.data.i[i];
+	}
+	return result;
+}
+
+void Array::sum(qbrt_value &result) const
+{
+	if (elem == ARRAY_INT) {
+		qbrt_value::i(result, count
+				? reduce_kernel< int64_t, AddOp >(data.i, count)
+				: 0);
+	} else {
+		qbrt_value::fp(result, count
+				? reduce_kernel< double, AddOp >(data.fp, count)
+				: 0.0);
+	}
+}
+
+void Array::min(qbrt_value &result) const
+{
+	if (elem == ARRAY_INT) {
+		qbrt_value::i(result
+				, reduce_kernel< int64_t, MinOp >(data.i, count));
+	} else {
+		qbrt_value::fp(result
+				, reduce_kernel< double, MinOp >(data.fp, count));
+	}
+}
+
+void Array::max(qbrt_value &result) const
+{
+	if (elem == ARRAY_INT) {
+		qbrt_value::i(result
+				, reduce_kernel< int64_t, MaxOp >(data.i, count));
+	} else {
+		qbrt_value::fp(result
+				, reduce_kernel< double, MaxOp >(data.fp, count));
+	}
+}
+
+void Array::dot(qbrt_value &result, const Array &a, const Array &b)
+{
+	if (a.elem == ARRAY_INT) {
+		qbrt_value::i(result, dot_kernel(a.data.i, b.data.i, a.count));
+	} else {
+		qbrt_value::fp(result
+				, dot_kernel(a.data.fp, b.data.fp, a.count));
+	}
+}
@@ -0,0 +1,137 @@
+#include "qbrt/binary.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+
+BinaryBuffer * BinaryBuffer::create(uint64_t size)
+{
+	BinaryBuffer *buf;
+	buf = (BinaryBuffer *) malloc(sizeof(BinaryBuffer) + size);
+	if (!buf) {
+		return NULL;
+	}
+	buf->refcount = 0;
+	buf->mapped = false;
+	buf->size = size;
+	buf->data = (char *) (buf + 1);
+	return buf;
+}
+
+BinaryBuffer * BinaryBuffer::grow(BinaryBuffer *buf, uint64_t size)
+{
+	BinaryBuffer *grown;
+	grown = (BinaryBuffer *) realloc(buf, sizeof(BinaryBuffer) + size);
+	if (!grown) {
+		return NULL;
+	}
+	grown->size = size;
+	grown->data = (char *) (grown + 1);
+	return grown;
+}
+
+BinaryBuffer * BinaryBuffer::map(int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		return NULL;
+	}
+	char *data(NULL);
+	if (st.st_size > 0) {
+		void *mem(mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0));
+		if (mem == MAP_FAILED) {
+			return NULL;
+		}
+		data = (char *) mem;
+	}
+	BinaryBuffer *buf;
+	buf = (BinaryBuffer *) malloc(sizeof(BinaryBuffer));
+	if (!buf) {
+		if (data) {
+			munmap(data, st.st_size);
+		}
+		return NULL;
+	}
+	buf->refcount = 0;
+	buf->mapped = true;
+	buf->size = st.st_size;
+	buf->data = data;
+	return buf;
+}
+
+void BinaryBuffer::retain(BinaryBuffer *buf)
+{
+	__sync_add_and_fetch(&buf->refcount, 1);
+}
+
+void BinaryBuffer::release(BinaryBuffer *buf)
+{
+	if (__sync_sub_and_fetch(&buf->refcount, 1) > 0) {
+		return;
+	}
+	// an empty file isn't mapped
+	if (buf->mapped && buf->size) {
+		munmap(buf->data, buf->size);
+	}
+	free(buf);
+}
+
+
+int64_t Binary::find(const char *c, uint32_t len, uint64_t from) const
+{
+	if (from > size || len > size - from) {
+		return -1;
+	}
+	const char *match((const char *) memmem(data + from, size - from
+				, c, len));
+	return match ? match - data : -1;
+}
+
+uint64_t Binary::line_end(uint64_t offset) const
+{
+	if (offset >= size) {
+		return size;
+	}
+	const char *nl((const char *) memchr(data + offset, '\n'
+				, size - offset));
+	return nl ? nl - data : size;
+}
+
+Binary * Binary::view(BinaryBuffer *buf, const char *c, uint64_t size)
+{
+	BinaryBuffer::retain(buf);
+	Binary *b(new Binary());
+	b->data = c;
+	b->buffer = buf;
+	b->size = size;
+	b->refcount = 0;
+	return b;
+}
+
+Binary * Binary::slice(const Binary &b, uint64_t offset, uint64_t len)
+{
+	if (offset > b.size) {
+		offset = b.size;
+	}
+	if (len > b.size - offset) {
+		len = b.size - offset;
+	}
+	return view(b.buffer, b.data + offset, len);
+}
+
+void Binary::retain(const Binary *b)
+{
+	__sync_add_and_fetch(&b->refcount, 1);
+}
+
+void Binary::release(const Binary *b)
+{
+	if (__sync_sub_and_fetch(&b->refcount, 1) > 0) {
+		return;
+	}
+	BinaryBuffer::release(b->buffer);
+	delete b;
+}
@@ -1,8 +1,10 @@
 #include "qbrt/core.h"
 #include "qbrt/type.h"
+#include "qbrt/binary.h"
 #include <iostream>
 #include <sstream>
 #include "qbrt/function.h"
+#include "qbrt/module.h"
 #include "qbrt/logic.h"
 #include "qbrt/tuple.h"
 #include "instruction/arithmetic.h"
@@ -10,7 +12,9 @@
 #include "instruction/schedule.h"
 #include "instruction/string.h"
 #include "instruction/type.h"
+#include "instruction/vector.h"
 #include <cstdlib>
+#include <cstring>
 
 using namespace std;
 
@@ -32,8 +36,11 @@ static void init_primitive_modules()
 	PRIMITIVE_MODULE[VT_REF] = "core";
 	PRIMITIVE_MODULE[VT_TUPLE] = "Tuple";
 	PRIMITIVE_MODULE[VT_LIST] = "list";
-	PRIMITIVE_MODULE[VT_MAP] = "Map";
-	PRIMITIVE_MODULE[VT_VECTOR] = "Vector";
+	PRIMITIVE_MODULE[VT_MAP] = "map";
+	PRIMITIVE_MODULE[VT_SET] = "set";
+	PRIMITIVE_MODULE[VT_VECTOR] = "vector";
+	PRIMITIVE_MODULE[VT_ARRAY] = "array";
+	PRIMITIVE_MODULE[VT_BINARY] = "binary";
 	PRIMITIVE_MODULE[VT_STREAM] = "io";
 	PRIMITIVE_MODULE[VT_PROMISE] = "core";
 	PRIMITIVE_MODULE[VT_KIND] = "core";
@@ -54,7 +61,10 @@ static void init_primitive_names()
 	PRIMITIVE_NAME[VT_TUPLE] = "Tuple";
 	PRIMITIVE_NAME[VT_LIST] = "List";
 	PRIMITIVE_NAME[VT_MAP] = "Map";
+	PRIMITIVE_NAME[VT_SET] = "Set";
 	PRIMITIVE_NAME[VT_VECTOR] = "Vector";
+	PRIMITIVE_NAME[VT_ARRAY] = "Array";
+	PRIMITIVE_NAME[VT_BINARY] = "Binary";
 	PRIMITIVE_NAME[VT_STREAM] = "Stream";
 	PRIMITIVE_NAME[VT_PROMISE] = "Promise";
 	PRIMITIVE_NAME[VT_KIND] = "Kind";
@@ -126,13 +136,99 @@ Type TYPE_TUPLE(VT_TUPLE);
 Type TYPE_FUNCTION(VT_FUNCTION);
 Type TYPE_LIST(VT_LIST);
 Type TYPE_MAP(VT_MAP);
+Type TYPE_SET(VT_SET);
 Type TYPE_VECTOR(VT_VECTOR);
+Type TYPE_ARRAY(VT_ARRAY);
+Type TYPE_BINARY(VT_BINARY);
 Type TYPE_STREAM(VT_STREAM);
 Type TYPE_PATTERNVAR(VT_PATTERNVAR);
 Type TYPE_PROMISE(VT_PROMISE);
 Type TYPE_FAILURE(VT_FAILURE);
 
 
+/** Atom ids index into the names, the map finds ids by name */
+static std::vector< const string * > g_atom_name;
+static std::map< string, Atom > g_atom;
+static volatile int g_atom_lock = 0;
+
+/** Names of the builtin atoms, in the order of BuiltinAtom */
+static const char *BUILTIN_ATOM_NAME[NUM_BUILTIN_ATOMS] = {
+	"typefailure"
+	, "module404"
+	, "function404"
+	, "register404"
+	, "field404"
+	, "construct404"
+	, "index404"
+	, "key404"
+	, "notfound"
+	, "empty"
+	, "eof"
+	, "file404"
+	, "ioerror"
+	, "timeout"
+	, "badaddress"
+	, "overflow"
+	, "divideby0"
+	, "badshift"
+	, "toobig"
+	, "sizemismatch"
+	, "unknown_context"
+	, "invalidopcode"
+	, "invalidcmpop"
+	, "callbackfailed"
+	, "callbackblocked"
+};
+
+static inline void lock_atoms()
+{
+	while (__sync_lock_test_and_set(&g_atom_lock, 1)) {}
+	if (g_atom_name.empty()) {
+		// intern the builtins first so they get their fixed ids
+		for (int i(0); i<NUM_BUILTIN_ATOMS; ++i) {
+			map< string, Atom >::const_iterator it;
+			it = g_atom.insert(make_pair(string(BUILTIN_ATOM_NAME[i])
+						, (Atom) i)).first;
+			g_atom_name.push_back(&it->first);
+		}
+	}
+}
+
+static inline void unlock_atoms()
+{
+	__sync_lock_release(&g_atom_lock);
+}
+
+Atom atom(const string &name)
+{
+	lock_atoms();
+	map< string, Atom >::const_iterator it(g_atom.find(name));
+	Atom a;
+	if (it != g_atom.end()) {
+		a = it->second;
+	} else {
+		a = g_atom_name.size();
+		it = g_atom.insert(make_pair(name, a)).first;
+		g_atom_name.push_back(&it->first);
+	}
+	unlock_atoms();
+	return a;
+}
+
+Atom atom(const char *name, uint16_t length)
+{
+	return atom(string(name, length));
+}
+
+const string & atom_name(Atom a)
+{
+	lock_atoms();
+	const string &name(*g_atom_name[a]);
+	unlock_atoms();
+	return name;
+}
+
+
 void qbrt_value::default_value(qbrt_value &v, const Type &t)
 {
 	switch (t.id) {
@@ -151,18 +247,13 @@ void qbrt_value::default_value(qbrt_value &v, const Type &t)
 	}
 }
 
-void qbrt_value::set_void(qbrt_value &v)
-{
-	v.data.str = NULL;
-	v.type = &TYPE_VOID;
-}
-
 void qbrt_value::ref(qbrt_value &v, qbrt_value &ref)
 {
 	if (&v == &ref) {
 		cerr << "set self ref\n";
 		return;
 	}
+	set_void(v);
 	v.type = &TYPE_REF;
 	v.data.ref = &ref;
 }
@@ -180,14 +271,24 @@ void qbrt_value::copy(qbrt_value &dst, const qbrt_value &src)
 			qbrt_value::b(dst, src.data.b);
 			break;
 		case VT_FLOAT:
-			qbrt_value::f(dst, src.data.f);
+			qbrt_value::fp(dst, src.data.fp);
 			break;
 		case VT_STRING:
-			qbrt_value::str(dst, *src.data.str);
+			qbrt_value::str(dst, src.data.str);
+			break;
+		case VT_HASHTAG:
+			qbrt_value::hashtag(dst, src.data.hashtag);
 			break;
+		case VT_LIST:
 		case VT_CONSTRUCT:
 			qbrt_value::construct(dst, src.type, src.data.cons);
 			break;
+		case VT_ARRAY:
+			qbrt_value::arr(dst, src.data.arr);
+			break;
+		case VT_BINARY:
+			qbrt_value::bin(dst, src.data.bin);
+			break;
 		default:
 			cerr << "wtf you can't copy that!\n";
 			break;
@@ -220,6 +321,9 @@ int16_t qbrt_value::get_field_index(const string &fldname) const
 			}
 			return -2;
 			break;
+		case VT_CONSTRUCT:
+		case VT_LIST:
+			return data.cons->field_index(fldname.c_str());
 	}
 	return -1;
 }
@@ -264,13 +368,26 @@ int qbrt_compare(const qbrt_value &a, const qbrt_value &b)
 	}
 
 	switch (a.type->id) {
+		case VT_VOID:
+			return 0;
 		case VT_INT:
 			return type_compare< int64_t >(a.data.i, b.data.i);
 		case VT_BOOL:
 			return type_compare< bool >(a.data.b, b.data.b);
+		case VT_FLOAT:
+			return type_compare< double >(a.data.fp, b.data.fp);
 		case VT_STRING:
-			return type_compare< const string & >(
+			return type_compare< const String & >(
 					*a.data.str, *b.data.str);
+		case VT_HASHTAG:
+			if (a.data.hashtag == b.data.hashtag) {
+				return 0;
+			}
+			return type_compare< const string & >(
+					atom_name(a.data.hashtag)
+					, atom_name(b.data.hashtag));
+		case VT_BINARY:
+			return Binary::compare(*a.data.bin, *b.data.bin);
 		case VT_LIST:
 		case VT_CONSTRUCT:
 			return type_compare< const Construct & >(
@@ -283,6 +400,59 @@ int qbrt_compare(const qbrt_value &a, const qbrt_value &b)
 	return 0;
 }
 
+static inline uint32_t hash_mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return (uint32_t) h;
+}
+
+static inline uint32_t hash_bytes(uint32_t h, const char *c, uint32_t size)
+{
+	// FNV-1a
+	for (uint32_t i(0); i<size; ++i) {
+		h ^= (uint8_t) c[i];
+		h *= 16777619;
+	}
+	return h;
+}
+
+uint32_t qbrt_hash(const qbrt_value &v)
+{
+	uint32_t h(2166136261u ^ v.type->id);
+	switch (v.type->id) {
+		case VT_VOID:
+			return h;
+		case VT_INT:
+			return hash_mix(v.data.i);
+		case VT_BOOL:
+			return h ^ v.data.b;
+		case VT_FLOAT:
+			// 0.0 and -0.0 compare equal
+			return v.data.fp == 0.0 ? h : hash_mix(v.data.i);
+		case VT_STRING:
+			return hash_bytes(h, v.data.str->chars, v.data.str->size);
+		case VT_HASHTAG:
+			return hash_mix(((uint64_t) VT_HASHTAG << 32)
+					| v.data.hashtag);
+		case VT_BINARY: {
+			// a huge binary only hashes its first 4GB
+			const Binary &b(*v.data.bin);
+			uint32_t size(b.size > UINT32_MAX ? UINT32_MAX : b.size);
+			return hash_bytes(h, b.data, size); }
+		case VT_LIST:
+		case VT_CONSTRUCT: {
+			// constructs compare by module and name
+			const Construct &c(*v.data.cons);
+			const string &mod(c.mod.name);
+			const char *name(c.name());
+			h = hash_bytes(h, mod.data(), mod.size());
+			return hash_bytes(h ^ '/', name, strlen(name)); }
+	}
+	return hash_mix((uintptr_t) v.data.reg);
+}
+
 string pretty_reg(uint16_t r)
 {
 	ostringstream result;
@@ -319,6 +489,7 @@ void init_instruction_sizes()
 	INSTRUCTION_SIZE[OP_CMP_LT] = cmp_instruction::SIZE;
 	INSTRUCTION_SIZE[OP_CMP_LTEQ] = cmp_instruction::SIZE;
 	INSTRUCTION_SIZE[OP_CONSTI] = consti_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_CONSTF] = constf_instruction::SIZE;
 	INSTRUCTION_SIZE[OP_CONSTS] = consts_instruction::SIZE;
 	INSTRUCTION_SIZE[OP_CONSTHASH] = consthash_instruction::SIZE;
 	INSTRUCTION_SIZE[OP_FORK] = fork_instruction::SIZE;
@@ -326,6 +497,18 @@ void init_instruction_sizes()
 	INSTRUCTION_SIZE[OP_IDIV] = binaryop_instruction::SIZE;
 	INSTRUCTION_SIZE[OP_IMULT] = binaryop_instruction::SIZE;
 	INSTRUCTION_SIZE[OP_ISUB] = binaryop_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_IMOD] = binaryop_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_IAND] = binaryop_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_IOR] = binaryop_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_IXOR] = binaryop_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_ISHL] = binaryop_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_ISHR] = binaryop_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_FADD] = binaryop_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_FSUB] = binaryop_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_FMULT] = binaryop_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_FDIV] = binaryop_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_ITOF] = convert_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_FTOI] = convert_instruction::SIZE;
 	INSTRUCTION_SIZE[OP_LCONTEXT] = lcontext_instruction::SIZE;
 	INSTRUCTION_SIZE[OP_LCONSTRUCT] = lconstruct_instruction::SIZE;
 	INSTRUCTION_SIZE[OP_LFUNC] = lfunc_instruction::SIZE;
@@ -333,6 +516,8 @@ void init_instruction_sizes()
 	INSTRUCTION_SIZE[OP_LOADOBJ] = loadobj_instruction::SIZE;
 	INSTRUCTION_SIZE[OP_MATCH] = match_instruction::SIZE;
 	INSTRUCTION_SIZE[OP_MATCHARGS] = matchargs_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_SWITCH] = switch_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_CASE] = case_instruction::SIZE;
 	INSTRUCTION_SIZE[OP_MOVE] = move_instruction::SIZE;
 	INSTRUCTION_SIZE[OP_REF] = ref_instruction::SIZE;
 	INSTRUCTION_SIZE[OP_COPY] = copy_instruction::SIZE;
@@ -351,6 +536,10 @@ void init_instruction_sizes()
 	INSTRUCTION_SIZE[OP_PATTERNVAR] = patternvar_instruction::SIZE;
 	INSTRUCTION_SIZE[OP_RECV] = recv_instruction::SIZE;
 	INSTRUCTION_SIZE[OP_STRACC] = stracc_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_VGET] = vget_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_VLEN] = vlen_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_VPUSH] = vpush_instruction::SIZE;
+	INSTRUCTION_SIZE[OP_VSET] = vset_instruction::SIZE;
 	INSTRUCTION_SIZE[OP_WAIT] = wait_instruction::SIZE;
 }
 
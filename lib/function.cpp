@@ -2,6 +2,8 @@
 #include "qbrt/resourcetype.h"
 #include "qbrt/module.h"
 #include <cstdlib>
+#include <cstring>
+#include <new>
 
 using namespace std;
 
@@ -76,18 +78,68 @@ const char * CFunction::protocol_name() const
 
 function_value::function_value(const Function *f)
 : func(f)
+, regv(inline_regv())
+, refcount(0)
 , argc(f->argc())
 , regc(f->regtotal())
 {
-	regv = (qbrt_value *) malloc(regc * sizeof(qbrt_value));
 	new (regv) qbrt_value[regc];
 }
 
+function_value * function_value::create(const Function *f)
+{
+	size_t size(sizeof(function_value)
+			+ f->regtotal() * sizeof(qbrt_value));
+	return new (::operator new(size)) function_value(f);
+}
+
+void function_value::retain(function_value *fv)
+{
+	__sync_add_and_fetch(&fv->refcount, 1);
+}
+
+void function_value::release(function_value *fv)
+{
+	if (__sync_sub_and_fetch(&fv->refcount, 1) == 0) {
+		destroy(fv);
+	}
+}
+
+void qbrt_value::retain_function(function_value *fv)
+{
+	function_value::retain(fv);
+}
+
+void qbrt_value::release_function(function_value *fv)
+{
+	function_value::release(fv);
+}
+
+void function_value::destroy(function_value *fv)
+{
+	for (int i(0); i<fv->regc; ++i) {
+		fv->regv[i].~qbrt_value();
+	}
+	if (fv->regv != fv->inline_regv()) {
+		free(fv->regv);
+	}
+	fv->~function_value();
+	::operator delete(fv);
+}
+
 void function_value::realloc(uint8_t new_regc)
 {
 	size_t newsize(new_regc * sizeof(qbrt_value));
-	qbrt_value *newreg =
-		(qbrt_value *) ::realloc(this->regv, newsize);
+	qbrt_value *newreg;
+	// values hold no pointers to themselves, so moving the
+	// bytes moves the values
+	if (this->regv == this->inline_regv()) {
+		newreg = (qbrt_value *) malloc(newsize);
+		memcpy((void *) newreg, this->regv
+				, this->regc * sizeof(qbrt_value));
+	} else {
+		newreg = (qbrt_value *) ::realloc((void *) this->regv, newsize);
+	}
 	this->regv = newreg;
 	for (int i(this->regc); i<new_regc; ++i) {
 		new (&this->regv[i]) qbrt_value();
@@ -118,23 +170,56 @@ void reassign_func(function_value &funcval, const Function *newfunc)
 }
 
 
-Failure::Failure(const std::string type_label, const string &module
+Failure::Failure(Atom type_atom, const string &module
 		, const char *fname, int pc
 		, const char *cfile, int cline)
-: debug()
-, usage()
-, http_code(0)
+: http_code(0)
+, trace(1)
+, debug_stream(NULL)
+, usage_stream(NULL)
 {
-	qbrt_value::hashtag(type, type_label);
+	qbrt_value::hashtag(type, type_atom);
 	qbrt_value::i(exit_code, -1);
-	trace.push_back(FailureEvent());
-	FailureEvent &e(trace.back());
-	e.set(module, fname, pc, cfile, cline);
+	trace.back().set(module.c_str(), fname, pc, cfile, cline);
+}
+
+Failure::Failure(Atom type_atom, const char *module
+		, const char *fname, int pc
+		, const char *cfile, int cline)
+: http_code(0)
+, trace(1)
+, debug_stream(NULL)
+, usage_stream(NULL)
+{
+	qbrt_value::hashtag(type, type_atom);
+	qbrt_value::i(exit_code, -1);
+	trace.back().set(module, fname, pc, cfile, cline);
+}
+
+ostringstream & Failure::debug()
+{
+	if (!debug_stream) {
+		debug_stream = new ostringstream();
+	}
+	return *debug_stream;
+}
+
+ostringstream & Failure::usage()
+{
+	if (!usage_stream) {
+		usage_stream = new ostringstream();
+	}
+	return *usage_stream;
 }
 
 string Failure::debug_msg() const
 {
-	return debug.str();
+	return debug_stream ? debug_stream->str() : string();
+}
+
+string Failure::usage_msg() const
+{
+	return usage_stream ? usage_stream->str() : string();
 }
 
 qbrt_value & Failure::value(uint8_t i)
@@ -163,24 +248,16 @@ const qbrt_value & Failure::value(uint8_t i) const
 	return *(const qbrt_value *) NULL;
 }
 
-void Failure::trace_up(const string &mod, const string &fname, uint16_t pc)
-{
-	trace.push_front(FailureEvent());
-	FailureEvent &e(trace.front());
-	e.up(mod, fname, pc);
-}
-
-void Failure::trace_down(const string &mod, const string &fname, uint16_t pc
+void Failure::trace_down(const string &mod, const char *fname, uint16_t pc
 		, const char *c_file, int c_line)
 {
 	trace.push_back(FailureEvent());
-	FailureEvent &e(trace.back());
-	e.down(mod, fname, pc, c_file, c_line);
+	trace.back().down(mod.c_str(), fname, pc, c_file, c_line);
 }
 
 void Failure::write(ostream &out, const Failure &f)
 {
-	out << "Failure: #" << *f.type.data.hashtag;
+	out << "Failure: #" << f.typestr();
 	string usage_msg(f.usage_msg());
 	if (!usage_msg.empty()) {
 		out << endl << usage_msg << endl;
@@ -195,9 +272,9 @@ void Failure::write(ostream &out, const Failure &f)
 	}
 }
 
-void Failure::write_trace(ostream &out, const list< FailureEvent > &trace)
+void Failure::write_trace(ostream &out, const vector< FailureEvent > &trace)
 {
-	list< FailureEvent >::const_iterator it(trace.begin());
+	vector< FailureEvent >::const_iterator it(trace.begin());
 	for (; it!=trace.end(); ++it) {
 		out << *it << endl;
 	}
@@ -208,10 +285,9 @@ ostream & operator << (ostream &out, const FailureEvent &e)
 {
 	out << (e.direction <= 0 ? '<' : ' ');
 	out << (e.direction >= 0 ? '>' : ' ');
-	out << *e.module.data.str << '/';
-	out << *e.function.data.str << ':' << e.pc.data.i;
+	out << e.module << '/' << e.function << ':' << e.pc;
 	if (e.direction <= 0) {
-		out << ' ' << *e.c_file.data.str << ':' << e.c_lineno.data.i;
+		out << ' ' << e.c_file << ':' << e.c_lineno;
 	}
 	return out;
 }
@@ -8,6 +8,7 @@
 #include "instruction/schedule.h"
 #include "instruction/string.h"
 #include "instruction/type.h"
+#include "instruction/vector.h"
 #include <iostream>
 
 using namespace std;
@@ -26,6 +27,8 @@ uint8_t iwriter(ostream &out, const I &i)
 
 DEFINE_IWRITER(binaryop);
 DEFINE_IWRITER(consti);
+DEFINE_IWRITER(constf);
+DEFINE_IWRITER(convert);
 DEFINE_IWRITER(consts);
 DEFINE_IWRITER(consthash);
 DEFINE_IWRITER(call);
@@ -39,6 +42,8 @@ DEFINE_IWRITER(loadtype);
 DEFINE_IWRITER(loadobj);
 DEFINE_IWRITER(match);
 DEFINE_IWRITER(matchargs);
+DEFINE_IWRITER(switch);
+DEFINE_IWRITER(case);
 DEFINE_IWRITER(newproc);
 DEFINE_IWRITER(patternvar);
 DEFINE_IWRITER(recv);
@@ -54,6 +59,10 @@ DEFINE_IWRITER(ctuple);
 DEFINE_IWRITER(stuple);
 DEFINE_IWRITER(clist);
 DEFINE_IWRITER(cons);
+DEFINE_IWRITER(vget);
+DEFINE_IWRITER(vlen);
+DEFINE_IWRITER(vpush);
+DEFINE_IWRITER(vset);
 
 instruction_writer WRITER[NUM_OP_CODES] = {0};
 
@@ -71,6 +80,7 @@ void init_writers()
 	WRITER[OP_CMP_LT] = (instruction_writer)iwriter<cmp_instruction>;
 	WRITER[OP_CMP_LTEQ] = (instruction_writer)iwriter<cmp_instruction>;
 	WRITER[OP_CONSTI] = (instruction_writer) iwriter<consti_instruction>;
+	WRITER[OP_CONSTF] = (instruction_writer) iwriter<constf_instruction>;
 	WRITER[OP_CONSTS] = (instruction_writer) iwriter<consts_instruction>;
 	WRITER[OP_CONSTHASH] =
 		(instruction_writer) iwriter<consthash_instruction>;
@@ -83,12 +93,26 @@ void init_writers()
 	WRITER[OP_IDIV] = (instruction_writer) iwriter<binaryop_instruction>;
 	WRITER[OP_IMULT] = (instruction_writer) iwriter<binaryop_instruction>;
 	WRITER[OP_ISUB] = (instruction_writer) iwriter<binaryop_instruction>;
+	WRITER[OP_IMOD] = (instruction_writer) iwriter<binaryop_instruction>;
+	WRITER[OP_IAND] = (instruction_writer) iwriter<binaryop_instruction>;
+	WRITER[OP_IOR] = (instruction_writer) iwriter<binaryop_instruction>;
+	WRITER[OP_IXOR] = (instruction_writer) iwriter<binaryop_instruction>;
+	WRITER[OP_ISHL] = (instruction_writer) iwriter<binaryop_instruction>;
+	WRITER[OP_ISHR] = (instruction_writer) iwriter<binaryop_instruction>;
+	WRITER[OP_FADD] = (instruction_writer) iwriter<binaryop_instruction>;
+	WRITER[OP_FSUB] = (instruction_writer) iwriter<binaryop_instruction>;
+	WRITER[OP_FMULT] = (instruction_writer) iwriter<binaryop_instruction>;
+	WRITER[OP_FDIV] = (instruction_writer) iwriter<binaryop_instruction>;
+	WRITER[OP_ITOF] = (instruction_writer) iwriter<convert_instruction>;
+	WRITER[OP_FTOI] = (instruction_writer) iwriter<convert_instruction>;
 	WRITER[OP_LFUNC] = (instruction_writer)iwriter<lfunc_instruction>;
 	WRITER[OP_LOADTYPE] = (instruction_writer)iwriter<loadtype_instruction>;
 	WRITER[OP_LOADOBJ] = (instruction_writer)iwriter<loadobj_instruction>;
 	WRITER[OP_MATCH] = (instruction_writer)iwriter<match_instruction>;
 	WRITER[OP_MATCHARGS] =
 		(instruction_writer)iwriter<matchargs_instruction>;
+	WRITER[OP_SWITCH] = (instruction_writer)iwriter<switch_instruction>;
+	WRITER[OP_CASE] = (instruction_writer)iwriter<case_instruction>;
 	WRITER[OP_NEWPROC] = (instruction_writer)iwriter<newproc_instruction>;
 	WRITER[OP_PATTERNVAR] =
 		(instruction_writer)iwriter<patternvar_instruction>;
@@ -107,6 +131,10 @@ void init_writers()
 	WRITER[OP_CLIST] = (instruction_writer) iwriter<clist_instruction>;
 	WRITER[OP_CONS] = (instruction_writer) iwriter<cons_instruction>;
 	WRITER[OP_WAIT] = (instruction_writer) iwriter<wait_instruction>;
+	WRITER[OP_VGET] = (instruction_writer) iwriter<vget_instruction>;
+	WRITER[OP_VLEN] = (instruction_writer) iwriter<vlen_instruction>;
+	WRITER[OP_VPUSH] = (instruction_writer) iwriter<vpush_instruction>;
+	WRITER[OP_VSET] = (instruction_writer) iwriter<vset_instruction>;
 }
 
 uint8_t write_instruction(ostream &out, const instruction &i)
@@ -37,6 +37,37 @@ struct consti_instruction
 	static const uint8_t SIZE = 7;
 };
 
+struct constf_instruction
+: public instruction
+{
+	uint16_t reg;
+	double value;
+
+	constf_instruction(reg_t reg, double value)
+		: instruction(OP_CONSTF)
+		, reg(reg)
+		, value(value)
+	{}
+
+	static const uint8_t SIZE = 11;
+};
+
+/** Convert between int and float, itof or ftoi */
+struct convert_instruction
+: public instruction
+{
+	uint16_t dst;
+	uint16_t src;
+
+	convert_instruction(uint8_t op, reg_t dst, reg_t src)
+		: instruction(op)
+		, dst(dst)
+		, src(src)
+	{}
+
+	static const uint8_t SIZE = 5;
+};
+
 #pragma pack(pop)
 
 #endif
@@ -84,7 +84,7 @@ struct patternvar_instruction
 };
 
 
-/** Construct a list. Don't need this w/ the list.Empty construct */
+/** Put the shared empty list in a register */
 struct clist_instruction
 : public instruction
 {
@@ -106,7 +106,7 @@ struct cons_instruction
 	uint16_t item;
 
 	cons_instruction(reg_t head, reg_t item)
-		: instruction(OP_CLIST)
+		: instruction(OP_CONS)
 		, head(head)
 		, item(item)
 	{}
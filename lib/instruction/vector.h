@@ -0,0 +1,78 @@
+#ifndef QBRT_INSTRUCTION_VECTOR_H
+#define QBRT_INSTRUCTION_VECTOR_H
+
+#include "qbrt/core.h"
+
+
+#pragma pack(push, 1)
+
+/** Copy the value at an index of a vector */
+struct vget_instruction
+: public instruction
+{
+	uint16_t dst;
+	uint16_t src;
+	uint16_t idx;
+
+	vget_instruction(reg_t dst, reg_t src, reg_t idx)
+		: instruction(OP_VGET)
+		, dst(dst)
+		, src(src)
+		, idx(idx)
+	{}
+
+	static const uint8_t SIZE = 7;
+};
+
+/** Replace the vector in dst with one that has the index set */
+struct vset_instruction
+: public instruction
+{
+	uint16_t dst;
+	uint16_t idx;
+	uint16_t src;
+
+	vset_instruction(reg_t dst, reg_t idx, reg_t src)
+		: instruction(OP_VSET)
+		, dst(dst)
+		, idx(idx)
+		, src(src)
+	{}
+
+	static const uint8_t SIZE = 7;
+};
+
+/** Replace the vector in dst with one that has src on the end */
+struct vpush_instruction
+: public instruction
+{
+	uint16_t dst;
+	uint16_t src;
+
+	vpush_instruction(reg_t dst, reg_t src)
+		: instruction(OP_VPUSH)
+		, dst(dst)
+		, src(src)
+	{}
+
+	static const uint8_t SIZE = 5;
+};
+
+struct vlen_instruction
+: public instruction
+{
+	uint16_t dst;
+	uint16_t src;
+
+	vlen_instruction(reg_t dst, reg_t src)
+		: instruction(OP_VLEN)
+		, dst(dst)
+		, src(src)
+	{}
+
+	static const uint8_t SIZE = 5;
+};
+
+#pragma pack(pop)
+
+#endif
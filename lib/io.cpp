@@ -1,54 +1,1441 @@
 #include "io.h"
+#include "qbrt/binary.h"
+#include "qbrt/function.h"
+#include "qbrt/type.h"
 #include <iostream>
 #include <stdio.h>
 #include <cstdlib>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <stddef.h>
 #include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 
 using namespace std;
 
+/** Read this many bytes at a time */
+#define READ_CHUNK_SIZE	(64 * 1024)
+/** Most bytes read into a binary with one call */
+#define READ_BINARY_MAX	(1024 * 1024 * 1024)
+/** Room a binary read starts with, it doubles as bytes arrive */
+#define READ_BINARY_START	(64 * 1024)
+/** Writers wait for a flush once this many bytes are queued */
+#define WRITE_BUFFER_SIZE	(64 * 1024)
+/** Datagrams received by one recvmmsg call */
+#define RECV_BATCH	64
+/** Largest datagram that can be received without being cut off */
+#define DATAGRAM_SIZE	(64 * 1024)
+/** Receive buffer asked for on datagram sockets */
+#define DATAGRAM_RCVBUF	(4 * 1024 * 1024)
+/** Datagrams sent by one sendmmsg call */
+#define SEND_BATCH	256
+/** Largest part of a binary a write queues as one segment */
+#define SEGMENT_MAX	(1024 * 1024 * 1024)
+/** Bytes a transfer moves with each call, also its pipe and buffer size */
+#define TRANSFER_CHUNK	(256 * 1024)
+/** Calls a transfer makes before letting other frames run */
+#define TRANSFER_ROUNDS	64
 
-void StreamGetline::handle()
+/** How long the flusher lets writes queue before it flushes again */
+#define FLUSH_TICK_NS	1000000
+
+/**
+ * Every stream, so queued writes can be flushed at exit
+ *
+ * These lists are never freed so the flusher and the workers, which
+ * still run while main returns, never see them destroyed.
+ */
+static vector< Stream * > &s_streams(*new vector< Stream * >());
+static pthread_mutex_t s_streams_lock = PTHREAD_MUTEX_INITIALIZER;
+/** Streams with writes queued since the flusher last took them */
+static vector< Stream * > &s_dirty(*new vector< Stream * >());
+static pthread_mutex_t s_dirty_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_dirty_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t s_flusher_once = PTHREAD_ONCE_INIT;
+
+
+ReadBuffer::ReadBuffer()
+: chunk(StringBuffer::create(READ_CHUNK_SIZE))
+, start(0)
+, end(0)
+, scanned(0)
+, eof(false)
+{
+	StringBuffer::retain(chunk);
+	// claim the whole chunk so strings viewing it never append into it
+	chunk->used = chunk->capacity;
+}
+
+ReadBuffer::~ReadBuffer()
+{
+	StringBuffer::release(chunk);
+}
+
+bool ReadBuffer::split(qbrt_value &line)
+{
+	const char *data(chunk->data);
+	const char *nl((const char *) memchr(data + scanned, '\n'
+				, end - scanned));
+	if (!nl) {
+		scanned = end;
+		return false;
+	}
+	uint32_t len(nl - data - start);
+	qbrt_value::str(line, String::view(chunk, data + start, len));
+	start += len + 1;
+	scanned = start;
+	return true;
+}
+
+bool ReadBuffer::next_line(qbrt_value &line)
+{
+	if (split(line)) {
+		return true;
+	}
+	if (!eof) {
+		return false;
+	}
+	if (start == end) {
+		qbrt_value::fail(line, NEW_FAILURE_ATOM(ATOM_EOF
+				, "io", "getline", 0));
+		return true;
+	}
+	// last line without a newline
+	qbrt_value::str(line, String::view(chunk, chunk->data + start
+				, end - start));
+	start = end;
+	scanned = end;
+	return true;
+}
+
+bool ReadBuffer::next_lines(qbrt_value &lines)
+{
+	qbrt_value line;
+	if (!next_line(line)) {
+		return false;
+	}
+	if (qbrt_value::failed(line)) {
+		lines = line;
+		return true;
+	}
+	qbrt_value empty;
+	List::empty(empty);
+	List::cons(lines, line, empty);
+	qbrt_value *tail(&lines.data.cons->value(1));
+	while (split(line) || (eof && start < end && next_line(line))) {
+		List::cons(*tail, line, empty);
+		tail = &tail->data.cons->value(1);
+	}
+	return true;
+}
+
+bool ReadBuffer::next_bytes(qbrt_value &bytes)
 {
-	char *line = NULL;
-	size_t n(0);
-	size_t len(getline(&line, &n, stream->file));
-	// get rid of that lame newline
-	// I will probably need to undue this later
-	if (line[len-1] == '\n') {
-		line[len-1] = '\0';
+	if (start < end) {
+		qbrt_value::str(bytes, String::view(chunk, chunk->data + start
+					, end - start));
+		start = end;
+		scanned = end;
+		return true;
 	}
-	qbrt_value::str(dst, line);
-	free(line);
+	if (!eof) {
+		return false;
+	}
+	qbrt_value::fail(bytes, NEW_FAILURE_ATOM(ATOM_EOF, "io", "read", 0));
+	return true;
+}
+
+void ReadBuffer::reserve()
+{
+	if (end < chunk->capacity) {
+		return;
+	}
+	// move the partial line to a new chunk, growing it if
+	// the line is too long to fit in half the chunk
+	uint32_t partial(end - start);
+	uint32_t capacity(READ_CHUNK_SIZE);
+	while (capacity < partial * 2) {
+		capacity <<= 1;
+	}
+	StringBuffer *next(StringBuffer::create(capacity));
+	StringBuffer::retain(next);
+	next->used = next->capacity;
+	memcpy(next->data, chunk->data + start, partial);
+	StringBuffer::release(chunk);
+	chunk = next;
+	scanned -= start;
+	start = 0;
+	end = partial;
+}
+
+WriteBuffer::WriteBuffer()
+: pending()
+, pending_bytes(0)
+{
+	pthread_spin_init(&lock, PTHREAD_PROCESS_PRIVATE);
+	pthread_mutex_init(&flush_lock, NULL);
+}
+
+WriteBuffer::~WriteBuffer()
+{
+	vector< Segment >::const_iterator it(pending.begin());
+	for (; it!=pending.end(); ++it) {
+		done(*it);
+	}
+	pthread_spin_destroy(&lock);
+	pthread_mutex_destroy(&flush_lock);
 }
 
-void StreamWrite::handle()
+uint64_t WriteBuffer::push(const String &src)
 {
-	size_t result(write(stream->fd, src.c_str(), src.size()));
-	if (result < 0) {
-		cerr << "failure of some kind\n";
+	if (src.empty()) {
+		return __sync_add_and_fetch(&pending_bytes, 0);
 	}
+	String::retain(&src);
+	return push(src.chars, src.size, &src, NULL);
+}
+
+uint64_t WriteBuffer::push(const Binary &src)
+{
+	if (src.empty()) {
+		return __sync_add_and_fetch(&pending_bytes, 0);
+	}
+	// segments hold less than 4GB, so a huge binary takes several
+	uint64_t queued(0);
+	for (uint64_t offset(0); offset<src.size; offset+=SEGMENT_MAX) {
+		uint64_t size(src.size - offset);
+		if (size > SEGMENT_MAX) {
+			size = SEGMENT_MAX;
+		}
+		Binary::retain(&src);
+		queued = push(src.data + offset, size, NULL, &src);
+	}
+	return queued;
+}
+
+uint64_t WriteBuffer::push(const char *chars, uint32_t size
+		, const String *str, const Binary *bin)
+{
+	if (size == 0) {
+		return __sync_add_and_fetch(&pending_bytes, 0);
+	}
+	Segment seg;
+	seg.chars = chars;
+	seg.size = size;
+	seg.offset = 0;
+	seg.str = str;
+	seg.bin = bin;
+	pthread_spin_lock(&lock);
+	pending.push_back(seg);
+	pthread_spin_unlock(&lock);
+	return __sync_add_and_fetch(&pending_bytes, size);
+}
+
+void WriteBuffer::done(const Segment &seg)
+{
+	if (seg.str) {
+		String::release(seg.str);
+	}
+	if (seg.bin) {
+		Binary::release(seg.bin);
+	}
+}
+
+bool WriteBuffer::flush(int fd)
+{
+	if (__sync_add_and_fetch(&pending_bytes, 0) == 0) {
+		return true;
+	}
+	pthread_mutex_lock(&flush_lock);
+	// take what's queued so writers can keep queueing during the write
+	vector< Segment > out;
+	pthread_spin_lock(&lock);
+	out.swap(pending);
+	pthread_spin_unlock(&lock);
+
+	iovec iov[IOV_MAX];
+	uint32_t first(0);
+	bool blocked(false);
+	while (first < out.size()) {
+		int iovcnt(0);
+		for (uint32_t i(first); i<out.size() && iovcnt<IOV_MAX; ++i) {
+			const Segment &seg(out[i]);
+			iov[iovcnt].iov_base = (char *) seg.chars + seg.offset;
+			iov[iovcnt].iov_len = seg.size - seg.offset;
+			++iovcnt;
+		}
+		ssize_t n(writev(fd, iov, iovcnt));
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				blocked = true;
+				break;
+			}
+			if (errno != EPIPE && errno != ECONNRESET) {
+				perror("write failure");
+			}
+			// drop the rest, the stream can't take any more
+			for (; first<out.size(); ++first) {
+				const Segment &seg(out[first]);
+				__sync_sub_and_fetch(&pending_bytes
+						, seg.size - seg.offset);
+				done(seg);
+			}
+			break;
+		}
+		__sync_sub_and_fetch(&pending_bytes, n);
+		// skip past what was written, the last may be partial
+		while (n > 0) {
+			Segment &seg(out[first]);
+			uint32_t left(seg.size - seg.offset);
+			if ((size_t) n < left) {
+				seg.offset += n;
+				break;
+			}
+			n -= left;
+			done(seg);
+			++first;
+		}
+	}
+	if (first < out.size()) {
+		// put back what didn't get written ahead of anything newer
+		pthread_spin_lock(&lock);
+		pending.insert(pending.begin(), out.begin() + first, out.end());
+		pthread_spin_unlock(&lock);
+	}
+	pthread_mutex_unlock(&flush_lock);
+	return !blocked;
+}
+
+Stream::Stream(int fd, FILE *file)
+: fd(fd)
+, file(file)
+, rbuf(NULL)
+, wbuf()
+, timeout(-1)
+, dirty(0)
+, watchers(0)
+, helper_reads(0)
+{
+	pthread_mutex_lock(&s_streams_lock);
+	s_streams.push_back(this);
+	pthread_mutex_unlock(&s_streams_lock);
+}
+
+Stream::~Stream()
+{
+	flush();
+	pthread_mutex_lock(&s_streams_lock);
+	vector< Stream * >::iterator it(s_streams.begin());
+	for (; it!=s_streams.end(); ++it) {
+		if (*it == this) {
+			s_streams.erase(it);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&s_streams_lock);
+	delete rbuf;
+}
+
+ReadBuffer & Stream::reader()
+{
+	if (!rbuf) {
+		rbuf = new ReadBuffer();
+	}
+	return *rbuf;
+}
+
+bool Stream::fill(qbrt_value &dst)
+{
+	char *buf;
+	uint32_t len;
+	read_space(buf, len);
+	ssize_t n;
+	do {
+		n = ::read(fd, buf, len);
+	} while (n < 0 && errno == EINTR);
+	return read_result(n < 0 ? -errno : n, dst);
+}
+
+void Stream::read_space(char *&buf, uint32_t &len)
+{
+	ReadBuffer &rb(reader());
+	rb.reserve();
+	buf = rb.chunk->data + rb.end;
+	len = rb.chunk->capacity - rb.end;
+}
+
+bool Stream::read_result(int64_t result, qbrt_value &dst)
+{
+	ReadBuffer &rb(reader());
+	if (result > 0) {
+		rb.end += result;
+		return true;
+	}
+	if (result == 0) {
+		rb.eof = true;
+		return true;
+	}
+	if (result == -EAGAIN || result == -EWOULDBLOCK
+			|| result == -EINTR)
+	{
+		return true;
+	}
+	qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_IOERROR, "io", "read", 0));
+	return false;
+}
+
+bool Stream::flush()
+{
+	return wbuf.flush(fd);
+}
+
+uint64_t Stream::queue(const String &src)
+{
+	uint64_t queued(wbuf.push(src));
+	mark_dirty();
+	return queued;
+}
+
+uint64_t Stream::queue(const Binary &src)
+{
+	uint64_t queued(wbuf.push(src));
+	mark_dirty();
+	return queued;
+}
+
+/**
+ * Flush the streams that have writes queued, then wait a tick so
+ * more writes can queue and go out together. Runs on its own thread
+ * so a slow reader on a blocking fd doesn't hold up anything else.
+ */
+static void * stream_flusher(void *)
+{
+	timespec tick;
+	tick.tv_sec = 0;
+	tick.tv_nsec = FLUSH_TICK_NS;
+	vector< Stream * > dirty;
+	for (;;) {
+		pthread_mutex_lock(&s_dirty_lock);
+		while (s_dirty.empty()) {
+			pthread_cond_wait(&s_dirty_cond, &s_dirty_lock);
+		}
+		dirty.swap(s_dirty);
+		pthread_mutex_unlock(&s_dirty_lock);
+
+		vector< Stream * >::iterator it(dirty.begin());
+		for (; it!=dirty.end(); ++it) {
+			Stream *s(*it);
+			// clear first so a write during the flush marks it again
+			__sync_lock_release(&s->dirty);
+			s->flush();
+			if (__sync_add_and_fetch(&s->wbuf.pending_bytes, 0)) {
+				// it would block, try again next tick
+				s->mark_dirty();
+			}
+		}
+		dirty.clear();
+		nanosleep(&tick, NULL);
+	}
+	return NULL;
+}
+
+static void start_stream_flusher()
+{
+	pthread_t thread;
+	pthread_create(&thread, NULL, stream_flusher, NULL);
+	pthread_detach(thread);
+}
+
+void Stream::mark_dirty()
+{
+	if (__sync_lock_test_and_set(&dirty, 1)) {
+		return;
+	}
+	pthread_once(&s_flusher_once, start_stream_flusher);
+	pthread_mutex_lock(&s_dirty_lock);
+	s_dirty.push_back(this);
+	pthread_cond_signal(&s_dirty_cond);
+	pthread_mutex_unlock(&s_dirty_lock);
+}
+
+StreamIO * Stream::write_binary(const Binary &src)
+{
+	if (queue(src) < WRITE_BUFFER_SIZE) {
+		return NULL;
+	}
+	return new StreamWrite(this);
+}
+
+void Stream::flush_all()
+{
+	pthread_mutex_lock(&s_streams_lock);
+	vector< Stream * >::iterator it(s_streams.begin());
+	for (; it!=s_streams.end(); ++it) {
+		(*it)->flush();
+	}
+	pthread_mutex_unlock(&s_streams_lock);
+}
+
+
+int32_t TimedStreamIO::timeout() const
+{
+	return stream->timeout;
+}
+
+bool TimedStreamIO::expire()
+{
+	qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_TIMEOUT, "io", fname, 0));
+	return true;
+}
+
+void TimedStreamIO::closed()
+{
+	qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_IOERROR, "io", fname, 0));
+}
+
+bool StreamGetline::handle()
+{
+	// a reader ahead of this one may have read its line already
+	return buffered() || !stream->fill(dst)
+		|| stream->reader().next_line(dst);
+}
+
+bool StreamGetline::buffered()
+{
+	return stream->reader().next_line(dst);
+}
+
+bool StreamGetlines::handle()
+{
+	return buffered() || !stream->fill(dst)
+		|| stream->reader().next_lines(dst);
+}
+
+bool StreamGetlines::buffered()
+{
+	return stream->reader().next_lines(dst);
+}
+
+void StreamGetline::read_buffer(char *&buf, uint32_t &len)
+{
+	stream->read_space(buf, len);
+}
+
+bool StreamGetline::read_done(int32_t result)
+{
+	return !stream->read_result(result, dst)
+		|| stream->reader().next_line(dst);
+}
+
+void StreamGetlines::read_buffer(char *&buf, uint32_t &len)
+{
+	stream->read_space(buf, len);
+}
+
+bool StreamGetlines::read_done(int32_t result)
+{
+	return !stream->read_result(result, dst)
+		|| stream->reader().next_lines(dst);
+}
+
+bool StreamSync::handle()
+{
+	stream->flush();
+	if (fsync(stream->fd) < 0) {
+		qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_IOERROR
+				, "io", "fsync", 0));
+	} else {
+		qbrt_value::set_void(dst);
+	}
+	return true;
+}
+
+void StreamSync::closed()
+{
+	qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_IOERROR, "io", "fsync", 0));
+}
+
+bool FileOpen::handle()
+{
+	FILE *f = fopen(filename.c_str(), mode.c_str());
+	if (!f) {
+		Atom type(errno == ENOENT ? ATOM_FILE404 : ATOM_IOERROR);
+		qbrt_value::fail(dst, NEW_FAILURE_ATOM(type, "io", "open", 0));
+		return true;
+	}
+	qbrt_value::stream(dst, new FileStream(fileno(f), f));
+	return true;
+}
+
+bool FileMap::handle()
+{
+	int fd(open(filename.c_str(), O_RDONLY | O_CLOEXEC));
+	if (fd < 0) {
+		Atom type(errno == ENOENT ? ATOM_FILE404 : ATOM_IOERROR);
+		qbrt_value::fail(dst, NEW_FAILURE_ATOM(type, "io", "mmap", 0));
+		return true;
+	}
+	BinaryBuffer *buf(BinaryBuffer::map(fd));
+	// the mapping doesn't need the file to stay open
+	close(fd);
+	if (!buf) {
+		qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_IOERROR
+				, "io", "mmap", 0));
+		return true;
+	}
+	qbrt_value::bin(dst, Binary::view(buf, buf->data, buf->size));
+	return true;
+}
+
+bool StreamRead::handle()
+{
+	return buffered() || !stream->fill(dst)
+		|| stream->reader().next_bytes(dst);
+}
+
+bool StreamRead::buffered()
+{
+	return stream->reader().next_bytes(dst);
+}
+
+void StreamRead::read_buffer(char *&buf, uint32_t &len)
+{
+	stream->read_space(buf, len);
+}
+
+bool StreamRead::read_done(int32_t result)
+{
+	return !stream->read_result(result, dst)
+		|| stream->reader().next_bytes(dst);
+}
+
+StreamReadBinary::StreamReadBinary(Stream *s, qbrt_value &dest
+		, BinaryBuffer *buf, uint64_t filled, uint64_t want)
+: TimedStreamIO(s, EPOLLIN, dest, "readbin")
+, buf(buf)
+, filled(filled)
+, want(want)
+{
+	BinaryBuffer::retain(buf);
+}
+
+StreamReadBinary::~StreamReadBinary()
+{
+	BinaryBuffer::release(buf);
+}
+
+bool StreamReadBinary::buffered()
+{
+	ReadBuffer &rb(stream->reader());
+	uint64_t n(rb.end - rb.start);
+	if (n > want - filled) {
+		n = want - filled;
+	}
+	if (n) {
+		if (!reserve(n)) {
+			return true;
+		}
+		memcpy(buf->data + filled, rb.chunk->data + rb.start, n);
+		rb.start += n;
+		if (rb.scanned < rb.start) {
+			rb.scanned = rb.start;
+		}
+		filled += n;
+	}
+	return (filled == want || rb.eof) && finish();
+}
+
+bool StreamReadBinary::handle()
+{
+	if (buffered()) {
+		return true;
+	}
+	// read once and wait to be woken again, pipes like stdin are
+	// left blocking so a second read could hold up the worker
+	char *data;
+	uint32_t len;
+	read_buffer(data, len);
+	ssize_t n;
+	do {
+		n = ::read(stream->fd, data, len);
+	} while (n < 0 && errno == EINTR);
+	return read_done(n < 0 ? -errno : n);
+}
+
+void StreamReadBinary::read_buffer(char *&data, uint32_t &len)
+{
+	uint64_t left(buf->size - filled);
+	data = buf->data + filled;
+	len = left > READ_BINARY_MAX ? READ_BINARY_MAX : left;
+}
+
+bool StreamReadBinary::read_done(int32_t result)
+{
+	if (result > 0) {
+		filled += result;
+		if (filled == want) {
+			return finish();
+		}
+		return filled == buf->size && !reserve(1);
+	}
+	if (result == 0) {
+		stream->reader().eof = true;
+		return finish();
+	}
+	if (result == -EAGAIN || result == -EWOULDBLOCK || result == -EINTR) {
+		return false;
+	}
+	qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_IOERROR
+			, "io", "readbin", 0));
+	return true;
+}
+
+bool StreamReadBinary::reserve(uint64_t room)
+{
+	if (buf->size - filled >= room) {
+		return true;
+	}
+	uint64_t size(buf->size * 2);
+	if (size < filled + room) {
+		size = filled + room;
+	}
+	if (size > want) {
+		size = want;
+	}
+	BinaryBuffer *grown(BinaryBuffer::grow(buf, size));
+	if (!grown) {
+		qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_TOOBIG
+				, "io", "readbin", 0));
+		return false;
+	}
+	buf = grown;
+	return true;
+}
+
+bool StreamReadBinary::finish()
+{
+	if (filled == 0 && buf->size > 0) {
+		qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_EOF
+				, "io", "readbin", 0));
+	} else {
+		qbrt_value::bin(dst, Binary::view(buf, buf->data, filled));
+	}
+	return true;
+}
+
+StreamIO * stream_read_binary(qbrt_value &dst, Stream &s, uint64_t n)
+{
+	// start small and grow as bytes arrive, n may be far more
+	// than the stream has
+	uint64_t size(n > READ_BINARY_START ? READ_BINARY_START : n);
+	BinaryBuffer *buf(BinaryBuffer::create(size));
+	if (!buf) {
+		qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_TOOBIG
+				, "io", "readbin", 0));
+		return NULL;
+	}
+	StreamReadBinary *io(new StreamReadBinary(&s, dst, buf, 0, n));
+	// bytes that were already read go first, unless the helpers
+	// are reading into the buffer
+	if (!s.helper_reads && io->buffered()) {
+		delete io;
+		return NULL;
+	}
+	return io;
+}
+
+bool StreamAccept::handle()
+{
+	int fd(accept4(stream->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC));
+	return accept_done(fd < 0 ? -errno : fd);
+}
+
+bool StreamAccept::accept_done(int32_t result)
+{
+	if (result >= 0) {
+		qbrt_value::stream(dst, new SocketStream(result));
+		return true;
+	}
+	if (result == -EAGAIN || result == -EWOULDBLOCK || result == -EINTR
+			|| result == -ECONNABORTED)
+	{
+		// another worker got it first, keep waiting
+		return false;
+	}
+	qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_IOERROR
+			, "io", "accept", 0));
+	return true;
+}
+
+bool StreamConnect::handle()
+{
+	int err(0);
+	socklen_t len(sizeof(err));
+	getsockopt(stream->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+	if (err == 0) {
+		qbrt_value::stream(dst, stream);
+	} else {
+		qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_IOERROR
+				, "io", "connect", 0));
+	}
+	return true;
+}
+
+bool StreamClose::handle()
+{
+	if (!stream->flush()) {
+		return false;
+	}
+	close(stream->fd);
+	stream->fd = -1;
+	qbrt_value::set_void(dst);
+	return true;
+}
+
+void StreamClose::closed()
+{
+	// another close got there first
+	qbrt_value::set_void(dst);
+}
+
+bool StreamWrite::handle()
+{
+	stream->flush();
+	return __sync_add_and_fetch(&stream->wbuf.pending_bytes, 0)
+		< WRITE_BUFFER_SIZE;
 }
 
 StreamIO * ByteStream::getline(qbrt_value &dst)
 {
+	// only read once epoll says there's something to read
+	if (reader().next_line(dst)) {
+		return NULL;
+	}
 	return new StreamGetline(this, dst);
 }
 
-StreamIO * ByteStream::write(const string &src)
+StreamIO * ByteStream::getlines(qbrt_value &dst)
+{
+	if (reader().next_lines(dst)) {
+		return NULL;
+	}
+	return new StreamGetlines(this, dst);
+}
+
+StreamIO * ByteStream::read(qbrt_value &dst)
+{
+	if (reader().next_bytes(dst)) {
+		return NULL;
+	}
+	return new StreamRead(this, dst);
+}
+
+StreamIO * ByteStream::write(qbrt_value &, const String &src)
 {
-	return new StreamWrite(this, src);
+	if (queue(src) < WRITE_BUFFER_SIZE) {
+		return NULL;
+	}
+	// too much queued, wait until the stream can take it
+	return new StreamWrite(this);
 }
 
 StreamIO * FileStream::getline(qbrt_value &dst)
 {
-	StreamGetline io(this, dst);
-	io.handle();
+	// files block so reading more is left to the helper threads.
+	// don't touch the buffer while they're reading into it
+	if (!helper_reads && reader().next_line(dst)) {
+		return NULL;
+	}
+	return new StreamGetline(this, dst);
+}
+
+StreamIO * FileStream::getlines(qbrt_value &dst)
+{
+	if (!helper_reads && reader().next_lines(dst)) {
+		return NULL;
+	}
+	return new StreamGetlines(this, dst);
+}
+
+StreamIO * FileStream::read(qbrt_value &dst)
+{
+	if (!helper_reads && reader().next_bytes(dst)) {
+		return NULL;
+	}
+	return new StreamRead(this, dst);
+}
+
+StreamIO * FileStream::write(qbrt_value &, const String &src)
+{
+	if (queue(src) < WRITE_BUFFER_SIZE) {
+		return NULL;
+	}
+	return new StreamWrite(this);
+}
+
+SocketStream::SocketStream(int fd)
+: ByteStream(fd, NULL)
+{
+	// writes are already batched, don't let tcp hold them back too.
+	// this fails harmlessly for unix sockets
+	int on(1);
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+StreamIO * ListenStream::getline(qbrt_value &dst)
+{
+	qbrt_value::fail(dst, FAIL_TYPE("io", "getline", 0));
+	return NULL;
+}
+
+StreamIO * ListenStream::getlines(qbrt_value &dst)
+{
+	qbrt_value::fail(dst, FAIL_TYPE("io", "getlines", 0));
+	return NULL;
+}
+
+StreamIO * ListenStream::read(qbrt_value &dst)
+{
+	qbrt_value::fail(dst, FAIL_TYPE("io", "read", 0));
+	return NULL;
+}
+
+StreamIO * ListenStream::write(qbrt_value &dst, const String &)
+{
+	qbrt_value::fail(dst, FAIL_TYPE("io", "write", 0));
+	return NULL;
+}
+
+StreamIO * ListenStream::accept(qbrt_value &dst)
+{
+	return new StreamAccept(this, dst);
+}
+
+/**
+ * Receive up to RECV_BATCH datagrams
+ * Return false if none are ready, otherwise set dst to a list of
+ * binaries or a failure.
+ */
+static bool recv_batch(int fd, qbrt_value &dst)
+{
+	// datagrams land in a scratch area big enough for the largest
+	// ones and are then packed together in one shared buffer
+	static __thread char *scratch(NULL);
+	if (!scratch) {
+		scratch = (char *) malloc(RECV_BATCH * DATAGRAM_SIZE);
+	}
+	mmsghdr msgs[RECV_BATCH];
+	iovec iov[RECV_BATCH];
+	memset(msgs, 0, sizeof(msgs));
+	for (int i(0); i<RECV_BATCH; ++i) {
+		iov[i].iov_base = scratch + i * DATAGRAM_SIZE;
+		iov[i].iov_len = DATAGRAM_SIZE;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	int count(recvmmsg(fd, msgs, RECV_BATCH, MSG_DONTWAIT, NULL));
+	if (count < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			return false;
+		}
+		qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_IOERROR
+				, "io", "recvmsgs", 0));
+		return true;
+	}
+
+	uint32_t total(0);
+	for (int i(0); i<count; ++i) {
+		total += msgs[i].msg_len;
+	}
+	BinaryBuffer *buf(BinaryBuffer::create(total));
+	if (!buf) {
+		qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_TOOBIG
+				, "io", "recvmsgs", 0));
+		return true;
+	}
+	char *data(buf->data);
+	// build the list backwards so it comes out in arrival order
+	List::empty(dst);
+	for (int i(count-1); i>=0; --i) {
+		total -= msgs[i].msg_len;
+		memcpy(data + total, iov[i].iov_base, msgs[i].msg_len);
+		qbrt_value msg;
+		qbrt_value::bin(msg, Binary::view(buf, data + total
+					, msgs[i].msg_len));
+		qbrt_value tail(dst);
+		List::cons(dst, msg, tail);
+	}
+	return true;
+}
+
+bool StreamRecvmsgs::handle()
+{
+	return recv_batch(stream->fd, dst);
+}
+
+bool StreamSendmsgs::handle()
+{
+	mmsghdr hdrs[SEND_BATCH];
+	iovec iov[SEND_BATCH];
+	while (sent < msgs.size()) {
+		uint32_t count(msgs.size() - sent);
+		if (count > SEND_BATCH) {
+			count = SEND_BATCH;
+		}
+		memset(hdrs, 0, count * sizeof(mmsghdr));
+		for (uint32_t i(0); i<count; ++i) {
+			iov[i] = msgs[sent + i];
+			hdrs[i].msg_hdr.msg_name = &addr;
+			hdrs[i].msg_hdr.msg_namelen = addrlen;
+			hdrs[i].msg_hdr.msg_iov = &iov[i];
+			hdrs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int result(sendmmsg(stream->fd, hdrs, count, MSG_DONTWAIT));
+		if (result < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK
+					|| errno == EINTR)
+			{
+				return false;
+			}
+			qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_IOERROR
+					, "io" , "sendmsgs", 0));
+			return true;
+		}
+		sent += result;
+	}
+	qbrt_value::set_void(dst);
+	return true;
+}
+
+void StreamSendmsgs::closed()
+{
+	qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_IOERROR
+			, "io", "sendmsgs", 0));
+}
+
+StreamTransfer::StreamTransfer(Stream *out, Stream *in, qbrt_value &dest)
+: StreamIO(out, EPOLLOUT)
+, out(out)
+, in(in)
+, mode(SPLICE)
+, piped(0)
+, buf(NULL)
+, start(0)
+, end(0)
+, fixed(false)
+, out_blocks(false)
+, in_blocks(false)
+, eof(false)
+, total(0)
+, dst(dest)
+{
+	pipe_fd[0] = -1;
+	pipe_fd[1] = -1;
+}
+
+StreamTransfer::~StreamTransfer()
+{
+	if (pipe_fd[0] >= 0) {
+		close(pipe_fd[0]);
+		close(pipe_fd[1]);
+	}
+	free(buf);
+}
+
+bool StreamTransfer::handle()
+{
+	// what's already queued for out goes first
+	if (stalls(out) || !out->flush()) {
+		return wait(out, EPOLLOUT);
+	}
+	for (int round(0); round<TRANSFER_ROUNDS; ++round) {
+		ssize_t n;
+		if (piped) {
+			n = splice(pipe_fd[0], NULL, out->fd, NULL, piped
+					, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n < 0 && errno == EINVAL) {
+				unpipe();
+				continue;
+			}
+			if (n < 0) {
+				return blocked(out, EPOLLOUT);
+			}
+			piped -= n;
+			total += n;
+		} else if (start < end) {
+			n = ::write(out->fd, buf + start, end - start);
+			if (n < 0) {
+				return blocked(out, EPOLLOUT);
+			}
+			start += n;
+			total += n;
+		} else if (eof) {
+			qbrt_value::i(dst, total);
+			return true;
+		} else if (mode == SENDFILE) {
+			n = sendfile(out->fd, in->fd, NULL, TRANSFER_CHUNK);
+			if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+				mode = COPY;
+				continue;
+			}
+			if (n < 0) {
+				return blocked(out, EPOLLOUT);
+			}
+			eof = (n == 0);
+			total += n;
+		} else if (stalls(in)) {
+			return wait(in, EPOLLIN);
+		} else if (mode == SPLICE) {
+			if (pipe_fd[0] < 0 && !open_pipe()) {
+				mode = COPY;
+				continue;
+			}
+			n = splice(in->fd, NULL, pipe_fd[1], NULL, TRANSFER_CHUNK
+					, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n < 0 && errno == EINVAL) {
+				mode = COPY;
+				continue;
+			}
+			if (n < 0) {
+				return blocked(in, EPOLLIN);
+			}
+			eof = (n == 0);
+			piped = n;
+		} else {
+			if (!buf) {
+				buf = (char *) malloc(TRANSFER_CHUNK);
+			}
+			n = ::read(in->fd, buf, TRANSFER_CHUNK);
+			if (n < 0) {
+				return blocked(in, EPOLLIN);
+			}
+			eof = (n == 0);
+			start = 0;
+			end = n;
+		}
+	}
+	// give the other frames a turn, then carry on
+	if (piped || start < end || mode == SENDFILE) {
+		return wait(out, EPOLLOUT);
+	}
+	return wait(in, EPOLLIN);
+}
+
+void StreamTransfer::closed()
+{
+	qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_IOERROR
+			, "io", "transfer", 0));
+}
+
+bool StreamTransfer::wait(Stream *s, uint32_t ev)
+{
+	if (!fixed) {
+		stream = s;
+		events = ev;
+	}
+	return false;
+}
+
+bool StreamTransfer::blocked(Stream *s, uint32_t ev)
+{
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+		return wait(s, ev);
+	}
+	qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_IOERROR
+			, "io", "transfer", 0));
+	return true;
+}
+
+bool StreamTransfer::open_pipe()
+{
+	if (pipe2(pipe_fd, O_NONBLOCK | O_CLOEXEC) < 0) {
+		pipe_fd[0] = -1;
+		pipe_fd[1] = -1;
+		return false;
+	}
+	// one splice can fill it, if the kernel allows a pipe that big
+	fcntl(pipe_fd[1], F_SETPIPE_SZ, TRANSFER_CHUNK);
+	return true;
+}
+
+void StreamTransfer::unpipe()
+{
+	if (!buf) {
+		buf = (char *) malloc(TRANSFER_CHUNK);
+	}
+	ssize_t n(::read(pipe_fd[0], buf, piped));
+	start = 0;
+	end = n < 0 ? 0 : n;
+	piped = 0;
+	mode = COPY;
+}
+
+/** Return true if io on fd can block, files never wait for long */
+static bool blocking_fd(int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		return false;
+	}
+	return !(fcntl(fd, F_GETFL) & O_NONBLOCK);
+}
+
+StreamIO * stream_transfer(qbrt_value &dst, Stream &out, Stream &in)
+{
+	StreamTransfer *io(new StreamTransfer(&out, &in, dst));
+	// bytes that were already read go out first
+	if (in.rbuf) {
+		qbrt_value rest;
+		if (in.rbuf->start < in.rbuf->end && in.rbuf->next_bytes(rest)) {
+			io->total = rest.data.str->size;
+			out.queue(*rest.data.str);
+		}
+		io->eof = in.rbuf->eof;
+	}
+	struct stat st;
+	if (fstat(in.fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		io->mode = StreamTransfer::SENDFILE;
+	}
+	bool in_file(dynamic_cast< FileStream * >(&in));
+	bool out_file(dynamic_cast< FileStream * >(&out));
+	if (out_file && !in_file) {
+		// writing a file never waits, so wait to read instead
+		io->stream = &in;
+		io->events = EPOLLIN;
+	}
+	// files might not be pollable, so stay with the other stream
+	io->fixed = in_file || out_file;
+	// the helper threads take the op while it waits on a blocking
+	// fd, it comes back to the worker to wait on the other one
+	io->out_blocks = blocking_fd(out.fd);
+	io->in_blocks = blocking_fd(in.fd);
+	return io;
+}
+
+StreamIO * DatagramStream::getline(qbrt_value &dst)
+{
+	qbrt_value::fail(dst, FAIL_TYPE("io", "getline", 0));
+	return NULL;
+}
+
+StreamIO * DatagramStream::getlines(qbrt_value &dst)
+{
+	qbrt_value::fail(dst, FAIL_TYPE("io", "getlines", 0));
 	return NULL;
 }
 
-StreamIO * FileStream::write(const string &src)
+StreamIO * DatagramStream::read(qbrt_value &dst)
 {
-	StreamWrite io(this, src);
-	io.handle();
+	qbrt_value::fail(dst, FAIL_TYPE("io", "read", 0));
 	return NULL;
 }
+
+StreamIO * DatagramStream::write(qbrt_value &dst, const String &)
+{
+	// datagrams go out with sendmsgs
+	qbrt_value::fail(dst, FAIL_TYPE("io", "write", 0));
+	return NULL;
+}
+
+StreamIO * DatagramStream::recvmsgs(qbrt_value &dst)
+{
+	// a busy socket usually has datagrams ready, so try before
+	// paying for a trip through the poller
+	if (recv_batch(fd, dst)) {
+		return NULL;
+	}
+	return new StreamRecvmsgs(this, dst);
+}
+
+
+/**
+ * Resolve an address for a socket type
+ * Return false and set dst to a failure if it's not an address.
+ */
+static bool socket_address(qbrt_value &dst, const string &address
+		, bool passive, int socktype, const char *fname
+		, sockaddr_storage &addr, socklen_t &addrlen)
+{
+	memset(&addr, 0, sizeof(addr));
+	if (address.compare(0, 5, "unix:") == 0) {
+		string path(address.substr(5));
+		sockaddr_un &un((sockaddr_un &) addr);
+		if (path.empty() || path.size() >= sizeof(un.sun_path)) {
+			qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_BADADDRESS
+					, "io" , fname, 0));
+			return false;
+		}
+		un.sun_family = AF_UNIX;
+		memcpy(un.sun_path, path.data(), path.size());
+		if (path[0] == '@') {
+			un.sun_path[0] = '\0';
+		}
+		addrlen = offsetof(sockaddr_un, sun_path) + path.size();
+	} else {
+		size_t colon(address.rfind(':'));
+		if (colon == string::npos) {
+			qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_BADADDRESS
+					, "io" , fname, 0));
+			return false;
+		}
+		string host(address.substr(0, colon));
+		string port(address.substr(colon + 1));
+		addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = socktype;
+		hints.ai_flags = AI_NUMERICSERV | (passive ? AI_PASSIVE : 0);
+		addrinfo *info;
+		if (getaddrinfo(host.empty() ? NULL : host.c_str()
+					, port.c_str(), &hints, &info) != 0)
+		{
+			qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_BADADDRESS
+					, "io" , fname, 0));
+			return false;
+		}
+		memcpy(&addr, info->ai_addr, info->ai_addrlen);
+		addrlen = info->ai_addrlen;
+		freeaddrinfo(info);
+	}
+	return true;
+}
+
+/**
+ * Make a socket for an address
+ * Return the fd or -1 and set dst to a failure.
+ */
+static int socket_open(qbrt_value &dst, const string &address, bool passive
+		, int socktype, const char *fname
+		, sockaddr_storage &addr, socklen_t &addrlen)
+{
+	if (!socket_address(dst, address, passive, socktype, fname
+				, addr, addrlen))
+	{
+		return -1;
+	}
+	int fd(socket(addr.ss_family, socktype | SOCK_NONBLOCK
+				| SOCK_CLOEXEC, 0));
+	if (fd < 0) {
+		qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_IOERROR
+				, "io", fname, 0));
+	}
+	return fd;
+}
+
+void socket_listen(qbrt_value &dst, const string &address)
+{
+	sockaddr_storage addr;
+	socklen_t addrlen;
+	int fd(socket_open(dst, address, true, SOCK_STREAM, "listen"
+				, addr, addrlen));
+	if (fd < 0) {
+		return;
+	}
+	int on(1);
+	if (addr.ss_family != AF_UNIX) {
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	}
+	if (bind(fd, (sockaddr *) &addr, addrlen) < 0
+			|| listen(fd, SOMAXCONN) < 0)
+	{
+		close(fd);
+		qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_IOERROR
+				, "io", "listen", 0));
+		return;
+	}
+	qbrt_value::stream(dst, new ListenStream(fd));
+}
+
+StreamIO * socket_connect(qbrt_value &dst, const string &address)
+{
+	sockaddr_storage addr;
+	socklen_t addrlen;
+	int fd(socket_open(dst, address, false, SOCK_STREAM, "connect"
+				, addr, addrlen));
+	if (fd < 0) {
+		return NULL;
+	}
+	SocketStream *stream(new SocketStream(fd));
+	if (connect(fd, (sockaddr *) &addr, addrlen) == 0) {
+		qbrt_value::stream(dst, stream);
+		return NULL;
+	}
+	if (errno == EINPROGRESS || errno == EAGAIN) {
+		return new StreamConnect(stream, dst);
+	}
+	close(fd);
+	stream->fd = -1;
+	delete stream;
+	qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_IOERROR
+			, "io", "connect", 0));
+	return NULL;
+}
+
+void socket_datagram(qbrt_value &dst, const string &address)
+{
+	sockaddr_storage addr;
+	socklen_t addrlen;
+	int fd(socket_open(dst, address, true, SOCK_DGRAM, "udp"
+				, addr, addrlen));
+	if (fd < 0) {
+		return;
+	}
+	// room to hold a burst while the receiving process is busy,
+	// the kernel caps it at net.core.rmem_max
+	int rcvbuf(DATAGRAM_RCVBUF);
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	if (bind(fd, (sockaddr *) &addr, addrlen) < 0) {
+		close(fd);
+		qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_IOERROR
+				, "io", "udp", 0));
+		return;
+	}
+	qbrt_value::stream(dst, new DatagramStream(fd));
+}
+
+StreamIO * DatagramStream::sendmsgs(qbrt_value &dst, const string &address
+		, const qbrt_value &msgs)
+{
+	StreamSendmsgs *io(new StreamSendmsgs(this, dst));
+	if (!socket_address(dst, address, false, SOCK_DGRAM, "sendmsgs"
+				, io->addr, io->addrlen))
+	{
+		delete io;
+		return NULL;
+	}
+	const qbrt_value *it(&msgs);
+	while (!List::empty(*it->data.cons)) {
+		const qbrt_value &msg(it->data.cons->value(0));
+		iovec bytes;
+		if (msg.type->id == VT_STRING) {
+			bytes.iov_base = (char *) msg.data.str->chars;
+			bytes.iov_len = msg.data.str->size;
+		} else if (msg.type->id == VT_BINARY) {
+			bytes.iov_base = (char *) msg.data.bin->data;
+			bytes.iov_len = msg.data.bin->size;
+		} else {
+			delete io;
+			qbrt_value::fail(dst, FAIL_TYPE("io", "sendmsgs", 0));
+			return NULL;
+		}
+		io->msgs.push_back(bytes);
+		it = &it->data.cons->value(1);
+	}
+	if (io->handle()) {
+		delete io;
+		return NULL;
+	}
+	return io;
+}
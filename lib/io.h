@@ -2,61 +2,578 @@
 #define QBRT_IO_H
 
 #include "qbrt/core.h"
+#include "timer.h"
+#include <string>
+#include <vector>
 #include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <pthread.h>
 
 
+struct Pipe;
+struct Binary;
+struct BinaryBuffer;
+struct IOWatch;
+
 struct StreamIO
 {
 	Stream *stream;
 	uint32_t events;
+	/** Set while the op waits with a deadline */
+	Timer timer;
+	/** The deadline passed while the kernel still had the op */
+	bool expired;
+	/** The watch the op waits on, set when its worker parks it */
+	IOWatch *watch;
 
 	StreamIO(Stream *s, uint32_t e)
 	: stream(s)
 	, events(e)
+	, timer()
+	, expired(false)
+	, watch(NULL)
 	{}
 	virtual ~StreamIO() {}
-	virtual void handle() = 0;
+	/** Do the operation, return false if it has to wait more */
+	virtual bool handle() = 0;
+
+	/** ms to wait before giving up, -1 to wait as long as it takes */
+	virtual int32_t timeout() const { return -1; }
+	/** Give up at the deadline, return false if it's already done */
+	virtual bool expire() { return false; }
+	/** Finish because the stream was closed while the op waited */
+	virtual void closed() {}
+	/**
+	 * Return true if an op without a stream waits in its worker
+	 * for a timer or a message instead of on a helper thread
+	 */
+	virtual bool parks() const { return false; }
+	/**
+	 * Return true if the op can block its thread even once its
+	 * stream is ready, so it has to run on a helper thread
+	 */
+	virtual bool blocks() const { return false; }
+	/**
+	 * Finish with bytes the stream has already read
+	 * Return false if the op needs more from the kernel.
+	 */
+	virtual bool buffered() { return false; }
+
+	/**
+	 * Return true if the kernel can do this op's reads into
+	 * read_buffer, otherwise it waits for events and handles them
+	 */
+	virtual bool reads() const { return false; }
+	/** Set buf and len to where the next read should go */
+	virtual void read_buffer(char *&, uint32_t &) {}
+	/**
+	 * Finish with the result of a read done for this op
+	 * Return false if it has to read more.
+	 */
+	virtual bool read_done(int32_t) { return true; }
+	/**
+	 * Return true if the kernel can accept this op's connection,
+	 * otherwise it waits for events and handles them
+	 */
+	virtual bool accepts() const { return false; }
+	/**
+	 * Finish with the fd of a connection accepted for this op
+	 * Return false if it has to accept again.
+	 */
+	virtual bool accept_done(int32_t) { return true; }
 };
 
-struct StreamGetline
+/** An op that fails with #timeout once its stream's timeout passes */
+struct TimedStreamIO
 : public StreamIO
 {
 	qbrt_value &dst;
+	const char *fname;
+
+	TimedStreamIO(Stream *s, uint32_t e, qbrt_value &dest
+			, const char *fname)
+	: StreamIO(s, e)
+	, dst(dest)
+	, fname(fname)
+	{}
 
+	virtual int32_t timeout() const;
+	virtual bool expire();
+	virtual void closed();
+};
+
+struct StreamGetline
+: public TimedStreamIO
+{
 	StreamGetline(Stream *s, qbrt_value &dest)
-	: StreamIO(s, EPOLLIN)
+	: TimedStreamIO(s, EPOLLIN, dest, "getline")
+	{}
+
+	virtual bool handle();
+	virtual bool buffered();
+	virtual bool reads() const { return true; }
+	virtual void read_buffer(char *&buf, uint32_t &len);
+	virtual bool read_done(int32_t result);
+};
+
+struct StreamGetlines
+: public TimedStreamIO
+{
+	StreamGetlines(Stream *s, qbrt_value &dest)
+	: TimedStreamIO(s, EPOLLIN, dest, "getlines")
+	{}
+
+	virtual bool handle();
+	virtual bool buffered();
+	virtual bool reads() const { return true; }
+	virtual void read_buffer(char *&buf, uint32_t &len);
+	virtual bool read_done(int32_t result);
+};
+
+/** Write everything queued and then sync the file to disk */
+struct StreamSync
+: public StreamIO
+{
+	qbrt_value &dst;
+
+	StreamSync(Stream *s, qbrt_value &dest)
+	: StreamIO(s, EPOLLOUT)
 	, dst(dest)
 	{}
 
-	virtual void handle();
+	virtual bool handle();
+	virtual void closed();
 };
 
-struct StreamWrite
+/** Open a file, there's no stream yet so it always blocks */
+struct FileOpen
+: public StreamIO
+{
+	std::string filename;
+	std::string mode;
+	qbrt_value &dst;
+
+	FileOpen(const std::string &filename, const std::string &mode
+			, qbrt_value &dest)
+	: StreamIO(NULL, 0)
+	, filename(filename)
+	, mode(mode)
+	, dst(dest)
+	{}
+
+	virtual bool handle();
+};
+
+/** Map a whole file read only, there's no stream so it blocks */
+struct FileMap
+: public StreamIO
+{
+	std::string filename;
+	qbrt_value &dst;
+
+	FileMap(const std::string &filename, qbrt_value &dest)
+	: StreamIO(NULL, 0)
+	, filename(filename)
+	, dst(dest)
+	{}
+
+	virtual bool handle();
+};
+
+/** Read whatever bytes are ready */
+struct StreamRead
+: public TimedStreamIO
+{
+	StreamRead(Stream *s, qbrt_value &dest)
+	: TimedStreamIO(s, EPOLLIN, dest, "read")
+	{}
+
+	virtual bool handle();
+	virtual bool buffered();
+	virtual bool reads() const { return true; }
+	virtual void read_buffer(char *&buf, uint32_t &len);
+	virtual bool read_done(int32_t result);
+};
+
+/**
+ * Read a number of bytes into a new binary, or what's left at eof
+ *
+ * The kernel reads straight into the binary's buffer so a large
+ * payload is never copied through the stream's read buffer. The
+ * buffer starts small and doubles as bytes arrive, so asking for
+ * more than the stream has doesn't reserve it all.
+ */
+struct StreamReadBinary
+: public TimedStreamIO
+{
+	BinaryBuffer *buf;
+	/** Bytes of buf read so far */
+	uint64_t filled;
+	/** Bytes asked for, buf grows toward this as they arrive */
+	uint64_t want;
+
+	StreamReadBinary(Stream *s, qbrt_value &dest, BinaryBuffer *buf
+			, uint64_t filled, uint64_t want);
+	~StreamReadBinary();
+
+	virtual bool handle();
+	/** Take what the stream's read buffer has, up to want */
+	virtual bool buffered();
+	virtual bool reads() const { return true; }
+	virtual void read_buffer(char *&buf, uint32_t &len);
+	virtual bool read_done(int32_t result);
+	/**
+	 * Grow buf, doubling it up to want, so room more bytes fit
+	 * Return false and fail dst with #toobig if it can't.
+	 */
+	bool reserve(uint64_t room);
+	/** Set dst to what's been read, or #eof if nothing was */
+	bool finish();
+};
+
+/** Accept a connection on a listening socket */
+struct StreamAccept
+: public TimedStreamIO
+{
+	StreamAccept(Stream *s, qbrt_value &dest)
+	: TimedStreamIO(s, EPOLLIN, dest, "accept")
+	{}
+
+	virtual bool handle();
+	virtual bool accepts() const { return true; }
+	virtual bool accept_done(int32_t result);
+};
+
+/** Wait for a socket's connect to finish */
+struct StreamConnect
+: public TimedStreamIO
+{
+	StreamConnect(Stream *s, qbrt_value &dest)
+	: TimedStreamIO(s, EPOLLOUT, dest, "connect")
+	{}
+
+	virtual bool handle();
+};
+
+/** Write everything queued and then close the stream */
+struct StreamClose
+: public StreamIO
+{
+	qbrt_value &dst;
+
+	StreamClose(Stream *s, qbrt_value &dest)
+	: StreamIO(s, EPOLLOUT)
+	, dst(dest)
+	{}
+
+	virtual bool handle();
+	virtual void closed();
+};
+
+/** Receive a batch of datagrams */
+struct StreamRecvmsgs
+: public TimedStreamIO
+{
+	StreamRecvmsgs(Stream *s, qbrt_value &dest)
+	: TimedStreamIO(s, EPOLLIN, dest, "recvmsgs")
+	{}
+
+	virtual bool handle();
+};
+
+/** Send datagrams to an address, as many as fit in each call */
+struct StreamSendmsgs
 : public StreamIO
 {
-	const std::string &src;
+	sockaddr_storage addr;
+	socklen_t addrlen;
+	/** Bytes of each string or binary to send */
+	std::vector< iovec > msgs;
+	/** Datagrams already sent */
+	uint32_t sent;
+	qbrt_value &dst;
+
+	StreamSendmsgs(Stream *s, qbrt_value &dest)
+	: StreamIO(s, EPOLLOUT)
+	, addrlen(0)
+	, sent(0)
+	, dst(dest)
+	{}
+
+	virtual bool handle();
+	virtual void closed();
+};
+
+/**
+ * Move the rest of one stream's bytes to another
+ *
+ * Files go out with sendfile and other streams are spliced through
+ * a pipe, so the bytes stay in the kernel. When the kernel can't do
+ * either for a pair of streams, they're copied through a big buffer.
+ * Between two sockets or pipes, the op waits on whichever side it's
+ * stuck on.
+ */
+struct StreamTransfer
+: public StreamIO
+{
+	enum Mode
+	{
+		SENDFILE,
+		SPLICE,
+		COPY,
+	};
+
+	Stream *out;
+	Stream *in;
+	Mode mode;
+	/** Pipe the bytes are spliced through, created when needed */
+	int pipe_fd[2];
+	/** Bytes spliced into the pipe and not yet out of it */
+	uint32_t piped;
+	/** Buffer for copying, bytes from start to end are left to write */
+	char *buf;
+	uint32_t start;
+	uint32_t end;
+	/** Either stream is a file, so the op never changes streams */
+	bool fixed;
+	/** The fd blocks, like a tty or a stdout pipe */
+	bool out_blocks;
+	bool in_blocks;
+	bool eof;
+	int64_t total;
+	qbrt_value &dst;
+
+	StreamTransfer(Stream *out, Stream *in, qbrt_value &dest);
+	~StreamTransfer();
+
+	virtual bool handle();
+	virtual void closed();
+	virtual bool blocks() const { return blocking(stream); }
+
+private:
+	bool blocking(const Stream *s) const
+	{
+		return s == in ? in_blocks : out_blocks;
+	}
+	/**
+	 * Return true if io on a blocking stream would stall the worker
+	 * the op is running on, then it has to move to the helpers first
+	 */
+	bool stalls(const Stream *s) const
+	{
+		return blocking(s) && !blocking(stream);
+	}
+	/** Wait for events on a stream, always returns false */
+	bool wait(Stream *, uint32_t events);
+	/**
+	 * Wait if errno says the stream isn't ready, otherwise fail
+	 * Return true if the op failed.
+	 */
+	bool blocked(Stream *, uint32_t events);
+	bool open_pipe();
+	/** Switch to copying, moving what's in the pipe to the buffer */
+	void unpipe();
+};
 
-	StreamWrite(Stream *s, const std::string &src)
+/** Wait for a stream's write buffer to drain below its limit */
+struct StreamWrite
+: public StreamIO
+{
+	StreamWrite(Stream *s)
 	: StreamIO(s, EPOLLOUT)
-	, src(src)
 	{}
 
-	virtual void handle();
+	virtual bool handle();
+};
+
+/** Wait until a timer expires */
+struct Sleep
+: public StreamIO
+{
+	int32_t ms;
+	qbrt_value &dst;
+
+	Sleep(int32_t ms, qbrt_value &dest)
+	: StreamIO(NULL, 0)
+	, ms(ms)
+	, dst(dest)
+	{}
+
+	virtual bool handle() { return false; }
+	virtual int32_t timeout() const { return ms; }
+	virtual bool expire();
+	virtual bool parks() const { return true; }
+};
+
+/**
+ * Wait for a message sent to the frame's process
+ *
+ * The sender puts the message straight into dst and wakes the frame
+ * so a waiting process doesn't run until there's something for it.
+ */
+struct Receive
+: public StreamIO
+{
+	Pipe &pipe;
+	CodeFrame *frame;
+	int32_t ms;
+	qbrt_value &dst;
+
+	Receive(Pipe &p, CodeFrame *f, int32_t ms, qbrt_value &dest)
+	: StreamIO(NULL, 0)
+	, pipe(p)
+	, frame(f)
+	, ms(ms)
+	, dst(dest)
+	{}
+
+	virtual bool handle();
+	virtual int32_t timeout() const { return ms; }
+	virtual bool expire();
+	virtual bool parks() const { return true; }
+};
+
+/**
+ * Bytes read from a stream that haven't been returned yet
+ *
+ * Reads go into a large chunk and lines are returned as strings
+ * that share the chunk, so a line isn't copied. When the chunk
+ * fills up, the partial line at the end moves to a new chunk.
+ * A chunk is freed once the buffer and every line that shares it
+ * have let go.
+ */
+struct ReadBuffer
+{
+	StringBuffer *chunk;
+	/** First byte not yet returned */
+	uint32_t start;
+	/** End of the bytes read so far */
+	uint32_t end;
+	/** Bytes before this have been searched for a newline */
+	uint32_t scanned;
+	bool eof;
+
+	ReadBuffer();
+	~ReadBuffer();
+
+	/** Set line to the next whole line, false if there isn't one */
+	bool split(qbrt_value &line);
+	/**
+	 * Set line to the next line, the rest of the stream at eof
+	 * or an #eof failure. Return false if a line isn't ready.
+	 */
+	bool next_line(qbrt_value &line);
+	/** Set lines to a list of every line that's ready */
+	bool next_lines(qbrt_value &lines);
+	/** Set bytes to everything that's been read, false if nothing */
+	bool next_bytes(qbrt_value &bytes);
+	/** Make room at the end of the chunk for another read */
+	void reserve();
+};
+
+/**
+ * Strings written to a stream that haven't gone out yet
+ *
+ * Writes only queue the string, then queued strings go out together
+ * in writev calls. Strings are immutable so the queue holds the
+ * string rather than copying its characters. Writes from any worker
+ * queue in the order they're made and only one flush runs at a time,
+ * so output from each writer stays in order.
+ */
+struct WriteBuffer
+{
+	struct Segment
+	{
+		const char *chars;
+		uint32_t size;
+		/** Characters already written */
+		uint32_t offset;
+		/** String or binary kept until the segment is written */
+		const String *str;
+		const Binary *bin;
+	};
+
+	std::vector< Segment > pending;
+	uint64_t pending_bytes;
+	pthread_spinlock_t lock;
+	pthread_mutex_t flush_lock;
+
+	WriteBuffer();
+	~WriteBuffer();
+
+	/** Queue a string, return the number of bytes now queued */
+	uint64_t push(const String &);
+	/** Queue a binary's bytes without copying them */
+	uint64_t push(const Binary &);
+	/**
+	 * Write what's queued to fd
+	 * Return false if the fd would block before all of it went out.
+	 */
+	bool flush(int fd);
+
+private:
+	uint64_t push(const char *, uint32_t size, const String *
+			, const Binary *);
+	/** Let go of a segment that's written or dropped */
+	void done(const Segment &);
 };
 
 struct Stream
 {
 	int fd;
 	FILE *file;
+	ReadBuffer *rbuf;
+	WriteBuffer wbuf;
+	/** ms reads and accepts wait before failing, -1 for no limit */
+	int32_t timeout;
+	/** Set while the stream waits for the flusher */
+	volatile int dirty;
+	/** A bit for each worker that has waited on the stream, by id */
+	volatile uint64_t watchers;
+	/**
+	 * Reads queued for the helper threads by the stream's worker.
+	 * The read buffer is theirs until these finish.
+	 */
+	uint32_t helper_reads;
 
-	Stream(int fd, FILE *file)
-	: fd(fd)
-	, file(file)
-	{}
+	Stream(int fd, FILE *file);
 
-	virtual ~Stream() {}
+	virtual ~Stream();
 	virtual StreamIO * getline(qbrt_value &dst) = 0;
-	virtual StreamIO * write(const std::string &src) = 0;
+	virtual StreamIO * getlines(qbrt_value &dst) = 0;
+	virtual StreamIO * read(qbrt_value &dst) = 0;
+	/** Queue bytes to write, set dst to a failure if it can't */
+	virtual StreamIO * write(qbrt_value &dst, const String &src) = 0;
+
+	ReadBuffer & reader();
+	/**
+	 * Read once into the read buffer
+	 * Return false and set dst to a failure if the read failed.
+	 */
+	bool fill(qbrt_value &dst);
+	/** Set buf and len to the free space in the read buffer */
+	void read_space(char *&buf, uint32_t &len);
+	/**
+	 * Add the bytes read or -errno to the read buffer
+	 * Return false and set dst to a failure if the read failed.
+	 */
+	bool read_result(int64_t result, qbrt_value &dst);
+	/**
+	 * Queue bytes to write and have the flusher thread write them
+	 * within a tick. Return the number of bytes now queued.
+	 */
+	uint64_t queue(const String &);
+	uint64_t queue(const Binary &);
+	/** Give the stream to the flusher if it doesn't have it yet */
+	void mark_dirty();
+	/** Write everything queued, return false if it would block */
+	bool flush();
+	/** Queue a binary, return the io to wait for if too much is queued */
+	StreamIO * write_binary(const Binary &);
+
+	/** Flush every stream, called at exit */
+	static void flush_all();
 };
 
 struct ByteStream
@@ -67,9 +584,70 @@ struct ByteStream
 	{}
 
 	StreamIO * getline(qbrt_value &dst);
-	StreamIO * write(const std::string &src);
+	StreamIO * getlines(qbrt_value &dst);
+	StreamIO * read(qbrt_value &dst);
+	StreamIO * write(qbrt_value &dst, const String &src);
+};
+
+/** A connected TCP or Unix socket */
+struct SocketStream
+: public ByteStream
+{
+	SocketStream(int fd);
+};
+
+/** A listening socket, it can only accept connections */
+struct ListenStream
+: public Stream
+{
+	ListenStream(int fd)
+	: Stream(fd, NULL)
+	{}
+
+	StreamIO * getline(qbrt_value &dst);
+	StreamIO * getlines(qbrt_value &dst);
+	StreamIO * read(qbrt_value &dst);
+	StreamIO * write(qbrt_value &dst, const String &src);
+	StreamIO * accept(qbrt_value &dst);
 };
 
+/**
+ * Set dst to a socket listening on an address, either host:port
+ * for TCP or unix:path for a Unix socket. A path that starts with @
+ * is in the abstract namespace.
+ */
+void socket_listen(qbrt_value &dst, const std::string &address);
+/** Connect a socket to an address, return the io to wait for if any */
+StreamIO * socket_connect(qbrt_value &dst, const std::string &address);
+
+/**
+ * A UDP or Unix datagram socket
+ *
+ * Datagrams are received and sent in batches with recvmmsg and
+ * sendmmsg so a burst of them costs one syscall and one wakeup
+ * instead of one for each datagram.
+ */
+struct DatagramStream
+: public Stream
+{
+	DatagramStream(int fd)
+	: Stream(fd, NULL)
+	{}
+
+	StreamIO * getline(qbrt_value &dst);
+	StreamIO * getlines(qbrt_value &dst);
+	StreamIO * read(qbrt_value &dst);
+	StreamIO * write(qbrt_value &dst, const String &src);
+	/** Set dst to a list of the datagrams that are ready */
+	StreamIO * recvmsgs(qbrt_value &dst);
+	/** Send each string in a list as a datagram to an address */
+	StreamIO * sendmsgs(qbrt_value &dst, const std::string &address
+			, const qbrt_value &msgs);
+};
+
+/** Set dst to a datagram socket bound to an address */
+void socket_datagram(qbrt_value &dst, const std::string &address);
+
 struct FileStream
 : public Stream
 {
@@ -78,7 +656,21 @@ struct FileStream
 	{}
 
 	StreamIO * getline(qbrt_value &dst);
-	StreamIO * write(const std::string &src);
+	StreamIO * getlines(qbrt_value &dst);
+	StreamIO * read(qbrt_value &dst);
+	StreamIO * write(qbrt_value &dst, const String &src);
 };
 
+/**
+ * Make the io that moves the rest of in to out
+ * dst is set to the number of bytes moved or an #ioerror failure.
+ */
+StreamIO * stream_transfer(qbrt_value &dst, Stream &out, Stream &in);
+
+/**
+ * Read n bytes into a binary, return the io to wait for if any
+ * dst is set to the binary, a shorter one at eof, or a failure.
+ */
+StreamIO * stream_read_binary(qbrt_value &dst, Stream &, uint64_t n);
+
 #endif
@@ -0,0 +1,203 @@
+#include "ioring.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+using namespace std;
+
+
+static int io_uring_setup(uint32_t entries, io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete
+		, uint32_t flags, void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete
+			, flags, arg, argsz);
+}
+
+IoRing::IoRing()
+: fd(-1)
+, entries(0)
+, sq_local_tail(0)
+, sq_head(NULL)
+, sq_tail(NULL)
+, sq_mask(NULL)
+, sq_array(NULL)
+, sqes(NULL)
+, cq_head(NULL)
+, cq_tail(NULL)
+, cq_mask(NULL)
+, cqes(NULL)
+, ring_mem(NULL)
+, ring_size(0)
+, sqes_size(0)
+{}
+
+IoRing * IoRing::create(uint32_t entries)
+{
+	io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	int fd(io_uring_setup(entries, &p));
+	if (fd < 0) {
+		return NULL;
+	}
+	// waiting with a timeout needs EXT_ARG
+	uint32_t needed(IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG);
+	if ((p.features & needed) != needed) {
+		close(fd);
+		return NULL;
+	}
+
+	size_t sq_size(p.sq_off.array + p.sq_entries * sizeof(uint32_t));
+	size_t cq_size(p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+	size_t ring_size(sq_size > cq_size ? sq_size : cq_size);
+	void *mem(mmap(NULL, ring_size, PROT_READ | PROT_WRITE
+				, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING));
+	if (mem == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+	size_t sqes_size(p.sq_entries * sizeof(io_uring_sqe));
+	void *sqes(mmap(NULL, sqes_size, PROT_READ | PROT_WRITE
+				, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+	if (sqes == MAP_FAILED) {
+		munmap(mem, ring_size);
+		close(fd);
+		return NULL;
+	}
+
+	IoRing *ring(new IoRing());
+	char *base((char *) mem);
+	ring->fd = fd;
+	ring->entries = p.sq_entries;
+	ring->sq_head = (uint32_t *) (base + p.sq_off.head);
+	ring->sq_tail = (uint32_t *) (base + p.sq_off.tail);
+	ring->sq_mask = (uint32_t *) (base + p.sq_off.ring_mask);
+	ring->sq_array = (uint32_t *) (base + p.sq_off.array);
+	ring->sqes = (io_uring_sqe *) sqes;
+	ring->cq_head = (uint32_t *) (base + p.cq_off.head);
+	ring->cq_tail = (uint32_t *) (base + p.cq_off.tail);
+	ring->cq_mask = (uint32_t *) (base + p.cq_off.ring_mask);
+	ring->cqes = (io_uring_cqe *) (base + p.cq_off.cqes);
+	ring->ring_mem = mem;
+	ring->ring_size = ring_size;
+	ring->sqes_size = sqes_size;
+	ring->sq_local_tail = *ring->sq_tail;
+	return ring;
+}
+
+IoRing::~IoRing()
+{
+	munmap(sqes, sqes_size);
+	munmap(ring_mem, ring_size);
+	close(fd);
+}
+
+io_uring_sqe & IoRing::next_sqe()
+{
+	if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE)
+			>= entries)
+	{
+		// full, hand what's queued to the kernel to make room
+		enter(0);
+	}
+	uint32_t i(sq_local_tail & *sq_mask);
+	io_uring_sqe &sqe(sqes[i]);
+	memset(&sqe, 0, sizeof(sqe));
+	sq_array[i] = i;
+	++sq_local_tail;
+	return sqe;
+}
+
+void IoRing::read(int fd, char *buf, uint32_t len, uint64_t data)
+{
+	io_uring_sqe &sqe(next_sqe());
+	sqe.opcode = IORING_OP_READ;
+	sqe.fd = fd;
+	sqe.addr = (uintptr_t) buf;
+	sqe.len = len;
+	// -1 reads from the current position, like read(2)
+	sqe.off = (uint64_t) -1;
+	sqe.user_data = data;
+}
+
+void IoRing::accept(int fd, uint64_t data)
+{
+	io_uring_sqe &sqe(next_sqe());
+	sqe.opcode = IORING_OP_ACCEPT;
+	sqe.fd = fd;
+	sqe.accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	sqe.user_data = data;
+}
+
+void IoRing::poll(int fd, uint32_t events, uint64_t data)
+{
+	io_uring_sqe &sqe(next_sqe());
+	sqe.opcode = IORING_OP_POLL_ADD;
+	sqe.fd = fd;
+	sqe.poll32_events = events;
+	sqe.user_data = data;
+}
+
+void IoRing::cancel(uint64_t target, uint64_t data)
+{
+	io_uring_sqe &sqe(next_sqe());
+	sqe.opcode = IORING_OP_ASYNC_CANCEL;
+	sqe.fd = -1;
+	sqe.addr = target;
+	sqe.user_data = data;
+}
+
+void IoRing::enter(int timeout)
+{
+	uint32_t to_submit(sq_local_tail - *sq_tail);
+	__atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+	if (timeout == 0) {
+		if (to_submit) {
+			io_uring_enter(fd, to_submit, 0, 0, NULL, 0);
+		}
+		return;
+	}
+	if (*cq_head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+		// completions are already waiting, don't sleep
+		if (to_submit) {
+			io_uring_enter(fd, to_submit, 0, 0, NULL, 0);
+		}
+		return;
+	}
+
+	__kernel_timespec ts;
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (timeout % 1000) * 1000000;
+	io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+	arg.sigmask_sz = _NSIG / 8;
+	arg.ts = timeout < 0 ? 0 : (uintptr_t) &ts;
+	int result(io_uring_enter(fd, to_submit, 1
+			, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG
+			, &arg, sizeof(arg)));
+	if (result < 0 && errno != ETIME && errno != EINTR) {
+		perror("io_uring_enter");
+	}
+}
+
+bool IoRing::complete(uint64_t &data, int32_t &result)
+{
+	uint32_t head(*cq_head);
+	if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+		return false;
+	}
+	const io_uring_cqe &cqe(cqes[head & *cq_mask]);
+	data = cqe.user_data;
+	result = cqe.res;
+	__atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
@@ -0,0 +1,62 @@
+#ifndef QBRT_IORING_H
+#define QBRT_IORING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+
+/**
+ * A worker's io_uring
+ *
+ * Set up with the raw syscalls so there's no dependency on liburing.
+ * Operations queue in the submission ring and all go to the kernel
+ * in the same io_uring_enter call that waits for completions.
+ */
+struct IoRing
+{
+	/** Return NULL if the kernel doesn't support io_uring */
+	static IoRing * create(uint32_t entries);
+	~IoRing();
+
+	/** Queue a read into buf at the file's current position */
+	void read(int fd, char *buf, uint32_t len, uint64_t data);
+	/** Queue an accept on a listening fd, the new fd is nonblocking */
+	void accept(int fd, uint64_t data);
+	/** Queue a wait for poll events on fd */
+	void poll(int fd, uint32_t events, uint64_t data);
+	/** Cancel the op queued with target, it completes with -ECANCELED */
+	void cancel(uint64_t target, uint64_t data);
+
+	/**
+	 * Submit what's queued and wait up to timeout ms for a
+	 * completion. Don't wait if timeout is 0, wait as long as it
+	 * takes if it's -1.
+	 */
+	void enter(int timeout);
+	/** Take the next completion, return false if there isn't one */
+	bool complete(uint64_t &data, int32_t &result);
+
+private:
+	IoRing();
+	io_uring_sqe & next_sqe();
+
+	int fd;
+	uint32_t entries;
+	/** Tail of the sqes filled in but not yet given to the kernel */
+	uint32_t sq_local_tail;
+	uint32_t *sq_head;
+	uint32_t *sq_tail;
+	uint32_t *sq_mask;
+	uint32_t *sq_array;
+	io_uring_sqe *sqes;
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t *cq_mask;
+	io_uring_cqe *cqes;
+	void *ring_mem;
+	size_t ring_size;
+	size_t sqes_size;
+};
+
+#endif
@@ -0,0 +1,342 @@
+#include "qbrt/map.h"
+#include <memory>
+#include <new>
+
+using namespace std;
+
+#define HAMT_BITS	5
+#define HAMT_MASK	0x1f
+/** Nodes below this shift have used the whole hash */
+#define HAMT_HASH_BITS	32
+#define HAMT_MAX_WIDTH	32
+
+
+/**
+ * Trie node with its entries and child pointers stored inline
+ *
+ * datamap has a bit set for each entry stored in this node and
+ * nodemap a bit for each child. Nodes past the end of the hash
+ * hold keys with colliding hashes and use datamap as their count.
+ */
+template < typename Entry >
+struct HamtNode
+{
+	uint32_t datamap;
+	uint32_t nodemap;
+	uint32_t edit;
+	uint16_t entry_cap;
+	uint16_t child_cap;
+
+	Entry * entries() { return (Entry *) (this + 1); }
+	const Entry * entries() const { return (const Entry *) (this + 1); }
+	HamtNode ** children()
+	{
+		return (HamtNode **) (entries() + entry_cap);
+	}
+	HamtNode * const * children() const
+	{
+		return (HamtNode * const *) (entries() + entry_cap);
+	}
+};
+
+static inline bool hamt_collision(int shift)
+{
+	return shift >= HAMT_HASH_BITS;
+}
+
+static inline uint32_t hamt_bit(uint32_t hash, int shift)
+{
+	return 1 << ((hash >> shift) & HAMT_MASK);
+}
+
+static inline int hamt_index(uint32_t bitmap, uint32_t bit)
+{
+	return __builtin_popcount(bitmap & (bit - 1));
+}
+
+template < typename Entry >
+static inline int hamt_entry_count(const HamtNode< Entry > *n, int shift)
+{
+	return hamt_collision(shift) ? n->datamap
+		: __builtin_popcount(n->datamap);
+}
+
+template < typename Entry >
+static HamtNode< Entry > * hamt_alloc(int entry_cap, int child_cap
+		, uint32_t edit)
+{
+	size_t size(sizeof(HamtNode< Entry >) + entry_cap * sizeof(Entry)
+			+ child_cap * sizeof(HamtNode< Entry > *));
+	HamtNode< Entry > *n = (HamtNode< Entry > *) ::operator new(size);
+	n->datamap = 0;
+	n->nodemap = 0;
+	n->edit = edit;
+	n->entry_cap = entry_cap;
+	n->child_cap = child_cap;
+	return n;
+}
+
+/**
+ * Get a version of the node that the edit can change, with room
+ * for the given number of entries and children. A node that
+ * already belongs to the edit is reused if it's big enough.
+ */
+template < typename Entry >
+static HamtNode< Entry > * hamt_editable(HamtNode< Entry > *n, int shift
+		, uint32_t edit, int entries, int children)
+{
+	bool owned(edit && n->edit == edit);
+	if (owned && n->entry_cap >= entries && n->child_cap >= children) {
+		return n;
+	}
+	if (edit) {
+		// leave room so the next insert can be in place
+		entries = entries < n->entry_cap ? n->entry_cap : entries + 1;
+		if (!hamt_collision(shift) && entries > HAMT_MAX_WIDTH) {
+			entries = HAMT_MAX_WIDTH;
+		}
+		if (children < n->child_cap) {
+			children = n->child_cap;
+		}
+	}
+
+	HamtNode< Entry > *copy(hamt_alloc< Entry >(entries, children, edit));
+	copy->datamap = n->datamap;
+	copy->nodemap = n->nodemap;
+	int count(hamt_entry_count(n, shift));
+	uninitialized_copy(n->entries(), n->entries() + count
+			, copy->entries());
+	memcpy(copy->children(), n->children()
+		, __builtin_popcount(n->nodemap) * sizeof(HamtNode< Entry > *));
+	if (owned) {
+		// nothing else can see a node that belongs to this edit
+		for (int i(0); i<count; ++i) {
+			n->entries()[i].~Entry();
+		}
+		::operator delete(n);
+	}
+	return copy;
+}
+
+/**
+ * Create a node that holds two entries whose hashes match up to
+ * this shift. slot is set to the second entry.
+ */
+template < typename Entry >
+static HamtNode< Entry > * hamt_pair(const Entry &e1, uint32_t h1
+		, const qbrt_value &key, uint32_t h2, int shift, uint32_t edit
+		, Entry *&slot)
+{
+	HamtNode< Entry > *n;
+	if (hamt_collision(shift)) {
+		n = hamt_alloc< Entry >(2, 0, edit);
+		n->datamap = 2;
+		new (&n->entries()[0]) Entry(e1);
+		slot = new (&n->entries()[1]) Entry();
+		slot->key = key;
+		return n;
+	}
+
+	uint32_t b1(hamt_bit(h1, shift));
+	uint32_t b2(hamt_bit(h2, shift));
+	if (b1 == b2) {
+		n = hamt_alloc< Entry >(0, 1, edit);
+		n->nodemap = b1;
+		n->children()[0] = hamt_pair(e1, h1, key, h2
+				, shift + HAMT_BITS, edit, slot);
+		return n;
+	}
+
+	n = hamt_alloc< Entry >(2, 0, edit);
+	n->datamap = b1 | b2;
+	int i1(b1 < b2 ? 0 : 1);
+	new (&n->entries()[i1]) Entry(e1);
+	slot = new (&n->entries()[1 - i1]) Entry();
+	slot->key = key;
+	return n;
+}
+
+template < typename Entry >
+static HamtNode< Entry > * hamt_insert_collision(HamtNode< Entry > *n
+		, const qbrt_value &key, int shift, uint32_t edit
+		, Entry *&slot, bool &added)
+{
+	int count(n->datamap);
+	for (int i(0); i<count; ++i) {
+		if (qbrt_compare(n->entries()[i].key, key) == 0) {
+			n = hamt_editable(n, shift, edit, count, 0);
+			slot = &n->entries()[i];
+			added = false;
+			return n;
+		}
+	}
+	n = hamt_editable(n, shift, edit, count + 1, 0);
+	slot = new (&n->entries()[count]) Entry();
+	slot->key = key;
+	n->datamap = count + 1;
+	added = true;
+	return n;
+}
+
+/**
+ * Insert a key below the given node
+ * Return the node that replaces it, which is the same node if
+ * it was changed in place. slot is set to the key's entry.
+ */
+template < typename Entry >
+static HamtNode< Entry > * hamt_insert(HamtNode< Entry > *n
+		, const qbrt_value &key, uint32_t hash, int shift
+		, uint32_t edit, Entry *&slot, bool &added)
+{
+	if (hamt_collision(shift)) {
+		return hamt_insert_collision(n, key, shift, edit, slot, added);
+	}
+
+	int entries(__builtin_popcount(n->datamap));
+	int children(__builtin_popcount(n->nodemap));
+	uint32_t bit(hamt_bit(hash, shift));
+	if (n->nodemap & bit) {
+		int ci(hamt_index(n->nodemap, bit));
+		HamtNode< Entry > *child(n->children()[ci]);
+		HamtNode< Entry > *newchild(hamt_insert(child, key, hash
+					, shift + HAMT_BITS, edit, slot, added));
+		if (newchild == child) {
+			return n;
+		}
+		n = hamt_editable(n, shift, edit, entries, children);
+		n->children()[ci] = newchild;
+		return n;
+	}
+
+	int ei(hamt_index(n->datamap, bit));
+	if (!(n->datamap & bit)) {
+		n = hamt_editable(n, shift, edit, entries + 1, children);
+		Entry *e(n->entries());
+		// moving entries along a node doesn't copy them, the slot
+		// they leave is constructed again
+		memmove((void *) &e[ei + 1], &e[ei]
+				, (entries - ei) * sizeof(Entry));
+		slot = new (&e[ei]) Entry();
+		slot->key = key;
+		n->datamap |= bit;
+		added = true;
+		return n;
+	}
+
+	if (qbrt_compare(n->entries()[ei].key, key) == 0) {
+		n = hamt_editable(n, shift, edit, entries, children);
+		slot = &n->entries()[ei];
+		added = false;
+		return n;
+	}
+
+	// two keys share this bit, push both down into a new child
+	const Entry &existing(n->entries()[ei]);
+	HamtNode< Entry > *child(hamt_pair(existing, qbrt_hash(existing.key)
+				, key, hash, shift + HAMT_BITS, edit, slot));
+	n = hamt_editable(n, shift, edit, entries, children + 1);
+	Entry *e(n->entries());
+	e[ei].~Entry();
+	memmove((void *) &e[ei], &e[ei + 1]
+			, (entries - ei - 1) * sizeof(Entry));
+	int ci(hamt_index(n->nodemap, bit));
+	HamtNode< Entry > **c(n->children());
+	memmove(&c[ci + 1], &c[ci], (children - ci) * sizeof(*c));
+	c[ci] = child;
+	n->datamap &= ~bit;
+	n->nodemap |= bit;
+	added = true;
+	return n;
+}
+
+template < typename Entry >
+const Entry * Hamt< Entry >::find(const qbrt_value &key) const
+{
+	uint32_t hash(qbrt_hash(key));
+	const HamtNode< Entry > *n(root);
+	for (int shift(0); n; shift += HAMT_BITS) {
+		if (hamt_collision(shift)) {
+			for (uint32_t i(0); i<n->datamap; ++i) {
+				const Entry &e(n->entries()[i]);
+				if (qbrt_compare(e.key, key) == 0) {
+					return &e;
+				}
+			}
+			return NULL;
+		}
+		uint32_t bit(hamt_bit(hash, shift));
+		if (n->datamap & bit) {
+			const Entry &e(n->entries()[hamt_index(n->datamap, bit)]);
+			return qbrt_compare(e.key, key) == 0 ? &e : NULL;
+		}
+		if (!(n->nodemap & bit)) {
+			return NULL;
+		}
+		n = n->children()[hamt_index(n->nodemap, bit)];
+	}
+	return NULL;
+}
+
+template < typename Entry >
+Entry & Hamt< Entry >::insert(const qbrt_value &key)
+{
+	uint32_t hash(qbrt_hash(key));
+	Entry *slot;
+	if (!root) {
+		root = hamt_alloc< Entry >(1, 0, edit);
+		root->datamap = hamt_bit(hash, 0);
+		slot = new (root->entries()) Entry();
+		slot->key = key;
+		++count;
+		return *slot;
+	}
+
+	bool added(false);
+	root = hamt_insert(root, key, hash, 0, edit, slot, added);
+	if (added) {
+		++count;
+	}
+	return *slot;
+}
+
+static uint32_t g_next_edit = 0;
+
+template < typename Entry >
+void Hamt< Entry >::transient()
+{
+	edit = __sync_add_and_fetch(&g_next_edit, 1);
+}
+
+template struct Hamt< MapEntry >;
+template struct Hamt< SetEntry >;
+
+
+Map * Map::insert(const Map &m, const qbrt_value &key, const qbrt_value &v)
+{
+	Map *result(new Map(m));
+	result->trie.edit = 0;
+	result->insert_in_place(key, v);
+	return result;
+}
+
+Map * Map::transient(const Map &m)
+{
+	Map *result(new Map(m));
+	result->trie.transient();
+	return result;
+}
+
+Set * Set::insert(const Set &s, const qbrt_value &key)
+{
+	Set *result(new Set(s));
+	result->trie.edit = 0;
+	result->insert_in_place(key);
+	return result;
+}
+
+Set * Set::transient(const Set &s)
+{
+	Set *result(new Set(s));
+	result->trie.transient();
+	return result;
+}
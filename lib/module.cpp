@@ -358,31 +358,36 @@ const QbrtFunction * Module::fetch_override(const string &protomod
 
 const Type * indexed_datatype(const Module &mod, uint16_t idx)
 {
-	map< uint16_t, const Type * >::const_iterator it;
-	it = mod.indexed_type_cache.find(idx);
-	if (it != mod.indexed_type_cache.end()) {
-		return it->second;
-	}
-
-	const DataTypeResource *dtr;
-	dtr = mod.resource.ptr< DataTypeResource >(idx);
-	if (!dtr) {
-		cerr << "DataTypeResource not found at: " << idx << endl;
-		return NULL;
+	// create the type under the lock, like qbrt_function, so
+	// every worker gets the same Type for the index
+	mod.lock_cache();
+	const Type *&t(mod.indexed_type_cache[idx]);
+	if (!t) {
+		const DataTypeResource *dtr;
+		dtr = mod.resource.ptr< DataTypeResource >(idx);
+		if (!dtr) {
+			mod.indexed_type_cache.erase(idx);
+			mod.unlock_cache();
+			cerr << "DataTypeResource not found at: " << idx << endl;
+			return NULL;
+		}
+		const char *name = fetch_string(mod.resource, dtr->name_idx);
+		t = new Type(mod.name, name, dtr->argc);
 	}
-	const char *name = fetch_string(mod.resource, dtr->name_idx);
-	const Type *t = new Type(mod.name, name, dtr->argc);
-	mod.indexed_type_cache[idx] = t;
-	return t;
+	const Type *result(t);
+	mod.unlock_cache();
+	return result;
 }
 
 const QbrtFunction * Module::qbrt_function(const FunctionHeader *f) const
 {
+	lock_cache();
 	const QbrtFunction *result = function_cache[f];
 	if (!result) {
 		result = new QbrtFunction(f, this);
 		function_cache[f] = result;
 	}
+	unlock_cache();
 	return result;
 }
 
@@ -458,6 +463,9 @@ Module * read_module(const string &objname)
 		cerr << "module name mismatch: " << header_name
 			<< " != " << objname & DIE;
 	}
+	load_nullary_constructs(*mod);
+	load_string_constants(*mod);
+	load_hashtag_atoms(*mod);
 
 	return mod;
 }
@@ -525,8 +533,77 @@ void Module::load_construct(qbrt_value &dst, const Module &m, const char *name)
 	const ConstructResource *construct_r;
 	construct_r = find_construct(m, name);
 
+	if (construct_r->fld_count == 0) {
+		map< const ConstructResource *, qbrt_value >::const_iterator it;
+		it = m.nullary_construct.find(construct_r);
+		if (it != m.nullary_construct.end()) {
+			dst = it->second;
+			return;
+		}
+	}
+
 	const Type *typ = indexed_datatype(m, construct_r->datatype_idx);
 
-	Construct *cons = new Construct(m, *construct_r);
+	Construct *cons = Construct::create(m, *construct_r);
 	qbrt_value::construct(dst, typ, cons);
 }
+
+/**
+ * Create string values for the module's string resources that point
+ * directly at the module data, so loading a constant doesn't copy it
+ */
+void load_string_constants(Module &m)
+{
+	const ResourceTable &tbl(m.resource);
+	m.string_constants.resize(tbl.resource_count, NULL);
+	for (uint16_t i(1); i<tbl.resource_count; ++i) {
+		if (tbl.type(i) != RESOURCE_STRING) {
+			continue;
+		}
+		const StringResource *s(tbl.ptr< StringResource >(i));
+		// bytes includes the null terminator
+		const String *str(String::literal(s->value, s->bytes - 1));
+		// the module holds its constants for as long as it's loaded
+		String::retain(str);
+		m.string_constants[i] = str;
+	}
+}
+
+/**
+ * Intern the module's hashtags when it's read so hashtag values
+ * can be loaded and compared without touching the strings
+ */
+void load_hashtag_atoms(Module &m)
+{
+	const ResourceTable &tbl(m.resource);
+	m.hashtag_atoms.resize(tbl.resource_count, 0);
+	for (uint16_t i(1); i<tbl.resource_count; ++i) {
+		if (tbl.type(i) != RESOURCE_HASHTAG) {
+			continue;
+		}
+		const HashTagResource *h(tbl.ptr< HashTagResource >(i));
+		m.hashtag_atoms[i] = atom(h->value, h->length);
+	}
+}
+
+/**
+ * Create the shared instance of each construct that has no fields.
+ * Run once when the module is read, so the map is never modified
+ * after the module becomes visible to other workers.
+ */
+void load_nullary_constructs(Module &m)
+{
+	const ResourceTable &tbl(m.resource);
+	for (uint16_t i(1); i<tbl.resource_count; ++i) {
+		if (tbl.type(i) != RESOURCE_CONSTRUCT) {
+			continue;
+		}
+		const ConstructResource *cr(tbl.ptr< ConstructResource >(i));
+		if (cr->fld_count != 0) {
+			continue;
+		}
+		const Type *typ = indexed_datatype(m, cr->datatype_idx);
+		qbrt_value &val(m.nullary_construct[cr]);
+		qbrt_value::construct(val, typ, Construct::create(m, *cr));
+	}
+}
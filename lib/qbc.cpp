@@ -26,6 +26,11 @@ Stmt::List *parsed_stmts;
 uint16_t AsmResource::NULL_INDEX = 0;
 string g_parse_module;
 
+/** Constructs compiled so far, indexed by module/Construct */
+static map< string, const AsmConstruct * > g_construct;
+/** Modules loaded as imports */
+static const ModuleMap *g_imported = NULL;
+
 typedef std::list< ResourceInfo > ResourceIndex;
 
 struct ObjectBuilder
@@ -375,10 +380,29 @@ void RegAlloc::alloc_dst(AsmReg &reg, const string &type)
 	CountMap::const_iterator it(registry.find(reg.name));
 	if (it != registry.end()) {
 		reg.idx = it->second;
+	} else {
+		reg.idx = counter++;
+		registry[reg.name] = reg.idx;
+	}
+	set_type(reg, type);
+}
+
+/**
+ * Remember the type of a value written to a register
+ * Types only stick when every write to the register agrees
+ */
+void RegAlloc::set_type(const AsmReg &reg, const string &type)
+{
+	if (reg.ext >= 0 || reg.specialid || reg.idx < argc) {
+		// only track whole, non-arg registers
 		return;
 	}
-	reg.idx = counter++;
-	registry[reg.name] = reg.idx;
+	TypeMap::iterator it(regtype.find(reg.name));
+	if (it == regtype.end()) {
+		regtype[reg.name] = type;
+	} else if (it->second != type) {
+		it->second.clear();
+	}
 }
 
 
@@ -591,6 +615,8 @@ void measure_jump_bytes(codeblock &code)
 			case OP_IFNOTFAIL:
 			case OP_MATCH:
 			case OP_MATCHARGS:
+			case OP_SWITCH:
+			case OP_CASE:
 			case OP_FORK:
 				count_jump_bytes(it);
 				break;
@@ -979,6 +1005,9 @@ ostream & operator << (ostream &out, const Token &t)
 		case TOKEN_INT:
 			out << "INT";
 			break;
+		case TOKEN_FLOAT:
+			out << "FLOAT";
+			break;
 		case TOKEN_LABEL:
 			out << "LABEL";
 			break;
@@ -1064,36 +1093,6 @@ void print_tokens(ostream &out, const list< vector< Token * > > &file)
 	}
 }
 
-struct ClistStatement
-{
-	ClistStatement(uint16_t dst)
-		: dst(dst)
-	{}
-
-	uint16_t dst;
-
-	void pretty(ostream &out) const
-	{
-		out << "clist " << dst;
-	}
-};
-
-struct ConsStatement
-{
-	ConsStatement(uint16_t head, uint16_t item)
-		: head(head)
-		, item(item)
-	{}
-
-	uint16_t head;
-	uint16_t item;
-
-	void pretty(ostream &out) const
-	{
-		out << "cons " << head <<" "<< item;
-	}
-};
-
 /**
  * wtf is this function trying to do?
  * I think it's trying to assign protocol info for functions
@@ -1247,6 +1246,55 @@ void print_resources(const ResourceSet &rs)
 	}
 }
 
+void index_constructs(const string &modname, const ResourceSet &rs)
+{
+	ResourceSet::const_iterator it(rs.begin());
+	for (; it!=rs.end(); ++it) {
+		if (it->first->type != RESOURCE_CONSTRUCT) {
+			continue;
+		}
+		const AsmConstruct *c(static_cast< AsmConstruct * >(it->first));
+		g_construct[modname +"/"+ c->name.value] = c;
+	}
+}
+
+int16_t construct_field_index(const string &modsym, const string &field)
+{
+	map< string, const AsmConstruct * >::const_iterator local;
+	local = g_construct.find(modsym);
+	if (local != g_construct.end()) {
+		AsmParamList::const_iterator it(local->second->fields.begin());
+		for (int16_t i(0); it!=local->second->fields.end(); ++it, ++i) {
+			if ((*it)->name.value == field) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	string::size_type slash(modsym.rfind('/'));
+	if (!g_imported || slash == string::npos) {
+		return -1;
+	}
+	ModuleMap::const_iterator mod;
+	mod = g_imported->find(modsym.substr(0, slash));
+	if (mod == g_imported->end() || !mod->second) {
+		return -1;
+	}
+	const ConstructResource *cons;
+	cons = find_construct(*mod->second, modsym.substr(slash + 1));
+	if (!cons) {
+		return -1;
+	}
+	const ResourceTable &res(mod->second->resource);
+	for (int16_t i(0); i<cons->fld_count; ++i) {
+		if (field == fetch_string(res, cons->fields[i].name_idx)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
 void generate_codeblock(AsmFunc &func, const Stmt::List &stmts)
 {
 	Stmt::List::const_iterator it(stmts.begin());
@@ -1297,8 +1345,8 @@ void load_imported_modules(ModuleMap &modmap, const set< string > &modnames)
 			if (!mod) {
 				cerr << "could not load module: "<< (*it) & DIE;
 			}
-			modmap[*it] = mod;
 		}
+		modmap[*it] = mod;
 	}
 }
 
@@ -1335,6 +1383,8 @@ bool compile_module(ModuleMap &modmap, const string &module_name)
 	obj.header.imports = obj.rs.imports_index();
 
 	load_imported_modules(modmap, obj.rs.imported_modules());
+	index_constructs(module_name, obj.rs);
+	g_imported = &modmap;
 
 	allocate_registers(*stmts, NULL);
 	cout << "---\n";
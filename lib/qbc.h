@@ -15,8 +15,14 @@ struct AsmDataType;
 struct RegAlloc
 {
 	typedef std::map< std::string, uint8_t > CountMap;
+	typedef std::map< std::string, std::string > TypeMap;
 
 	CountMap registry;
+	/**
+	 * The type written to each register, or an empty string
+	 * if the register is written with different or unknown types
+	 */
+	TypeMap regtype;
 	const uint8_t argc;
 	uint8_t counter;
 
@@ -27,6 +33,7 @@ struct RegAlloc
 	void declare_arg(const std::string &name, const std::string &type);
 	void assign_src(AsmReg &);
 	void alloc_dst(AsmReg &, const std::string &type = std::string());
+	void set_type(const AsmReg &, const std::string &type);
 };
 
 
@@ -321,6 +328,7 @@ struct AsmFunc
 	const AsmTypeSpec &result_type;
 	const AsmString &name;
 	AsmString doc;
+	RegAlloc::TypeMap regtype;
 	uint16_t line_no;
 	uint8_t fcontext;
 	uint8_t argc;
@@ -342,6 +350,13 @@ struct DeclList
 void set_function_context(Stmt::List &, uint8_t asmfc, AsmResource *);
 void allocate_registers(Stmt::List &, RegAlloc *);
 
+/**
+ * Find the index of a field in the given construct at compile time
+ * Return -1 if the construct or field is unknown
+ */
+int16_t construct_field_index(const std::string &modsym
+		, const std::string &field);
+
 void label_next(AsmFunc &, const std::string &lbl);
 void asm_jump(AsmFunc &, const std::string &lbl, jump_instruction *);
 void asm_instruction(AsmFunc &, instruction *);
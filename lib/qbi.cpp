@@ -8,6 +8,7 @@
 #include "instruction/schedule.h"
 #include "instruction/string.h"
 #include "instruction/type.h"
+#include "instruction/vector.h"
 #include <vector>
 #include <map>
 #include <stdio.h>
@@ -61,6 +62,36 @@ uint8_t print_binaryop_instruction(const binaryop_instruction &i)
 		case OP_IDIV:
 			opcode = "idiv";
 			break;
+		case OP_IMOD:
+			opcode = "imod";
+			break;
+		case OP_IAND:
+			opcode = "iand";
+			break;
+		case OP_IOR:
+			opcode = "ior";
+			break;
+		case OP_IXOR:
+			opcode = "ixor";
+			break;
+		case OP_ISHL:
+			opcode = "ishl";
+			break;
+		case OP_ISHR:
+			opcode = "ishr";
+			break;
+		case OP_FADD:
+			opcode = "fadd";
+			break;
+		case OP_FSUB:
+			opcode = "fsub";
+			break;
+		case OP_FMULT:
+			opcode = "fmult";
+			break;
+		case OP_FDIV:
+			opcode = "fdiv";
+			break;
 	}
 	cout << opcode;
 	print_register(i.result);
@@ -111,6 +142,39 @@ uint8_t print_match_instruction(const match_instruction &i)
 	return match_instruction::SIZE;
 }
 
+uint8_t print_switch_instruction(const switch_instruction &i)
+{
+	cout << "switch";
+	print_register(i.input);
+	cout << ' ';
+	print_jump_delta(i.jump_data);
+	cout << endl;
+	return switch_instruction::SIZE;
+}
+
+uint8_t print_case_instruction(const case_instruction &i)
+{
+	cout << "case ";
+	switch (i.kind) {
+		case CASE_INT:
+			cout << (int16_t) i.key;
+			break;
+		case CASE_BOOL:
+			cout << (i.key ? "true" : "false");
+			break;
+		case CASE_HASHTAG:
+			cout << "hashtag:" << i.key;
+			break;
+		case CASE_CONSTRUCT:
+			cout << "construct:" << i.key;
+			break;
+	}
+	cout << ' ';
+	print_jump_delta(i.jump_data);
+	cout << endl;
+	return case_instruction::SIZE;
+}
+
 uint8_t print_matchargs_instruction(const matchargs_instruction &i)
 {
 	cout << "matchargs";
@@ -148,6 +212,59 @@ uint8_t print_stracc_instruction(const stracc_instruction &i)
 	return stracc_instruction::SIZE;
 }
 
+uint8_t print_clist_instruction(const clist_instruction &i)
+{
+	cout << "clist " << pretty_reg(i.dst) << endl;
+	return clist_instruction::SIZE;
+}
+
+uint8_t print_cons_instruction(const cons_instruction &i)
+{
+	cout << "cons";
+	print_register(i.head);
+	print_register(i.item);
+	cout << endl;
+	return cons_instruction::SIZE;
+}
+
+uint8_t print_vget_instruction(const vget_instruction &i)
+{
+	cout << "vget";
+	print_register(i.dst);
+	print_register(i.src);
+	print_register(i.idx);
+	cout << endl;
+	return vget_instruction::SIZE;
+}
+
+uint8_t print_vset_instruction(const vset_instruction &i)
+{
+	cout << "vset";
+	print_register(i.dst);
+	print_register(i.idx);
+	print_register(i.src);
+	cout << endl;
+	return vset_instruction::SIZE;
+}
+
+uint8_t print_vpush_instruction(const vpush_instruction &i)
+{
+	cout << "vpush";
+	print_register(i.dst);
+	print_register(i.src);
+	cout << endl;
+	return vpush_instruction::SIZE;
+}
+
+uint8_t print_vlen_instruction(const vlen_instruction &i)
+{
+	cout << "vlen";
+	print_register(i.dst);
+	print_register(i.src);
+	cout << endl;
+	return vlen_instruction::SIZE;
+}
+
 uint8_t print_loadobj_instruction(const loadobj_instruction &i)
 {
 	cout << "loadobj";
@@ -238,6 +355,23 @@ uint8_t print_consti_instruction(const consti_instruction &i)
 	return consti_instruction::SIZE;
 }
 
+uint8_t print_constf_instruction(const constf_instruction &i)
+{
+	cout << "constf";
+	print_register(i.reg);
+	cout << " " << i.value << endl;
+	return constf_instruction::SIZE;
+}
+
+uint8_t print_convert_instruction(const convert_instruction &i)
+{
+	cout << (i.opcode() == OP_ITOF ? "itof" : "ftoi");
+	print_register(i.dst);
+	print_register(i.src);
+	cout << endl;
+	return convert_instruction::SIZE;
+}
+
 uint8_t print_ctuple_instruction(const ctuple_instruction &i)
 {
 	cout << "ctuple";
@@ -327,6 +461,18 @@ void set_printers()
 	PRINTER[OP_IMULT] = (instruction_printer) print_binaryop_instruction;
 	PRINTER[OP_IDIV] = (instruction_printer) print_binaryop_instruction;
 	PRINTER[OP_ISUB] = (instruction_printer) print_binaryop_instruction;
+	PRINTER[OP_IMOD] = (instruction_printer) print_binaryop_instruction;
+	PRINTER[OP_IAND] = (instruction_printer) print_binaryop_instruction;
+	PRINTER[OP_IOR] = (instruction_printer) print_binaryop_instruction;
+	PRINTER[OP_IXOR] = (instruction_printer) print_binaryop_instruction;
+	PRINTER[OP_ISHL] = (instruction_printer) print_binaryop_instruction;
+	PRINTER[OP_ISHR] = (instruction_printer) print_binaryop_instruction;
+	PRINTER[OP_FADD] = (instruction_printer) print_binaryop_instruction;
+	PRINTER[OP_FSUB] = (instruction_printer) print_binaryop_instruction;
+	PRINTER[OP_FMULT] = (instruction_printer) print_binaryop_instruction;
+	PRINTER[OP_FDIV] = (instruction_printer) print_binaryop_instruction;
+	PRINTER[OP_ITOF] = (instruction_printer) print_convert_instruction;
+	PRINTER[OP_FTOI] = (instruction_printer) print_convert_instruction;
 	PRINTER[OP_LCONTEXT] = (instruction_printer) print_lcontext_instruction;
 	PRINTER[OP_LCONSTRUCT] =
 		(instruction_printer) print_lconstruct_instruction;
@@ -335,6 +481,8 @@ void set_printers()
 	PRINTER[OP_MATCH] = (instruction_printer) print_match_instruction;
 	PRINTER[OP_MATCHARGS] =
 		(instruction_printer) print_matchargs_instruction;
+	PRINTER[OP_SWITCH] = (instruction_printer) print_switch_instruction;
+	PRINTER[OP_CASE] = (instruction_printer) print_case_instruction;
 	PRINTER[OP_CONSTS] = (instruction_printer) print_consts_instruction;
 	PRINTER[OP_CONSTHASH] =
 		(instruction_printer) print_consthash_instruction;
@@ -344,6 +492,7 @@ void set_printers()
 	PRINTER[OP_REF] = (instruction_printer) print_ref_instruction;
 	PRINTER[OP_COPY] = (instruction_printer) print_copy_instruction;
 	PRINTER[OP_CONSTI] = (instruction_printer) print_consti_instruction;
+	PRINTER[OP_CONSTF] = (instruction_printer) print_constf_instruction;
 	PRINTER[OP_FORK] = (instruction_printer) print_fork_instruction;
 	PRINTER[OP_GOTO] = (instruction_printer) print_goto_instruction;
 	PRINTER[OP_IF] = (instruction_printer) print_if_instruction;
@@ -356,6 +505,12 @@ void set_printers()
 	PRINTER[OP_RECV] = (instruction_printer) print_recv_instruction;
 	PRINTER[OP_STRACC] = (instruction_printer) print_stracc_instruction;
 	PRINTER[OP_WAIT] = (instruction_printer) print_wait_instruction;
+	PRINTER[OP_CLIST] = (instruction_printer) print_clist_instruction;
+	PRINTER[OP_CONS] = (instruction_printer) print_cons_instruction;
+	PRINTER[OP_VGET] = (instruction_printer) print_vget_instruction;
+	PRINTER[OP_VLEN] = (instruction_printer) print_vlen_instruction;
+	PRINTER[OP_VPUSH] = (instruction_printer) print_vpush_instruction;
+	PRINTER[OP_VSET] = (instruction_printer) print_vset_instruction;
 }
 
 void print_function_header(const FunctionHeader &f, const ResourceTable &tbl)
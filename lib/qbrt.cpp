@@ -6,6 +6,9 @@
 #include "qbrt/tuple.h"
 #include "qbrt/map.h"
 #include "qbrt/vector.h"
+#include "qbrt/array.h"
+#include "qbrt/binary.h"
+#include "qbrt/switch.h"
 #include "qbrt/module.h"
 #include "io.h"
 #include "instruction/arithmetic.h"
@@ -13,17 +16,21 @@
 #include "instruction/schedule.h"
 #include "instruction/string.h"
 #include "instruction/type.h"
+#include "instruction/vector.h"
 
 #include <vector>
+#include <algorithm>
 #include <stack>
 #include <iostream>
 #include <sstream>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <signal.h>
 
 using namespace std;
 
@@ -56,8 +63,12 @@ void init_const_registers()
 	qbrt_value::fp(CONST_REGISTER[REG_FZERO], 0.0);
 	qbrt_value::str(CONST_REGISTER[REG_EMPTYSTR], "");
 	qbrt_value::str(CONST_REGISTER[REG_NEWLINE], "\n");
-	qbrt_value::list(CONST_REGISTER[REG_EMPTYLIST], NULL);
-	qbrt_value::vect(CONST_REGISTER[REG_EMPTYVECT], NULL);
+	// workers may still copy these while the registers are
+	// destroyed at exit, so they're never let go
+	String::retain(CONST_REGISTER[REG_EMPTYSTR].data.str);
+	String::retain(CONST_REGISTER[REG_NEWLINE].data.str);
+	// REG_EMPTYLIST is set once the list module is loaded
+	qbrt_value::vect(CONST_REGISTER[REG_EMPTYVECT], Vector::create());
 	CONST_REGISTER[REG_VOID] = qbrt_value();
 }
 
@@ -88,7 +99,7 @@ struct OpContext
 	virtual int & pc() const = 0;
 	virtual Worker & worker() const = 0;
 	virtual const ResourceTable & resource() const = 0;
-	virtual qbrt_value * get_context(const std::string &) = 0;
+	virtual const ContextTable * context() const = 0;
 	virtual void io(StreamIO *op) = 0;
 
 	void backtrace(Failure &f)
@@ -253,9 +264,9 @@ public:
 		return NULL;
 	}
 
-	qbrt_value * get_context(const std::string &name)
+	const ContextTable * context() const
 	{
-		return add_context(&frame, name);
+		return frame.context();
 	}
 
 	const ResourceTable & resource() const
@@ -367,9 +378,9 @@ public:
 		return NULL;
 	}
 
-	qbrt_value * get_context(const std::string &name)
+	const ContextTable * context() const
 	{
-		return add_context(&frame, name);
+		return frame.context();
 	}
 
 	const ResourceTable & resource() const
@@ -389,6 +400,30 @@ private:
 };
 
 
+/**
+ * Check that both operands have the primitive type the operation
+ * expects. Set a type failure in the result if they don't.
+ */
+static bool binaryop_types(OpContext &ctx, const qbrt_value &a
+		, const qbrt_value &b, uint8_t vt, qbrt_value &result)
+{
+	if (a.type->id == vt && b.type->id == vt) {
+		return true;
+	}
+	const char *kind = (vt == VT_FLOAT) ? "float" : "integer";
+	Failure *fail = FAIL_TYPE(ctx.module_name(), ctx.function_name()
+			, ctx.pc());
+	if (a.type->id != vt) {
+		fail->debug() << "unexpected type for first operand in "
+			<< kind << " binary operation: " << (int) a.type->id;
+	} else {
+		fail->debug() << "unexpected type for second operand in "
+			<< kind << " binary operation: " << (int) b.type->id;
+	}
+	qbrt_value::fail(result, fail);
+	return false;
+}
+
 void execute_binaryop(OpContext &ctx, const binaryop_instruction &i)
 {
 	const qbrt_value &a(*ctx.srcvalue(i.a));
@@ -396,81 +431,196 @@ void execute_binaryop(OpContext &ctx, const binaryop_instruction &i)
 	RETURN_FAILURE(ctx, i.a);
 	RETURN_FAILURE(ctx, i.b);
 
-	Failure *fail;
-	qbrt_value *result(ctx.dstvalue(i.result));
+	qbrt_value &result(*ctx.dstvalue(i.result));
+	uint8_t vt(VT_INT);
 	switch (i.opcode()) {
 		case OP_IADD:
 		case OP_ISUB:
 		case OP_IMULT:
-			if (a.type->id != VT_INT) {
-				fail = FAIL_TYPE(ctx.module_name(),
-						ctx.function_name(), ctx.pc());
-				fail->debug << "unexpected type for first "
-					" operand in integer binary operation: "
-					<< a.type->id;
-				qbrt_value::fail(*result, fail);
-				ctx.pc() += binaryop_instruction::SIZE;
-				return;
-			}
-			if (b.type->id != VT_INT) {
-				fail = FAIL_TYPE(ctx.module_name(),
-						ctx.function_name(), ctx.pc());
-				fail->debug << "unexpected type for second "
-					" operand in integer binary operation: "
-					<< b.type->id;
-				qbrt_value::fail(*result, fail);
-				ctx.pc() += binaryop_instruction::SIZE;
-				return;
-			}
+		case OP_IAND:
+		case OP_IOR:
+		case OP_IXOR:
+		case OP_ISHL:
+		case OP_ISHR:
+			break;
+		case OP_FADD:
+		case OP_FSUB:
+		case OP_FMULT:
+		case OP_FDIV:
+			vt = VT_FLOAT;
 			break;
 		default:
 			cerr << "how'd *that* happen?\n";
 			exit(1);
 	}
+	if (!binaryop_types(ctx, a, b, vt, result)) {
+		ctx.pc() += binaryop_instruction::SIZE;
+		return;
+	}
+
 	switch (i.opcode()) {
 		case OP_IADD:
-			qbrt_value::i(*result, a.data.i + b.data.i);
+			qbrt_value::i(result, a.data.i + b.data.i);
 			break;
 		case OP_ISUB:
-			qbrt_value::i(*result, a.data.i - b.data.i);
+			qbrt_value::i(result, a.data.i - b.data.i);
 			break;
 		case OP_IMULT:
-			qbrt_value::i(*result, a.data.i * b.data.i);
+			qbrt_value::i(result, a.data.i * b.data.i);
+			break;
+		case OP_IAND:
+			qbrt_value::i(result, a.data.i & b.data.i);
+			break;
+		case OP_IOR:
+			qbrt_value::i(result, a.data.i | b.data.i);
+			break;
+		case OP_IXOR:
+			qbrt_value::i(result, a.data.i ^ b.data.i);
+			break;
+		case OP_ISHL:
+		case OP_ISHR:
+			if (b.data.i < 0 || b.data.i > 63) {
+				Failure *f = NEW_FAILURE_ATOM(ATOM_BADSHIFT
+						, ctx.module_name()
+						, ctx.function_name(), ctx.pc());
+				f->debug() << "shift must be 0-63: "
+					<< b.data.i;
+				qbrt_value::fail(result, f);
+			} else if (i.opcode() == OP_ISHL) {
+				// shift unsigned so that overflow is defined
+				qbrt_value::i(result, (int64_t)
+						((uint64_t) a.data.i << b.data.i));
+			} else {
+				// right shift keeps the sign
+				qbrt_value::i(result, a.data.i >> b.data.i);
+			}
+			break;
+		case OP_FADD:
+			qbrt_value::fp(result, a.data.fp + b.data.fp);
+			break;
+		case OP_FSUB:
+			qbrt_value::fp(result, a.data.fp - b.data.fp);
+			break;
+		case OP_FMULT:
+			qbrt_value::fp(result, a.data.fp * b.data.fp);
+			break;
+		case OP_FDIV:
+			// ieee division, x/0.0 is inf or nan not a failure
+			qbrt_value::fp(result, a.data.fp / b.data.fp);
 			break;
 	}
 	ctx.pc() += binaryop_instruction::SIZE;
 }
 
+/** Integer divide and modulo, which can fail */
 void execute_divide(OpContext &ctx, const binaryop_instruction &i)
 {
+	const qbrt_value &a(*ctx.srcvalue(i.a));
 	const qbrt_value &b(*ctx.srcvalue(i.b));
+	RETURN_FAILURE(ctx, i.a);
+	RETURN_FAILURE(ctx, i.b);
+
 	qbrt_value &result(*ctx.dstvalue(i.result));
-	if (b.data.i == 0) {
-		qbrt_value::fail(result, NEW_FAILURE("divideby0"
+	if (!binaryop_types(ctx, a, b, VT_INT, result)) {
+		// failure already set
+	} else if (b.data.i == 0) {
+		qbrt_value::fail(result, NEW_FAILURE_ATOM(ATOM_DIVIDEBY0
+				, ctx.module_name(), ctx.function_name()
+				, ctx.pc()));
+	} else if (b.data.i == -1 && a.data.i == INT64_MIN) {
+		qbrt_value::fail(result, NEW_FAILURE_ATOM(ATOM_OVERFLOW
 				, ctx.module_name(), ctx.function_name()
 				, ctx.pc()));
+	} else if (i.opcode() == OP_IMOD) {
+		qbrt_value::i(result, a.data.i % b.data.i);
 	} else {
-		const qbrt_value &a(*ctx.srcvalue(i.a));
 		qbrt_value::i(result, a.data.i / b.data.i);
 	}
 	ctx.pc() += binaryop_instruction::SIZE;
 }
 
+/**
+ * Convert an int to a float or a float to an int. ftoi truncates
+ * toward zero and fails if the float is out of range or nan.
+ */
+void execute_convert(OpContext &ctx, const convert_instruction &i)
+{
+	RETURN_FAILURE(ctx, i.src);
+	const qbrt_value &src(*ctx.srcvalue(i.src));
+	qbrt_value &dst(*ctx.dstvalue(i.dst));
+	uint8_t vt(i.opcode() == OP_ITOF ? VT_INT : VT_FLOAT);
+	Failure *f;
+	if (src.type->id != vt) {
+		f = FAIL_TYPE(ctx.module_name(), ctx.function_name()
+				, ctx.pc());
+		f->debug() << "unexpected type for conversion: "
+			<< (int) src.type->id;
+		qbrt_value::fail(dst, f);
+	} else if (i.opcode() == OP_ITOF) {
+		qbrt_value::fp(dst, (double) src.data.i);
+	} else if (src.data.fp >= -9223372036854775808.0
+			&& src.data.fp < 9223372036854775808.0) {
+		qbrt_value::i(dst, (int64_t) src.data.fp);
+	} else {
+		f = NEW_FAILURE_ATOM(ATOM_OVERFLOW, ctx.module_name()
+				, ctx.function_name(), ctx.pc());
+		f->debug() << "float out of int range: " << src.data.fp;
+		qbrt_value::fail(dst, f);
+	}
+	ctx.pc() += convert_instruction::SIZE;
+}
+
+/**
+ * Find the index of a field in a value. Construct field indexes
+ * are cached by instruction so repeated access avoids the name lookup.
+ */
+static int16_t field_index(OpContext &ctx, const instruction &op
+		, const qbrt_value &val, uint16_t field_name)
+{
+	const ResourceTable &resource(ctx.resource());
+	if (val.type->id != VT_CONSTRUCT && val.type->id != VT_LIST) {
+		return val.get_field_index(fetch_string(resource, field_name));
+	}
+
+	const ConstructResource *cons(&val.data.cons->resource);
+	uintptr_t slot(((uintptr_t) &op) % FIELD_CACHE_SIZE);
+	FieldCache &cache(ctx.worker().field_cache[slot]);
+	if (cache.op == &op && cache.construct == cons) {
+		return cache.index;
+	}
+
+	int16_t fldidx(val.get_field_index(fetch_string(resource, field_name)));
+	if (fldidx >= 0) {
+		cache.op = &op;
+		cache.construct = cons;
+		cache.index = fldidx;
+	}
+	return fldidx;
+}
+
+static Failure * field404(OpContext &ctx, const qbrt_value &val
+		, uint16_t field_name)
+{
+	Failure *f = NEW_FAILURE_ATOM(ATOM_FIELD404, ctx.module_name()
+			, ctx.function_name(), ctx.pc());
+	f->debug() << "could not retrieve field named: "
+		<< fetch_string(ctx.resource(), field_name) << " from ";
+	qbrt_value::append_type(f->debug(), val);
+	return f;
+}
+
 void execute_fieldget(OpContext &ctx, const fieldget_instruction &i)
 {
 	const qbrt_value *src(ctx.srcvalue(i.src));
 	qbrt_value *dst(ctx.dstvalue(i.dst));
 
-	const ResourceTable &resource(ctx.resource());
-	const char *field_name = fetch_string(resource, i.field_name);
-
-	int16_t fldidx(src->get_field_index(field_name));
+	int16_t fldidx(field_index(ctx, i, *src, i.field_name));
 	if (fldidx < 0) {
-		cerr << "could not retrieve field named: " << field_name <<endl;
-		exit(1);
+		qbrt_value::fail(*dst, field404(ctx, *src, i.field_name));
+		// continue on with execution
+	} else {
+		qbrt_value::copy(*dst, src->data.reg->value(fldidx));
 	}
-
-	qbrt_value::copy(*dst, src->data.reg->value(fldidx));
 	ctx.pc() += fieldget_instruction::SIZE;
 }
 
@@ -479,12 +629,10 @@ void execute_fieldset(OpContext &ctx, const fieldset_instruction &i)
 	const qbrt_value *src(ctx.srcvalue(i.src));
 	qbrt_value *dst(ctx.dstvalue(i.dst));
 
-	const ResourceTable &resource(ctx.resource());
-	const char *field_name = fetch_string(resource, i.field_name);
-	int16_t fldidx(src->get_field_index(field_name));
+	int16_t fldidx(field_index(ctx, i, *dst, i.field_name));
 	if (fldidx < 0) {
-		cerr << "could not retrieve field named: " << field_name <<endl;
-		exit(1);
+		ctx.fail_frame(field404(ctx, *dst, i.field_name));
+		return;
 	}
 
 	qbrt_value::copy(dst->data.reg->value(fldidx), *src);
@@ -545,7 +693,7 @@ bool equal_value(const qbrt_value &a, const qbrt_value &b)
 		case VT_INT:
 			return a.data.i == b.data.i;
 		case VT_HASHTAG:
-			return *a.data.hashtag == *b.data.hashtag;
+			return a.data.hashtag == b.data.hashtag;
 		case VT_LIST:
 		case VT_CONSTRUCT:
 			return *a.data.cons == *b.data.cons;
@@ -575,15 +723,36 @@ void execute_iffail(OpContext &ctx, const iffail_instruction &i)
 
 void execute_cfailure(OpContext &ctx, const cfailure_instruction &i)
 {
-	const char *failtype = fetch_string(ctx.resource(), i.hashtag_id);
+	const Module *mod(current_module(ctx.worker()));
 	qbrt_value &result(*ctx.dstvalue(i.dst));
-	Failure *f = NEW_FAILURE(failtype, ctx.module_name()
+	Failure *f = NEW_FAILURE_ATOM(mod->hashtag_atom(i.hashtag_id)
+			, ctx.module_name()
 			, ctx.function_name(), ctx.pc());
 	ctx.backtrace(*f);
 	qbrt_value::fail(result, f);
 	ctx.pc() += cfailure_instruction::SIZE;
 }
 
+template < typename T >
+static inline bool cmp_primitive(uint8_t op, T a, T b)
+{
+	switch (op) {
+		case OP_CMP_EQ:
+			return a == b;
+		case OP_CMP_NOTEQ:
+			return a != b;
+		case OP_CMP_GT:
+			return a > b;
+		case OP_CMP_GTEQ:
+			return a >= b;
+		case OP_CMP_LT:
+			return a < b;
+		case OP_CMP_LTEQ:
+			return a <= b;
+	}
+	return false;
+}
+
 void execute_cmp(OpContext &ctx, const cmp_instruction &i)
 {
 	RETURN_FAILURE(ctx, i.a);
@@ -600,8 +769,21 @@ void execute_cmp(OpContext &ctx, const cmp_instruction &i)
 		return;
 	}
 
+	// compare unboxed ints and floats directly
+	if (a.type->id == VT_INT && b.type->id == VT_INT) {
+		qbrt_value::b(*dst, cmp_primitive(i.opcode()
+					, a.data.i, b.data.i));
+		ctx.pc() += cmp_instruction::SIZE;
+		return;
+	}
+	if (a.type->id == VT_FLOAT && b.type->id == VT_FLOAT) {
+		qbrt_value::b(*dst, cmp_primitive(i.opcode()
+					, a.data.fp, b.data.fp));
+		ctx.pc() += cmp_instruction::SIZE;
+		return;
+	}
+
 	int comparison(qbrt_compare(a, b));
-	bool result;
 	switch (i.opcode()) {
 		case OP_CMP_EQ:
 			qbrt_value::b(*dst, comparison == 0);
@@ -619,11 +801,11 @@ void execute_cmp(OpContext &ctx, const cmp_instruction &i)
 			qbrt_value::b(*dst, comparison < 0);
 			break;
 		case OP_CMP_LTEQ:
-			qbrt_value::b(*dst, comparison >= 0);
+			qbrt_value::b(*dst, comparison <= 0);
 			break;
 		default:
-			f = NEW_FAILURE("invalidcmpop", ctx.module_name()
-					, ctx.function_name()
+			f = NEW_FAILURE_ATOM(ATOM_INVALIDCMPOP
+					, ctx.module_name(), ctx.function_name()
 					, ctx.pc());
 			ctx.backtrace(*f);
 			ctx.fail_frame(f);
@@ -646,6 +828,18 @@ void execute_consti(OpContext &ctx, const consti_instruction &i)
 	ctx.pc() += consti_instruction::SIZE;
 }
 
+void execute_constf(OpContext &ctx, const constf_instruction &i)
+{
+	qbrt_value *dst = ctx.dstvalue(i.reg);
+	if (!dst) {
+		ctx.fail_frame(FAIL_REGISTER404(ctx.module_name()
+					, ctx.function_name(), ctx.pc()));
+		return;
+	}
+	qbrt_value::fp(*dst, i.value);
+	ctx.pc() += constf_instruction::SIZE;
+}
+
 void execute_move(OpContext &ctx, const move_instruction &i)
 {
 	qbrt_value &dst(*ctx.dstvalue(i.dst));
@@ -678,22 +872,23 @@ void execute_consts(OpContext &ctx, const consts_instruction &i)
 {
 	RETURN_FAILURE(ctx, i.reg);
 
-	const char *str = fetch_string(ctx.resource(), i.string_id);
 	qbrt_value *dst = ctx.dstvalue(i.reg);
 	if (!dst) {
 		Failure *f = FAIL_REGISTER404(ctx.module_name()
 				, ctx.function_name(), ctx.pc());
-		f->debug << "invalid register: " << i.reg;
+		f->debug() << "invalid register: " << i.reg;
 		ctx.fail_frame(f);
 		return;
 	}
-	qbrt_value::str(*dst, str);
+	const Module *mod(current_module(ctx.worker()));
+	qbrt_value::str(*dst, mod->string_constant(i.string_id));
 	ctx.pc() += consts_instruction::SIZE;
 }
 
 void execute_consthash(OpContext &ctx, const consthash_instruction &i)
 {
-	const char *hash = fetch_string(ctx.resource(), i.hash_id);
+	const Module *mod(current_module(ctx.worker()));
+	Atom hash(mod->hashtag_atom(i.hash_id));
 	qbrt_value::hashtag(*ctx.dstvalue(i.reg), hash);
 	ctx.pc() += consthash_instruction::SIZE;
 }
@@ -704,36 +899,65 @@ void execute_ctuple(OpContext &ctx, const ctuple_instruction &i)
 	if (!dst) {
 		Failure *f = FAIL_REGISTER404(ctx.module_name()
 				, ctx.function_name(), ctx.pc());
-		f->debug << "invalid register: " << i.dst;
+		f->debug() << "invalid register: " << i.dst;
 		ctx.fail_frame(f);
 		cerr << f->debug_msg() << endl;
 		return;
 	}
 
-	qbrt_value::tuple(*dst, new Tuple(i.size));
+	qbrt_value::tuple(*dst, Tuple::create(i.size));
 	ctx.pc() += ctuple_instruction::SIZE;
 }
 
+/**
+ * Find a context variable for an lcontext instruction. Results are
+ * cached by instruction and context table, tables never change.
+ */
+static qbrt_value * find_context(OpContext &ctx, const instruction &op
+		, Atom name)
+{
+	const ContextTable *tbl(ctx.context());
+	if (!tbl) {
+		return NULL;
+	}
+
+	uintptr_t slot(((uintptr_t) &op) % CONTEXT_CACHE_SIZE);
+	ContextCache &cache(ctx.worker().context_cache[slot]);
+	if (cache.op == &op && cache.table == tbl) {
+		return cache.value;
+	}
+
+	qbrt_value *val(tbl->find(name));
+	if (val) {
+		cache.op = &op;
+		cache.table = tbl;
+		cache.value = val;
+	}
+	return val;
+}
+
 void execute_lcontext(OpContext &ctx, const lcontext_instruction &i)
 {
-	const char *name = fetch_string(ctx.resource(), i.hashtag);
 	qbrt_value *dst(ctx.dstvalue(i.reg));
 	Failure *fail;
 	if (!dst) {
 		fail = FAIL_REGISTER404(ctx.module_name()
 				, ctx.function_name(), ctx.pc());
-		fail->debug << "invalid register: " << i.reg;
+		fail->debug() << "invalid register: " << i.reg;
 		ctx.fail_frame(fail);
 		return;
 	}
 
-	qbrt_value *src = ctx.get_context(name);
+	const Module *mod(current_module(ctx.worker()));
+	Atom name(mod->hashtag_atom(i.hashtag));
+	qbrt_value *src(find_context(ctx, i, name));
 	if (src) {
 		qbrt_value::ref(*dst, *src);
 	} else {
-		fail = NEW_FAILURE("unknown_context", ctx.module_name()
+		fail = NEW_FAILURE_ATOM(ATOM_UNKNOWN_CONTEXT, ctx.module_name()
 				, ctx.function_name(), ctx.pc());
-		fail->debug << "cannot find context variable: " << name;
+		fail->debug() << "cannot find context variable: "
+			<< atom_name(name);
 		qbrt_value::fail(*dst, fail);
 		cerr << fail->debug_msg() << endl;
 	}
@@ -741,6 +965,31 @@ void execute_lcontext(OpContext &ctx, const lcontext_instruction &i)
 	ctx.pc() += lcontext_instruction::SIZE;
 }
 
+void execute_clist(OpContext &ctx, const clist_instruction &i)
+{
+	List::empty(*ctx.dstvalue(i.dst));
+	ctx.pc() += clist_instruction::SIZE;
+}
+
+/** Replace the list in head with a new node for item in front of it */
+void execute_cons(OpContext &ctx, const cons_instruction &i)
+{
+	RETURN_FAILURE(ctx, i.head);
+
+	qbrt_value &head(*ctx.dstvalue(i.head));
+	const qbrt_value &item(*ctx.srcvalue(i.item));
+	if (head.type->id != VT_LIST) {
+		Failure *f = FAIL_TYPE(ctx.module_name(), ctx.function_name()
+				, ctx.pc());
+		f->debug() << "cons expected a list, found ";
+		qbrt_value::append_type(f->debug(), head);
+		ctx.fail_frame(f);
+		return;
+	}
+	List::push(head, item);
+	ctx.pc() += cons_instruction::SIZE;
+}
+
 void execute_lconstruct(OpContext &ctx, const lconstruct_instruction &i)
 {
 	const ResourceTable &resource(ctx.resource());
@@ -754,7 +1003,7 @@ void execute_lconstruct(OpContext &ctx, const lconstruct_instruction &i)
 	if (!dst) {
 		fail = FAIL_REGISTER404(ctx.module_name(), ctx.function_name()
 				, ctx.pc());
-		fail->debug << "invalid register: " << i.reg;
+		fail->debug() << "invalid register: " << i.reg;
 		ctx.fail_frame(fail);
 		return;
 	}
@@ -764,7 +1013,7 @@ void execute_lconstruct(OpContext &ctx, const lconstruct_instruction &i)
 	} else {
 		fail = FAIL_MODULE404(ctx.module_name(), ctx.function_name()
 				, ctx.pc());
-		fail->debug << "Cannot find module: '" << modname << "'";
+		fail->debug() << "Cannot find module: '" << modname << "'";
 		qbrt_value::fail(*dst, fail);
 		// continue on with execution
 	}
@@ -785,7 +1034,7 @@ void execute_loadfunc(OpContext &ctx, const lfunc_instruction &i)
 	if (!dst) {
 		fail = FAIL_REGISTER404(ctx.module_name(), ctx.function_name()
 				, ctx.pc());
-		fail->debug << "Invalid register: " << i.reg;
+		fail->debug() << "Invalid register: " << i.reg;
 		ctx.fail_frame(fail);
 		return;
 	}
@@ -793,7 +1042,7 @@ void execute_loadfunc(OpContext &ctx, const lfunc_instruction &i)
 	if (!mod) {
 		fail = FAIL_MODULE404(ctx.module_name(), ctx.function_name()
 				, ctx.pc());
-		fail->debug << "Cannot find module: '" << modname << "'";
+		fail->debug() << "Cannot find module: '" << modname << "'";
 		qbrt_value::fail(*dst, fail);
 		ctx.pc() += lfunc_instruction::SIZE;
 		return;
@@ -802,15 +1051,15 @@ void execute_loadfunc(OpContext &ctx, const lfunc_instruction &i)
 
 	c_function cf = NULL;
 	if (qbrt) {
-		qbrt_value::f(*dst, new function_value(qbrt));
+		qbrt_value::f(*dst, function_value::create(qbrt));
 	} else {
 		const CFunction *cf = fetch_c_function(*mod, fname);
 		if (cf) {
-			qbrt_value::f(*dst, new function_value(cf));
+			qbrt_value::f(*dst, function_value::create(cf));
 		} else {
 			fail = FAIL_FUNCTION404(ctx.module_name()
 					, ctx.function_name(), ctx.pc());
-			fail->debug << "could not find function: " << modname
+			fail->debug() << "could not find function: " << modname
 				<<'.'<< fname;
 			qbrt_value::fail(*dst, fail);
 		}
@@ -872,6 +1121,99 @@ void execute_matchargs(OpContext &ctx, const matchargs_instruction &i)
 	ctx.pc() += matchargs_instruction::SIZE;
 }
 
+/**
+ * Build the jump table from the case instructions that follow
+ * a switch. Jumps in the table are relative to the switch.
+ * Fail the frame and return NULL if a case names a construct
+ * that doesn't exist.
+ */
+static SwitchTable * build_switch_table(OpContext &ctx
+		, const switch_instruction &sw)
+{
+	const ResourceTable &resource(ctx.resource());
+	const Module *mod(current_module(ctx.worker()));
+	SwitchTable *tbl = new SwitchTable(sw.jump());
+	int32_t offset(switch_instruction::SIZE);
+	const uint8_t *code((const uint8_t *) &sw);
+	const case_instruction *c((const case_instruction *) (code + offset));
+	while (c->opcode() == OP_CASE) {
+		switch (c->kind) {
+			case CASE_INT:
+				tbl->add(CASE_INT, (uint64_t) (int64_t)
+						(int16_t) c->key
+						, offset + c->jump());
+				break;
+			case CASE_BOOL:
+				tbl->add(CASE_BOOL, c->key, offset + c->jump());
+				break;
+			case CASE_HASHTAG:
+				tbl->add(CASE_HASHTAG, mod->hashtag_atom(c->key)
+						, offset + c->jump());
+				break;
+			case CASE_CONSTRUCT:
+			{
+				const ModSym &ms(fetch_modsym(resource, c->key));
+				const char *modname(
+						fetch_string(resource, ms.mod_name));
+				const char *name(
+						fetch_string(resource, ms.sym_name));
+				const Module *cmod(find_module(ctx.worker()
+							, modname));
+				const ConstructResource *cons(cmod
+						? find_construct(*cmod, name)
+						: NULL);
+				if (!cons) {
+					Failure *f = NEW_FAILURE_ATOM(
+						ATOM_CONSTRUCT404
+						, ctx.module_name()
+						, ctx.function_name()
+						, ctx.pc());
+					f->debug() << "switch case not found: "
+						<< modname <<'/'<< name;
+					ctx.backtrace(*f);
+					ctx.fail_frame(f);
+					delete tbl;
+					return NULL;
+				}
+				tbl->add(CASE_CONSTRUCT, (uintptr_t) cons
+						, offset + c->jump());
+				break;
+			}
+		}
+		offset += case_instruction::SIZE;
+		c = (const case_instruction *) (code + offset);
+	}
+	tbl->finish();
+	return tbl;
+}
+
+/**
+ * Jump to the case that matches the input or to the default label.
+ * The table is built the first time a worker runs the switch.
+ */
+void execute_switch(OpContext &ctx, const switch_instruction &i)
+{
+	RETURN_FAILURE(ctx, i.input);
+	const qbrt_value &input(*ctx.srcvalue(i.input));
+
+	Worker &w(ctx.worker());
+	uintptr_t slot(((uintptr_t) &i) % SWITCH_CACHE_SIZE);
+	SwitchCache &cache(w.switch_cache[slot]);
+	if (cache.op != &i) {
+		SwitchTable *&tbl(w.switch_table[&i]);
+		if (!tbl) {
+			tbl = build_switch_table(ctx, i);
+			if (!tbl) {
+				w.switch_table.erase(&i);
+				return;
+			}
+		}
+		cache.op = &i;
+		cache.table = tbl;
+	}
+	ctx.pc() += cache.table->find(input);
+}
+
 void execute_newproc(OpContext &ctx, const newproc_instruction &i)
 {
 	Failure *f;
@@ -888,13 +1230,13 @@ void execute_newproc(OpContext &ctx, const newproc_instruction &i)
 	ctx.pc() += newproc_instruction::SIZE;
 
 	function_value *fval = func->data.f;
-	qbrt_value::set_void(*func);
-
 	Worker &w(ctx.worker());
 
 	const QbrtFunction *qfunc;
 	qfunc = dynamic_cast< const QbrtFunction * >(fval->func);
+	// the call holds the function value before the register lets go
 	FunctionCall *call = new FunctionCall(*qfunc, *fval);
+	qbrt_value::set_void(*func);
 	ProcessRoot *proc = new_process(w.app, call);
 	qbrt_value::i(pid, proc->pid);
 }
@@ -914,16 +1256,16 @@ void execute_patternvar(OpContext &ctx, const patternvar_instruction &i)
 
 void execute_recv(OpContext &ctx, const recv_instruction &i)
 {
-	Worker &w(ctx.worker());
-	if (w.current->proc->recv.empty()) {
-		w.current->cfstate = CFS_PEERWAIT;
-		return;
-	}
-
+	CodeFrame &frame(*ctx.worker().current);
 	qbrt_value &dst(*ctx.dstvalue(i.dst));
-	qbrt_value *msg(w.current->proc->recv.pop());
-	dst = *msg;
 	ctx.pc() += recv_instruction::SIZE;
+	qbrt_value *msg(frame.proc->recv.pop());
+	if (msg) {
+		dst = *msg;
+		return;
+	}
+	// park until a message is sent instead of polling for one
+	frame.io_push(new Receive(frame.proc->recv, &frame, -1, dst));
 }
 
 void execute_stracc(OpContext &ctx, const stracc_instruction &i)
@@ -940,32 +1282,34 @@ void execute_stracc(OpContext &ctx, const stracc_instruction &i)
 
 	if (dst.type->id != VT_STRING) {
 		f = FAIL_TYPE(ctx.module_name(), ctx.function_name(), op_pc);
-		f->debug << "stracc destination is not a string";
+		f->debug() << "stracc destination is not a string";
 		qbrt_value::i(f->exit_code, 1);
 		ctx.fail_frame(f);
 		return;
 	}
 
-	ostringstream out;
 	switch (src.type->id) {
 		case VT_STRING:
-			*dst.data.str += *src.data.str;
+			qbrt_value::str(dst
+					, String::append(*dst.data.str
+						, *src.data.str));
 			break;
 		case VT_INT:
-			out << src.data.i;
-			*dst.data.str += out.str();
+			qbrt_value::str(dst
+					, String::append(*dst.data.str
+						, src.data.i));
 			break;
 		case VT_VOID:
 			f = FAIL_TYPE(ctx.module_name(), ctx.function_name()
 					, op_pc);
-			f->debug << "cannot append void to string";
+			f->debug() << "cannot append void to string";
 			cerr << f->debug_msg() << endl;
 			qbrt_value::fail(dst, f);
 			break;
 		default:
 			f = FAIL_TYPE(ctx.module_name(), ctx.function_name()
 					, op_pc);
-			f->debug << "stracc source type is not supported: "
+			f->debug() << "stracc source type is not supported: "
 				<< (int) src.type->id;
 			cerr << f->debug_msg() << endl;
 			qbrt_value::fail(dst, f);
@@ -973,6 +1317,115 @@ void execute_stracc(OpContext &ctx, const stracc_instruction &i)
 	}
 }
 
+static Failure * vector_type_failure(OpContext &ctx, const char *opname
+		, const qbrt_value &val)
+{
+	Failure *f = FAIL_TYPE(ctx.module_name(), ctx.function_name()
+			, ctx.pc());
+	f->debug() << opname << " expected a vector, found ";
+	qbrt_value::append_type(f->debug(), val);
+	return f;
+}
+
+/**
+ * Check that an index register holds an int within the vector
+ * Return a failure if it doesn't.
+ */
+static Failure * vector_index(OpContext &ctx, const Vector &v
+		, const qbrt_value &idx, uint32_t &i)
+{
+	Failure *f;
+	if (idx.type->id != VT_INT) {
+		f = FAIL_TYPE(ctx.module_name(), ctx.function_name(), ctx.pc());
+		f->debug() << "vector index is not an int: ";
+		qbrt_value::append_type(f->debug(), idx);
+		return f;
+	}
+	if (idx.data.i < 0 || idx.data.i >= v.size()) {
+		f = NEW_FAILURE_ATOM(ATOM_INDEX404, ctx.module_name()
+				, ctx.function_name(), ctx.pc());
+		f->debug() << "vector index " << idx.data.i
+			<< " is out of range for size " << v.size();
+		return f;
+	}
+	i = idx.data.i;
+	return NULL;
+}
+
+void execute_vget(OpContext &ctx, const vget_instruction &i)
+{
+	RETURN_FAILURE(ctx, i.src);
+	RETURN_FAILURE(ctx, i.idx);
+
+	const qbrt_value &src(*ctx.srcvalue(i.src));
+	const qbrt_value &idx(*ctx.srcvalue(i.idx));
+	qbrt_value &dst(*ctx.dstvalue(i.dst));
+
+	uint32_t index;
+	Failure *f;
+	if (src.type->id != VT_VECTOR) {
+		qbrt_value::fail(dst, vector_type_failure(ctx, "vget", src));
+	} else if ((f = vector_index(ctx, *src.data.vect, idx, index))) {
+		qbrt_value::fail(dst, f);
+	} else {
+		qbrt_value::copy(dst, *src.data.vect->get(index));
+	}
+	ctx.pc() += vget_instruction::SIZE;
+}
+
+void execute_vset(OpContext &ctx, const vset_instruction &i)
+{
+	RETURN_FAILURE(ctx, i.dst);
+	RETURN_FAILURE(ctx, i.idx);
+
+	qbrt_value &dst(*ctx.dstvalue(i.dst));
+	const qbrt_value &idx(*ctx.srcvalue(i.idx));
+	const qbrt_value &src(*ctx.srcvalue(i.src));
+
+	if (dst.type->id != VT_VECTOR) {
+		ctx.fail_frame(vector_type_failure(ctx, "vset", dst));
+		return;
+	}
+	uint32_t index;
+	Failure *f(vector_index(ctx, *dst.data.vect, idx, index));
+	if (f) {
+		ctx.fail_frame(f);
+		return;
+	}
+	qbrt_value::vect(dst, Vector::set(*dst.data.vect, index, src));
+	ctx.pc() += vset_instruction::SIZE;
+}
+
+void execute_vpush(OpContext &ctx, const vpush_instruction &i)
+{
+	RETURN_FAILURE(ctx, i.dst);
+
+	qbrt_value &dst(*ctx.dstvalue(i.dst));
+	const qbrt_value &src(*ctx.srcvalue(i.src));
+
+	if (dst.type->id != VT_VECTOR) {
+		ctx.fail_frame(vector_type_failure(ctx, "vpush", dst));
+		return;
+	}
+	qbrt_value::vect(dst, Vector::push(*dst.data.vect, src));
+	ctx.pc() += vpush_instruction::SIZE;
+}
+
+void execute_vlen(OpContext &ctx, const vlen_instruction &i)
+{
+	RETURN_FAILURE(ctx, i.src);
+
+	const qbrt_value &src(*ctx.srcvalue(i.src));
+	qbrt_value &dst(*ctx.dstvalue(i.dst));
+
+	if (src.type->id != VT_VECTOR) {
+		qbrt_value::fail(dst, vector_type_failure(ctx, "vlen", src));
+	} else {
+		qbrt_value::i(dst, src.data.vect->size());
+	}
+	ctx.pc() += vlen_instruction::SIZE;
+}
+
 void execute_loadtype(OpContext &ctx, const loadtype_instruction &i)
 {
 	const char *modname = fetch_string(ctx.resource(), i.modname);
@@ -1038,8 +1491,11 @@ void init_executioners()
 	x[OP_CMP_LT] = (executioner) execute_cmp;
 	x[OP_CMP_LTEQ] = (executioner) execute_cmp;
 	x[OP_CONSTI] = (executioner) execute_consti;
+	x[OP_CONSTF] = (executioner) execute_constf;
 	x[OP_CONSTS] = (executioner) execute_consts;
 	x[OP_CONSTHASH] = (executioner) execute_consthash;
+	x[OP_CLIST] = (executioner) execute_clist;
+	x[OP_CONS] = (executioner) execute_cons;
 	x[OP_CTUPLE] = (executioner) execute_ctuple;
 	x[OP_FIELDGET] = (executioner) execute_fieldget;
 	x[OP_FIELDSET] = (executioner) execute_fieldset;
@@ -1047,11 +1503,24 @@ void init_executioners()
 	x[OP_IDIV] = (executioner) execute_divide;
 	x[OP_IMULT] = (executioner) execute_binaryop;
 	x[OP_ISUB] = (executioner) execute_binaryop;
+	x[OP_IAND] = (executioner) execute_binaryop;
+	x[OP_IOR] = (executioner) execute_binaryop;
+	x[OP_IXOR] = (executioner) execute_binaryop;
+	x[OP_ISHL] = (executioner) execute_binaryop;
+	x[OP_ISHR] = (executioner) execute_binaryop;
+	x[OP_IMOD] = (executioner) execute_divide;
+	x[OP_FADD] = (executioner) execute_binaryop;
+	x[OP_FSUB] = (executioner) execute_binaryop;
+	x[OP_FMULT] = (executioner) execute_binaryop;
+	x[OP_FDIV] = (executioner) execute_binaryop;
+	x[OP_ITOF] = (executioner) execute_convert;
+	x[OP_FTOI] = (executioner) execute_convert;
 	x[OP_LCONTEXT] = (executioner) execute_lcontext;
 	x[OP_LCONSTRUCT] = (executioner) execute_lconstruct;
 	x[OP_LFUNC] = (executioner) execute_loadfunc;
 	x[OP_MATCH] = (executioner) execute_match;
 	x[OP_MATCHARGS] = (executioner) execute_matchargs;
+	x[OP_SWITCH] = (executioner) execute_switch;
 	x[OP_NEWPROC] = (executioner) execute_newproc;
 	x[OP_PATTERNVAR] = (executioner) execute_patternvar;
 	x[OP_RECV] = (executioner) execute_recv;
@@ -1067,6 +1536,10 @@ void init_executioners()
 	x[OP_IFFAIL] = (executioner) execute_iffail;
 	x[OP_IFNOTFAIL] = (executioner) execute_iffail;
 	x[OP_WAIT] = (executioner) execute_wait;
+	x[OP_VGET] = (executioner) execute_vget;
+	x[OP_VLEN] = (executioner) execute_vlen;
+	x[OP_VPUSH] = (executioner) execute_vpush;
+	x[OP_VSET] = (executioner) execute_vset;
 }
 
 void execute_instruction(Worker &w, const instruction &i)
@@ -1075,11 +1548,12 @@ void execute_instruction(Worker &w, const instruction &i)
 	executioner x = EXECUTIONER[opcode];
 	WorkerOpContext ctx(w);
 	if (!x) {
-		Failure *f = NEW_FAILURE("invalidopcode", ctx.module_name()
-				, ctx.function_name(), ctx.pc());
+		Failure *f = NEW_FAILURE_ATOM(ATOM_INVALIDOPCODE
+				, ctx.module_name(), ctx.function_name()
+				, ctx.pc());
 		qbrt_value::i(f->exit_code, 1);
-		f->debug << "Opcode not implemented: " << (int) opcode;
-		f->usage << "Internal program error";
+		f->debug() << "Opcode not implemented: " << (int) opcode;
+		f->usage() << "Internal program error";
 		ctx.backtrace(*f);
 		ctx.fail_frame(f);
 		return;
@@ -1090,6 +1564,35 @@ void execute_instruction(Worker &w, const instruction &i)
 	//inspect_call_frame(cerr, *w.task->cframe);
 }
 
+/**
+ * Fill in the dispatch key for a call
+ * Return false if the call's arguments can't be cached, function
+ * values are typed by their signatures so they aren't.
+ */
+static bool dispatch_key(DispatchKey &key, const function_value &funcval)
+{
+	if (funcval.argc > DISPATCH_MAX_ARGS) {
+		return false;
+	}
+	memset(&key, 0, sizeof(key));
+	key.func = funcval.func;
+	for (int i(0); i<funcval.argc; ++i) {
+		const qbrt_value &val(funcval.value(i));
+		switch (val.type->id) {
+			case VT_FUNCTION:
+				return false;
+			case VT_CONSTRUCT:
+			case VT_LIST:
+				key.shape[i] = &val.data.cons->resource;
+				break;
+			default:
+				key.shape[i] = val.type;
+				break;
+		}
+	}
+	return true;
+}
+
 void override_function(Worker &w, function_value &funcval)
 {
 	int pfc_type(PFC_TYPE(funcval.fcontext()));
@@ -1106,10 +1609,6 @@ void override_function(Worker &w, function_value &funcval)
 		reassign_func(funcval, def_func);
 	}
 
-	ostringstream value_type_stream;
-	load_function_value_types(value_type_stream, funcval);
-	string value_types(value_type_stream.str());
-
 	const Function &func(*funcval.func);
 	const QbrtFunction *qfunc;
 	qfunc = dynamic_cast< const QbrtFunction * >(&func);
@@ -1118,18 +1617,37 @@ void override_function(Worker &w, function_value &funcval)
 		return;
 	}
 
+	// calls with arguments shaped like an earlier call go where it
+	// went, without formatting the types or searching the modules
+	DispatchKey key;
+	bool cached(dispatch_key(key, funcval));
+	if (cached) {
+		map< DispatchKey, const Function * >::const_iterator it;
+		it = w.dispatch.find(key);
+		if (it != w.dispatch.end()) {
+			if (it->second) {
+				reassign_func(funcval, it->second);
+			}
+			return;
+		}
+	}
+
+	ostringstream value_type_stream;
+	load_function_value_types(value_type_stream, funcval);
+	string value_types(value_type_stream.str());
+
 	const char *proto_name = func.protocol_name();
-	const QbrtFunction *overridef(find_override(w, func.mod->name.c_str()
+	const Function *target(find_override(w, func.mod->name.c_str()
 				, proto_name, funcval.name(), value_types));
-	if (overridef) {
-		reassign_func(funcval, overridef);
-	} else {
-		const CFunction *cfunc = find_c_override(w
-				, func.mod->name.c_str()
+	if (!target) {
+		target = find_c_override(w, func.mod->name.c_str()
 				, proto_name, funcval.name(), value_types);
-		if (cfunc) {
-			reassign_func(funcval, cfunc);
-		}
+	}
+	if (target) {
+		reassign_func(funcval, target);
+	}
+	if (cached) {
+		w.dispatch[key] = target;
 	}
 }
 
@@ -1233,38 +1751,103 @@ void call(Worker &w, qbrt_value &res, qbrt_value &f)
 			fail = FAIL_TYPE(w.current->function_call().mod->name
 					, w.current->function_call().name()
 					, w.current->pc);
-			fail->debug << "Unknown function type: "
+			fail->debug() << "Unknown function type: "
 				<< (int)f.type->id;
 			qbrt_value::fail(res, fail);
 			return;
 	}
 }
 
-void core_print(OpContext &ctx, qbrt_value &out)
+/**
+ * Call a function from inside a C function and wait for the result
+ *
+ * A C callee is called directly. A qbrt callee runs in a nested loop
+ * on this worker until it returns. The C function can't be suspended,
+ * so a callee that waits for io or another process is abandoned and
+ * the result is set to a #callbackblocked failure.
+ */
+void callback(Worker &w, qbrt_value &res, function_value &f)
 {
-	const qbrt_value *val = ctx.srcvalue(PRIMARY_REG(0));
-	if (!val) {
-		cout << "no param for print\n";
+	for (uint16_t i(0); i<f.argc; ++i) {
+		const qbrt_value &arg(follow_ref(f.value(i)));
+		if (arg.type->id == VT_FAILURE) {
+			res = arg;
+			return;
+		}
+	}
+
+	const Function *func(f.func);
+	if (func->cfunc() && func->fcontext() == PFC_NONE) {
+		WorkerCContext ctx(w, f);
+		func->cfunc()(ctx, res);
 		return;
 	}
-	switch (val->type->id) {
-		case VT_INT:
-			cout << val->data.i;
-			break;
-		case VT_STRING:
-			cout << *(val->data.str);
-			break;
-		default:
-			cout << "type not supported by print: "
-				<< val->type->name << endl;
-			break;
+
+	CodeFrame *caller(w.current);
+	qbrtcall(w, res, &f);
+	while (w.current != caller) {
+		execute_instruction(w, frame_instruction(*w.current));
+		CodeFrame &frame(*w.current);
+		if (frame.io || frame.cfstate == CFS_IOWAIT
+				|| frame.cfstate == CFS_PEERWAIT
+				|| frame.cfstate == CFS_NEW)
+		{
+			// leave the abandoned frames for forked paths
+			// that might still point at them
+			w.current = caller;
+			Failure *fail = NEW_FAILURE_ATOM(ATOM_CALLBACKBLOCKED
+					, caller->function_call().mod->name
+					, f.name(), 0);
+			fail->debug() << "callback cannot wait inside "
+				<< caller->function_call().name();
+			qbrt_value::fail(res, fail);
+			return;
+		}
+		if (frame.cfstate == CFS_COMPLETE
+				|| frame.cfstate == CFS_FAILED)
+		{
+			frame.finish_frame(w);
+		}
 	}
 }
 
-ostream & inspect_value_index(ostream &out, const qbrt_value_index &v)
+/** Where io/print writes, so it queues with other stdout writes */
+static Stream *print_stream = NULL;
+
+void core_print(OpContext &ctx, qbrt_value &out)
 {
-	out << "value index:\n";
-	inspect_indent += 2;
+	const qbrt_value *val = ctx.srcvalue(PRIMARY_REG(0));
+	const String *text;
+	if (!val) {
+		text = String::literal("no param for print\n", 19);
+	} else if (val->type->id == VT_STRING) {
+		text = val->data.str;
+	} else {
+		ostringstream s;
+		switch (val->type->id) {
+			case VT_INT:
+				s << val->data.i;
+				break;
+			case VT_FLOAT:
+				s << val->data.fp;
+				break;
+			default:
+				s << "type not supported by print: "
+					<< val->type->name << endl;
+				break;
+		}
+		text = String::create(s.str());
+	}
+	StreamIO *io(print_stream->write(out, *text));
+	if (io) {
+		ctx.io(io);
+	}
+}
+
+ostream & inspect_value_index(ostream &out, const qbrt_value_index &v)
+{
+	out << "value index:\n";
+	inspect_indent += 2;
 	for (int i(0); i<v.num_values(); ++i) {
 		for (int j(0); j<inspect_indent; ++j) {
 			out << "  ";
@@ -1341,7 +1924,7 @@ ostream & inspect(ostream &out, const qbrt_value &v)
 			inspect_function_value(out, *v.data.f);
 			break;
 		case VT_HASHTAG:
-			out << '#' << *v.data.hashtag;
+			out << '#' << atom_name(v.data.hashtag);
 			break;
 		case VT_BOOL:
 			out << (v.data.b ? "true" : "false");
@@ -1422,7 +2005,7 @@ void core_send(OpContext &ctx, qbrt_value &out)
 	Worker &w(ctx.worker());
 	it = w.process.find(pid.data.i);
 	if (it != w.process.end()) {
-		it->second->recv.push(qbrt_value::dup(src));
+		deliver_msg(*it->second, src);
 		return;
 	}
 
@@ -1433,6 +2016,48 @@ void core_send(OpContext &ctx, qbrt_value &out)
 	}
 }
 
+/** Clamp a number of ms to what a timer can hold, -1 for no limit */
+static int32_t timeout_ms(int64_t ms)
+{
+	if (ms < 0) {
+		return -1;
+	}
+	return ms > INT_MAX ? INT_MAX : ms;
+}
+
+/** Wait for a number of ms */
+void core_sleep(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &ms(*ctx.srcvalue(PRIMARY_REG(0)));
+	if (ms.type->id != VT_INT) {
+		qbrt_value::fail(out, FAIL_TYPE("core", "sleep", 0));
+		return;
+	}
+	if (ms.data.i <= 0) {
+		qbrt_value::set_void(out);
+		return;
+	}
+	ctx.io(new Sleep(timeout_ms(ms.data.i), out));
+}
+
+/** Receive a message, or fail with #timeout if none comes in time */
+void core_recv_timeout(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &ms(*ctx.srcvalue(PRIMARY_REG(0)));
+	if (ms.type->id != VT_INT) {
+		qbrt_value::fail(out, FAIL_TYPE("core", "recv_timeout", 0));
+		return;
+	}
+	CodeFrame *frame(ctx.worker().current);
+	qbrt_value *msg(frame->proc->recv.pop());
+	if (msg) {
+		out = *msg;
+		return;
+	}
+	ctx.io(new Receive(frame->proc->recv, frame, timeout_ms(ms.data.i)
+				, out));
+}
+
 /** Convert a string value to a string, straight copy */
 void core_str_from_str(OpContext &ctx, qbrt_value &result)
 {
@@ -1441,11 +2066,17 @@ void core_str_from_str(OpContext &ctx, qbrt_value &result)
 
 /** Convert an integer value to a string */
 void core_str_from_int(OpContext &ctx, qbrt_value &result)
+{
+	const qbrt_value &src(*ctx.srcvalue(PRIMARY_REG(0)));
+	qbrt_value::str(result, String::create(src.data.i));
+}
+
+void core_str_from_float(OpContext &ctx, qbrt_value &result)
 {
 	const qbrt_value &src(*ctx.srcvalue(PRIMARY_REG(0)));
 	ostringstream out;
-	out << src.data.i;
-	qbrt_value::str(result, out.str());
+	out << src.data.fp;
+	qbrt_value::str(result, String::create(out.str()));
 }
 
 void list_empty(OpContext &ctx, qbrt_value &out)
@@ -1455,10 +2086,6 @@ void list_empty(OpContext &ctx, qbrt_value &out)
 		cerr << "no param for list empty\n";
 		return;
 	}
-	if (val->type->id != VT_CONSTRUCT) {
-		cerr << "empty arg not a list: " << (int) val->type->id
-			<< endl;
-	}
 	List::is_empty(out, *val);
 }
 
@@ -1475,166 +2102,1751 @@ void list_pop(OpContext &ctx, qbrt_value &out)
 		cerr << "no param for list pop\n";
 		return;
 	}
+	List::pop(out, *val);
 }
 
-void core_open(OpContext &ctx, qbrt_value &out)
+/**
+ * Copy a function value so a callback can set its own args
+ * The copy is held in callee so it outlives each call.
+ */
+static function_value * copy_callback(qbrt_value &callee
+		, const function_value &f)
 {
-	const qbrt_value &filename(*ctx.srcvalue(PRIMARY_REG(0)));
-	const qbrt_value &mode(*ctx.srcvalue(PRIMARY_REG(1)));
-	// these type checks should be done automatically...
-	// once types are working.
-	if (filename.type->id != VT_STRING) {
-		cerr << "first argument to open is not a string\n";
-		cerr << "argument is type: " << (int)filename.type->id << endl;
-		exit(2);
+	function_value *copy(function_value::create(f.func));
+	qbrt_value::f(callee, copy);
+	for (uint8_t i(0); i<copy->regc && i<f.regc; ++i) {
+		copy->value(i) = f.value(i);
 	}
-	if (mode.type->id != VT_STRING) {
-		cerr << "second argument to open is not a string\n";
-		cerr << "argument is type: " << (int) mode.type->id << endl;
-		exit(2);
+	return copy;
+}
+
+/**
+ * Get the list and function arguments for a higher order list function
+ * The function is copied so calls don't change the caller's registers.
+ */
+static function_value * list_callback(OpContext &ctx, const char *fname
+		, const qbrt_value *&l, uint8_t func_reg, qbrt_value &callee
+		, qbrt_value &out)
+{
+	l = ctx.srcvalue(PRIMARY_REG(0));
+	const qbrt_value &f(*ctx.srcvalue(PRIMARY_REG(func_reg)));
+	if (l->type->id != VT_LIST || f.type->id != VT_FUNCTION) {
+		qbrt_value::fail(out, FAIL_TYPE("list", fname, 0));
+		return NULL;
 	}
-	FILE *f = fopen(filename.data.str->c_str(), mode.data.str->c_str());
-	int fd = fileno(f);
-	qbrt_value::stream(out, new FileStream(fd, f));
+	return copy_callback(callee, *f.data.f);
 }
 
-void core_getline(OpContext &ctx, qbrt_value &out)
+void list_length(OpContext &ctx, qbrt_value &out)
 {
-	qbrt_value &stream(*ctx.dstvalue(PRIMARY_REG(0)));
-	if (stream.type->id != VT_STREAM) {
-		cerr << "first argument to getline is not a stream\n";
-		exit(2);
+	const qbrt_value *l(ctx.srcvalue(PRIMARY_REG(0)));
+	if (l->type->id != VT_LIST) {
+		qbrt_value::fail(out, FAIL_TYPE("list", "length", 0));
+		return;
 	}
-	ctx.io(stream.data.stream->getline(out));
+	int64_t length(0);
+	while (!List::empty(*l->data.cons)) {
+		++length;
+		l = &l->data.cons->value(1);
+	}
+	qbrt_value::i(out, length);
 }
 
-void core_write(OpContext &ctx, qbrt_value &out)
+void list_reverse(OpContext &ctx, qbrt_value &out)
 {
-	qbrt_value &stream(*ctx.dstvalue(PRIMARY_REG(0)));
-	const qbrt_value &text(*ctx.srcvalue(PRIMARY_REG(1)));
-	if (stream.type->id != VT_STREAM) {
-		cerr << "first argument to write is not a stream\n";
-		exit(2);
+	const qbrt_value &l(*ctx.srcvalue(PRIMARY_REG(0)));
+	if (l.type->id != VT_LIST) {
+		qbrt_value::fail(out, FAIL_TYPE("list", "reverse", 0));
+		return;
 	}
-	if (text.type->id != VT_STRING) {
-		cerr << "second argument to write is not a string\n";
-		cerr << "argument is type: " << (int) text.type->id << endl;
-		exit(2);
+	List::reverse(out, l);
+}
+
+/** Return a list with the items of the second list after the first */
+void list_append(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value *a(ctx.srcvalue(PRIMARY_REG(0)));
+	const qbrt_value &b(*ctx.srcvalue(PRIMARY_REG(1)));
+	if (a->type->id != VT_LIST || b.type->id != VT_LIST) {
+		qbrt_value::fail(out, FAIL_TYPE("list", "append", 0));
+		return;
 	}
-	ctx.io(stream.data.stream->write(*text.data.str));
+	// copy the nodes of a and share all of b
+	qbrt_value result(b);
+	qbrt_value *tail(&result);
+	while (!List::empty(*a->data.cons)) {
+		List::cons(*tail, a->data.cons->value(0), b);
+		tail = &tail->data.cons->value(1);
+		a = &a->data.cons->value(1);
+	}
+	out = result;
 }
 
-int main(int argc, const char **argv)
+/** Return a list of the function applied to each item */
+void list_map(OpContext &ctx, qbrt_value &out)
 {
-	if (argc < 2) {
-		cerr << "an object name is required\n";
-		return 0;
+	const qbrt_value *l;
+	qbrt_value callee;
+	function_value *f(list_callback(ctx, "map", l, 1, callee, out));
+	if (!f) {
+		return;
 	}
-	const char *objname = argv[1];
-	init_executioners();
-	init_const_registers();
+	qbrt_value result;
+	List::empty(result);
+	qbrt_value *tail(&result);
+	qbrt_value mapped;
+	while (!List::empty(*l->data.cons)) {
+		f->value(0) = l->data.cons->value(0);
+		callback(ctx.worker(), mapped, *f);
+		if (qbrt_value::failed(mapped)) {
+			out = mapped;
+			return;
+		}
+		List::cons(*tail, mapped, CONST_REGISTER[REG_EMPTYLIST]);
+		tail = &tail->data.cons->value(1);
+		l = &l->data.cons->value(1);
+	}
+	out = result;
+}
 
+/** Return a list of the items for which the function returns true */
+void list_filter(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value *l;
+	qbrt_value callee;
+	function_value *f(list_callback(ctx, "filter", l, 1, callee, out));
+	if (!f) {
+		return;
+	}
+	qbrt_value result;
+	List::empty(result);
+	qbrt_value *tail(&result);
+	qbrt_value keep;
+	while (!List::empty(*l->data.cons)) {
+		const qbrt_value &item(l->data.cons->value(0));
+		f->value(0) = item;
+		callback(ctx.worker(), keep, *f);
+		if (qbrt_value::failed(keep)) {
+			out = keep;
+			return;
+		}
+		if (keep.type->id != VT_BOOL) {
+			qbrt_value::fail(out, FAIL_TYPE("list", "filter", 0));
+			return;
+		}
+		if (keep.data.b) {
+			List::cons(*tail, item, CONST_REGISTER[REG_EMPTYLIST]);
+			tail = &tail->data.cons->value(1);
+		}
+		l = &l->data.cons->value(1);
+	}
+	out = result;
+}
 
-	Application app;
-	Module *mod_core = const_cast< Module * >(load_module(app, "core"));
-	if (!mod_core) {
-		return -1;
+/** Combine the items from the front, calling f(accumulator, item) */
+void list_fold(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value *l;
+	qbrt_value callee;
+	function_value *f(list_callback(ctx, "fold", l, 2, callee, out));
+	if (!f) {
+		return;
 	}
-	Module *mod_list = const_cast< Module * >(load_module(app, "list"));
-	if (!mod_list) {
-		return -1;
+	qbrt_value acc(*ctx.srcvalue(PRIMARY_REG(1)));
+	while (!List::empty(*l->data.cons)) {
+		f->value(0) = acc;
+		f->value(1) = l->data.cons->value(0);
+		callback(ctx.worker(), acc, *f);
+		if (qbrt_value::failed(acc)) {
+			break;
+		}
+		l = &l->data.cons->value(1);
 	}
-	add_c_function(*mod_core, core_pid, "pid", 0, "");
-	add_c_function(*mod_core, core_send, "send", 2
-			, "io/Stream;core/String;");
-	add_c_function(*mod_core, core_wid, "wid", 0, "");
-	add_type(*mod_core, "Int", TYPE_INT);
-	add_type(*mod_core, "String", TYPE_STRING);
-	add_type(*mod_core, "ByteString", TYPE_STRING);
-	add_c_override(*mod_core, core_str_from_str, "core", "Stringy", "str", 1
-			, "core/String");
-	add_c_override(*mod_core, core_str_from_int, "core", "Stringy", "str", 1
-			, "core/Int");
+	out = acc;
+}
 
-	add_c_function(*mod_list, list_empty, "is_empty", 1, "core/List;");
-	add_c_function(*mod_list, list_head, "head", 1, "core/List;");
-	add_c_function(*mod_list, list_pop, "pop", 1, "core/List;");
+static bool list_sort_less(const qbrt_value &a, const qbrt_value &b)
+{
+	return qbrt_compare(a, b) < 0;
+}
 
-	Module *mod_io = new Module("io");
-	add_c_function(*mod_io, core_print, "print", 1, "core/String;");
-	add_c_function(*mod_io, core_open, "open", 2
-			, "core/String;core/String;");
-	add_c_function(*mod_io, core_write, "write", 2
-			, "io/Stream;core/String;");
-	add_c_function(*mod_io, core_getline, "getline", 1, "io/Stream;");
+/** Return the items in a stable ascending order */
+void list_sort(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value *l(ctx.srcvalue(PRIMARY_REG(0)));
+	if (l->type->id != VT_LIST) {
+		qbrt_value::fail(out, FAIL_TYPE("list", "sort", 0));
+		return;
+	}
+	vector< qbrt_value > items;
+	while (!List::empty(*l->data.cons)) {
+		items.push_back(l->data.cons->value(0));
+		l = &l->data.cons->value(1);
+	}
+	stable_sort(items.begin(), items.end(), list_sort_less);
 
-	load_module(app, mod_list);
-	load_module(app, mod_io);
-	Worker &w0(new_worker(app));
-	Worker &w1(new_worker(app));
+	qbrt_value result;
+	List::empty(result);
+	vector< qbrt_value >::const_reverse_iterator it(items.rbegin());
+	for (; it!=items.rend(); ++it) {
+		List::push(result, *it);
+	}
+	out = result;
+}
 
-	const Module *main_module = load_module(app, objname);
-	if (!main_module) {
-		return 1;
+/**
+ * Write each item of a list to the stream
+ * Nested lists are written directly, other items that aren't
+ * strings or ints are passed to core/str. Return false and set
+ * err if that fails.
+ */
+static bool format_list(Worker &w, ostream &result, const qbrt_value *l
+		, qbrt_value &str, qbrt_value &err)
+{
+	result << '[';
+	qbrt_value item_str;
+	while (!List::empty(*l->data.cons)) {
+		const qbrt_value &item(l->data.cons->value(0));
+		switch (item.type->id) {
+			case VT_STRING:
+				result << *item.data.str;
+				break;
+			case VT_INT:
+				result << item.data.i;
+				break;
+			case VT_LIST:
+				if (!format_list(w, result, &item, str, err)) {
+					return false;
+				}
+				break;
+			default:
+				if (str.type->id != VT_FUNCTION) {
+					const Module *core(find_module(w, "core"));
+					qbrt_value::f(str, function_value::create(
+							core->fetch_function("str")));
+				}
+				str.data.f->value(0) = item;
+				callback(w, item_str, *str.data.f);
+				if (item_str.type->id != VT_STRING) {
+					err = item_str;
+					return false;
+				}
+				result << *item_str.data.str;
+				break;
+		}
+		result << ',';
+		l = &l->data.cons->value(1);
 	}
+	result << ']';
+	return true;
+}
 
-	const QbrtFunction *qbrt_main(main_module->fetch_function("__main"));
-	if (!qbrt_main) {
-		cerr << "no __main function defined\n";
-		return 1;
+void list_format(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value *l(ctx.srcvalue(PRIMARY_REG(0)));
+	if (l->type->id != VT_LIST) {
+		qbrt_value::fail(out, FAIL_TYPE("list", "format", 0));
+		return;
 	}
-	function_value *main_func = new function_value(qbrt_main);
-	int main_func_argc(main_func->argc);
-	if (main_func_argc >= 1) {
-		qbrt_value::i(main_func->regv[0], argc - 1);
+	qbrt_value str;
+	ostringstream result;
+	if (format_list(ctx.worker(), result, l, str, out)) {
+		qbrt_value::str(out, String::create(result.str()));
 	}
-	if (main_func_argc >= 2) {
-		qbrt_value head;
-		Module::load_construct(head, *mod_list, "Empty");
-		for (int i(1); i<argc; ++i) {
-			qbrt_value node;
-			Module::load_construct(node, *mod_list, "Node");
-			qbrt_value::str(node.data.reg->value(0), argv[i]);
-			node.data.reg->value(1) = head;
-			head = node;
-		}
-		List::reverse(main_func->regv[1], head);
+}
+
+/** Return a new empty map */
+void map_empty(OpContext &ctx, qbrt_value &out)
+{
+	qbrt_value::map(out, Map::create());
+}
+
+/** Return a new map with a key set to a value */
+void map_insert(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &m(*ctx.srcvalue(PRIMARY_REG(0)));
+	const qbrt_value &key(*ctx.srcvalue(PRIMARY_REG(1)));
+	const qbrt_value &val(*ctx.srcvalue(PRIMARY_REG(2)));
+	if (m.type->id != VT_MAP) {
+		qbrt_value::fail(out, FAIL_TYPE("map", "insert", 0));
+		return;
 	}
+	qbrt_value::map(out, Map::insert(*m.data.map, key, val));
+}
 
-	Stream *stream_stdin = NULL;
-	Stream *stream_stdout = NULL;
-	struct stat buf;
-	fstat(fileno(stdin), &buf);
-	// printf("mode is %o\n", buf.st_mode);
-	if (S_ISREG(buf.st_mode)) {
-		// cerr << "stdin is a regular file\n";
-		stream_stdin = new FileStream(fileno(stdin), stdin);
-		stream_stdout = new FileStream(fileno(stdout), stdout);
-	} else if (S_ISCHR(buf.st_mode)) {
-		// cerr << "stdin is a character device\n";
-		stream_stdin = new FileStream(fileno(stdin), stdin);
-		stream_stdout = new FileStream(fileno(stdout), stdout);
-	} else if (S_ISFIFO(buf.st_mode)) {
-		// cerr << "stdin is fifo\n";
-		stream_stdin = new ByteStream(fileno(stdin), stdin);
-		stream_stdout = new ByteStream(fileno(stdout), stdout);
+/** Find the value for a key or fail with #key404 */
+void map_find(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &m(*ctx.srcvalue(PRIMARY_REG(0)));
+	const qbrt_value &key(*ctx.srcvalue(PRIMARY_REG(1)));
+	if (m.type->id != VT_MAP) {
+		qbrt_value::fail(out, FAIL_TYPE("map", "find", 0));
+		return;
+	}
+	const qbrt_value *val(m.data.map->find(key));
+	if (val) {
+		out = *val;
+	} else {
+		qbrt_value::fail(out, NEW_FAILURE_ATOM(ATOM_KEY404
+				, "map", "find", 0));
 	}
+}
 
+void map_contains(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &m(*ctx.srcvalue(PRIMARY_REG(0)));
+	const qbrt_value &key(*ctx.srcvalue(PRIMARY_REG(1)));
+	if (m.type->id != VT_MAP) {
+		qbrt_value::fail(out, FAIL_TYPE("map", "contains", 0));
+		return;
+	}
+	qbrt_value::b(out, m.data.map->find(key) != NULL);
+}
 
-	qbrt_value result;
-	qbrt_value::i(result, 0);
-	FunctionCall *main_call = new FunctionCall(result, *qbrt_main
-			, *main_func);
-	qbrt_value::stream(*add_context(main_call, "stdin"), stream_stdin);
-	qbrt_value::stream(*add_context(main_call, "stdout"), stream_stdout);
-	ProcessRoot *main_proc = new_process(app, main_call);
+void map_size(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &m(*ctx.srcvalue(PRIMARY_REG(0)));
+	if (m.type->id != VT_MAP) {
+		qbrt_value::fail(out, FAIL_TYPE("map", "size", 0));
+		return;
+	}
+	qbrt_value::i(out, m.data.map->size());
+}
+
+/**
+ * Build a map from a list of keys and a list of values
+ * The map is built in place and only becomes visible once it's done.
+ */
+void map_from_lists(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value *keys(ctx.srcvalue(PRIMARY_REG(0)));
+	const qbrt_value *vals(ctx.srcvalue(PRIMARY_REG(1)));
+	if (keys->type->id != VT_LIST || vals->type->id != VT_LIST) {
+		qbrt_value::fail(out, FAIL_TYPE("map", "from_lists", 0));
+		return;
+	}
+	Map *m(Map::transient(Map()));
+	// an Empty list has no fields, a Node has a value and next
+	while (keys->data.cons->num_values()
+			&& vals->data.cons->num_values())
+	{
+		m->insert_in_place(keys->data.cons->value(0)
+				, vals->data.cons->value(0));
+		keys = &keys->data.cons->value(1);
+		vals = &vals->data.cons->value(1);
+	}
+	m->persist();
+	qbrt_value::map(out, m);
+}
+
+/** Return a new empty set */
+void set_empty(OpContext &ctx, qbrt_value &out)
+{
+	qbrt_value::set(out, Set::create());
+}
+
+/** Return a new set that includes an item */
+void set_insert(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &s(*ctx.srcvalue(PRIMARY_REG(0)));
+	const qbrt_value &item(*ctx.srcvalue(PRIMARY_REG(1)));
+	if (s.type->id != VT_SET) {
+		qbrt_value::fail(out, FAIL_TYPE("set", "insert", 0));
+		return;
+	}
+	qbrt_value::set(out, Set::insert(*s.data.set, item));
+}
+
+void set_contains(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &s(*ctx.srcvalue(PRIMARY_REG(0)));
+	const qbrt_value &item(*ctx.srcvalue(PRIMARY_REG(1)));
+	if (s.type->id != VT_SET) {
+		qbrt_value::fail(out, FAIL_TYPE("set", "contains", 0));
+		return;
+	}
+	qbrt_value::b(out, s.data.set->contains(item));
+}
+
+void set_size(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &s(*ctx.srcvalue(PRIMARY_REG(0)));
+	if (s.type->id != VT_SET) {
+		qbrt_value::fail(out, FAIL_TYPE("set", "size", 0));
+		return;
+	}
+	qbrt_value::i(out, s.data.set->size());
+}
+
+/** Build a set in place from the items in a list */
+void set_from_list(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value *items(ctx.srcvalue(PRIMARY_REG(0)));
+	if (items->type->id != VT_LIST) {
+		qbrt_value::fail(out, FAIL_TYPE("set", "from_list", 0));
+		return;
+	}
+	Set *s(Set::transient(Set()));
+	while (items->data.cons->num_values()) {
+		s->insert_in_place(items->data.cons->value(0));
+		items = &items->data.cons->value(1);
+	}
+	s->persist();
+	qbrt_value::set(out, s);
+}
+
+/** Build a vector in place from the items in a list */
+void vector_from_list(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value *items(ctx.srcvalue(PRIMARY_REG(0)));
+	if (items->type->id != VT_LIST) {
+		qbrt_value::fail(out, FAIL_TYPE("vector", "from_list", 0));
+		return;
+	}
+	Vector *v(Vector::transient(Vector()));
+	while (items->data.cons->num_values()) {
+		v->push_in_place(items->data.cons->value(0));
+		items = &items->data.cons->value(1);
+	}
+	v->persist();
+	qbrt_value::vect(out, v);
+}
+
+/** Return the items of a vector from start up to end */
+void vector_slice(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &v(*ctx.srcvalue(PRIMARY_REG(0)));
+	const qbrt_value &start(*ctx.srcvalue(PRIMARY_REG(1)));
+	const qbrt_value &end(*ctx.srcvalue(PRIMARY_REG(2)));
+	if (v.type->id != VT_VECTOR || start.type->id != VT_INT
+			|| end.type->id != VT_INT)
+	{
+		qbrt_value::fail(out, FAIL_TYPE("vector", "slice", 0));
+		return;
+	}
+	if (start.data.i < 0 || start.data.i > end.data.i
+			|| end.data.i > v.data.vect->size())
+	{
+		Failure *f = NEW_FAILURE_ATOM(ATOM_INDEX404
+				, "vector", "slice", 0);
+		f->debug() << "slice " << start.data.i << ':' << end.data.i
+			<< " is out of range for size " << v.data.vect->size();
+		qbrt_value::fail(out, f);
+		return;
+	}
+	qbrt_value::vect(out, Vector::slice(*v.data.vect, start.data.i
+				, end.data.i));
+}
+
+void vector_concat(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &a(*ctx.srcvalue(PRIMARY_REG(0)));
+	const qbrt_value &b(*ctx.srcvalue(PRIMARY_REG(1)));
+	if (a.type->id != VT_VECTOR || b.type->id != VT_VECTOR) {
+		qbrt_value::fail(out, FAIL_TYPE("vector", "concat", 0));
+		return;
+	}
+	qbrt_value::vect(out, Vector::concat(*a.data.vect, *b.data.vect));
+}
+
+#define PARALLEL_MAP	0
+#define PARALLEL_REDUCE	1
+#define PARALLEL_EACH	2
 
-	int tid1 = pthread_create(&w0.thread, &w0.thread_attr
-			, launch_worker, &w0);
-	int tid2 = pthread_create(&w1.thread, &w1.thread_attr
-			, launch_worker, &w1);
+/**
+ * Call a function on the items of a list or vector across workers
+ *
+ * Each result is stored at its item's index so they come back in
+ * order whichever worker ran them. A reduce chunk folds its own
+ * items and stores the total where the chunk started.
+ */
+struct ParallelCallback
+: public ParallelJob
+{
+	const function_value &func;
+	vector< qbrt_value > item;
+	vector< qbrt_value > result;
+	vector< uint8_t > chunk_start;
+	uint32_t failed;
+	uint8_t op;
+
+	ParallelCallback(CodeFrame &frame, uint8_t op
+			, const function_value &f, vector< qbrt_value > &items)
+	: ParallelJob(frame, items.size())
+	, func(f)
+	, item()
+	, result(items.size())
+	, chunk_start(op == PARALLEL_REDUCE ? items.size() : 0)
+	, failed(0)
+	, op(op)
+	{
+		item.swap(items);
+	}
+
+	void run_chunk(Worker &, uint32_t begin, uint32_t end);
+	void call_item(Worker &, qbrt_value &res, function_value &);
+	/** Set out to a failed result, return false if none failed */
+	bool failure(qbrt_value &out) const;
+};
+
+void ParallelCallback::run_chunk(Worker &w, uint32_t begin, uint32_t end)
+{
+	if (__sync_add_and_fetch(&failed, 0)) {
+		return;
+	}
+	qbrt_value callee;
+	function_value *f(copy_callback(callee, func));
+	if (op == PARALLEL_REDUCE) {
+		qbrt_value acc(item[begin]);
+		for (uint32_t i(begin + 1); i<end; ++i) {
+			f->value(0) = acc;
+			f->value(1) = item[i];
+			call_item(w, acc, *f);
+			if (qbrt_value::failed(acc)) {
+				break;
+			}
+		}
+		result[begin] = acc;
+		chunk_start[begin] = 1;
+		if (qbrt_value::failed(acc)) {
+			__sync_lock_test_and_set(&failed, 1);
+		}
+		return;
+	}
+	for (uint32_t i(begin); i<end; ++i) {
+		f->value(0) = item[i];
+		call_item(w, result[i], *f);
+		if (qbrt_value::failed(result[i])) {
+			__sync_lock_test_and_set(&failed, 1);
+			return;
+		}
+	}
+}
+
+void ParallelCallback::call_item(Worker &w, qbrt_value &res
+		, function_value &f)
+{
+	callback(w, res, f);
+	if (w.current->cfstate == CFS_FAILED) {
+		// keep the path going, the owner reports the failure
+		w.current->cfstate = CFS_READY;
+		Failure *fail = NEW_FAILURE_ATOM(ATOM_CALLBACKFAILED
+				, frame->function_call().mod->name, f.name(), 0);
+		qbrt_value::fail(res, fail);
+	}
+}
+
+bool ParallelCallback::failure(qbrt_value &out) const
+{
+	if (!failed) {
+		return false;
+	}
+	vector< qbrt_value >::const_iterator it(result.begin());
+	for (; it!=result.end(); ++it) {
+		if (qbrt_value::failed(*it)) {
+			out = *it;
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Copy the items of a list or vector, return false for other types */
+static bool collection_items(const qbrt_value &src
+		, vector< qbrt_value > &items)
+{
+	const qbrt_value *l;
+	switch (src.type->id) {
+		case VT_LIST:
+			for (l=&src; !List::empty(*l->data.cons)
+					; l=&l->data.cons->value(1))
+			{
+				items.push_back(l->data.cons->value(0));
+			}
+			return true;
+		case VT_VECTOR:
+			items.reserve(src.data.vect->size());
+			for (uint32_t i(0); i<src.data.vect->size(); ++i) {
+				items.push_back(*src.data.vect->get(i));
+			}
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Get the items and function for a parallel collection function
+ * Return NULL and set out to a failure if they're the wrong types.
+ */
+static const function_value * parallel_args(OpContext &ctx
+		, const char *fname, vector< qbrt_value > &items
+		, uint8_t func_reg, qbrt_value &out)
+{
+	const qbrt_value &src(*ctx.srcvalue(PRIMARY_REG(0)));
+	const qbrt_value &f(*ctx.srcvalue(PRIMARY_REG(func_reg)));
+	if (f.type->id != VT_FUNCTION || !collection_items(src, items)) {
+		const char *modname(src.type->id == VT_VECTOR
+				? "vector" : "list");
+		qbrt_value::fail(out, FAIL_TYPE(modname, fname, 0));
+		return NULL;
+	}
+	return f.data.f;
+}
+
+/**
+ * Map a list or vector to a new one of the same kind, calling the
+ * function on chunks of items on every worker
+ */
+void parallel_map(OpContext &ctx, qbrt_value &out)
+{
+	vector< qbrt_value > items;
+	const function_value *f(parallel_args(ctx, "pmap", items, 1, out));
+	if (!f) {
+		return;
+	}
+	Worker &w(ctx.worker());
+	ParallelCallback job(*w.current, PARALLEL_MAP, *f, items);
+	run_parallel_job(w, job);
+	if (job.failure(out)) {
+		return;
+	}
+
+	if (ctx.srcvalue(PRIMARY_REG(0))->type->id == VT_VECTOR) {
+		Vector *v(Vector::transient(Vector()));
+		for (uint32_t i(0); i<job.count; ++i) {
+			v->push_in_place(job.result[i]);
+		}
+		v->persist();
+		qbrt_value::vect(out, v);
+		return;
+	}
+	qbrt_value result;
+	List::empty(result);
+	for (uint32_t i(job.count); i>0; --i) {
+		List::push(result, job.result[i - 1]);
+	}
+	out = result;
+}
+
+/**
+ * Fold the items of a list or vector into the initial value
+ * Chunks are folded on separate workers, then the chunk totals are
+ * folded in order, so the function has to be associative.
+ */
+void parallel_reduce(OpContext &ctx, qbrt_value &out)
+{
+	vector< qbrt_value > items;
+	const function_value *f(parallel_args(ctx, "preduce", items, 2, out));
+	if (!f) {
+		return;
+	}
+	Worker &w(ctx.worker());
+	ParallelCallback job(*w.current, PARALLEL_REDUCE, *f, items);
+	run_parallel_job(w, job);
+	if (job.failure(out)) {
+		return;
+	}
+
+	qbrt_value callee;
+	function_value *total(copy_callback(callee, *f));
+	qbrt_value acc(*ctx.srcvalue(PRIMARY_REG(1)));
+	for (uint32_t i(0); i<job.count; ++i) {
+		if (!job.chunk_start[i]) {
+			continue;
+		}
+		total->value(0) = acc;
+		total->value(1) = job.result[i];
+		callback(w, acc, *total);
+		if (qbrt_value::failed(acc)) {
+			break;
+		}
+	}
+	out = acc;
+}
+
+/** Call the function on each item of a list or vector across workers */
+void parallel_each(OpContext &ctx, qbrt_value &out)
+{
+	vector< qbrt_value > items;
+	const function_value *f(parallel_args(ctx, "peach", items, 1, out));
+	if (!f) {
+		return;
+	}
+	Worker &w(ctx.worker());
+	ParallelCallback job(*w.current, PARALLEL_EACH, *f, items);
+	run_parallel_job(w, job);
+	job.failure(out);
+}
+
+/**
+ * Build a packed array from the numbers in a list or vector
+ * It's a float array if any of them are floats.
+ */
+void array_from(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &src(*ctx.srcvalue(PRIMARY_REG(0)));
+	vector< qbrt_value > items;
+	uint8_t elem(ARRAY_INT);
+	bool numbers(collection_items(src, items));
+	vector< qbrt_value >::const_iterator it(items.begin());
+	for (; numbers && it!=items.end(); ++it) {
+		if (it->type->id == VT_FLOAT) {
+			elem = ARRAY_FLOAT;
+		} else if (it->type->id != VT_INT) {
+			numbers = false;
+		}
+	}
+	if (!numbers) {
+		qbrt_value::fail(out, FAIL_TYPE("array", "from", 0));
+		return;
+	}
+
+	Array *a(Array::create(elem, items.size()));
+	for (uint32_t i(0); i<a->count; ++i) {
+		const qbrt_value &item(items[i]);
+		if (elem == ARRAY_INT) {
+			a->data.i[i] = item.data.i;
+		} else if (item.type->id == VT_INT) {
+			a->data.fp[i] = (double) item.data.i;
+		} else {
+			a->data.fp[i] = item.data.fp;
+		}
+	}
+	qbrt_value::arr(out, a);
+}
+
+/** Get an array argument, set out to a failure if it isn't one */
+static const Array * array_arg(OpContext &ctx, uint8_t reg
+		, const char *fname, qbrt_value &out)
+{
+	const qbrt_value &a(*ctx.srcvalue(PRIMARY_REG(reg)));
+	if (a.type->id != VT_ARRAY) {
+		qbrt_value::fail(out, FAIL_TYPE("array", fname, 0));
+		return NULL;
+	}
+	return a.data.arr;
+}
+
+/**
+ * Check that b can be combined with the items of a
+ * b is another array of the same kind and size, or a number.
+ * An int array can't be combined with a float.
+ */
+static bool array_operand(const Array &a, const qbrt_value &b
+		, const char *fname, qbrt_value &out)
+{
+	Failure *f;
+	switch (b.type->id) {
+		case VT_ARRAY:
+			if (b.data.arr->elem != a.elem) {
+				break;
+			}
+			if (b.data.arr->count != a.count) {
+				f = NEW_FAILURE_ATOM(ATOM_SIZEMISMATCH
+						, "array", fname, 0);
+				f->debug() << "array sizes " << a.count << " and "
+					<< b.data.arr->count << " don't match";
+				qbrt_value::fail(out, f);
+				return false;
+			}
+			return true;
+		case VT_INT:
+			return true;
+		case VT_FLOAT:
+			if (a.elem == ARRAY_FLOAT) {
+				return true;
+			}
+			break;
+	}
+	qbrt_value::fail(out, FAIL_TYPE("array", fname, 0));
+	return false;
+}
+
+/** Check int division won't divide by 0 or overflow */
+static bool array_int_divisor(int64_t a, int64_t b, qbrt_value &out)
+{
+	if (b == 0) {
+		qbrt_value::fail(out, NEW_FAILURE_ATOM(ATOM_DIVIDEBY0
+				, "array", "div", 0));
+		return false;
+	}
+	if (b == -1 && a == INT64_MIN) {
+		qbrt_value::fail(out, NEW_FAILURE_ATOM(ATOM_OVERFLOW
+				, "array", "div", 0));
+		return false;
+	}
+	return true;
+}
+
+static void array_arith(OpContext &ctx, qbrt_value &out, uint8_t op
+		, const char *fname)
+{
+	const Array *a(array_arg(ctx, 0, fname, out));
+	const qbrt_value &b(*ctx.srcvalue(PRIMARY_REG(1)));
+	if (!a || !array_operand(*a, b, fname, out)) {
+		return;
+	}
+	if (op == ARRAY_DIV && a->elem == ARRAY_INT) {
+		for (uint32_t i(0); i<a->count; ++i) {
+			int64_t divisor(b.type->id == VT_ARRAY
+					? b.data.arr->data.i[i] : b.data.i);
+			if (!array_int_divisor(a->data.i[i], divisor, out)) {
+				return;
+			}
+		}
+	}
+	if (b.type->id == VT_ARRAY) {
+		qbrt_value::arr(out, Array::arith(op, *a, *b.data.arr));
+	} else {
+		qbrt_value::arr(out, Array::arith(op, *a, b));
+	}
+}
+
+void array_add(OpContext &ctx, qbrt_value &out)
+{
+	array_arith(ctx, out, ARRAY_ADD, "add");
+}
+
+void array_sub(OpContext &ctx, qbrt_value &out)
+{
+	array_arith(ctx, out, ARRAY_SUB, "sub");
+}
+
+void array_mul(OpContext &ctx, qbrt_value &out)
+{
+	array_arith(ctx, out, ARRAY_MUL, "mul");
+}
+
+void array_div(OpContext &ctx, qbrt_value &out)
+{
+	array_arith(ctx, out, ARRAY_DIV, "div");
+}
+
+static void array_compare(OpContext &ctx, qbrt_value &out, uint8_t op
+		, const char *fname)
+{
+	const Array *a(array_arg(ctx, 0, fname, out));
+	const qbrt_value &b(*ctx.srcvalue(PRIMARY_REG(1)));
+	if (!a || !array_operand(*a, b, fname, out)) {
+		return;
+	}
+	if (b.type->id == VT_ARRAY) {
+		qbrt_value::arr(out, Array::compare(op, *a, *b.data.arr));
+	} else {
+		qbrt_value::arr(out, Array::compare(op, *a, b));
+	}
+}
+
+void array_lt(OpContext &ctx, qbrt_value &out)
+{
+	array_compare(ctx, out, ARRAY_LT, "lt");
+}
+
+void array_gt(OpContext &ctx, qbrt_value &out)
+{
+	array_compare(ctx, out, ARRAY_GT, "gt");
+}
+
+void array_eq(OpContext &ctx, qbrt_value &out)
+{
+	array_compare(ctx, out, ARRAY_EQ, "eq");
+}
+
+void array_sum(OpContext &ctx, qbrt_value &out)
+{
+	const Array *a(array_arg(ctx, 0, "sum", out));
+	if (a) {
+		a->sum(out);
+	}
+}
+
+void array_min(OpContext &ctx, qbrt_value &out)
+{
+	const Array *a(array_arg(ctx, 0, "min", out));
+	if (!a) {
+		return;
+	}
+	if (!a->count) {
+		qbrt_value::fail(out, NEW_FAILURE_ATOM(ATOM_EMPTY
+				, "array", "min", 0));
+		return;
+	}
+	a->min(out);
+}
+
+void array_max(OpContext &ctx, qbrt_value &out)
+{
+	const Array *a(array_arg(ctx, 0, "max", out));
+	if (!a) {
+		return;
+	}
+	if (!a->count) {
+		qbrt_value::fail(out, NEW_FAILURE_ATOM(ATOM_EMPTY
+				, "array", "max", 0));
+		return;
+	}
+	a->max(out);
+}
+
+void array_dot(OpContext &ctx, qbrt_value &out)
+{
+	const Array *a(array_arg(ctx, 0, "dot", out));
+	const qbrt_value &b(*ctx.srcvalue(PRIMARY_REG(1)));
+	if (!a || !array_operand(*a, b, "dot", out)) {
+		return;
+	}
+	if (b.type->id != VT_ARRAY) {
+		qbrt_value::fail(out, FAIL_TYPE("array", "dot", 0));
+		return;
+	}
+	Array::dot(out, *a, *b.data.arr);
+}
+
+/** Return the items of an array at each index in an int array */
+void array_gather(OpContext &ctx, qbrt_value &out)
+{
+	const Array *a(array_arg(ctx, 0, "gather", out));
+	const Array *index(array_arg(ctx, 1, "gather", out));
+	if (!a || !index) {
+		return;
+	}
+	if (index->elem != ARRAY_INT) {
+		qbrt_value::fail(out, FAIL_TYPE("array", "gather", 0));
+		return;
+	}
+	for (uint32_t i(0); i<index->count; ++i) {
+		int64_t idx(index->data.i[i]);
+		if (idx < 0 || idx >= a->count) {
+			Failure *f = NEW_FAILURE_ATOM(ATOM_INDEX404
+					, "array", "gather", 0);
+			f->debug() << "index " << idx
+				<< " is out of range for size " << a->count;
+			qbrt_value::fail(out, f);
+			return;
+		}
+	}
+	qbrt_value::arr(out, Array::gather(*a, *index));
+}
+
+void array_to_float(OpContext &ctx, qbrt_value &out)
+{
+	const Array *a(array_arg(ctx, 0, "to_float", out));
+	if (a) {
+		qbrt_value::arr(out, Array::to_float(*a));
+	}
+}
+
+void array_to_list(OpContext &ctx, qbrt_value &out)
+{
+	const Array *a(array_arg(ctx, 0, "to_list", out));
+	if (!a) {
+		return;
+	}
+	qbrt_value result;
+	qbrt_value item;
+	List::empty(result);
+	for (uint32_t i(a->count); i>0; --i) {
+		a->get(item, i - 1);
+		List::push(result, item);
+	}
+	out = result;
+}
+
+void array_length(OpContext &ctx, qbrt_value &out)
+{
+	const Array *a(array_arg(ctx, 0, "length", out));
+	if (a) {
+		qbrt_value::i(out, a->count);
+	}
+}
+
+void array_get(OpContext &ctx, qbrt_value &out)
+{
+	const Array *a(array_arg(ctx, 0, "get", out));
+	const qbrt_value &idx(*ctx.srcvalue(PRIMARY_REG(1)));
+	if (!a) {
+		return;
+	}
+	if (idx.type->id != VT_INT) {
+		qbrt_value::fail(out, FAIL_TYPE("array", "get", 0));
+		return;
+	}
+	if (idx.data.i < 0 || idx.data.i >= a->count) {
+		Failure *f = NEW_FAILURE_ATOM(ATOM_INDEX404, "array", "get", 0);
+		f->debug() << "index " << idx.data.i
+			<< " is out of range for size " << a->count;
+		qbrt_value::fail(out, f);
+		return;
+	}
+	a->get(out, idx.data.i);
+}
+
+/** Convert an array to a string in the same format as lists */
+void array_str(OpContext &ctx, qbrt_value &out)
+{
+	const Array &a(*ctx.srcvalue(PRIMARY_REG(0))->data.arr);
+	ostringstream result;
+	result << '[';
+	for (uint32_t i(0); i<a.count; ++i) {
+		if (a.elem == ARRAY_INT) {
+			result << a.data.i[i];
+		} else {
+			result << a.data.fp[i];
+		}
+		result << ',';
+	}
+	result << ']';
+	qbrt_value::str(out, String::create(result.str()));
+}
+
+/** Get a binary argument, set out to a failure if it isn't one */
+static const Binary * binary_arg(OpContext &ctx, uint8_t reg
+		, const char *fname, qbrt_value &out)
+{
+	const qbrt_value &b(*ctx.srcvalue(PRIMARY_REG(reg)));
+	if (b.type->id != VT_BINARY) {
+		qbrt_value::fail(out, FAIL_TYPE("binary", fname, 0));
+		return NULL;
+	}
+	return b.data.bin;
+}
+
+/** Get an int argument that can't be negative */
+static bool offset_arg(OpContext &ctx, uint8_t reg, const char *fname
+		, uint64_t &offset, qbrt_value &out)
+{
+	const qbrt_value &i(*ctx.srcvalue(PRIMARY_REG(reg)));
+	if (i.type->id != VT_INT || i.data.i < 0) {
+		qbrt_value::fail(out, FAIL_TYPE("binary", fname, 0));
+		return false;
+	}
+	offset = i.data.i;
+	return true;
+}
+
+void binary_length(OpContext &ctx, qbrt_value &out)
+{
+	const Binary *b(binary_arg(ctx, 0, "length", out));
+	if (b) {
+		qbrt_value::i(out, b->size);
+	}
+}
+
+/** Get the byte at an index as an int */
+void binary_get(OpContext &ctx, qbrt_value &out)
+{
+	const Binary *b(binary_arg(ctx, 0, "get", out));
+	uint64_t idx;
+	if (!b || !offset_arg(ctx, 1, "get", idx, out)) {
+		return;
+	}
+	if (idx >= b->size) {
+		Failure *f = NEW_FAILURE_ATOM(ATOM_INDEX404
+				, "binary", "get", 0);
+		f->debug() << "index " << idx
+			<< " is out of range for size " << b->size;
+		qbrt_value::fail(out, f);
+		return;
+	}
+	qbrt_value::i(out, (uint8_t) b->data[idx]);
+}
+
+/** Share the bytes from an offset, as many as len or what's left */
+void binary_slice(OpContext &ctx, qbrt_value &out)
+{
+	const Binary *b(binary_arg(ctx, 0, "slice", out));
+	uint64_t offset, len;
+	if (!b || !offset_arg(ctx, 1, "slice", offset, out)
+			|| !offset_arg(ctx, 2, "slice", len, out))
+	{
+		return;
+	}
+	qbrt_value::bin(out, Binary::slice(*b, offset, len));
+}
+
+/** Find where a string next appears, or fail with #notfound */
+void binary_find(OpContext &ctx, qbrt_value &out)
+{
+	const Binary *b(binary_arg(ctx, 0, "find", out));
+	const qbrt_value &needle(*ctx.srcvalue(PRIMARY_REG(1)));
+	uint64_t from;
+	if (!b || !offset_arg(ctx, 2, "find", from, out)) {
+		return;
+	}
+	if (needle.type->id != VT_STRING) {
+		qbrt_value::fail(out, FAIL_TYPE("binary", "find", 0));
+		return;
+	}
+	const String &s(*needle.data.str);
+	int64_t pos(b->find(s.chars, s.size, from));
+	if (pos < 0) {
+		qbrt_value::fail(out, NEW_FAILURE_ATOM(ATOM_NOTFOUND
+				, "binary", "find", 0));
+		return;
+	}
+	qbrt_value::i(out, pos);
+}
+
+/**
+ * Share the line that starts at an offset, without its newline
+ * Fail with #eof once the offset is past the end.
+ */
+void binary_line(OpContext &ctx, qbrt_value &out)
+{
+	const Binary *b(binary_arg(ctx, 0, "line", out));
+	uint64_t offset;
+	if (!b || !offset_arg(ctx, 1, "line", offset, out)) {
+		return;
+	}
+	if (offset >= b->size) {
+		qbrt_value::fail(out, NEW_FAILURE_ATOM(ATOM_EOF
+				, "binary", "line", 0));
+		return;
+	}
+	uint64_t end(b->line_end(offset));
+	qbrt_value::bin(out, Binary::slice(*b, offset, end - offset));
+}
+
+/** Share each line, the last one doesn't need a newline */
+void binary_lines(OpContext &ctx, qbrt_value &out)
+{
+	const Binary *b(binary_arg(ctx, 0, "lines", out));
+	if (!b) {
+		return;
+	}
+	qbrt_value result;
+	qbrt_value empty;
+	List::empty(result);
+	List::empty(empty);
+	qbrt_value *tail(&result);
+	qbrt_value line;
+	uint64_t offset(0);
+	while (offset < b->size) {
+		uint64_t end(b->line_end(offset));
+		qbrt_value::bin(line, Binary::slice(*b, offset, end - offset));
+		List::cons(*tail, line, empty);
+		tail = &tail->data.cons->value(1);
+		offset = end + 1;
+	}
+	out = result;
+}
+
+/** Copy a binary's bytes into a string */
+void binary_str(OpContext &ctx, qbrt_value &out)
+{
+	const Binary *b(binary_arg(ctx, 0, "str", out));
+	if (!b) {
+		return;
+	}
+	if (b->size > UINT32_MAX) {
+		qbrt_value::fail(out, NEW_FAILURE_ATOM(ATOM_TOOBIG
+				, "binary", "str", 0));
+		return;
+	}
+	qbrt_value::str(out, String::create(b->data, b->size));
+}
+
+/** Copy a string into a new binary */
+void binary_from_str(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &src(*ctx.srcvalue(PRIMARY_REG(0)));
+	if (src.type->id != VT_STRING) {
+		qbrt_value::fail(out, FAIL_TYPE("binary", "from_str", 0));
+		return;
+	}
+	const String &s(*src.data.str);
+	BinaryBuffer *buf(BinaryBuffer::create(s.size));
+	if (!buf) {
+		qbrt_value::fail(out, NEW_FAILURE_ATOM(ATOM_TOOBIG
+				, "binary", "from_str", 0));
+		return;
+	}
+	memcpy(buf->data, s.chars, s.size);
+	qbrt_value::bin(out, Binary::view(buf, buf->data, s.size));
+}
+
+/** Join a list of strings and binaries into one binary */
+void binary_join(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &src(*ctx.srcvalue(PRIMARY_REG(0)));
+	if (src.type->id != VT_LIST) {
+		qbrt_value::fail(out, FAIL_TYPE("binary", "join", 0));
+		return;
+	}
+	// size it all first so the bytes are copied once
+	uint64_t total(0);
+	const qbrt_value *it(&src);
+	for (; !List::empty(*it->data.cons); it=&it->data.cons->value(1)) {
+		const qbrt_value &item(it->data.cons->value(0));
+		if (item.type->id == VT_STRING) {
+			total += item.data.str->size;
+		} else if (item.type->id == VT_BINARY) {
+			total += item.data.bin->size;
+		} else {
+			qbrt_value::fail(out, FAIL_TYPE("binary", "join", 0));
+			return;
+		}
+	}
+	BinaryBuffer *buf(BinaryBuffer::create(total));
+	if (!buf) {
+		qbrt_value::fail(out, NEW_FAILURE_ATOM(ATOM_TOOBIG
+				, "binary", "join", 0));
+		return;
+	}
+	char *data(buf->data);
+	for (it=&src; !List::empty(*it->data.cons); it=&it->data.cons->value(1)) {
+		const qbrt_value &item(it->data.cons->value(0));
+		if (item.type->id == VT_STRING) {
+			memcpy(data, item.data.str->chars, item.data.str->size);
+			data += item.data.str->size;
+		} else {
+			memcpy(data, item.data.bin->data, item.data.bin->size);
+			data += item.data.bin->size;
+		}
+	}
+	qbrt_value::bin(out, Binary::view(buf, buf->data, total));
+}
+
+/** Map a file read only so it can be used without reading it */
+void core_mmap(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &filename(*ctx.srcvalue(PRIMARY_REG(0)));
+	if (filename.type->id != VT_STRING) {
+		qbrt_value::fail(out, FAIL_TYPE("io", "mmap", 0));
+		return;
+	}
+	ctx.io(new FileMap(filename.data.str->str(), out));
+}
+
+void core_open(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &filename(*ctx.srcvalue(PRIMARY_REG(0)));
+	const qbrt_value &mode(*ctx.srcvalue(PRIMARY_REG(1)));
+	// these type checks should be done automatically...
+	// once types are working.
+	if (filename.type->id != VT_STRING) {
+		cerr << "first argument to open is not a string\n";
+		cerr << "argument is type: " << (int)filename.type->id << endl;
+		exit(2);
+	}
+	if (mode.type->id != VT_STRING) {
+		cerr << "second argument to open is not a string\n";
+		cerr << "argument is type: " << (int) mode.type->id << endl;
+		exit(2);
+	}
+	ctx.io(new FileOpen(filename.data.str->str(), mode.data.str->str()
+				, out));
+}
+
+void core_getline(OpContext &ctx, qbrt_value &out)
+{
+	qbrt_value &stream(*ctx.dstvalue(PRIMARY_REG(0)));
+	if (stream.type->id != VT_STREAM) {
+		cerr << "first argument to getline is not a stream\n";
+		exit(2);
+	}
+	StreamIO *io(stream.data.stream->getline(out));
+	if (io) {
+		ctx.io(io);
+	}
+}
+
+/** Get a list of the lines that can be read without waiting again */
+void core_getlines(OpContext &ctx, qbrt_value &out)
+{
+	qbrt_value &stream(*ctx.dstvalue(PRIMARY_REG(0)));
+	if (stream.type->id != VT_STREAM) {
+		qbrt_value::fail(out, FAIL_TYPE("io", "getlines", 0));
+		return;
+	}
+	StreamIO *io(stream.data.stream->getlines(out));
+	if (io) {
+		ctx.io(io);
+	}
+}
+
+/** Read whatever bytes a stream has ready, waiting if there are none */
+void core_read(OpContext &ctx, qbrt_value &out)
+{
+	qbrt_value &stream(*ctx.dstvalue(PRIMARY_REG(0)));
+	if (stream.type->id != VT_STREAM) {
+		qbrt_value::fail(out, FAIL_TYPE("io", "read", 0));
+		return;
+	}
+	StreamIO *io(stream.data.stream->read(out));
+	if (io) {
+		ctx.io(io);
+	}
+}
+
+void core_listen(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &address(*ctx.srcvalue(PRIMARY_REG(0)));
+	if (address.type->id != VT_STRING) {
+		qbrt_value::fail(out, FAIL_TYPE("io", "listen", 0));
+		return;
+	}
+	socket_listen(out, address.data.str->str());
+}
+
+void core_accept(OpContext &ctx, qbrt_value &out)
+{
+	qbrt_value &stream(*ctx.dstvalue(PRIMARY_REG(0)));
+	ListenStream *listener(NULL);
+	if (stream.type->id == VT_STREAM) {
+		listener = dynamic_cast< ListenStream * >(stream.data.stream);
+	}
+	if (!listener) {
+		qbrt_value::fail(out, FAIL_TYPE("io", "accept", 0));
+		return;
+	}
+	ctx.io(listener->accept(out));
+}
+
+void core_connect(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &address(*ctx.srcvalue(PRIMARY_REG(0)));
+	if (address.type->id != VT_STRING) {
+		qbrt_value::fail(out, FAIL_TYPE("io", "connect", 0));
+		return;
+	}
+	StreamIO *io(socket_connect(out, address.data.str->str()));
+	if (io) {
+		ctx.io(io);
+	}
+}
+
+void core_udp(OpContext &ctx, qbrt_value &out)
+{
+	const qbrt_value &address(*ctx.srcvalue(PRIMARY_REG(0)));
+	if (address.type->id != VT_STRING) {
+		qbrt_value::fail(out, FAIL_TYPE("io", "udp", 0));
+		return;
+	}
+	socket_datagram(out, address.data.str->str());
+}
+
+/** Get a list of the datagrams that are ready, waiting if there are none */
+void core_recvmsgs(OpContext &ctx, qbrt_value &out)
+{
+	qbrt_value &stream(*ctx.dstvalue(PRIMARY_REG(0)));
+	DatagramStream *dgram(NULL);
+	if (stream.type->id == VT_STREAM) {
+		dgram = dynamic_cast< DatagramStream * >(stream.data.stream);
+	}
+	if (!dgram) {
+		qbrt_value::fail(out, FAIL_TYPE("io", "recvmsgs", 0));
+		return;
+	}
+	StreamIO *io(dgram->recvmsgs(out));
+	if (io) {
+		ctx.io(io);
+	}
+}
+
+/** Send each string in a list as a datagram */
+void core_sendmsgs(OpContext &ctx, qbrt_value &out)
+{
+	qbrt_value &stream(*ctx.dstvalue(PRIMARY_REG(0)));
+	const qbrt_value &address(*ctx.srcvalue(PRIMARY_REG(1)));
+	const qbrt_value &msgs(*ctx.srcvalue(PRIMARY_REG(2)));
+	DatagramStream *dgram(NULL);
+	if (stream.type->id == VT_STREAM) {
+		dgram = dynamic_cast< DatagramStream * >(stream.data.stream);
+	}
+	if (!dgram || address.type->id != VT_STRING
+			|| msgs.type->id != VT_LIST)
+	{
+		qbrt_value::fail(out, FAIL_TYPE("io", "sendmsgs", 0));
+		return;
+	}
+	StreamIO *io(dgram->sendmsgs(out, address.data.str->str(), msgs));
+	if (io) {
+		ctx.io(io);
+	}
+}
+
+/**
+ * Get the stream argument for a function that reads or writes bytes
+ * Listening and datagram sockets don't have bytes to read or write.
+ */
+static Stream * byte_stream_arg(OpContext &ctx, uint8_t reg)
+{
+	qbrt_value &stream(*ctx.dstvalue(PRIMARY_REG(reg)));
+	if (stream.type->id != VT_STREAM) {
+		return NULL;
+	}
+	Stream *s(stream.data.stream);
+	if (dynamic_cast< ListenStream * >(s)
+			|| dynamic_cast< DatagramStream * >(s))
+	{
+		return NULL;
+	}
+	return s;
+}
+
+/** Move the rest of one stream to another without reading it in */
+void core_transfer(OpContext &ctx, qbrt_value &out)
+{
+	Stream *to(byte_stream_arg(ctx, 0));
+	Stream *from(byte_stream_arg(ctx, 1));
+	if (!to || !from) {
+		qbrt_value::fail(out, FAIL_TYPE("io", "transfer", 0));
+		return;
+	}
+	ctx.io(stream_transfer(out, *to, *from));
+}
+
+/** Read a number of bytes into a binary, fewer at the end */
+void core_readbin(OpContext &ctx, qbrt_value &out)
+{
+	Stream *stream(byte_stream_arg(ctx, 0));
+	const qbrt_value &n(*ctx.srcvalue(PRIMARY_REG(1)));
+	if (!stream || n.type->id != VT_INT || n.data.i < 0) {
+		qbrt_value::fail(out, FAIL_TYPE("io", "readbin", 0));
+		return;
+	}
+	StreamIO *io(stream_read_binary(out, *stream, n.data.i));
+	if (io) {
+		ctx.io(io);
+	}
+}
+
+/** Queue a binary to write without copying it */
+void core_writebin(OpContext &ctx, qbrt_value &out)
+{
+	Stream *stream(byte_stream_arg(ctx, 0));
+	const qbrt_value &src(*ctx.srcvalue(PRIMARY_REG(1)));
+	if (!stream || src.type->id != VT_BINARY) {
+		qbrt_value::fail(out, FAIL_TYPE("io", "writebin", 0));
+		return;
+	}
+	qbrt_value::set_void(out);
+	StreamIO *io(stream->write_binary(*src.data.bin));
+	if (io) {
+		ctx.io(io);
+	}
+}
+
+/** Set how long reads and accepts on a stream wait, -1 for ever */
+void core_timeout(OpContext &ctx, qbrt_value &out)
+{
+	qbrt_value &stream(*ctx.dstvalue(PRIMARY_REG(0)));
+	const qbrt_value &ms(*ctx.srcvalue(PRIMARY_REG(1)));
+	if (stream.type->id != VT_STREAM || ms.type->id != VT_INT) {
+		qbrt_value::fail(out, FAIL_TYPE("io", "timeout", 0));
+		return;
+	}
+	stream.data.stream->timeout = timeout_ms(ms.data.i);
+	qbrt_value::set_void(out);
+}
+
+/** Write what's queued for a stream and close it */
+void core_close(OpContext &ctx, qbrt_value &out)
+{
+	qbrt_value &stream(*ctx.dstvalue(PRIMARY_REG(0)));
+	if (stream.type->id != VT_STREAM) {
+		qbrt_value::fail(out, FAIL_TYPE("io", "close", 0));
+		return;
+	}
+	ctx.io(new StreamClose(stream.data.stream, out));
+}
+
+/** Write what's queued for a file stream and sync it to disk */
+void core_fsync(OpContext &ctx, qbrt_value &out)
+{
+	qbrt_value &stream(*ctx.dstvalue(PRIMARY_REG(0)));
+	if (stream.type->id != VT_STREAM) {
+		qbrt_value::fail(out, FAIL_TYPE("io", "fsync", 0));
+		return;
+	}
+	ctx.io(new StreamSync(stream.data.stream, out));
+}
+
+void core_write(OpContext &ctx, qbrt_value &out)
+{
+	qbrt_value &stream(*ctx.dstvalue(PRIMARY_REG(0)));
+	const qbrt_value &text(*ctx.srcvalue(PRIMARY_REG(1)));
+	if (stream.type->id != VT_STREAM) {
+		cerr << "first argument to write is not a stream\n";
+		exit(2);
+	}
+	if (text.type->id != VT_STRING) {
+		cerr << "second argument to write is not a string\n";
+		cerr << "argument is type: " << (int) text.type->id << endl;
+		exit(2);
+	}
+	StreamIO *io(stream.data.stream->write(out, *text.data.str));
+	if (io) {
+		ctx.io(io);
+	}
+}
+
+#define MIN_WORKERS	2
+
+/**
+ * Make the stream for stdin or stdout. Files and terminals are
+ * always ready so they're used directly, pipes and sockets wait
+ * for epoll.
+ */
+static Stream * std_stream(FILE *f)
+{
+	struct stat buf;
+	fstat(fileno(f), &buf);
+	if (S_ISREG(buf.st_mode) || S_ISCHR(buf.st_mode)) {
+		return new FileStream(fileno(f), f);
+	}
+	return new ByteStream(fileno(f), f);
+}
+
+int main(int argc, const char **argv)
+{
+	if (argc < 2) {
+		cerr << "an object name is required\n";
+		return 0;
+	}
+	const char *objname = argv[1];
+	init_executioners();
+	init_const_registers();
+	// a closed socket should fail the write, not kill everything
+	signal(SIGPIPE, SIG_IGN);
+
+
+	Application app;
+	Module *mod_core = const_cast< Module * >(load_module(app, "core"));
+	if (!mod_core) {
+		return -1;
+	}
+	Module *mod_list = const_cast< Module * >(load_module(app, "list"));
+	if (!mod_list) {
+		return -1;
+	}
+	List::init(*mod_list);
+	List::empty(CONST_REGISTER[REG_EMPTYLIST]);
+	add_c_function(*mod_core, core_pid, "pid", 0, "");
+	add_c_function(*mod_core, core_send, "send", 2
+			, "io/Stream;core/String;");
+	add_c_function(*mod_core, core_wid, "wid", 0, "");
+	add_c_function(*mod_core, core_sleep, "sleep", 1, "core/Int;");
+	add_c_function(*mod_core, core_recv_timeout, "recv_timeout", 1
+			, "core/Int;");
+	add_type(*mod_core, "Int", TYPE_INT);
+	add_type(*mod_core, "Float", TYPE_FLOAT);
+	add_type(*mod_core, "String", TYPE_STRING);
+	add_type(*mod_core, "ByteString", TYPE_BINARY);
+	add_c_override(*mod_core, core_str_from_str, "core", "Stringy", "str", 1
+			, "core/String");
+	add_c_override(*mod_core, core_str_from_int, "core", "Stringy", "str", 1
+			, "core/Int");
+	add_c_override(*mod_core, core_str_from_float, "core", "Stringy", "str"
+			, 1, "core/Float");
+
+	add_c_function(*mod_list, list_empty, "is_empty", 1, "core/List;");
+	add_c_function(*mod_list, list_head, "head", 1, "core/List;");
+	add_c_function(*mod_list, list_pop, "pop", 1, "core/List;");
+	add_c_function(*mod_list, list_length, "length", 1, "core/List;");
+	add_c_function(*mod_list, list_reverse, "reverse", 1, "core/List;");
+	add_c_function(*mod_list, list_append, "append", 2
+			, "core/List;core/List;");
+	add_c_function(*mod_list, list_map, "map", 2, "core/List;*F;");
+	add_c_function(*mod_list, list_filter, "filter", 2, "core/List;*F;");
+	add_c_function(*mod_list, list_fold, "fold", 3, "core/List;*A;*F;");
+	add_c_function(*mod_list, list_sort, "sort", 1, "core/List;");
+	add_c_function(*mod_list, list_format, "format", 1, "core/List;");
+	add_c_function(*mod_list, parallel_map, "pmap", 2, "core/List;*F;");
+	add_c_function(*mod_list, parallel_reduce, "preduce", 3
+			, "core/List;*A;*F;");
+	add_c_function(*mod_list, parallel_each, "peach", 2, "core/List;*F;");
+
+	Module *mod_map = const_cast< Module * >(load_module(app, "map"));
+	if (!mod_map) {
+		return -1;
+	}
+	add_type(*mod_map, "Map", TYPE_MAP);
+	add_c_function(*mod_map, map_empty, "empty", 0, "");
+	add_c_function(*mod_map, map_insert, "insert", 3, "map/Map;*K;*V;");
+	add_c_function(*mod_map, map_find, "find", 2, "map/Map;*K;");
+	add_c_function(*mod_map, map_contains, "contains", 2, "map/Map;*K;");
+	add_c_function(*mod_map, map_size, "size", 1, "map/Map;");
+	add_c_function(*mod_map, map_from_lists, "from_lists", 2
+			, "core/List;core/List;");
+
+	Module *mod_set = const_cast< Module * >(load_module(app, "set"));
+	if (!mod_set) {
+		return -1;
+	}
+	add_type(*mod_set, "Set", TYPE_SET);
+	add_c_function(*mod_set, set_empty, "empty", 0, "");
+	add_c_function(*mod_set, set_insert, "insert", 2, "set/Set;*T;");
+	add_c_function(*mod_set, set_contains, "contains", 2, "set/Set;*T;");
+	add_c_function(*mod_set, set_size, "size", 1, "set/Set;");
+	add_c_function(*mod_set, set_from_list, "from_list", 1, "core/List;");
+
+	Module *mod_vector = const_cast< Module * >(load_module(app, "vector"));
+	if (!mod_vector) {
+		return -1;
+	}
+	add_type(*mod_vector, "Vector", TYPE_VECTOR);
+	add_c_function(*mod_vector, vector_from_list, "from_list", 1
+			, "core/List;");
+	add_c_function(*mod_vector, vector_slice, "slice", 3
+			, "vector/Vector;core/Int;core/Int;");
+	add_c_function(*mod_vector, vector_concat, "concat", 2
+			, "vector/Vector;vector/Vector;");
+	add_c_function(*mod_vector, parallel_map, "pmap", 2
+			, "vector/Vector;*F;");
+	add_c_function(*mod_vector, parallel_reduce, "preduce", 3
+			, "vector/Vector;*A;*F;");
+	add_c_function(*mod_vector, parallel_each, "peach", 2
+			, "vector/Vector;*F;");
+
+	Module *mod_array = const_cast< Module * >(load_module(app, "array"));
+	if (!mod_array) {
+		return -1;
+	}
+	add_type(*mod_array, "Array", TYPE_ARRAY);
+	add_c_function(*mod_array, array_from, "from_list", 1, "core/List;");
+	add_c_function(*mod_array, array_from, "from_vector", 1
+			, "vector/Vector;");
+	add_c_function(*mod_array, array_to_list, "to_list", 1
+			, "array/Array;");
+	add_c_function(*mod_array, array_to_float, "to_float", 1
+			, "array/Array;");
+	add_c_function(*mod_array, array_length, "length", 1, "array/Array;");
+	add_c_function(*mod_array, array_get, "get", 2
+			, "array/Array;core/Int;");
+	add_c_function(*mod_array, array_add, "add", 2, "array/Array;*N;");
+	add_c_function(*mod_array, array_sub, "sub", 2, "array/Array;*N;");
+	add_c_function(*mod_array, array_mul, "mul", 2, "array/Array;*N;");
+	add_c_function(*mod_array, array_div, "div", 2, "array/Array;*N;");
+	add_c_function(*mod_array, array_lt, "lt", 2, "array/Array;*N;");
+	add_c_function(*mod_array, array_gt, "gt", 2, "array/Array;*N;");
+	add_c_function(*mod_array, array_eq, "eq", 2, "array/Array;*N;");
+	add_c_function(*mod_array, array_sum, "sum", 1, "array/Array;");
+	add_c_function(*mod_array, array_min, "min", 1, "array/Array;");
+	add_c_function(*mod_array, array_max, "max", 1, "array/Array;");
+	add_c_function(*mod_array, array_dot, "dot", 2
+			, "array/Array;array/Array;");
+	add_c_function(*mod_array, array_gather, "gather", 2
+			, "array/Array;array/Array;");
+	add_c_override(*mod_array, array_str, "core", "Stringy", "str", 1
+			, "array/Array");
+
+	Module *mod_binary = const_cast< Module * >(load_module(app, "binary"));
+	if (!mod_binary) {
+		return -1;
+	}
+	add_type(*mod_binary, "Binary", TYPE_BINARY);
+	add_c_function(*mod_binary, binary_length, "length", 1
+			, "binary/Binary;");
+	add_c_function(*mod_binary, binary_get, "get", 2
+			, "binary/Binary;core/Int;");
+	add_c_function(*mod_binary, binary_slice, "slice", 3
+			, "binary/Binary;core/Int;core/Int;");
+	add_c_function(*mod_binary, binary_find, "find", 3
+			, "binary/Binary;core/String;core/Int;");
+	add_c_function(*mod_binary, binary_line, "line", 2
+			, "binary/Binary;core/Int;");
+	add_c_function(*mod_binary, binary_lines, "lines", 1
+			, "binary/Binary;");
+	add_c_function(*mod_binary, binary_str, "str", 1, "binary/Binary;");
+	add_c_function(*mod_binary, binary_from_str, "from_str", 1
+			, "core/String;");
+	add_c_function(*mod_binary, binary_join, "join", 1, "core/List;");
+	add_c_override(*mod_binary, binary_str, "core", "Stringy", "str", 1
+			, "binary/Binary");
+
+	Module *mod_io = new Module("io");
+	add_c_function(*mod_io, core_print, "print", 1, "core/String;");
+	add_c_function(*mod_io, core_open, "open", 2
+			, "core/String;core/String;");
+	add_c_function(*mod_io, core_write, "write", 2
+			, "io/Stream;core/String;");
+	add_c_function(*mod_io, core_getline, "getline", 1, "io/Stream;");
+	add_c_function(*mod_io, core_getlines, "getlines", 1, "io/Stream;");
+	add_c_function(*mod_io, core_fsync, "fsync", 1, "io/Stream;");
+	add_c_function(*mod_io, core_read, "read", 1, "io/Stream;");
+	add_c_function(*mod_io, core_close, "close", 1, "io/Stream;");
+	add_c_function(*mod_io, core_listen, "listen", 1, "core/String;");
+	add_c_function(*mod_io, core_accept, "accept", 1, "io/Stream;");
+	add_c_function(*mod_io, core_connect, "connect", 1, "core/String;");
+	add_c_function(*mod_io, core_transfer, "transfer", 2
+			, "io/Stream;io/Stream;");
+	add_c_function(*mod_io, core_timeout, "timeout", 2
+			, "io/Stream;core/Int;");
+	add_c_function(*mod_io, core_readbin, "readbin", 2
+			, "io/Stream;core/Int;");
+	add_c_function(*mod_io, core_writebin, "writebin", 2
+			, "io/Stream;binary/Binary;");
+	add_c_function(*mod_io, core_mmap, "mmap", 1, "core/String;");
+	add_c_function(*mod_io, core_udp, "udp", 1, "core/String;");
+	add_c_function(*mod_io, core_recvmsgs, "recvmsgs", 1, "io/Stream;");
+	add_c_function(*mod_io, core_sendmsgs, "sendmsgs", 3
+			, "io/Stream;core/String;core/List;");
+
+	load_module(app, mod_list);
+	load_module(app, mod_io);
+	// QBRT_IO=uring picks io_uring, workers use epoll if it's missing
+	const char *io_engine(getenv("QBRT_IO"));
+	app.use_ring = io_engine && strcmp(io_engine, "uring") == 0;
+	// a worker for each cpu so parallel jobs can use all of them
+	long worker_count(sysconf(_SC_NPROCESSORS_ONLN));
+	if (worker_count < MIN_WORKERS) {
+		worker_count = MIN_WORKERS;
+	}
+	for (long i(0); i<worker_count; ++i) {
+		new_worker(app);
+	}
+
+	const Module *main_module = load_module(app, objname);
+	if (!main_module) {
+		return 1;
+	}
+
+	const QbrtFunction *qbrt_main(main_module->fetch_function("__main"));
+	if (!qbrt_main) {
+		cerr << "no __main function defined\n";
+		return 1;
+	}
+	function_value *main_func = function_value::create(qbrt_main);
+	int main_func_argc(main_func->argc);
+	if (main_func_argc >= 1) {
+		qbrt_value::i(main_func->regv[0], argc - 1);
+	}
+	if (main_func_argc >= 2) {
+		// build it from the back so it doesn't need to be reversed
+		qbrt_value &head(main_func->regv[1]);
+		List::empty(head);
+		for (int i(argc - 1); i>=1; --i) {
+			qbrt_value arg;
+			qbrt_value::str(arg, argv[i]);
+			List::push(head, arg);
+		}
+	}
+
+	Stream *stream_stdin = std_stream(stdin);
+	Stream *stream_stdout = std_stream(stdout);
+	print_stream = stream_stdout;
+
+
+	qbrt_value result;
+	qbrt_value::i(result, 0);
+	FunctionCall *main_call = new FunctionCall(result, *qbrt_main
+			, *main_func);
+	qbrt_value::stream(*add_context(main_call, atom("stdin"))
+			, stream_stdin);
+	qbrt_value::stream(*add_context(main_call, atom("stdout"))
+			, stream_stdout);
+	ProcessRoot *main_proc = new_process(app, main_call);
+
+	Application::WorkerMap::iterator wit(app.worker.begin());
+	for (; wit!=app.worker.end(); ++wit) {
+		Worker &w(*wit->second);
+		pthread_create(&w.thread, &w.thread_attr, launch_worker, &w);
+	}
 
 	application_loop(app);
+	Stream::flush_all();
 
 	if (qbrt_value::failed(result)) {
 		Failure *fail = result.data.failure;
@@ -0,0 +1,59 @@
+#ifndef QBRT_ARRAY_H
+#define QBRT_ARRAY_H
+
+#include "qbrt/core.h"
+
+
+#define ARRAY_INT	0
+#define ARRAY_FLOAT	1
+
+#define ARRAY_ADD	0
+#define ARRAY_SUB	1
+#define ARRAY_MUL	2
+#define ARRAY_DIV	3
+
+#define ARRAY_LT	0
+#define ARRAY_GT	1
+#define ARRAY_EQ	2
+
+/**
+ * Packed array of ints or floats
+ *
+ * Items are stored unboxed and 32 byte aligned so the kernels can
+ * work on several at once with SSE2 or AVX2 instructions. Arrays
+ * are not changed once they're built.
+ */
+struct Array
+{
+	union {
+		int64_t *i;
+		double *fp;
+	} data;
+	uint32_t count;
+	uint8_t elem;
+
+	uint32_t size() const { return count; }
+	void get(qbrt_value &, uint32_t i) const;
+
+	static Array * create(uint8_t elem, uint32_t count);
+
+	/** Apply the op to the items at each index of a and b */
+	static Array * arith(uint8_t op, const Array &a, const Array &b);
+	/** Apply the op to each item and a number */
+	static Array * arith(uint8_t op, const Array &a, const qbrt_value &b);
+	/** Return an int array that is 1 where the comparison holds */
+	static Array * compare(uint8_t op, const Array &a, const Array &b);
+	static Array * compare(uint8_t op, const Array &a, const qbrt_value &b);
+	/** Return the items at each index, indexes must be in range */
+	static Array * gather(const Array &, const Array &index);
+	static Array * to_float(const Array &);
+
+	void sum(qbrt_value &) const;
+	/** The array must not be empty */
+	void min(qbrt_value &) const;
+	/** The array must not be empty */
+	void max(qbrt_value &) const;
+	static void dot(qbrt_value &, const Array &a, const Array &b);
+};
+
+#endif
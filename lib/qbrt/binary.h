@@ -0,0 +1,77 @@
+#ifndef QBRT_BINARY_H
+#define QBRT_BINARY_H
+
+#include <stdint.h>
+#include <string.h>
+
+
+/**
+ * Bytes shared by the binaries that view them
+ *
+ * The bytes are either allocated with the buffer, outside any value,
+ * or mapped read only from a file. The buffer counts the binaries
+ * that view it and the reads filling it, and is freed, or unmapped,
+ * when the last lets go. Bytes are only written while the buffer is being filled,
+ * never once a binary views them, so binaries can go to other
+ * processes and workers without a copy.
+ */
+struct BinaryBuffer
+{
+	uint32_t refcount;
+	bool mapped;
+	uint64_t size;
+	char *data;
+
+	/** Allocate room for size bytes, return NULL if there isn't any */
+	static BinaryBuffer * create(uint64_t size);
+	/**
+	 * Resize a buffer no binary views yet, keeping its bytes
+	 * Return NULL and leave buf as it was if there isn't room.
+	 */
+	static BinaryBuffer * grow(BinaryBuffer *buf, uint64_t size);
+	/** Map a whole file, return NULL if it can't be mapped */
+	static BinaryBuffer * map(int fd);
+	static void retain(BinaryBuffer *);
+	static void release(BinaryBuffer *);
+};
+
+/**
+ * Immutable view of some of a buffer's bytes
+ *
+ * A binary counts the values and queued writes that hold it, like
+ * a string, and lets go of its buffer when the last of them does.
+ */
+struct Binary
+{
+	const char *data;
+	BinaryBuffer *buffer;
+	uint64_t size;
+	mutable uint32_t refcount;
+
+	bool empty() const { return size == 0; }
+	/** Offset of the first match at or after from, -1 if none */
+	int64_t find(const char *, uint32_t len, uint64_t from) const;
+	/** Offset of the newline ending the line at offset, or size */
+	uint64_t line_end(uint64_t offset) const;
+
+	static Binary * view(BinaryBuffer *, const char *, uint64_t size);
+	/** Share part of a binary, clamped to what it has */
+	static Binary * slice(const Binary &, uint64_t offset, uint64_t len);
+	static void retain(const Binary *);
+	static void release(const Binary *);
+
+	static int compare(const Binary &a, const Binary &b)
+	{
+		uint64_t n(a.size < b.size ? a.size : b.size);
+		int comparison(n ? memcmp(a.data, b.data, n) : 0);
+		if (comparison) {
+			return comparison;
+		}
+		if (a.size < b.size) {
+			return -1;
+		}
+		return a.size > b.size ? 1 : 0;
+	}
+};
+
+#endif
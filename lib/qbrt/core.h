@@ -5,6 +5,8 @@
 #include <map>
 #include <string>
 #include <vector>
+#include "qbrt/string.h"
+#include "qbrt/binary.h"
 
 
 // TYPE DECLARATIONS
@@ -18,7 +20,9 @@ struct Worker;
 struct Type;
 struct List;
 struct Map;
+struct Set;
 struct Vector;
+struct Array;
 struct Stream;
 struct Tuple;
 struct Promise;
@@ -27,6 +31,49 @@ struct Construct;
 struct OpContext;
 typedef void (*c_function)(OpContext &, qbrt_value &out);
 
+/**
+ * Hashtags are interned into a global table so they can be
+ * stored and compared as integers
+ */
+typedef uint32_t Atom;
+Atom atom(const char *name, uint16_t length);
+Atom atom(const std::string &name);
+const std::string & atom_name(Atom);
+
+/**
+ * Atoms for the runtime's own failures, interned before any others
+ * so their ids are constants and creating a failure skips the table
+ */
+enum BuiltinAtom
+{
+	ATOM_TYPEFAILURE
+	, ATOM_MODULE404
+	, ATOM_FUNCTION404
+	, ATOM_REGISTER404
+	, ATOM_FIELD404
+	, ATOM_CONSTRUCT404
+	, ATOM_INDEX404
+	, ATOM_KEY404
+	, ATOM_NOTFOUND
+	, ATOM_EMPTY
+	, ATOM_EOF
+	, ATOM_FILE404
+	, ATOM_IOERROR
+	, ATOM_TIMEOUT
+	, ATOM_BADADDRESS
+	, ATOM_OVERFLOW
+	, ATOM_DIVIDEBY0
+	, ATOM_BADSHIFT
+	, ATOM_TOOBIG
+	, ATOM_SIZEMISMATCH
+	, ATOM_UNKNOWN_CONTEXT
+	, ATOM_INVALIDOPCODE
+	, ATOM_INVALIDCMPOP
+	, ATOM_CALLBACKFAILED
+	, ATOM_CALLBACKBLOCKED
+	, NUM_BUILTIN_ATOMS
+};
+
 
 // VALUE TYPES
 
@@ -48,6 +95,8 @@ typedef void (*c_function)(OpContext &, qbrt_value &out);
 #define VT_PROMISE	0x10
 #define VT_SET		0x11
 #define VT_PATTERNVAR	0x12
+#define VT_ARRAY	0x13
+#define VT_BINARY	0x14
 #define VT_FAILURE	0xff
 
 extern Type TYPE_VOID;
@@ -61,7 +110,10 @@ extern Type TYPE_TUPLE;
 extern Type TYPE_FUNCTION;
 extern Type TYPE_LIST;
 extern Type TYPE_MAP;
+extern Type TYPE_SET;
 extern Type TYPE_VECTOR;
+extern Type TYPE_ARRAY;
+extern Type TYPE_BINARY;
 extern Type TYPE_STREAM;
 extern Type TYPE_KIND;
 extern Type TYPE_PROMISE;
@@ -73,11 +125,10 @@ struct qbrt_value
 	union {
 		bool b;
 		int64_t i;
-		std::string *str;
-		std::string *hashtag;
+		const String *str;
+		Atom hashtag;
 		function_value *f;
-		// binary_value *bin;
-		// uint8_t *bin;
+		const Binary *bin;
 		double fp;
 		qbrt_value *ref;
 		qbrt_value_index *reg;
@@ -86,7 +137,9 @@ struct qbrt_value
 		Tuple *tuple;
 		List *list;
 		Map *map;
+		Set *set;
 		Vector *vect;
+		Array *arr;
 		Stream *stream;
 		Promise *promise;
 		Failure *failure;
@@ -121,35 +174,71 @@ struct qbrt_value
 		data.str = NULL;
 		default_value(*this, t);
 	}
+	qbrt_value(const qbrt_value &v)
+	: data(v.data)
+	, type(v.type)
+	{
+		retain(*this);
+	}
+	qbrt_value & operator = (const qbrt_value &v)
+	{
+		retain(v);
+		set_void(*this);
+		data = v.data;
+		type = v.type;
+		return *this;
+	}
 	static void default_value(qbrt_value &, const Type &);
-	static void set_void(qbrt_value &);
+	static void set_void(qbrt_value &v)
+	{
+		release(v);
+		v.data.str = NULL;
+		v.type = &TYPE_VOID;
+	}
 	static void b(qbrt_value &v, bool b)
 	{
+		set_void(v);
 		v.type = &TYPE_BOOL;
 		v.data.b = b;
 	}
 	static void i(qbrt_value &v, int64_t i)
 	{
+		set_void(v);
 		v.type = &TYPE_INT;
 		v.data.i = i;
 	}
 	static void fp(qbrt_value &v, double f)
 	{
+		set_void(v);
 		v.type = &TYPE_FLOAT;
 		v.data.fp = f;
 	}
-	static void str(qbrt_value &v, const std::string &s)
+	static void str(qbrt_value &v, const String *s)
 	{
+		// s may already be in v, hold it before letting go of v
+		String::retain(s);
+		set_void(v);
 		v.type = &TYPE_STRING;
-		v.data.str = new std::string(s);
+		v.data.str = s;
 	}
-	static void hashtag(qbrt_value &v, const std::string &h)
+	static void str(qbrt_value &v, const std::string &s)
+	{
+		str(v, String::create(s));
+	}
+	static void hashtag(qbrt_value &v, Atom a)
 	{
+		set_void(v);
 		v.type = &TYPE_HASHTAG;
-		v.data.hashtag = new std::string(h);
+		v.data.hashtag = a;
+	}
+	static void hashtag(qbrt_value &v, const std::string &h)
+	{
+		hashtag(v, atom(h));
 	}
 	static void f(qbrt_value &v, function_value *f)
 	{
+		retain_function(f);
+		set_void(v);
 		v.type = &TYPE_FUNCTION;
 		v.data.f = f;
 	}
@@ -168,16 +257,19 @@ struct qbrt_value
 	}
 	static void construct(qbrt_value &v, const Type *t, Construct *cons)
 	{
+		set_void(v);
 		v.type = t;
 		v.data.cons = cons;
 	}
 	static void patternvar(qbrt_value &v)
 	{
+		set_void(v);
 		v.type = &TYPE_PATTERNVAR;
 		v.data.reg = NULL;
 	}
 	static void promise(qbrt_value &v, Promise *p)
 	{
+		set_void(v);
 		v.type = &TYPE_PROMISE;
 		v.data.promise = p;
 	}
@@ -187,8 +279,15 @@ struct qbrt_value
 		v.type = &TYPE_MAP;
 		v.data.map = m;
 	}
+	static void set(qbrt_value &v, Set *s)
+	{
+		set_void(v);
+		v.type = &TYPE_SET;
+		v.data.set = s;
+	}
 	static void tuple(qbrt_value &v, Tuple *tup)
 	{
+		set_void(v);
 		v.type = &TYPE_TUPLE;
 		v.data.tuple = tup;
 	}
@@ -198,6 +297,19 @@ struct qbrt_value
 		dst.type = &TYPE_VECTOR;
 		dst.data.vect = v;
 	}
+	static void arr(qbrt_value &dst, Array *a)
+	{
+		set_void(dst);
+		dst.type = &TYPE_ARRAY;
+		dst.data.arr = a;
+	}
+	static void bin(qbrt_value &dst, const Binary *b)
+	{
+		Binary::retain(b);
+		set_void(dst);
+		dst.type = &TYPE_BINARY;
+		dst.data.bin = b;
+	}
 	static void stream(qbrt_value &dst, Stream *s)
 	{
 		set_void(dst);
@@ -229,7 +341,39 @@ struct qbrt_value
 
 	static void append_type(std::ostringstream &, const qbrt_value &);
 
-	~qbrt_value() {}
+	~qbrt_value()
+	{
+		release(*this);
+	}
+
+private:
+	/**
+	 * Strings, binaries and function values count the values
+	 * that hold them
+	 */
+	static void retain(const qbrt_value &v)
+	{
+		if (v.type == &TYPE_STRING) {
+			String::retain(v.data.str);
+		} else if (v.type == &TYPE_BINARY) {
+			Binary::retain(v.data.bin);
+		} else if (v.type == &TYPE_FUNCTION) {
+			retain_function(v.data.f);
+		}
+	}
+	static void release(const qbrt_value &v)
+	{
+		if (v.type == &TYPE_STRING) {
+			String::release(v.data.str);
+		} else if (v.type == &TYPE_BINARY) {
+			Binary::release(v.data.bin);
+		} else if (v.type == &TYPE_FUNCTION) {
+			release_function(v.data.f);
+		}
+	}
+	/** function_value isn't complete here, these are in function.cpp */
+	static void retain_function(function_value *);
+	static void release_function(function_value *);
 };
 
 struct qbrt_value_index
@@ -240,6 +384,8 @@ struct qbrt_value_index
 };
 
 int qbrt_compare(const qbrt_value &, const qbrt_value &);
+/** Hash a value so that values that compare equal hash the same */
+uint32_t qbrt_hash(const qbrt_value &);
 
 static inline const Type & value_type(const qbrt_value &v)
 {
@@ -261,10 +407,13 @@ static inline const Type & value_type(const qbrt_value &v)
 #define OP_LFUNC	0x0a
 #define OP_LOADOBJ	0x0b
 #define OP_LOADTYPE	0x0c
+#define OP_CONSTF	0x0d
 #define OP_LCONTEXT	0x0f
 #define OP_GOTO		0x11
 #define OP_IF		0x12
 #define OP_IFNOT	0x13
+#define OP_SWITCH	0x14
+#define OP_CASE		0x15
 #define OP_IFLT		0x16
 #define OP_IFLTEQ	0x17
 #define OP_IFGT		0x18
@@ -281,6 +430,18 @@ static inline const Type & value_type(const qbrt_value &v)
 #define OP_ISUB		0x31
 #define OP_IMULT	0x32
 #define OP_IDIV		0x33
+#define OP_IMOD		0x34
+#define OP_IAND		0x35
+#define OP_IOR		0x36
+#define OP_IXOR		0x37
+#define OP_ISHL		0x38
+#define OP_ISHR		0x39
+#define OP_FADD		0x3a
+#define OP_FSUB		0x3b
+#define OP_FMULT	0x3c
+#define OP_FDIV		0x3d
+#define OP_ITOF		0x3e
+#define OP_FTOI		0x3f
 #define OP_CTUPLE	0x40
 #define OP_STUPLE	0x41
 #define OP_CLIST	0x42
@@ -300,6 +461,10 @@ static inline const Type & value_type(const qbrt_value &v)
 #define OP_MATCHARGS	0x51
 #define OP_FIELDGET	0x52
 #define OP_FIELDSET	0x53
+#define OP_VGET		0x54
+#define OP_VSET		0x55
+#define OP_VPUSH	0x56
+#define OP_VLEN		0x57
 #define NUM_OP_CODES	0x100
 
 
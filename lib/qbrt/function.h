@@ -6,6 +6,7 @@
 #include "qbrt/resourcetype.h"
 #include <set>
 #include <stack>
+#include <vector>
 #include <iostream>
 #include <sstream>
 
@@ -349,15 +350,25 @@ private:
 	uint8_t fctx;
 };
 
+/**
+ * Function values keep their registers inline after the header.
+ * If a polymorph needs more registers than were allocated,
+ * realloc() moves them to a separate heap array.
+ * Use function_value::create() to allocate one. It counts the
+ * values and calls that hold it and is freed when the last lets go.
+ */
 struct function_value
 : public qbrt_value_index
 {
 	const Function *func;
 	qbrt_value *regv;
+	uint32_t refcount;
 	uint8_t argc;
 	uint8_t regc;
 
-	function_value(const Function *);
+	static function_value * create(const Function *);
+	static void retain(function_value *);
+	static void release(function_value *);
 	void realloc(uint8_t regc);
 
 	uint8_t fcontext() const { return func->fcontext(); }
@@ -374,6 +385,13 @@ struct function_value
 	uint8_t num_values() const { return regc; }
 	qbrt_value & value(uint8_t r) { return regv[r]; }
 	const qbrt_value & value(uint8_t r) const { return regv[r]; }
+
+private:
+	function_value(const Function *);
+	~function_value() {}
+	static void destroy(function_value *);
+
+	qbrt_value * inline_regv() { return (qbrt_value *) (this + 1); }
 };
 
 void load_function_value_types(std::ostringstream &, const function_value &);
@@ -408,96 +426,118 @@ static inline const char * fcontext_name(int fc) {
 	return "wtf_is_that_fcontext";
 }
 
+/**
+ * One step in a failure's trace
+ *
+ * Names point at strings owned by the module or function, so
+ * recording an event doesn't copy anything. They're only
+ * formatted when the trace is written.
+ */
 struct FailureEvent
 {
-	qbrt_value module;
-	qbrt_value function;
-	qbrt_value pc;
-	qbrt_value c_file;
-	qbrt_value c_lineno;
+	const char *module;
+	const char *function;
+	const char *c_file;
+	int c_lineno;
+	uint16_t pc;
 
 	FailureEvent()
-	: module(TYPE_STRING)
-	, function(TYPE_STRING)
-	, pc(TYPE_INT)
-	, c_file(TYPE_STRING)
-	, c_lineno(TYPE_INT)
+	: module(NULL)
+	, function(NULL)
+	, c_file(NULL)
+	, c_lineno(0)
+	, pc(0)
 	, direction(0)
 	{}
 
-	void up(const std::string &mod, const std::string &func, uint16_t pc)
+	void up(const char *mod, const char *func, uint16_t pc)
 	{
-		qbrt_value::str(module, mod);
-		qbrt_value::str(function, func);
-		qbrt_value::i(this->pc, pc);
+		module = mod;
+		function = func;
+		this->pc = pc;
 		direction = +1;
 	}
-	void down(const std::string &mod, const std::string &func, uint16_t pc
+	void down(const char *mod, const char *func, uint16_t pc
 			, const char *cfile, int cline)
 	{
 		set(mod, func, pc, cfile, cline);
 		direction = -1;
 	}
-	void set(const std::string &mod, const std::string &func, uint16_t pc
+	void set(const char *mod, const char *func, uint16_t pc
 			, const char *cfile, int cline)
 	{
-		qbrt_value::str(module, mod);
-		qbrt_value::str(function, func);
-		qbrt_value::i(this->pc, pc);
-		qbrt_value::str(c_file, cfile);
-		qbrt_value::i(c_lineno, cline);
+		module = mod;
+		function = func;
+		this->pc = pc;
+		c_file = cfile;
+		c_lineno = cline;
 	}
 
 	friend std::ostream & operator << (std::ostream &,const FailureEvent &);
 
 private:
-	int direction;
+	int8_t direction;
 };
 
+/**
+ * Failures are ordinary values so creating one should be cheap.
+ * The debug and usage streams are only allocated when written to
+ * and the trace stores pointers to names rather than copies.
+ */
 struct Failure
 : public qbrt_value_index
 {
 	qbrt_value type;		// 0
 	qbrt_value exit_code;		// 1
 	int http_code;			// 2
-	std::ostringstream debug;	// 3
-	std::ostringstream usage;	// 4
 	// these will go to the call stack
-	std::list< FailureEvent > trace;
+	std::vector< FailureEvent > trace;
 
-	Failure(const std::string type_label, const std::string &module
+	/** The module name must outlive the failure */
+	Failure(Atom type, const std::string &module
+			, const char *fname, int pc
+			, const char *cfile, int cline);
+	Failure(Atom type, const char *module
 			, const char *fname, int pc
 			, const char *cfile, int cline);
 
+	std::ostringstream & debug();
+	std::ostringstream & usage();
 	std::string debug_msg() const;
-	std::string usage_msg() const { return usage.str(); }
+	std::string usage_msg() const;
 
 	const std::string & typestr() const
 	{
-		return *type.data.str;
+		return atom_name(type.data.hashtag);
 	}
 	uint8_t num_values() const { return 1; }
 	qbrt_value & value(uint8_t);
 	const qbrt_value & value(uint8_t) const;
 
-	void trace_up(const std::string &mod, const std::string &fname
-			, uint16_t pc);
-	void trace_down(const std::string &mod, const std::string &fname
+	void trace_down(const std::string &mod, const char *fname
 			, uint16_t pc, const char *c_file, int c_line);
 
 	static void write(std::ostream &, const Failure &);
 	static void write_trace(std::ostream &
-			, const std::list< FailureEvent > &);
+			, const std::vector< FailureEvent > &);
+
+private:
+	std::ostringstream *debug_stream;
+	std::ostringstream *usage_stream;
 };
 
+/** Look up the type by name, use NEW_FAILURE_ATOM for builtin atoms */
 #define NEW_FAILURE(type, mod, fname, pc) \
+		(new Failure(atom(type), mod, fname, pc, __FILE__, __LINE__))
+#define NEW_FAILURE_ATOM(type, mod, fname, pc) \
 		(new Failure(type, mod, fname, pc, __FILE__, __LINE__))
-#define FAIL_TYPE(mod, fname, pc) (NEW_FAILURE("typefailure", mod, fname, pc))
+#define FAIL_TYPE(mod, fname, pc) \
+		(NEW_FAILURE_ATOM(ATOM_TYPEFAILURE, mod, fname, pc))
 #define FAIL_MODULE404(mod, fname, pc) \
-		(NEW_FAILURE("module404", mod, fname, pc))
+		(NEW_FAILURE_ATOM(ATOM_MODULE404, mod, fname, pc))
 #define FAIL_FUNCTION404(mod, fname, pc) \
-		(NEW_FAILURE("function404", mod, fname, pc))
+		(NEW_FAILURE_ATOM(ATOM_FUNCTION404, mod, fname, pc))
 #define FAIL_REGISTER404(mod, fname, pc) \
-		(NEW_FAILURE("register404", mod, fname, pc))
+		(NEW_FAILURE_ATOM(ATOM_REGISTER404, mod, fname, pc))
 
 #endif
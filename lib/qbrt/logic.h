@@ -78,6 +78,46 @@ struct matchargs_instruction
 	static const uint8_t SIZE = 7;
 };
 
+struct switch_instruction
+: public jump_instruction
+{
+	uint16_t input;
+
+	switch_instruction(reg_t in)
+	: jump_instruction(OP_SWITCH)
+	, input(in)
+	{}
+
+	static const uint8_t SIZE = 5;
+};
+
+#define CASE_INT	0
+#define CASE_BOOL	1
+#define CASE_HASHTAG	2
+#define CASE_CONSTRUCT	3
+
+/**
+ * One entry in a switch table. The cases for a switch come
+ * right after it, the jump is relative to the case.
+ *
+ * The key is the int itself for CASE_INT and CASE_BOOL, a hashtag
+ * resource for CASE_HASHTAG and a modsym resource for CASE_CONSTRUCT
+ */
+struct case_instruction
+: public jump_instruction
+{
+	uint8_t kind;
+	uint16_t key;
+
+	case_instruction(uint8_t kind, uint16_t key)
+	: jump_instruction(OP_CASE)
+	, kind(kind)
+	, key(key)
+	{}
+
+	static const uint8_t SIZE = 6;
+};
+
 struct fork_instruction
 : public jump_instruction
 {
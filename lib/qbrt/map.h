@@ -4,57 +4,99 @@
 #include "core.h"
 #include <string.h>
 
-struct Map
+
+struct MapEntry
 {
 	qbrt_value key;
 	qbrt_value value;
-	Map *left;
-	Map *right;
+};
 
-	Map()
-		: value()
-		, left(NULL)
-		, right(NULL)
-	{}
+struct SetEntry
+{
+	qbrt_value key;
+};
+
+template < typename Entry >
+struct HamtNode;
+
+/**
+ * Persistent hash array mapped trie
+ *
+ * Each level of the trie uses 5 bits of the key's hash, so a lookup
+ * visits at most 7 nodes no matter what order keys were inserted.
+ * Inserting copies the path from the root and leaves the old trie
+ * unchanged.
+ *
+ * A transient trie has a nonzero edit id. Nodes it creates are
+ * marked with that id and are changed in place by later inserts,
+ * which makes building a trie with many inserts cheap. Call
+ * persist() before sharing it.
+ */
+template < typename Entry >
+struct Hamt
+{
+	HamtNode< Entry > *root;
+	uint32_t count;
+	uint32_t edit;
 
-	Map(const qbrt_value &key, const qbrt_value &val)
-		: key(key)
-		, value(val)
-		, left(NULL)
-		, right(NULL)
+	Hamt()
+	: root(NULL)
+	, count(0)
+	, edit(0)
 	{}
-};
 
+	const Entry * find(const qbrt_value &key) const;
+	/** Return the entry for a key, adding it if it isn't there */
+	Entry & insert(const qbrt_value &key);
 
-Map * insert(Map *m, const qbrt_value &key, const qbrt_value &val)
+	void transient();
+	void persist() { edit = 0; }
+};
+
+struct Map
 {
-	if (!m) {
-		return new Map(key, val);
+	Hamt< MapEntry > trie;
+
+	uint32_t size() const { return trie.count; }
+	const qbrt_value * find(const qbrt_value &key) const
+	{
+		const MapEntry *e(trie.find(key));
+		return e ? &e->value : NULL;
 	}
-	Map *copy = new Map(*m);
-	int comparison(qbrt_compare(key, m->key));
-	if (comparison < 0) {
-		copy->left = insert(copy->left, key, val);
-	} else if (comparison > 0) {
-		copy->right = insert(copy->right, key, val);
-	} else {
-		copy->value = val;
+
+	static Map * create() { return new Map(); }
+	/** Return a new map with the key set to the value */
+	static Map * insert(const Map &, const qbrt_value &key
+			, const qbrt_value &value);
+
+	/** Return a copy of the map that can be changed in place */
+	static Map * transient(const Map &);
+	/** Set a key in a transient map */
+	void insert_in_place(const qbrt_value &key, const qbrt_value &v)
+	{
+		trie.insert(key).value = v;
 	}
-	return copy;
-}
+	/** Stop changing the map in place */
+	void persist() { trie.persist(); }
+};
 
-qbrt_value * find(Map *m, const qbrt_value &key)
+struct Set
 {
-	if (!m) {
-		return NULL;
-	}
-	int comparison(qbrt_compare(key, m->key));
-	if (comparison < 0) {
-		return find(m->left, key);
-	} else if (comparison > 0) {
-		return find(m->right, key);
+	Hamt< SetEntry > trie;
+
+	uint32_t size() const { return trie.count; }
+	bool contains(const qbrt_value &key) const
+	{
+		return trie.find(key) != NULL;
 	}
-	return &m->value;
-}
+
+	static Set * create() { return new Set(); }
+	/** Return a new set that includes the key */
+	static Set * insert(const Set &, const qbrt_value &key);
+
+	static Set * transient(const Set &);
+	void insert_in_place(const qbrt_value &key) { trie.insert(key); }
+	void persist() { trie.persist(); }
+};
 
 #endif
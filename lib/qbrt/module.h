@@ -207,6 +207,8 @@ struct Module
 
 	Module(const std::string &module_name)
 	: name(module_name)
+	, resource()
+	, cache_lock(0)
 	{}
 
 	friend void add_type(Module &, const std::string &name, const Type &);
@@ -214,12 +216,39 @@ struct Module
 
 	static void load_construct(qbrt_value &, const Module &
 			, const char *name);
+	friend void load_nullary_constructs(Module &);
+	friend void load_string_constants(Module &);
+	friend void load_hashtag_atoms(Module &);
+
+	/** Get the string value for a string resource in this module */
+	const String * string_constant(uint16_t idx) const
+	{
+		return string_constants[idx];
+	}
+	/** Get the interned atom for a hashtag resource in this module */
+	Atom hashtag_atom(uint16_t idx) const
+	{
+		return hashtag_atoms[idx];
+	}
 
 private:
 	const QbrtFunction * qbrt_function(const FunctionHeader *) const;
 	mutable std::map< const FunctionHeader *, const QbrtFunction * >
 		function_cache;
 	mutable std::map< uint16_t, const Type * > indexed_type_cache;
+	/** Guards the caches, workers can fill them at the same time */
+	mutable volatile int cache_lock;
+	void lock_cache() const
+	{
+		while (__sync_lock_test_and_set(&cache_lock, 1)) {}
+	}
+	void unlock_cache() const { __sync_lock_release(&cache_lock); }
+	/** Shared immutable instances of constructs with no fields */
+	std::map< const ConstructResource *, qbrt_value > nullary_construct;
+	/** String values pointing at this module's string resources */
+	std::vector< const String * > string_constants;
+	/** Atoms for this module's hashtag resources */
+	std::vector< Atom > hashtag_atoms;
 };
 typedef std::map< std::string, const Module * > ModuleMap;
 
@@ -233,6 +262,9 @@ const CFunction * fetch_c_override(const Module &, const std::string &protomod
 
 const ConstructResource * find_construct(const Module &
 		, const std::string &name);
+void load_nullary_constructs(Module &);
+void load_string_constants(Module &);
+void load_hashtag_atoms(Module &);
 
 static inline const char * fetch_string(const ResourceTable &tbl, uint16_t idx)
 {
@@ -4,7 +4,10 @@
 #include "qbrt/core.h"
 #include "qbrt/function.h"
 #include <set>
+#include <map>
 #include <list>
+#include <vector>
+#include <string.h>
 #include <pthread.h>
 
 
@@ -24,9 +27,11 @@ typedef uint8_t CodeFrameState;
 
 typedef uint32_t WorkerID; // this should just be OS thread id?
 
+struct CodeFrame;
 struct ParallelPath;
 struct FunctionCall;
 struct ProcessRoot;
+struct Worker;
 struct StreamIO;
 struct Module;
 struct Application;
@@ -38,17 +43,49 @@ struct Pipe
 public:
 	Pipe()
 	: pipe_lock()
+	, waiter(NULL)
+	, waiter_dst(NULL)
 	{
 		pthread_spin_init(&pipe_lock, PTHREAD_PROCESS_PRIVATE);
 	}
 
 	bool empty() const;
-	void push(qbrt_value *);
+	/**
+	 * Push a message, or give it straight to the frame waiting for
+	 * one. Return that frame so it can be woken.
+	 */
+	CodeFrame * push(qbrt_value *);
+	/** Pop the next message or return NULL if there isn't one */
 	qbrt_value * pop();
+	/** Pop a message into dst or wait for one, false if waiting */
+	bool pop_or_wait(qbrt_value &dst, CodeFrame *);
+	/** Stop waiting, return false if a message already came */
+	bool cancel_wait(CodeFrame *);
 
 private:
 	std::list< qbrt_value * > data;
-	pthread_spinlock_t pipe_lock;
+	/** Any worker can send to a process so the data is locked */
+	mutable pthread_spinlock_t pipe_lock;
+	CodeFrame *waiter;
+	qbrt_value *waiter_dst;
+};
+
+/**
+ * Context variables visible to a frame, sorted by name
+ *
+ * Tables are never modified once a frame uses them, so child frames
+ * share their parent's table and adding a context copies it.
+ */
+struct ContextTable
+{
+	struct Entry
+	{
+		Atom name;
+		qbrt_value *value;
+	};
+	std::vector< Entry > entry;
+
+	qbrt_value * find(Atom) const;
 };
 
 struct CodeFrame
@@ -69,7 +106,7 @@ struct CodeFrame
 	, cftype(type)
 	, cfstate(CFS_READY)
 	, pc(0)
-	, frame_context()
+	, frame_context(parent.frame_context)
 	{}
 
 	CodeFrame(CodeFrameType type)
@@ -79,8 +116,9 @@ struct CodeFrame
 	, cftype(type)
 	, cfstate(CFS_READY)
 	, pc(0)
-	, frame_context()
+	, frame_context(NULL)
 	{}
+	virtual ~CodeFrame() {}
 
 	virtual FunctionCall & function_call() = 0;
 	virtual const FunctionCall & function_call() const = 0;
@@ -94,11 +132,11 @@ struct CodeFrame
 	virtual void finish_frame(Worker &) = 0;
 
 	static void backtrace(Failure &, const CodeFrame *);
-	friend qbrt_value * get_context(CodeFrame *, const std::string &);
-	friend qbrt_value * add_context(CodeFrame *, const std::string &);
+	const ContextTable * context() const { return frame_context; }
+	friend qbrt_value * add_context(CodeFrame *, Atom name);
 
 private:
-	std::map< std::string, qbrt_value > frame_context;
+	const ContextTable *frame_context;
 
 public:
 	typedef std::list< CodeFrame * > List;
@@ -108,27 +146,33 @@ struct FunctionCall
 : public CodeFrame
 {
 	qbrt_value *result;
-	qbrt_value_index &regv;
+	/** Held by the call until it's done */
+	function_value &regv;
 	const FunctionHeader *header;
 	const Module *mod;
 
 	FunctionCall(qbrt_value &result, const QbrtFunction &func
-			, qbrt_value_index &vals)
+			, function_value &vals)
 	: CodeFrame(CFT_CALL)
 	, result(&result)
 	, regv(vals)
 	, header(func.header)
 	, mod(func.mod)
-	{}
+	{
+		function_value::retain(&regv);
+	}
 	FunctionCall(CodeFrame &parent, qbrt_value &result
-			, const QbrtFunction &func, qbrt_value_index &vals)
+			, const QbrtFunction &func, function_value &vals)
 	: CodeFrame(parent, CFT_CALL)
 	, result(&result)
 	, regv(vals)
 	, header(func.header)
 	, mod(func.mod)
-	{}
-	FunctionCall(const QbrtFunction &func, qbrt_value_index &vals);
+	{
+		function_value::retain(&regv);
+	}
+	FunctionCall(const QbrtFunction &func, function_value &vals);
+	~FunctionCall();
 
 	virtual void finish_frame(Worker &);
 
@@ -175,6 +219,34 @@ static inline ParallelPath * fork_frame(CodeFrame &src)
 }
 
 
+/**
+ * Data parallel work that any worker can help run
+ *
+ * Workers claim chunks of the job's indexes, each taking a share of
+ * what's left so chunks shrink as the job nears the end. Chunks run
+ * on a path forked from the frame that started the job.
+ */
+struct ParallelJob
+{
+	CodeFrame *frame;
+	uint32_t count;
+	uint32_t next;
+	uint32_t done;
+	/** Smallest chunk to claim, grows when items are quick */
+	uint32_t grain;
+
+	ParallelJob(CodeFrame &frame, uint32_t count)
+	: frame(&frame)
+	, count(count)
+	, next(0)
+	, done(0)
+	, grain(1)
+	{}
+	virtual ~ParallelJob() {}
+
+	virtual void run_chunk(Worker &, uint32_t begin, uint32_t end) = 0;
+};
+
 struct ProcessRoot
 {
 	Worker *owner;
@@ -209,6 +281,109 @@ struct ProcessRoot
  * These problems can probably be punted on for now and worked out
  * once it's time to add multiple workers
  */
+/**
+ * Remembers the field index most recently resolved by a fieldget
+ * or fieldset instruction so repeated access skips the name lookup
+ */
+struct FieldCache
+{
+	const instruction *op;
+	const ConstructResource *construct;
+	int16_t index;
+};
+#define FIELD_CACHE_SIZE 64
+
+/**
+ * Remembers the context variable most recently found by an
+ * lcontext instruction for a given context table
+ */
+struct ContextCache
+{
+	const instruction *op;
+	const ContextTable *table;
+	qbrt_value *value;
+};
+#define CONTEXT_CACHE_SIZE 16
+
+struct SwitchTable;
+struct IoRing;
+struct TimerWheel;
+
+/**
+ * A stream fd registered with a worker's epoll set. The fd stays
+ * registered while the worker uses the stream and is re-armed
+ * whenever a frame starts waiting on it.
+ */
+struct IOWatch
+{
+	Stream *stream;
+	/** The stream's fd, kept after closing the stream clears it */
+	int fd;
+	/** Frames waiting to read or write, in the order they asked */
+	CodeFrame::List readers;
+	CodeFrame::List writers;
+	/** The events epoll will report next, 0 once they've fired */
+	uint32_t armed;
+	/** False for regular files, their io goes to helper threads */
+	bool pollable;
+	/** Set once the stream is closed and its worker forgot the fd */
+	bool closed;
+
+	IOWatch(Stream *s, int fd)
+	: stream(s)
+	, fd(fd)
+	, readers()
+	, writers()
+	, armed(0)
+	, pollable(true)
+	, closed(false)
+	{}
+};
+
+/**
+ * Io a helper thread runs for a frame. Only the first frame waiting
+ * to read or to write a stream goes to a helper.
+ */
+struct BlockingJob
+{
+	Worker *w;
+	CodeFrame *frame;
+	/** Set by the helper if the io finished */
+	bool done;
+};
+
+/** A stream another worker closed and the fd it had */
+struct ClosedStream
+{
+	Stream *stream;
+	int fd;
+};
+
+/** Remembers the jump table for a switch instruction */
+struct SwitchCache
+{
+	const instruction *op;
+	const SwitchTable *table;
+};
+#define SWITCH_CACHE_SIZE 16
+
+#define DISPATCH_MAX_ARGS 4
+/**
+ * Identifies a polymorphic call by its default function and the shape
+ * of each argument. A construct's shape is its resource because its
+ * type name includes its field types, anything else's is its type.
+ */
+struct DispatchKey
+{
+	const Function *func;
+	const void *shape[DISPATCH_MAX_ARGS];
+
+	friend bool operator < (const DispatchKey &a, const DispatchKey &b)
+	{
+		return memcmp(&a, &b, sizeof(DispatchKey)) < 0;
+	}
+};
+
 struct Worker
 {
 	Application &app;
@@ -219,12 +394,39 @@ struct Worker
 	CodeFrame *current;
 	CodeFrame::List *fresh;
 	CodeFrame::List *stale;
+	/** New processes handed over by the application thread */
+	CodeFrame::List incoming;
+	mutable pthread_spinlock_t incoming_lock;
 	qbrt_value drain;
+	/** The worker's io_uring, io uses epfd if it's NULL */
+	IoRing *ring;
 	int epfd;
+	/** Deadlines for the frames waiting on io */
+	TimerWheel *timers;
+	/** Number of frames waiting on io */
 	int iocount;
+	/** Instructions run since io was last polled */
+	uint32_t ioticks;
+	/** Set while the worker has nothing to run and waits on its io */
+	volatile int sleeping;
+	std::map< int, IOWatch * > iowatch;
+	/** Jobs handed back by helper threads, done or to run again */
+	std::list< BlockingJob > iodone;
+	/** Streams closed by other workers, also guarded by iodone_lock */
+	std::vector< ClosedStream > closed;
+	pthread_spinlock_t iodone_lock;
+	/** eventfd in the epoll set, signalled when iodone gets a job */
+	int iodone_fd;
 	WorkerID id;
 	TaskID next_taskid;
 	TaskID next_pid;
+	FieldCache field_cache[FIELD_CACHE_SIZE];
+	ContextCache context_cache[CONTEXT_CACHE_SIZE];
+	SwitchCache switch_cache[SWITCH_CACHE_SIZE];
+	/** Jump tables built by this worker, kept for the life of the code */
+	std::map< const instruction *, SwitchTable * > switch_table;
+	/** Where polymorphic calls went, NULL if to the default function */
+	std::map< DispatchKey, const Function * > dispatch;
 
 	Worker(Application &, WorkerID);
 
@@ -250,6 +452,11 @@ const CFunction * find_c_override(Worker &, const std::string &protomod
 void gotowork(Worker &);
 void * launch_worker(void *);
 
+/** Run one chunk of any parallel job, return false if there are none */
+bool parallel_work(Worker &);
+/** Start a parallel job and help run it until every chunk is done */
+void run_parallel_job(Worker &, ParallelJob &);
+
 
 struct Application
 {
@@ -258,10 +465,14 @@ struct Application
 	ModuleMap module;
 	ProcessRoot::Map newproc;
 	ProcessRoot::Map recv;
+	std::list< ParallelJob * > parallel;
 	pthread_spinlock_t application_lock;
+	pthread_spinlock_t parallel_lock;
 	WorkerID next_workerid;
 	uint64_t pid_count;
 	bool running;
+	/** Workers use io_uring instead of epoll when it's available */
+	bool use_ring;
 
 	Application();
 	~Application();
@@ -279,6 +490,8 @@ const CFunction * find_c_override(Application &, const std::string &protomod
 		, const std::string &protoname, const std::string &name
 		, const std::string &param_types);
 bool send_msg(Application &, uint64_t pid, const qbrt_value &src);
+/** Give a message to a process, waking it if it's waiting for one */
+void deliver_msg(ProcessRoot &, const qbrt_value &src);
 Worker & new_worker(Application &);
 ProcessRoot * new_process(Application &, FunctionCall *);
 void application_loop(Application &);
@@ -2,6 +2,7 @@
 #define QBRT_STMT_H
 
 #include "qbrt/resourcetype.h"
+#include "qbrt/logic.h"
 #include <string>
 #include <list>
 #include <map>
@@ -148,6 +149,23 @@ struct binaryop_stmt
 	void pretty(std::ostream &) const;
 };
 
+struct convert_stmt
+: public Stmt
+{
+	convert_stmt(uint8_t op, AsmReg *dst, AsmReg *src)
+	: dst(dst)
+	, src(src)
+	, opcode(op)
+	{}
+	AsmReg *dst;
+	AsmReg *src;
+	uint8_t opcode;
+
+	void allocate_registers(RegAlloc *);
+	void generate_code(AsmFunc &);
+	void pretty(std::ostream &) const;
+};
+
 struct bindtype_stmt
 : public Stmt
 {
@@ -290,6 +308,21 @@ struct consti_stmt
 	void pretty(std::ostream &) const;
 };
 
+struct constf_stmt
+: public Stmt
+{
+	constf_stmt(AsmReg *dst, double val)
+		: dst(dst)
+		, value(val)
+	{}
+	AsmReg *dst;
+	double value;
+
+	void allocate_registers(RegAlloc *);
+	void generate_code(AsmFunc &);
+	void pretty(std::ostream &) const;
+};
+
 struct consts_stmt
 : public Stmt
 {
@@ -574,6 +607,58 @@ struct lfunc_stmt
 /**
  * Pattern match on a given register value
  */
+struct switch_stmt
+: public Stmt
+{
+	switch_stmt(AsmReg *in, const std::string &dflt)
+	: input(in)
+	, dflt(dflt)
+	{}
+
+	AsmReg *input;
+	AsmLabel dflt;
+
+	void allocate_registers(RegAlloc *);
+	void generate_code(AsmFunc &);
+	void pretty(std::ostream &) const;
+};
+
+struct case_stmt
+: public Stmt
+{
+	case_stmt(int64_t val, const std::string &lbl)
+	: label(lbl)
+	, hashtag()
+	, modsym(NULL)
+	, value(val)
+	, kind(CASE_INT)
+	{}
+	case_stmt(const std::string &hash, const std::string &lbl)
+	: label(lbl)
+	, hashtag(hash)
+	, modsym(NULL)
+	, value(0)
+	, kind(CASE_HASHTAG)
+	{}
+	case_stmt(AsmModSym *ms, const std::string &lbl)
+	: label(lbl)
+	, hashtag()
+	, modsym(ms)
+	, value(0)
+	, kind(CASE_CONSTRUCT)
+	{}
+
+	AsmLabel label;
+	AsmHashTag hashtag;
+	AsmModSym *modsym;
+	int64_t value;
+	uint8_t kind;
+
+	void collect_resources(ResourceSet &);
+	void generate_code(AsmFunc &);
+	void pretty(std::ostream &) const;
+};
+
 struct match_stmt
 : public Stmt
 {
@@ -684,6 +769,111 @@ struct stracc_stmt
 	void pretty(std::ostream &) const;
 };
 
+struct clist_stmt
+: public Stmt
+{
+	clist_stmt(AsmReg *dst)
+	: dst(dst)
+	{}
+	AsmReg *dst;
+
+	void allocate_registers(RegAlloc *);
+	void generate_code(AsmFunc &);
+	void pretty(std::ostream &) const;
+};
+
+struct cons_stmt
+: public Stmt
+{
+	cons_stmt(AsmReg *head, AsmReg *item)
+	: head(head)
+	, item(item)
+	{}
+	AsmReg *head;
+	AsmReg *item;
+
+	void allocate_registers(RegAlloc *);
+	void generate_code(AsmFunc &);
+	void pretty(std::ostream &) const;
+};
+
+struct cvect_stmt
+: public Stmt
+{
+	cvect_stmt(AsmReg *dst)
+	: dst(dst)
+	{}
+	AsmReg *dst;
+
+	void allocate_registers(RegAlloc *);
+	void generate_code(AsmFunc &);
+	void pretty(std::ostream &) const;
+};
+
+struct vget_stmt
+: public Stmt
+{
+	vget_stmt(AsmReg *dst, AsmReg *src, AsmReg *idx)
+	: dst(dst)
+	, src(src)
+	, idx(idx)
+	{}
+	AsmReg *dst;
+	AsmReg *src;
+	AsmReg *idx;
+
+	void allocate_registers(RegAlloc *);
+	void generate_code(AsmFunc &);
+	void pretty(std::ostream &) const;
+};
+
+struct vlen_stmt
+: public Stmt
+{
+	vlen_stmt(AsmReg *dst, AsmReg *src)
+	: dst(dst)
+	, src(src)
+	{}
+	AsmReg *dst;
+	AsmReg *src;
+
+	void allocate_registers(RegAlloc *);
+	void generate_code(AsmFunc &);
+	void pretty(std::ostream &) const;
+};
+
+struct vpush_stmt
+: public Stmt
+{
+	vpush_stmt(AsmReg *dst, AsmReg *src)
+	: dst(dst)
+	, src(src)
+	{}
+	AsmReg *dst;
+	AsmReg *src;
+
+	void allocate_registers(RegAlloc *);
+	void generate_code(AsmFunc &);
+	void pretty(std::ostream &) const;
+};
+
+struct vset_stmt
+: public Stmt
+{
+	vset_stmt(AsmReg *dst, AsmReg *idx, AsmReg *src)
+	: dst(dst)
+	, idx(idx)
+	, src(src)
+	{}
+	AsmReg *dst;
+	AsmReg *idx;
+	AsmReg *src;
+
+	void allocate_registers(RegAlloc *);
+	void generate_code(AsmFunc &);
+	void pretty(std::ostream &) const;
+};
+
 struct wait_stmt
 : public Stmt
 {
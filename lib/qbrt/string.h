@@ -1,6 +1,10 @@
 #ifndef QBRT_STRING_H
 #define QBRT_STRING_H
 
+#include <stdint.h>
+#include <string>
+#include <ostream>
+
 
 struct StringResource
 {
@@ -14,4 +18,106 @@ struct HashTagResource
 	const char value[];
 };
 
+
+/**
+ * Growable character storage shared by the strings that view it.
+ * Strings only ever append past the end of what's been used so
+ * existing views never see their characters change.
+ */
+struct StringBuffer
+{
+	uint32_t refcount;
+	uint32_t capacity;
+	uint32_t used;
+	char data[];
+
+	static StringBuffer * create(uint32_t capacity);
+	static void retain(StringBuffer *);
+	static void release(StringBuffer *);
+};
+
+/**
+ * Immutable string value
+ *
+ * The characters are stored inline after the String header,
+ * in a shared StringBuffer, or externally in module data.
+ * Strings are not null terminated. A string counts the values and
+ * queued writes that hold it and is freed when the last lets go.
+ * A slice of inline characters holds the string they belong to.
+ */
+struct String
+{
+	const char *chars;
+	StringBuffer *buffer;
+	/** String whose inline characters these are, if not this one */
+	const String *owner;
+	uint32_t size;
+	mutable uint32_t refcount;
+
+	bool empty() const { return size == 0; }
+	std::string str() const { return std::string(chars, size); }
+	bool inline_chars() const
+	{
+		return chars == (const char *) (this + 1);
+	}
+
+	/** Create a string with a copy of the given characters */
+	static String * create(const char *, uint32_t size);
+	static String * create(const std::string &s)
+	{
+		return create(s.data(), s.size());
+	}
+	static String * create(int64_t);
+	/** Create a string that points to characters it doesn't own */
+	static String * literal(const char *, uint32_t size);
+	/** Share characters with another string without copying them */
+	static String * slice(const String &, uint32_t offset, uint32_t len);
+	/** Return a new string with characters appended to the first */
+	static String * append(const String &, const char *, uint32_t size);
+	static String * append(const String &a, const String &b)
+	{
+		return append(a, b.chars, b.size);
+	}
+	static String * append(const String &, int64_t);
+	/** Create a string that views characters in a shared buffer */
+	static String * view(StringBuffer *, const char *, uint32_t size);
+	static void retain(const String *);
+	static void release(const String *);
+
+	static int compare(const String &, const String &);
+
+	friend bool operator < (const String &a, const String &b)
+	{
+		return String::compare(a, b) < 0;
+	}
+	friend bool operator > (const String &a, const String &b)
+	{
+		return String::compare(a, b) > 0;
+	}
+	friend bool operator == (const String &a, const String &b)
+	{
+		return String::compare(a, b) == 0;
+	}
+	friend std::ostream & operator << (std::ostream &o, const String &s)
+	{
+		return o.write(s.chars, s.size);
+	}
+
+private:
+	String(const char *c, StringBuffer *buf, uint32_t sz)
+	: chars(c)
+	, buffer(buf)
+	, owner(NULL)
+	, size(sz)
+	, refcount(0)
+	{}
+	~String() {}
+};
+
+/**
+ * Write the decimal digits for an integer backwards from end
+ * Return a pointer to the first digit
+ */
+char * format_int(char *end, int64_t);
+
 #endif
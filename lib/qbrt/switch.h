@@ -0,0 +1,48 @@
+#ifndef QBRT_SWITCH_H
+#define QBRT_SWITCH_H
+
+#include "core.h"
+#include "logic.h"
+#include <vector>
+
+
+/**
+ * Jump table for a switch instruction
+ *
+ * Maps the ints, hashtags and construct types named by the switch's
+ * case instructions to a jump from the switch. Small ints that are
+ * close together index straight into an array, everything else goes
+ * through an open addressed hash, so finding a case doesn't depend
+ * on how many cases there are.
+ */
+struct SwitchTable
+{
+	SwitchTable(int32_t default_jump);
+
+	/** Add a case, if the key is already there the first one wins */
+	void add(uint8_t kind, uint64_t key, int32_t jump);
+	/** Build the lookup tables once all cases are added */
+	void finish();
+
+	/** Return the jump for a value or the default jump */
+	int32_t find(const qbrt_value &) const;
+
+private:
+	struct Slot
+	{
+		uint64_t key;
+		int32_t jump;
+		uint8_t kind;
+	};
+
+	int32_t find(uint8_t kind, uint64_t key) const;
+
+	std::vector< Slot > cases;
+	std::vector< Slot > slot;
+	std::vector< int32_t > dense;
+	int64_t dense_base;
+	uint32_t mask;
+	int32_t default_jump;
+};
+
+#endif
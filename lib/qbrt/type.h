@@ -46,22 +46,18 @@ struct ConstructResource
 	static const uint32_t SIZE = 12;
 };
 
+/**
+ * Construct values are allocated in a single block with the fields
+ * stored inline after the header. Use Construct::create() to allocate one.
+ * Values share constructs by pointer so they're never freed.
+ */
 struct Construct
 : public qbrt_value_index
 {
 	const Module &mod;
 	const ConstructResource &resource;
-	qbrt_value *fields;
 
-	Construct(const Module &m, const ConstructResource &cr)
-	: mod(m)
-	, resource(cr)
-	, fields(new qbrt_value[cr.fld_count])
-	{}
-	~Construct()
-	{
-		delete[] fields;
-	}
+	static Construct * create(const Module &, const ConstructResource &);
 
 	friend bool operator < (const Construct &a, const Construct &b)
 	{
@@ -77,47 +73,92 @@ struct Construct
 	}
 
 	uint8_t num_values() const { return resource.fld_count; }
-	qbrt_value & value(uint8_t i) { return fields[i]; }
-	const qbrt_value & value(uint8_t i) const { return fields[i]; }
+	qbrt_value & value(uint8_t i) { return fields()[i]; }
+	const qbrt_value & value(uint8_t i) const { return fields()[i]; }
 
 	const char * name() const;
 	const DataTypeResource * datatype() const;
-	static bool compare(const Construct &, const Construct &);
+	/** Return the index of the named field or -1 if there isn't one */
+	int16_t field_index(const char *field_name) const;
+	static int compare(const Construct &, const Construct &);
+
+private:
+	Construct(const Module &m, const ConstructResource &cr)
+	: mod(m)
+	, resource(cr)
+	{}
+	~Construct() {}
+
+	qbrt_value * fields() { return (qbrt_value *) (this + 1); }
+	const qbrt_value * fields() const
+	{
+		return (const qbrt_value *) (this + 1);
+	}
 };
 
 void load_construct_value_types(std::ostringstream &, const Construct &);
 
 
+/**
+ * Tuple values store their data inline after the header.
+ * Use Tuple::create() to allocate one. Like constructs, tuples are
+ * shared by pointer and never freed.
+ */
 struct Tuple
 : public qbrt_value_index
 {
-	qbrt_value *data;
 	uint8_t size;
 
+	static Tuple * create(uint8_t size);
+
+	uint8_t num_values() const { return size; }
+	qbrt_value & value(uint8_t i) { return data()[i]; }
+	const qbrt_value & value(uint8_t i) const { return data()[i]; }
+
+private:
 	Tuple(uint8_t sz)
-		: data(new qbrt_value[sz])
-		, size(sz)
+	: size(sz)
 	{}
+	~Tuple() {}
 
-	~Tuple()
+	qbrt_value * data() { return (qbrt_value *) (this + 1); }
+	const qbrt_value * data() const
 	{
-		delete[] data;
+		return (const qbrt_value *) (this + 1);
 	}
-
-	uint8_t num_values() const { return size; }
-	qbrt_value & value(uint8_t i) { return data[i]; }
-	const qbrt_value & value(uint8_t i) const { return data[i]; }
 };
 
 
-/** Static class for operating on list.List constructs */
+/**
+ * Static class for operating on list/List values
+ *
+ * Lists are list/Node and list/Empty constructs, so they match like
+ * any other construct. The constructs are found once when the list
+ * module is loaded, so building or walking a list never looks up
+ * a name. Every empty list is the same shared Empty value.
+ */
 struct List
 {
+	static void init(const Module &list_module);
+
+	static void empty(qbrt_value &result) { result = s_empty; }
+	/** Set result to a new Node of item followed by tail */
+	static void cons(qbrt_value &result, const qbrt_value &item
+			, const qbrt_value &tail);
 	static void push(qbrt_value &head, const qbrt_value &item);
 	static void reverse(qbrt_value &result, const qbrt_value &head);
 	static void head(qbrt_value &result, const qbrt_value &head);
 	static void pop(qbrt_value &result, const qbrt_value &head);
 	static void is_empty(qbrt_value &result, const qbrt_value &head);
+
+	/** Empty has no fields, a Node has a value and next */
+	static bool empty(const Construct &c) { return c.num_values() == 0; }
+
+private:
+	static const Module *s_module;
+	static const ConstructResource *s_node;
+	static const Type *s_type;
+	static qbrt_value s_empty;
 };
 
 
@@ -133,6 +174,9 @@ struct Type
 
 	static int compare(const Type &a, const Type &b)
 	{
+		if (&a == &b) {
+			return 0;
+		}
 		if (a.id < b.id) {
 			return -1;
 		}
@@ -4,54 +4,61 @@
 #include "qbrt/core.h"
 #include <string.h>
 
+
+struct VectorNode;
+
+/**
+ * Persistent vector
+ *
+ * Values are kept in a 32-way trie of leaves with the last leaf held
+ * outside the trie as the tail, so pushing a value usually copies
+ * only the tail. Internal nodes store the cumulative size of their
+ * children (an RRB tree), which lets slice and concat build trees
+ * with partly full nodes without copying every value.
+ *
+ * A transient vector has a nonzero edit id and changes the nodes it
+ * created in place. Call persist() before sharing it.
+ */
 struct Vector
 {
-	qbrt_value value[16];
-	Vector *higher[16];
+	VectorNode *root;
+	VectorNode *tail;
+	uint32_t count;
+	uint32_t edit;
+	uint8_t shift;
 
 	Vector()
-		: value()
-	{
-		memset(higher, 0, sizeof(higher));
-	}
-
-	Vector(const Vector &v)
-		: value(v.value)
-	{
-		memcpy(higher, v.higher, sizeof(higher));
-	}
-};
+	: root(NULL)
+	, tail(NULL)
+	, count(0)
+	, edit(0)
+	, shift(0)
+	{}
 
-Vector * set(Vector *v, uint32_t i, const qbrt_value &val)
-{
-	uint32_t lower(i & 0xf);
-	uint32_t upper(i >> 4);
-	Vector *copy;
-	if (v) {
-		copy = new Vector(*v);
-	} else {
-		copy = new Vector();
-	}
-	if (upper == 0) {
-		copy->value[lower] = val;
-	} else {
-		copy->higher[lower] = set(v->higher[lower], upper, val);
-	}
-	return copy;
-}
-
-qbrt_value * get(Vector *v, uint32_t i)
-{
-	if (!v) {
-		return NULL;
-	}
-	uint32_t lower(i & 0xf);
-	uint32_t upper(i >> 4);
-	if (upper == 0) {
-		return &v->value[lower];
-	} else {
-		return get(v->higher[lower], upper);
-	}
-}
+	uint32_t size() const { return count; }
+	/** Get the value at an index or NULL if it's out of range */
+	const qbrt_value * get(uint32_t i) const;
+
+	static Vector * create() { return new Vector(); }
+	/** Return a new vector with the value added at the end */
+	static Vector * push(const Vector &, const qbrt_value &);
+	/** Return a new vector with the index set to the value */
+	static Vector * set(const Vector &, uint32_t i, const qbrt_value &);
+	/** Return the values from start up to but not including end */
+	static Vector * slice(const Vector &, uint32_t start, uint32_t end);
+	static Vector * concat(const Vector &, const Vector &);
+
+	/** Return a copy of the vector that can be changed in place */
+	static Vector * transient(const Vector &);
+	void push_in_place(const qbrt_value &);
+	/** Set an index in a transient vector, it must be in range */
+	void set_in_place(uint32_t i, const qbrt_value &);
+	/** Stop changing the vector in place */
+	void persist() { edit = 0; }
+
+private:
+	uint32_t tail_offset() const;
+	void push_leaf(VectorNode *);
+};
 
 #endif
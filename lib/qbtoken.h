@@ -109,6 +109,14 @@ struct Token
 		return i;
 	}
 
+	double floatval() const
+	{
+		double f;
+		std::istringstream s(text);
+		s >> f;
+		return f;
+	}
+
 	bool boolval() const
 	{
 		bool b;
@@ -1,48 +1,152 @@
 #include "qbrt/schedule.h"
 #include "qbrt/module.h"
 #include "io.h"
+#include "ioring.h"
+#include "timer.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
 
 using namespace std;
 
-#define MAX_EPOLL_EVENTS 16
+#define MAX_EPOLL_EVENTS 256
+/** Poll io after this many instructions if nothing else has */
+#define IO_POLL_INSTRUCTIONS	4096
+/** Helper threads for io that epoll can't wait on */
+#define BLOCKING_IO_THREADS	4
+/** Submission entries in each worker's io_uring */
+#define IORING_ENTRIES	256
+/** io_uring user data for the iodone eventfd, frames are never NULL */
+#define IORING_IODONE	0
+/** io_uring user data for cancels, frames are never at address 1 */
+#define IORING_CANCEL	1
+/** Each chunk claims 1/(share * workers) of what's left in a job */
+#define PARALLEL_SHARE	2
+/** Aim for chunks that take at least this long to run */
+#define PARALLEL_CHUNK_NS	50000
 
 
 bool Pipe::empty() const
 {
-	return data.empty();
+	pthread_spin_lock(&pipe_lock);
+	bool result(data.empty());
+	pthread_spin_unlock(&pipe_lock);
+	return result;
 }
 
-void Pipe::push(qbrt_value *val)
+CodeFrame * Pipe::push(qbrt_value *val)
 {
-	data.push_back(val);
+	pthread_spin_lock(&pipe_lock);
+	CodeFrame *woken(waiter);
+	if (woken) {
+		*waiter_dst = *val;
+		waiter = NULL;
+		waiter_dst = NULL;
+	} else {
+		data.push_back(val);
+	}
+	pthread_spin_unlock(&pipe_lock);
+	return woken;
 }
 
 qbrt_value * Pipe::pop()
 {
-	qbrt_value *val = data.front();
-	data.pop_front();
+	qbrt_value *val(NULL);
+	pthread_spin_lock(&pipe_lock);
+	if (!data.empty()) {
+		val = data.front();
+		data.pop_front();
+	}
+	pthread_spin_unlock(&pipe_lock);
 	return val;
 }
 
-qbrt_value * get_context(CodeFrame *f, const string &name)
+bool Pipe::pop_or_wait(qbrt_value &dst, CodeFrame *frame)
 {
-	while (f) {
-		if (f->frame_context.find(name) == f->frame_context.end()) {
-			f = f->parent;
-			continue;
+	pthread_spin_lock(&pipe_lock);
+	bool popped(!data.empty());
+	if (popped) {
+		dst = *data.front();
+		data.pop_front();
+	} else {
+		waiter = frame;
+		waiter_dst = &dst;
+	}
+	pthread_spin_unlock(&pipe_lock);
+	return popped;
+}
+
+bool Pipe::cancel_wait(CodeFrame *frame)
+{
+	pthread_spin_lock(&pipe_lock);
+	bool waiting(waiter == frame);
+	if (waiting) {
+		waiter = NULL;
+		waiter_dst = NULL;
+	}
+	pthread_spin_unlock(&pipe_lock);
+	return waiting;
+}
+
+bool Sleep::expire()
+{
+	qbrt_value::set_void(dst);
+	return true;
+}
+
+bool Receive::handle()
+{
+	return pipe.pop_or_wait(dst, frame);
+}
+
+bool Receive::expire()
+{
+	if (!pipe.cancel_wait(frame)) {
+		// a message got here first and is waking the frame
+		return false;
+	}
+	qbrt_value::fail(dst, NEW_FAILURE_ATOM(ATOM_TIMEOUT
+			, "core", "recv", 0));
+	return true;
+}
+
+qbrt_value * ContextTable::find(Atom name) const
+{
+	vector< Entry >::const_iterator it(entry.begin());
+	for (; it!=entry.end() && it->name <= name; ++it) {
+		if (it->name == name) {
+			return it->value;
 		}
-		return &f->frame_context[name];
 	}
 	return NULL;
 }
 
-qbrt_value * add_context(CodeFrame *f, const string &name)
+/**
+ * Add a context variable to a frame. The frame gets a new table
+ * so frames sharing the old one aren't changed.
+ */
+qbrt_value * add_context(CodeFrame *f, Atom name)
 {
-	qbrt_value *ctx = get_context(f, name);
-	if (ctx) {
-		return ctx;
+	const ContextTable *old(f->frame_context);
+	if (old) {
+		qbrt_value *existing(old->find(name));
+		if (existing) {
+			return existing;
+		}
 	}
-	return &f->frame_context[name];
+
+	ContextTable *tbl(old ? new ContextTable(*old) : new ContextTable());
+	vector< ContextTable::Entry >::iterator it(tbl->entry.begin());
+	while (it != tbl->entry.end() && it->name < name) {
+		++it;
+	}
+	ContextTable::Entry e;
+	e.name = name;
+	e.value = new qbrt_value();
+	tbl->entry.insert(it, e);
+	f->frame_context = tbl;
+	return e.value;
 }
 
 void CodeFrame::io_pop()
@@ -56,22 +160,39 @@ void CodeFrame::io_pop()
 
 void CodeFrame::backtrace(Failure &f, const CodeFrame *frame)
 {
-	if (!frame) {
-		return;
+	// count the frames first so the trace only moves once
+	int depth(0);
+	for (const CodeFrame *i(frame); i; i=i->parent) {
+		++depth;
+	}
+	f.trace.insert(f.trace.begin(), depth, FailureEvent());
+	for (; frame; frame=frame->parent) {
+		const FunctionCall &call(frame->function_call());
+		f.trace[--depth].up(call.mod->name.c_str(), call.name()
+				, frame->pc);
 	}
-	const FunctionCall &call(frame->function_call());
-	f.trace_up(call.mod->name, call.name(), frame->pc);
-	backtrace(f, frame->parent);
 }
 
 
-FunctionCall::FunctionCall(const QbrtFunction &func, qbrt_value_index &vals)
+FunctionCall::FunctionCall(const QbrtFunction &func, function_value &vals)
 : CodeFrame(CFT_CALL)
 , result(NULL)
 , regv(vals)
 , header(func.header)
 , mod(func.mod)
-{}
+{
+	function_value::retain(&regv);
+}
+
+FunctionCall::~FunctionCall()
+{
+	// the function value may be called again with the args it has,
+	// but let go of the locals
+	for (uint8_t i(header->argc); i<regv.num_values(); ++i) {
+		qbrt_value::set_void(regv.value(i));
+	}
+	function_value::release(&regv);
+}
 
 const char * FunctionCall::name() const
 {
@@ -111,29 +232,78 @@ Worker::Worker(Application &app, WorkerID id)
 , process()
 , fresh(new CodeFrame::List())
 , stale(new CodeFrame::List())
+, incoming()
 , drain()
-, epfd(0)
+, ring(NULL)
+, epfd(-1)
+, timers(new TimerWheel())
 , iocount(0)
+, ioticks(0)
+, sleeping(0)
+, iowatch()
+, iodone()
+, closed()
+, iodone_fd(-1)
 , id(id)
 , next_taskid(0)
 , next_pid(0)
+, field_cache()
+, context_cache()
+, switch_cache()
+, switch_table()
 {
+	pthread_spin_init(&incoming_lock, PTHREAD_PROCESS_PRIVATE);
+	pthread_spin_init(&iodone_lock, PTHREAD_PROCESS_PRIVATE);
+	iodone_fd = eventfd(0, EFD_NONBLOCK);
+	if (app.use_ring) {
+		ring = IoRing::create(IORING_ENTRIES);
+	}
+	if (ring) {
+		ring->poll(iodone_fd, EPOLLIN, IORING_IODONE);
+		return;
+	}
 	epfd = epoll_create(1);
 	if (epfd < 0) {
 		perror("epoll_create failure");
 	}
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	// watches are never NULL so NULL means iodone
+	ev.data.ptr = NULL;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, iodone_fd, &ev) < 0) {
+		perror("eventfd failure");
+	}
 }
 
 bool Worker::empty() const
 {
+	// incoming moves to stale while locked
+	pthread_spin_lock(&incoming_lock);
 	bool empty = !current
 		&& (!fresh || fresh->empty())
-		&& (!stale || stale->empty());
+		&& (!stale || stale->empty())
+		&& incoming.empty()
+		&& iocount == 0;
+	pthread_spin_unlock(&incoming_lock);
 	return empty;
 }
 
+/** Move any processes assigned to this worker into its task list */
+static void take_incoming(Worker &w)
+{
+	pthread_spin_lock(&w.incoming_lock);
+	CodeFrame::List::const_iterator it(w.incoming.begin());
+	for (; it!=w.incoming.end(); ++it) {
+		ProcessRoot *proc((*it)->proc);
+		w.process[proc->pid] = proc;
+	}
+	w.stale->splice(w.stale->end(), w.incoming);
+	pthread_spin_unlock(&w.incoming_lock);
+}
+
 void findtask(Worker &w)
 {
+	take_incoming(w);
 	if (w.fresh->empty()) {
 		if (w.stale->empty()) {
 			// all tasks are waiting on io
@@ -222,6 +392,8 @@ const Module * load_module(Worker &w, const string &objname)
 	if (it != w.module.end()) {
 		return it->second;
 	}
+	// a new module can have overrides for calls already dispatched
+	w.dispatch.clear();
 	const Module *mod = find_app_module(w.app, objname);
 	if (mod) {
 		w.module[objname] = mod;
@@ -233,52 +405,751 @@ const Module * load_module(Worker &w, const string &objname)
 	return mod;
 }
 
+/** Wake a worker through its eventfd, its io wait returns */
+static void iowake(Worker &w)
+{
+	uint64_t one(1);
+	if (write(w.iodone_fd, &one, sizeof(one)) < 0) {
+		perror("eventfd write failure");
+	}
+}
+
+/** Wake a worker if it's sleeping with nothing to run */
+static void wake_idle(Worker &w)
+{
+	// pairs with the barrier in idle_wait so one of them sees
+	// the other's change
+	__sync_synchronize();
+	if (w.sleeping) {
+		iowake(w);
+	}
+}
+
 static void assign_process(Worker &w, ProcessRoot *proc)
 {
 	proc->owner = &w;
-	w.process[proc->pid] = proc;
-	w.stale->push_back(proc->call);
+	pthread_spin_lock(&w.incoming_lock);
+	w.incoming.push_back(proc->call);
+	pthread_spin_unlock(&w.incoming_lock);
+	wake_idle(w);
 }
 
-void iopush(Worker &w)
+static bool iorunning(const Worker &, const IOWatch &
+		, const CodeFrame::List &);
+
+/**
+ * Arm the fd for whatever the frames waiting on it need. The watch
+ * is oneshot so events stop once reported, until the next arm. A
+ * list whose first op is on a helper doesn't wait for epoll.
+ */
+static void ioarm(Worker &w, IOWatch &watch)
 {
-	// add this io
-	StreamIO &io(*w.current->io);
+	uint32_t events(0);
+	if (!watch.readers.empty() && !iorunning(w, watch, watch.readers)) {
+		events |= EPOLLIN;
+	}
+	if (!watch.writers.empty() && !iorunning(w, watch, watch.writers)) {
+		events |= EPOLLOUT;
+	}
+	if (!events || (events & watch.armed) == events) {
+		return;
+	}
 	epoll_event ev;
-	ev.events = io.events;
-	ev.data.ptr = w.current;
-	epoll_ctl(w.epfd, EPOLL_CTL_ADD, io.stream->fd, &ev);
-	++w.iocount;
-	w.current = NULL;
+	ev.events = events | EPOLLONESHOT;
+	ev.data.ptr = &watch;
+	epoll_ctl(w.epfd, EPOLL_CTL_MOD, watch.stream->fd, &ev);
+	watch.armed = events;
 }
 
-void iopop(Worker &w, CodeFrame *cf)
+/** Put a frame whose io is done back in the worker's task list */
+static void ioresume(Worker &w, CodeFrame *cf)
 {
-	epoll_ctl(w.epfd, EPOLL_CTL_DEL, cf->io->stream->fd, NULL);
-	--w.iocount;
+	w.timers->cancel(cf->io->timer);
 	cf->io_pop();
 	cf->cfstate = CFS_READY;
 	w.stale->push_back(cf);
+	__sync_sub_and_fetch(&w.iocount, 1);
+}
+
+/** Start the deadline for a frame's io if it has one */
+static void iotimer(Worker &w, CodeFrame *cf)
+{
+	int32_t timeout(cf->io->timeout());
+	if (timeout < 0 || cf->io->timer.pending()) {
+		// the deadline of an op that moved streams keeps going
+		return;
+	}
+	cf->io->timer.frame = cf;
+	w.timers->add(cf->io->timer, clock_ms(), timeout);
+}
+
+/** Run a frame's io, return false if it has to keep waiting */
+static bool ioready(Worker &w, CodeFrame *cf)
+{
+	if (!cf->io->handle()) {
+		return false;
+	}
+	ioresume(w, cf);
+	return true;
+}
+
+/** Io waiting for a helper thread, never freed since helpers outlive main */
+static list< BlockingJob > &blocking_queue(*new list< BlockingJob >());
+static pthread_mutex_t blocking_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t blocking_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t blocking_once = PTHREAD_ONCE_INIT;
+
+/** Hand a job back to its worker from another thread */
+static void iofinish(const BlockingJob &job)
+{
+	Worker &w(*job.w);
+	pthread_spin_lock(&w.iodone_lock);
+	w.iodone.push_back(job);
+	pthread_spin_unlock(&w.iodone_lock);
+	iowake(w);
+}
+
+/**
+ * Run io that blocks, then hand the job back to its worker. Io that
+ * has to wait more goes back too, the worker queues it again.
+ */
+static void * blocking_helper(void *)
+{
+	for (;;) {
+		pthread_mutex_lock(&blocking_lock);
+		while (blocking_queue.empty()) {
+			pthread_cond_wait(&blocking_cond, &blocking_lock);
+		}
+		BlockingJob job(blocking_queue.front());
+		blocking_queue.pop_front();
+		pthread_mutex_unlock(&blocking_lock);
+
+		job.done = job.frame->io->handle();
+		iofinish(job);
+	}
+	return NULL;
+}
+
+static void start_blocking_helpers()
+{
+	for (int i(0); i<BLOCKING_IO_THREADS; ++i) {
+		pthread_t thread;
+		pthread_create(&thread, NULL, blocking_helper, NULL);
+		pthread_detach(thread);
+	}
+}
+
+/** Give a frame's io to the helper threads */
+static void ioblock(Worker &w, CodeFrame *cf)
+{
+	pthread_once(&blocking_once, start_blocking_helpers);
+	BlockingJob job;
+	job.w = &w;
+	job.frame = cf;
+	job.done = false;
+	pthread_mutex_lock(&blocking_lock);
+	blocking_queue.push_back(job);
+	pthread_cond_signal(&blocking_cond);
+	pthread_mutex_unlock(&blocking_lock);
+}
+
+/** Make a watch for a stream, other workers hear when it's closed */
+static IOWatch * new_watch(Worker &w, Stream *stream)
+{
+	__sync_fetch_and_or(&stream->watchers, 1ull << (w.id % 64));
+	return new IOWatch(stream, stream->fd);
+}
+
+static void ioclosed(Worker &, IOWatch &, bool notify);
+
+/**
+ * Find the watch for a stream's fd. A watch left from a stream
+ * closed by another worker, whose fd has been reused, is closed.
+ */
+static IOWatch *& find_watch(Worker &w, Stream *stream)
+{
+	IOWatch *watch(w.iowatch[stream->fd]);
+	if (watch && watch->stream != stream) {
+		ioclosed(w, *watch, false);
+	}
+	return w.iowatch[stream->fd];
+}
+
+/** The frames waiting to read or to write, whichever op does */
+static CodeFrame::List & ioqueue(IOWatch &watch, const StreamIO &op)
+{
+	return (op.events & EPOLLIN) ? watch.readers : watch.writers;
+}
+
+/** Add a frame to the ones waiting on a watch */
+static CodeFrame::List & iowait(Worker &w, IOWatch &watch, CodeFrame *cf)
+{
+	CodeFrame::List &waiting(ioqueue(watch, *cf->io));
+	waiting.push_back(cf);
+	cf->io->watch = &watch;
+	iotimer(w, cf);
+	return waiting;
+}
+
+/** Return true if an op has moved to wait for something else */
+static bool iomoved(const StreamIO &op, Stream *stream, uint32_t events)
+{
+	return op.stream != stream || op.events != events;
+}
+
+/** Return true if an op on this watch runs on a helper thread */
+static bool iohelped(const Worker &w, const IOWatch &watch
+		, const StreamIO &op)
+{
+	// the ring can read files but anything else still blocks
+	return (!watch.pollable || op.blocks()) && !(w.ring && op.reads());
+}
+
+/** Queue a frame's io on the ring */
+static void ring_submit(Worker &, CodeFrame *);
+
+/**
+ * Start the io of the first frame waiting on a watch. Epoll
+ * starts it once ioarm says what the watch is waiting for.
+ */
+static void iostart(Worker &w, IOWatch &watch, CodeFrame *cf)
+{
+	if (iohelped(w, watch, *cf->io)) {
+		ioblock(w, cf);
+	} else if (w.ring) {
+		ring_submit(w, cf);
+	} else {
+		ioarm(w, watch);
+	}
+}
+
+/**
+ * Queue a frame's stream io on its watch. Only the first frame
+ * waiting to read or to write is given to the helpers so two of
+ * them never use a stream's buffers at once.
+ */
+static void ioqueue_helped(Worker &w, IOWatch &watch, CodeFrame *cf)
+{
+	CodeFrame::List &waiting(iowait(w, watch, cf));
+	if (&waiting == &watch.readers) {
+		++watch.stream->helper_reads;
+	}
+	if (waiting.front() == cf) {
+		ioblock(w, cf);
+	}
+}
+
+/** Tell the other workers that waited on a stream that it's closed */
+static void ioclose_notify(Worker &w, const IOWatch &watch)
+{
+	uint64_t watchers(watch.stream->watchers);
+	ClosedStream closed;
+	closed.stream = watch.stream;
+	closed.fd = watch.fd;
+	Application::WorkerMap::iterator it(w.app.worker.begin());
+	for (; it!=w.app.worker.end(); ++it) {
+		Worker &other(*it->second);
+		if (&other == &w || !(watchers & (1ull << (other.id % 64)))) {
+			continue;
+		}
+		pthread_spin_lock(&other.iodone_lock);
+		other.closed.push_back(closed);
+		pthread_spin_unlock(&other.iodone_lock);
+		iowake(other);
+	}
+}
+
+/**
+ * Fail the frames in a list that wait on a closed stream. If the
+ * first one's op is running it's left to finish on its own.
+ */
+static void ioabandon(Worker &w, IOWatch &watch, CodeFrame::List &waiting
+		, bool running)
+{
+	CodeFrame::List::iterator it(waiting.begin());
+	if (it != waiting.end() && running) {
+		if (w.ring && !iohelped(w, watch, *(*it)->io)) {
+			w.ring->cancel((uintptr_t) *it, IORING_CANCEL);
+		}
+		++it;
+	}
+	while (it != waiting.end()) {
+		CodeFrame *cf(*it);
+		it = waiting.erase(it);
+		if (&waiting == &watch.readers && iohelped(w, watch, *cf->io)) {
+			--watch.stream->helper_reads;
+		}
+		cf->io->closed();
+		ioresume(w, cf);
+	}
+}
+
+/** Return true if the first op waiting in the list already started */
+static bool iorunning(const Worker &w, const IOWatch &watch
+		, const CodeFrame::List &waiting)
+{
+	// only helpers and the ring run ops before they're ready
+	return !waiting.empty()
+		&& (w.ring || iohelped(w, watch, *waiting.front()->io));
+}
+
+/**
+ * Fail the frames waiting on a closed stream and forget its watch.
+ * Frames whose ops are already running finish first, the watch is
+ * deleted with the last of them.
+ */
+static void ioclosed(Worker &w, IOWatch &watch, bool notify)
+{
+	if (!watch.closed) {
+		watch.closed = true;
+		map< int, IOWatch * >::iterator it(w.iowatch.find(watch.fd));
+		if (it != w.iowatch.end() && it->second == &watch) {
+			w.iowatch.erase(it);
+		}
+		if (notify) {
+			ioclose_notify(w, watch);
+		}
+	}
+	ioabandon(w, watch, watch.readers, iorunning(w, watch, watch.readers));
+	ioabandon(w, watch, watch.writers, iorunning(w, watch, watch.writers));
+	if (watch.readers.empty() && watch.writers.empty()) {
+		delete &watch;
+	}
+}
+
+static void iopark(Worker &, CodeFrame *);
+
+/**
+ * Finish the reads waiting in a list whose bytes the stream already
+ * read for a reader ahead of them, so they don't wait on the kernel
+ * for bytes it won't send again.
+ */
+static void iobuffered(Worker &w, IOWatch &watch, CodeFrame::List &waiting)
+{
+	if (&waiting != &watch.readers) {
+		return;
+	}
+	while (!waiting.empty() && waiting.front()->io->buffered()) {
+		CodeFrame *cf(waiting.front());
+		waiting.pop_front();
+		if (iohelped(w, watch, *cf->io)) {
+			--watch.stream->helper_reads;
+		}
+		ioresume(w, cf);
+	}
+}
+
+/**
+ * Finish a helper's stream job and give the next frame waiting on
+ * the stream to the helpers. Io that has to wait more goes back to
+ * the helpers behind any other jobs.
+ */
+static void ioblock_done(Worker &w, const BlockingJob &job)
+{
+	CodeFrame *cf(job.frame);
+	StreamIO &op(*cf->io);
+	IOWatch &watch(*op.watch);
+	CodeFrame::List &waiting(
+			!watch.readers.empty() && watch.readers.front() == cf
+			? watch.readers : watch.writers);
+	bool done(job.done);
+	if (!done && op.expired) {
+		done = op.expire();
+	}
+	if (!done && watch.stream->fd < 0) {
+		op.closed();
+		done = true;
+	}
+	if (!done && op.stream == watch.stream
+			&& &ioqueue(watch, op) == &waiting)
+	{
+		ioblock(w, cf);
+		return;
+	}
+	waiting.pop_front();
+	if (&waiting == &watch.readers) {
+		--watch.stream->helper_reads;
+	}
+	if (done) {
+		ioresume(w, cf);
+	} else {
+		iopark(w, cf);
+	}
+	if (watch.stream->fd < 0) {
+		ioabandon(w, watch, waiting, false);
+		ioclosed(w, watch, true);
+		return;
+	}
+	iobuffered(w, watch, waiting);
+	if (!waiting.empty()) {
+		iostart(w, watch, waiting.front());
+	}
+}
+
+/** Finish the jobs the helper threads have run */
+static void iodone(Worker &w)
+{
+	uint64_t count;
+	if (read(w.iodone_fd, &count, sizeof(count)) < 0
+			&& errno != EAGAIN)
+	{
+		perror("eventfd read failure");
+	}
+	list< BlockingJob > done;
+	vector< ClosedStream > closed;
+	pthread_spin_lock(&w.iodone_lock);
+	done.swap(w.iodone);
+	closed.swap(w.closed);
+	pthread_spin_unlock(&w.iodone_lock);
+	list< BlockingJob >::const_iterator it(done.begin());
+	for (; it!=done.end(); ++it) {
+		if (it->frame->io->watch) {
+			ioblock_done(w, *it);
+		} else if (it->done) {
+			ioresume(w, it->frame);
+		} else {
+			ioblock(w, it->frame);
+		}
+	}
+	vector< ClosedStream >::const_iterator cit(closed.begin());
+	for (; cit!=closed.end(); ++cit) {
+		map< int, IOWatch * >::iterator wit(w.iowatch.find(cit->fd));
+		if (wit != w.iowatch.end() && wit->second
+				&& wit->second->stream == cit->stream)
+		{
+			ioclosed(w, *wit->second, false);
+		}
+	}
+}
+
+/**
+ * Queue a frame's io on the ring. Reads go straight into the
+ * stream's read buffer and accepts take the connection, anything
+ * else waits for poll events.
+ */
+static void ring_submit(Worker &w, CodeFrame *cf)
+{
+	StreamIO &op(*cf->io);
+	if (op.reads()) {
+		char *buf;
+		uint32_t len;
+		op.read_buffer(buf, len);
+		w.ring->read(op.stream->fd, buf, len, (uintptr_t) cf);
+	} else if (op.accepts()) {
+		w.ring->accept(op.stream->fd, (uintptr_t) cf);
+	} else {
+		w.ring->poll(op.stream->fd, op.events, (uintptr_t) cf);
+	}
+}
+
+/**
+ * Park a frame on the ring. Only the first frame waiting to read
+ * or write a stream has an op in the ring so they finish in order.
+ */
+static void ring_push(Worker &w, CodeFrame *cf)
+{
+	StreamIO &op(*cf->io);
+	IOWatch *&watch(find_watch(w, op.stream));
+	if (!watch) {
+		watch = new_watch(w, op.stream);
+		struct stat st;
+		if (fstat(op.stream->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+			watch->pollable = false;
+		}
+	}
+	if (iohelped(w, *watch, op)) {
+		ioqueue_helped(w, *watch, cf);
+		return;
+	}
+	CodeFrame::List &waiting(iowait(w, *watch, cf));
+	if (waiting.front() == cf) {
+		ring_submit(w, cf);
+	}
 }
 
-void iowork(Worker &w)
+/** Finish or resubmit a frame's io when the ring completes it */
+static void ring_complete(Worker &w, CodeFrame *cf, int32_t result)
+{
+	StreamIO &op(*cf->io);
+	IOWatch &watch(*op.watch);
+	CodeFrame::List &waiting(ioqueue(watch, op));
+	Stream *stream(op.stream);
+	uint32_t events(op.events);
+	bool done;
+	if (op.expired && result == -ECANCELED) {
+		done = op.expire();
+	} else {
+		if (op.reads()) {
+			done = op.read_done(result);
+		} else if (op.accepts()) {
+			done = op.accept_done(result);
+		} else {
+			done = op.handle();
+		}
+		if (!done && op.expired) {
+			// finished what the kernel did, but out of time
+			done = op.expire();
+		}
+	}
+	if (!done && watch.stream->fd < 0) {
+		// the stream was closed while the kernel had the op
+		op.closed();
+		done = true;
+	}
+	if (!done && !iomoved(op, stream, events)) {
+		ring_submit(w, cf);
+		return;
+	}
+	waiting.pop_front();
+	if (done) {
+		ioresume(w, cf);
+	} else {
+		ring_push(w, cf);
+	}
+	if (watch.stream->fd < 0) {
+		ioabandon(w, watch, waiting, false);
+		ioclosed(w, watch, true);
+		return;
+	}
+	iobuffered(w, watch, waiting);
+	if (!waiting.empty()) {
+		iostart(w, watch, waiting.front());
+	}
+}
+
+/** Submit queued ring ops and handle their completions */
+static void ring_work(Worker &w, int timeout)
+{
+	w.ring->enter(timeout);
+	uint64_t data;
+	int32_t result;
+	while (w.ring->complete(data, result)) {
+		if (data == IORING_IODONE) {
+			iodone(w);
+			w.ring->poll(w.iodone_fd, EPOLLIN, IORING_IODONE);
+		} else if (data == IORING_CANCEL) {
+			// the cancelled op completes on its own
+		} else {
+			ring_complete(w, (CodeFrame *) data, result);
+		}
+	}
+}
+
+/**
+ * Park a frame until its stream is ready. Io that epoll can't
+ * wait for goes to the helper threads and io on a closed stream
+ * fails right away.
+ */
+static void iopark(Worker &w, CodeFrame *cf)
+{
+	Stream *stream(cf->io->stream);
+	if (stream->fd < 0) {
+		cf->io->closed();
+		ioresume(w, cf);
+		return;
+	}
+	if (w.ring) {
+		ring_push(w, cf);
+		return;
+	}
+
+	IOWatch *&watch(find_watch(w, stream));
+	if (!watch) {
+		watch = new_watch(w, stream);
+		epoll_event ev;
+		ev.events = EPOLLONESHOT;
+		ev.data.ptr = watch;
+		if (epoll_ctl(w.epfd, EPOLL_CTL_ADD, stream->fd, &ev) < 0
+				&& errno != EEXIST)
+		{
+			// regular files can't be polled
+			watch->pollable = false;
+		}
+	}
+	if (iohelped(w, *watch, *cf->io)) {
+		ioqueue_helped(w, *watch, cf);
+		return;
+	}
+	iowait(w, *watch, cf);
+	ioarm(w, *watch);
+}
+
+/** Park the current frame until its io is done */
+void iopush(Worker &w)
+{
+	CodeFrame *cf(w.current);
+	// count it before it stops being current so the application
+	// never sees this worker as empty
+	__sync_add_and_fetch(&w.iocount, 1);
+	w.current = NULL;
+	if (cf->io->stream) {
+		iopark(w, cf);
+	} else if (!cf->io->parks()) {
+		ioblock(w, cf);
+	} else if (cf->io->handle()) {
+		ioresume(w, cf);
+	} else {
+		iotimer(w, cf);
+	}
+}
+
+/**
+ * Run the first frame waiting in the list. A read that didn't get
+ * a whole line stays at the front to wait for more.
+ */
+static void iopop(Worker &w, IOWatch &watch, CodeFrame::List &waiting)
+{
+	CodeFrame *cf(waiting.front());
+	StreamIO &op(*cf->io);
+	Stream *stream(op.stream);
+	uint32_t events(op.events);
+	if (ioready(w, cf)) {
+		waiting.pop_front();
+		iobuffered(w, watch, waiting);
+	} else if (iomoved(op, stream, events)) {
+		waiting.pop_front();
+		iopark(w, cf);
+	}
+}
+
+/** Give up on a frame's io when its deadline passes */
+static void ioexpire(Worker &w, CodeFrame *cf)
+{
+	StreamIO &op(*cf->io);
+	if (!op.stream) {
+		if (op.expire()) {
+			ioresume(w, cf);
+		}
+		return;
+	}
+	IOWatch &watch(*op.watch);
+	CodeFrame::List &waiting(ioqueue(watch, op));
+	bool helped(iohelped(w, watch, op));
+	if (helped && waiting.front() == cf) {
+		// a helper has the op, finish when it hands it back
+		op.expired = true;
+		return;
+	}
+	if (w.ring && waiting.front() == cf) {
+		// the kernel has the op, finish when it's cancelled
+		op.expired = true;
+		w.ring->cancel((uintptr_t) cf, IORING_CANCEL);
+		return;
+	}
+	waiting.remove(cf);
+	if (helped && &waiting == &watch.readers) {
+		--watch.stream->helper_reads;
+	}
+	op.expire();
+	ioresume(w, cf);
+}
+
+/** Expire the timers that are due */
+static void timerwork(Worker &w)
+{
+	Timer *t(w.timers->advance(clock_ms()));
+	while (t) {
+		Timer *next(t->next);
+		ioexpire(w, t->frame);
+		t = next;
+	}
+}
+
+/**
+ * Wait for epoll events and run the operations that are ready. Each
+ * event runs one waiting read and one waiting write for its stream.
+ */
+static void epoll_work(Worker &w, int timeout)
 {
 	epoll_event events[MAX_EPOLL_EVENTS];
-	int timeout(w.fresh->empty() && w.stale->empty() ? 100 : 0);
 	int fdcnt(epoll_wait(w.epfd, events, MAX_EPOLL_EVENTS, timeout));
 	if (fdcnt == -1) {
-		perror("epoll_wait");
+		if (errno != EINTR) {
+			perror("epoll_wait");
+		}
 		return;
 	}
 	for (int i(0); i<fdcnt; ++i) {
-		CodeFrame *cf = static_cast< CodeFrame * >(events[i].data.ptr);
-		cf->io->handle();
-		iopop(w, cf);
+		if (!events[i].data.ptr) {
+			iodone(w);
+			continue;
+		}
+		IOWatch &watch(*static_cast< IOWatch * >(events[i].data.ptr));
+		uint32_t ev(events[i].events);
+		watch.armed = 0;
+		// hangups are reported even when a helper has the op
+		if ((ev & (EPOLLIN | EPOLLERR | EPOLLHUP))
+				&& !watch.readers.empty()
+				&& !iorunning(w, watch, watch.readers))
+		{
+			iopop(w, watch, watch.readers);
+		}
+		if ((ev & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+				&& !watch.writers.empty()
+				&& !iorunning(w, watch, watch.writers))
+		{
+			iopop(w, watch, watch.writers);
+		}
+		if (watch.stream->fd < 0) {
+			ioclosed(w, watch, true);
+			continue;
+		}
+		ioarm(w, watch);
 	}
 }
 
+/**
+ * Collect io events, run the operations that are ready and give up
+ * on the ones whose deadlines have passed
+ */
+void iowork(Worker &w, int timeout)
+{
+	if (w.timers->count) {
+		// don't sleep past the next deadline
+		int next(w.timers->next_timeout(clock_ms()));
+		if (timeout < 0 || next < timeout) {
+			timeout = next;
+		}
+	}
+	if (w.ring) {
+		ring_work(w, timeout);
+	} else {
+		epoll_work(w, timeout);
+	}
+	if (w.timers->count) {
+		timerwork(w);
+	}
+}
+
+/**
+ * Sleep on the worker's io until something wakes it: io, a deadline
+ * or another thread with a process, a message or a parallel job.
+ */
+static void idle_wait(Worker &w)
+{
+	w.sleeping = 1;
+	// pairs with the barrier in wake_idle
+	__sync_synchronize();
+	pthread_spin_lock(&w.incoming_lock);
+	bool idle(w.incoming.empty());
+	pthread_spin_unlock(&w.incoming_lock);
+	pthread_spin_lock(&w.app.parallel_lock);
+	idle = idle && w.app.parallel.empty();
+	pthread_spin_unlock(&w.app.parallel_lock);
+	if (idle) {
+		w.ioticks = 0;
+		iowork(w, -1);
+	}
+	w.sleeping = 0;
+}
+
 void execute_instruction(Worker &, const instruction &);
 
+/**
+ * Run frames until the application stops. Io is polled when the
+ * current frame stops running or every IO_POLL_INSTRUCTIONS while
+ * it keeps going, not after each instruction.
+ */
 void gotowork(Worker &w)
 {
 	while (w.app.running) {
@@ -288,15 +1159,18 @@ void gotowork(Worker &w)
 		getline(cin, ready);
 		*/
 		if (!w.current) {
-			// never going to get out of this loop
-			// but ok for now. can find a new proc
-			// from the application later.
-			timespec qtp;
-			qtp.tv_sec = 0;
-			qtp.tv_nsec = 2000;
-			nanosleep(&qtp, NULL);
-			sched_yield();
+			if (w.iocount > 0) {
+				w.ioticks = 0;
+				iowork(w, 0);
+			}
 			findtask(w);
+			if (w.current) {
+				continue;
+			}
+			// help with any parallel jobs before sleeping
+			if (!parallel_work(w)) {
+				idle_wait(w);
+			}
 			continue;
 		}
 
@@ -305,12 +1179,11 @@ void gotowork(Worker &w)
 
 		if (w.current->io) {
 			iopush(w);
+			continue;
 		}
-		if (w.iocount > 0) {
-			iowork(w);
-			if (!w.current) {
-				findtask(w);
-			}
+		if (w.iocount > 0 && ++w.ioticks >= IO_POLL_INSTRUCTIONS) {
+			w.ioticks = 0;
+			iowork(w, 0);
 		}
 
 		switch (w.current->cfstate) {
@@ -331,6 +1204,98 @@ void gotowork(Worker &w)
 	}
 }
 
+static uint64_t parallel_clock()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+/**
+ * Claim the next chunk of the newest parallel job
+ * Each claim takes a share of the remaining items so early chunks
+ * are big and the last ones small enough to balance the workers.
+ */
+static ParallelJob * claim_parallel_chunk(Application &app
+		, uint32_t &begin, uint32_t &end)
+{
+	pthread_spin_lock(&app.parallel_lock);
+	if (app.parallel.empty()) {
+		pthread_spin_unlock(&app.parallel_lock);
+		return NULL;
+	}
+	ParallelJob *job(app.parallel.front());
+	uint32_t left(job->count - job->next);
+	uint32_t size(left / (PARALLEL_SHARE * app.worker.size()));
+	if (size < job->grain) {
+		size = job->grain;
+	}
+	if (size > left) {
+		size = left;
+	}
+	begin = job->next;
+	end = begin + size;
+	job->next = end;
+	if (end == job->count) {
+		app.parallel.pop_front();
+	}
+	pthread_spin_unlock(&app.parallel_lock);
+	return job;
+}
+
+bool parallel_work(Worker &w)
+{
+	uint32_t begin, end;
+	ParallelJob *job(claim_parallel_chunk(w.app, begin, end));
+	if (!job) {
+		return false;
+	}
+
+	CodeFrame *current(w.current);
+	ParallelPath *path(new ParallelPath(*job->frame));
+	w.current = path;
+	uint64_t start(parallel_clock());
+	job->run_chunk(w, begin, end);
+	uint64_t item_time((parallel_clock() - start) / (end - begin) + 1);
+	w.current = current;
+	if (path->fork.empty()) {
+		delete path;
+	}
+
+	// quick items get bigger chunks so claiming them costs less
+	uint64_t grain(PARALLEL_CHUNK_NS / item_time);
+	if (grain > job->grain) {
+		pthread_spin_lock(&w.app.parallel_lock);
+		if (grain > job->grain) {
+			job->grain = grain;
+		}
+		pthread_spin_unlock(&w.app.parallel_lock);
+	}
+	__sync_add_and_fetch(&job->done, end - begin);
+	return true;
+}
+
+void run_parallel_job(Worker &w, ParallelJob &job)
+{
+	if (job.count == 0) {
+		return;
+	}
+	pthread_spin_lock(&w.app.parallel_lock);
+	// nested jobs go first so the jobs waiting on them can finish
+	w.app.parallel.push_front(&job);
+	pthread_spin_unlock(&w.app.parallel_lock);
+	Application::WorkerMap::iterator it(w.app.worker.begin());
+	for (; it!=w.app.worker.end(); ++it) {
+		wake_idle(*it->second);
+	}
+
+	while (__sync_add_and_fetch(&job.done, 0) < job.count) {
+		if (!parallel_work(w)) {
+			sched_yield();
+		}
+	}
+}
+
 void * launch_worker(void *void_worker)
 {
 	Worker *w = static_cast< Worker * >(void_worker);
@@ -346,13 +1311,16 @@ Application::Application()
 : next_workerid(1)
 , pid_count(0)
 , running(true)
+, use_ring(false)
 {
 	pthread_spin_init(&application_lock, PTHREAD_PROCESS_PRIVATE);
+	pthread_spin_init(&parallel_lock, PTHREAD_PROCESS_PRIVATE);
 }
 
 Application::~Application()
 {
 	pthread_spin_destroy(&application_lock);
+	pthread_spin_destroy(&parallel_lock);
 }
 
 const Module * find_app_module(Application &app, const string &modname)
@@ -399,14 +1367,30 @@ const CFunction * find_c_override(Application &app, const std::string &protomod
 
 bool send_msg(Application &app, uint64_t pid, const qbrt_value &src)
 {
+	pthread_spin_lock(&app.application_lock);
 	ProcessRoot::Map::iterator it(app.recv.find(pid));
-	if (it == app.recv.end()) {
+	ProcessRoot *proc(it == app.recv.end() ? NULL : it->second);
+	pthread_spin_unlock(&app.application_lock);
+	if (!proc) {
 		return false;
 	}
-	it->second->recv.push(qbrt_value::dup(src));
+	deliver_msg(*proc, src);
 	return true;
 }
 
+void deliver_msg(ProcessRoot &proc, const qbrt_value &src)
+{
+	CodeFrame *woken(proc.recv.push(qbrt_value::dup(src)));
+	if (woken) {
+		// the receive is done, its worker just has to resume it
+		BlockingJob job;
+		job.w = proc.owner;
+		job.frame = woken;
+		job.done = true;
+		iofinish(job);
+	}
+}
+
 ProcessRoot * new_process(Application &app, FunctionCall *call)
 {
 	pthread_spin_lock(&app.application_lock);
@@ -436,12 +1420,15 @@ void cycle_distributor(Application::WorkerMap::iterator &it, Application &app)
 
 void distribute_work(Application::WorkerMap::iterator &it, Application &app)
 {
+	// workers add new processes while this runs
+	pthread_spin_lock(&app.application_lock);
 	while (!app.newproc.empty() && it != app.worker.end()) {
 		ProcessRoot::Map::iterator proc(app.newproc.begin());
 		assign_process(*it->second, proc->second);
 		app.newproc.erase(proc);
 		cycle_distributor(it, app);
 	}
+	pthread_spin_unlock(&app.application_lock);
 }
 
 void application_loop(Application &app)
@@ -7,6 +7,7 @@
 #include "instruction/schedule.h"
 #include "instruction/string.h"
 #include "instruction/type.h"
+#include "instruction/vector.h"
 #include <iostream>
 #include <stdlib.h>
 
@@ -71,7 +72,12 @@ void binaryop_stmt::allocate_registers(RegAlloc *alloc)
 	alloc->assign_src(*a);
 	alloc->assign_src(*b);
 
-	const char *datatype = type == 'i' ? "core/Int" : "";
+	const char *datatype = "";
+	if (type == 'i') {
+		datatype = "core/Int";
+	} else if (type == 'f') {
+		datatype = "core/Float";
+	}
 	alloc->alloc_dst(*result, datatype);
 }
 
@@ -94,6 +100,36 @@ void binaryop_stmt::generate_code(AsmFunc &f)
 		case 0x2f69: // /i
 			opcode = OP_IDIV;
 			break;
+		case 0x2569: // %i
+			opcode = OP_IMOD;
+			break;
+		case 0x2669: // &i
+			opcode = OP_IAND;
+			break;
+		case 0x7c69: // |i
+			opcode = OP_IOR;
+			break;
+		case 0x5e69: // ^i
+			opcode = OP_IXOR;
+			break;
+		case 0x3c69: // <i
+			opcode = OP_ISHL;
+			break;
+		case 0x3e69: // >i
+			opcode = OP_ISHR;
+			break;
+		case 0x2b66: // +f
+			opcode = OP_FADD;
+			break;
+		case 0x2d66: // -f
+			opcode = OP_FSUB;
+			break;
+		case 0x2a66: // *f
+			opcode = OP_FMULT;
+			break;
+		case 0x2f66: // /f
+			opcode = OP_FDIV;
+			break;
 		default:
 			std::cerr << "unknown binary op: " << type << op
 				<<' '<< cmp << endl;
@@ -108,6 +144,22 @@ void binaryop_stmt::pretty(std::ostream &out) const
 			<<' '<< *a <<' '<< *b;
 }
 
+void convert_stmt::allocate_registers(RegAlloc *alloc)
+{
+	alloc->assign_src(*src);
+	alloc->alloc_dst(*dst, opcode == OP_ITOF ? "core/Float" : "core/Int");
+}
+
+void convert_stmt::generate_code(AsmFunc &f)
+{
+	asm_instruction(f, new convert_instruction(opcode, *dst, *src));
+}
+
+void convert_stmt::pretty(std::ostream &out) const
+{
+	out << (opcode == OP_ITOF ? "itof " : "ftoi ") << *dst <<' '<< *src;
+}
+
 void bind_stmt::set_function_context(uint8_t, AsmResource *)
 {
 	this->polymorph = new AsmPolymorph(*protocol);
@@ -213,6 +265,21 @@ void consti_stmt::pretty(std::ostream &out) const
 	out << "consti " << *dst << " " << value;
 }
 
+void constf_stmt::allocate_registers(RegAlloc *r)
+{
+	r->alloc_dst(*dst, "core/Float");
+}
+
+void constf_stmt::generate_code(AsmFunc &f)
+{
+	asm_instruction(f, new constf_instruction(*dst, value));
+}
+
+void constf_stmt::pretty(std::ostream &out) const
+{
+	out << "constf " << *dst << " " << value;
+}
+
 void consts_stmt::allocate_registers(RegAlloc *r)
 {
 	r->alloc_dst(*dst, "core/String");
@@ -470,6 +537,7 @@ void dfunc_stmt::allocate_registers(RegAlloc *)
 		(*it)->allocate_registers(&regs);
 	}
 	func->regc = regs.counter - func->argc;
+	func->regtype = regs.regtype;
 }
 
 void dfunc_stmt::collect_resources(ResourceSet &rs)
@@ -559,6 +627,24 @@ void protocol_stmt::pretty(std::ostream &out) const
 }
 
 
+/**
+ * Find the field index for a register that only ever holds one
+ * construct. Return -1 if it can't be known at compile time.
+ */
+static int16_t known_field_index(const AsmFunc &f, const AsmReg &reg
+		, const string &field)
+{
+	if (reg.reg_type != '$' || reg.ext >= 0) {
+		return -1;
+	}
+	RegAlloc::TypeMap::const_iterator it(f.regtype.find(reg.name));
+	if (it == f.regtype.end() || it->second.empty()) {
+		return -1;
+	}
+	int16_t fldidx(construct_field_index(it->second, field));
+	return fldidx <= 0x7f ? fldidx : -1;
+}
+
 void fieldget_stmt::allocate_registers(RegAlloc *r)
 {
 	r->assign_src(*src);
@@ -572,6 +658,13 @@ void fieldget_stmt::collect_resources(ResourceSet &rs)
 
 void fieldget_stmt::generate_code(AsmFunc &f)
 {
+	int16_t fldidx(known_field_index(f, *src, field_name.value));
+	if (fldidx >= 0) {
+		AsmReg field(*src);
+		field.ext = fldidx;
+		asm_instruction(f, new copy_instruction(*dst, field));
+		return;
+	}
 	asm_instruction(f, new fieldget_instruction(
 				*dst, *src, *field_name.index));
 }
@@ -584,7 +677,8 @@ void fieldget_stmt::pretty(std::ostream &out) const
 void fieldset_stmt::allocate_registers(RegAlloc *r)
 {
 	r->assign_src(*src);
-	r->alloc_dst(*dst);
+	// setting a field doesn't change the type of dst
+	r->assign_src(*dst);
 }
 
 void fieldset_stmt::collect_resources(ResourceSet &rs)
@@ -594,6 +688,13 @@ void fieldset_stmt::collect_resources(ResourceSet &rs)
 
 void fieldset_stmt::generate_code(AsmFunc &f)
 {
+	int16_t fldidx(known_field_index(f, *dst, field_name.value));
+	if (fldidx >= 0) {
+		AsmReg field(*dst);
+		field.ext = fldidx;
+		asm_instruction(f, new copy_instruction(field, *src));
+		return;
+	}
 	asm_instruction(f, new fieldset_instruction(
 				*dst, *field_name.index, *src));
 }
@@ -687,7 +788,7 @@ void lconstruct_stmt::collect_resources(ResourceSet &rs)
 
 void lconstruct_stmt::allocate_registers(RegAlloc *r)
 {
-	r->alloc_dst(*dst);
+	r->alloc_dst(*dst, modsym->module.value +"/"+ modsym->symbol.value);
 }
 
 void lconstruct_stmt::generate_code(AsmFunc &f)
@@ -702,6 +803,11 @@ void lconstruct_stmt::generate_code(AsmFunc &f)
 						, CONST_REG(REG_FALSE)));
 			return;
 		}
+	} else if (modsym->module.value == "list"
+			&& modsym->symbol.value == "Empty")
+	{
+		asm_instruction(f, new clist_instruction(*dst));
+		return;
 	}
 	asm_instruction(f, new lconstruct_instruction(*dst, *modsym->index));
 }
@@ -768,6 +874,74 @@ void matchargs_stmt::pretty(ostream &out) const
 		<< ' ' << nonmatch.name;
 }
 
+void switch_stmt::allocate_registers(RegAlloc *r)
+{
+	r->assign_src(*input);
+}
+
+void switch_stmt::generate_code(AsmFunc &f)
+{
+	asm_jump(f, dflt.name, new switch_instruction(*input));
+}
+
+void switch_stmt::pretty(ostream &out) const
+{
+	out << "switch " << *input << " @" << dflt.name;
+}
+
+void case_stmt::collect_resources(ResourceSet &rs)
+{
+	if (kind == CASE_HASHTAG) {
+		collect_resource(rs, hashtag);
+	} else if (kind == CASE_CONSTRUCT) {
+		collect_modsym(rs, *modsym);
+	}
+}
+
+void case_stmt::generate_code(AsmFunc &f)
+{
+	uint8_t prev(f.code.empty() ? OP_NOOP : f.code.back()->opcode());
+	if (prev != OP_SWITCH && prev != OP_CASE) {
+		cerr << "case must follow a switch or another case in "
+			<< f.name.value << endl;
+		exit(1);
+	}
+
+	case_instruction *i;
+	if (kind == CASE_INT) {
+		if (value < INT16_MIN || value > INT16_MAX) {
+			cerr << "switch case out of range: " << value << endl;
+			exit(1);
+		}
+		i = new case_instruction(CASE_INT, (uint16_t) value);
+	} else if (kind == CASE_HASHTAG) {
+		i = new case_instruction(CASE_HASHTAG, *hashtag.index);
+	} else if (modsym->module.value == "core"
+			&& (modsym->symbol.value == "True"
+				|| modsym->symbol.value == "False"))
+	{
+		// core bools aren't constructs at runtime
+		i = new case_instruction(CASE_BOOL
+				, modsym->symbol.value == "True");
+	} else {
+		i = new case_instruction(CASE_CONSTRUCT, *modsym->index);
+	}
+	asm_jump(f, label.name, i);
+}
+
+void case_stmt::pretty(ostream &out) const
+{
+	out << "case ";
+	if (kind == CASE_INT) {
+		out << value;
+	} else if (kind == CASE_HASHTAG) {
+		out << '#' << hashtag.value;
+	} else {
+		out << *modsym;
+	}
+	out << " @" << label.name;
+}
+
 void newproc_stmt::allocate_registers(RegAlloc *r)
 {
 	r->assign_src(*func);
@@ -856,6 +1030,120 @@ void stracc_stmt::pretty(std::ostream &out) const
 	out << "stracc " << *dst <<' '<< *src;
 }
 
+void clist_stmt::allocate_registers(RegAlloc *r)
+{
+	r->alloc_dst(*dst, "list/List");
+}
+
+void clist_stmt::generate_code(AsmFunc &f)
+{
+	asm_instruction(f, new clist_instruction(*dst));
+}
+
+void clist_stmt::pretty(std::ostream &out) const
+{
+	out << "clist " << *dst;
+}
+
+void cons_stmt::allocate_registers(RegAlloc *r)
+{
+	r->assign_src(*item);
+	r->assign_src(*head);
+}
+
+void cons_stmt::generate_code(AsmFunc &f)
+{
+	asm_instruction(f, new cons_instruction(*head, *item));
+}
+
+void cons_stmt::pretty(std::ostream &out) const
+{
+	out << "cons " << *head <<' '<< *item;
+}
+
+void cvect_stmt::allocate_registers(RegAlloc *r)
+{
+	r->alloc_dst(*dst, "vector/Vector");
+}
+
+void cvect_stmt::generate_code(AsmFunc &f)
+{
+	// all empty vectors are the same so just copy the shared one
+	asm_instruction(f, new copy_instruction(*dst
+				, CONST_REG(REG_EMPTYVECT)));
+}
+
+void cvect_stmt::pretty(std::ostream &out) const
+{
+	out << "cvect " << *dst;
+}
+
+void vget_stmt::allocate_registers(RegAlloc *r)
+{
+	r->assign_src(*src);
+	r->assign_src(*idx);
+	r->alloc_dst(*dst);
+}
+
+void vget_stmt::generate_code(AsmFunc &f)
+{
+	asm_instruction(f, new vget_instruction(*dst, *src, *idx));
+}
+
+void vget_stmt::pretty(std::ostream &out) const
+{
+	out << "vget " << *dst <<' '<< *src <<' '<< *idx;
+}
+
+void vlen_stmt::allocate_registers(RegAlloc *r)
+{
+	r->assign_src(*src);
+	r->alloc_dst(*dst, "core/Int");
+}
+
+void vlen_stmt::generate_code(AsmFunc &f)
+{
+	asm_instruction(f, new vlen_instruction(*dst, *src));
+}
+
+void vlen_stmt::pretty(std::ostream &out) const
+{
+	out << "vlen " << *dst <<' '<< *src;
+}
+
+void vpush_stmt::allocate_registers(RegAlloc *r)
+{
+	r->assign_src(*src);
+	r->assign_src(*dst);
+}
+
+void vpush_stmt::generate_code(AsmFunc &f)
+{
+	asm_instruction(f, new vpush_instruction(*dst, *src));
+}
+
+void vpush_stmt::pretty(std::ostream &out) const
+{
+	out << "vpush " << *dst <<' '<< *src;
+}
+
+void vset_stmt::allocate_registers(RegAlloc *r)
+{
+	r->assign_src(*idx);
+	r->assign_src(*src);
+	r->assign_src(*dst);
+}
+
+void vset_stmt::generate_code(AsmFunc &f)
+{
+	asm_instruction(f, new vset_instruction(*dst, *idx, *src));
+}
+
+void vset_stmt::pretty(std::ostream &out) const
+{
+	out << "vset " << *dst <<' '<< *idx <<' '<< *src;
+}
+
 void wait_stmt::allocate_registers(RegAlloc *r)
 {
 	r->assign_src(*reg);
@@ -0,0 +1,164 @@
+#include "qbrt/string.h"
+#include <string.h>
+#include <new>
+
+using namespace std;
+
+/** Minimum capacity for a buffer created by append */
+#define STRING_BUFFER_MIN	32
+
+
+StringBuffer * StringBuffer::create(uint32_t capacity)
+{
+	StringBuffer *buf;
+	buf = (StringBuffer *) ::operator new(sizeof(StringBuffer) + capacity);
+	buf->refcount = 0;
+	buf->capacity = capacity;
+	buf->used = 0;
+	return buf;
+}
+
+void StringBuffer::retain(StringBuffer *buf)
+{
+	__sync_add_and_fetch(&buf->refcount, 1);
+}
+
+void StringBuffer::release(StringBuffer *buf)
+{
+	if (__sync_sub_and_fetch(&buf->refcount, 1) == 0) {
+		::operator delete(buf);
+	}
+}
+
+
+String * String::create(const char *c, uint32_t size)
+{
+	void *mem = ::operator new(sizeof(String) + size);
+	char *inline_chars = (char *) mem + sizeof(String);
+	memcpy(inline_chars, c, size);
+	return new (mem) String(inline_chars, NULL, size);
+}
+
+String * String::create(int64_t i)
+{
+	char digits[24];
+	char *end(digits + sizeof(digits));
+	char *start(format_int(end, i));
+	return create(start, end - start);
+}
+
+String * String::literal(const char *c, uint32_t size)
+{
+	return new String(c, NULL, size);
+}
+
+String * String::view(StringBuffer *buf, const char *c, uint32_t size)
+{
+	StringBuffer::retain(buf);
+	return new String(c, buf, size);
+}
+
+String * String::slice(const String &s, uint32_t offset, uint32_t len)
+{
+	if (offset > s.size) {
+		offset = s.size;
+	}
+	if (len > s.size - offset) {
+		len = s.size - offset;
+	}
+	if (s.buffer) {
+		return view(s.buffer, s.chars + offset, len);
+	}
+	String *result(literal(s.chars + offset, len));
+	if (s.owner || s.inline_chars()) {
+		// keep the string with the inline characters alive
+		result->owner = s.owner ? s.owner : &s;
+		retain(result->owner);
+	}
+	return result;
+}
+
+String * String::append(const String &s, const char *c, uint32_t size)
+{
+	StringBuffer *buf(s.buffer);
+	if (buf) {
+		// if s ends where the buffer's used space ends,
+		// claim the space after it and write there
+		uint32_t end(s.chars + s.size - buf->data);
+		if (end + size <= buf->capacity
+			&& __sync_bool_compare_and_swap(&buf->used, end
+				, end + size))
+		{
+			memcpy(buf->data + end, c, size);
+			return view(buf, s.chars, s.size + size);
+		}
+	}
+
+	uint32_t total(s.size + size);
+	uint32_t capacity(total * 2);
+	if (capacity < STRING_BUFFER_MIN) {
+		capacity = STRING_BUFFER_MIN;
+	}
+	buf = StringBuffer::create(capacity);
+	memcpy(buf->data, s.chars, s.size);
+	memcpy(buf->data + s.size, c, size);
+	buf->used = total;
+	return view(buf, buf->data, total);
+}
+
+String * String::append(const String &s, int64_t i)
+{
+	char digits[24];
+	char *end(digits + sizeof(digits));
+	char *start(format_int(end, i));
+	return append(s, start, end - start);
+}
+
+void String::retain(const String *s)
+{
+	__sync_add_and_fetch(&s->refcount, 1);
+}
+
+void String::release(const String *s)
+{
+	if (__sync_sub_and_fetch(&s->refcount, 1) > 0) {
+		return;
+	}
+	if (s->buffer) {
+		StringBuffer::release(s->buffer);
+	}
+	if (s->owner) {
+		release(s->owner);
+	}
+	s->~String();
+	::operator delete((void *) s);
+}
+
+int String::compare(const String &a, const String &b)
+{
+	uint32_t n(a.size < b.size ? a.size : b.size);
+	int comparison(memcmp(a.chars, b.chars, n));
+	if (comparison) {
+		return comparison;
+	}
+	if (a.size < b.size) {
+		return -1;
+	}
+	return a.size > b.size ? 1 : 0;
+}
+
+
+char * format_int(char *end, int64_t i)
+{
+	// work in unsigned so the most negative value doesn't overflow
+	uint64_t u(i < 0 ? -(uint64_t) i : i);
+	char *c(end);
+	do {
+		*--c = '0' + (u % 10);
+		u /= 10;
+	} while (u);
+	if (i < 0) {
+		*--c = '-';
+	}
+	return c;
+}
@@ -0,0 +1,124 @@
+#include "qbrt/switch.h"
+#include "qbrt/type.h"
+
+using namespace std;
+
+/** Ints use the dense table if it would be at most this much bigger */
+#define SWITCH_DENSE_SPREAD	4
+#define SWITCH_DENSE_MAX	256
+
+
+static inline uint32_t switch_hash(uint8_t kind, uint64_t key)
+{
+	uint64_t h((key ^ ((uint64_t) kind << 56)) * 0x9e3779b97f4a7c15ULL);
+	return (uint32_t) (h >> 32);
+}
+
+SwitchTable::SwitchTable(int32_t default_jump)
+: cases()
+, slot()
+, dense()
+, dense_base(0)
+, mask(0)
+, default_jump(default_jump)
+{}
+
+void SwitchTable::add(uint8_t kind, uint64_t key, int32_t jump)
+{
+	vector< Slot >::const_iterator it(cases.begin());
+	for (; it!=cases.end(); ++it) {
+		if (it->kind == kind && it->key == key) {
+			return;
+		}
+	}
+	Slot s;
+	s.key = key;
+	s.jump = jump;
+	s.kind = kind;
+	cases.push_back(s);
+}
+
+void SwitchTable::finish()
+{
+	int64_t low(0);
+	int64_t high(0);
+	uint32_t ints(0);
+	vector< Slot >::const_iterator it(cases.begin());
+	for (; it!=cases.end(); ++it) {
+		if (it->kind != CASE_INT) {
+			continue;
+		}
+		int64_t i((int64_t) it->key);
+		if (ints == 0 || i < low) {
+			low = i;
+		}
+		if (ints == 0 || i > high) {
+			high = i;
+		}
+		++ints;
+	}
+
+	bool use_dense(ints > 0 && high - low < SWITCH_DENSE_MAX
+			&& high - low < ints * SWITCH_DENSE_SPREAD);
+	if (use_dense) {
+		dense_base = low;
+		dense.assign(high - low + 1, default_jump);
+	}
+
+	uint32_t size(4);
+	while (size < cases.size() * 2) {
+		size <<= 1;
+	}
+	slot.assign(size, Slot());
+	for (uint32_t i(0); i<size; ++i) {
+		slot[i].jump = default_jump;
+		slot[i].kind = 0xff;
+	}
+	mask = size - 1;
+
+	for (it=cases.begin(); it!=cases.end(); ++it) {
+		if (use_dense && it->kind == CASE_INT) {
+			dense[(int64_t) it->key - dense_base] = it->jump;
+			continue;
+		}
+		uint32_t i(switch_hash(it->kind, it->key) & mask);
+		while (slot[i].kind != 0xff) {
+			i = (i + 1) & mask;
+		}
+		slot[i] = *it;
+	}
+	cases.clear();
+}
+
+int32_t SwitchTable::find(uint8_t kind, uint64_t key) const
+{
+	if (kind == CASE_INT && !dense.empty()) {
+		uint64_t i(key - (uint64_t) dense_base);
+		return i < dense.size() ? dense[i] : default_jump;
+	}
+	uint32_t i(switch_hash(kind, key) & mask);
+	while (slot[i].kind != 0xff) {
+		if (slot[i].kind == kind && slot[i].key == key) {
+			return slot[i].jump;
+		}
+		i = (i + 1) & mask;
+	}
+	return default_jump;
+}
+
+int32_t SwitchTable::find(const qbrt_value &v) const
+{
+	switch (v.type->id) {
+		case VT_INT:
+			return find(CASE_INT, (uint64_t) v.data.i);
+		case VT_BOOL:
+			return find(CASE_BOOL, v.data.b ? 1 : 0);
+		case VT_HASHTAG:
+			return find(CASE_HASHTAG, v.data.hashtag);
+		case VT_CONSTRUCT:
+		case VT_LIST:
+			return find(CASE_CONSTRUCT
+					, (uintptr_t) &v.data.cons->resource);
+	}
+	return default_jump;
+}
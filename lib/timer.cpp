@@ -0,0 +1,153 @@
+#include "timer.h"
+#include <time.h>
+
+using namespace std;
+
+/** Ticks the whole wheel covers */
+#define TIMER_SPAN	(1ULL << (TIMER_SLOT_BITS * TIMER_LEVELS))
+
+
+uint64_t clock_ms()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+TimerWheel::TimerWheel()
+: count(0)
+, tick(clock_ms())
+, occupied(0)
+{
+	for (int l(0); l<TIMER_LEVELS; ++l) {
+		for (int i(0); i<TIMER_SLOTS; ++i) {
+			slot[l][i].next = &slot[l][i];
+			slot[l][i].prev = &slot[l][i];
+		}
+	}
+}
+
+void TimerWheel::add(Timer &t, uint64_t now, uint32_t ms)
+{
+	if (!count) {
+		// nothing to expire on the way, skip ahead
+		tick = now;
+	}
+	t.expires = now + ms;
+	place(t);
+	++count;
+}
+
+void TimerWheel::cancel(Timer &t)
+{
+	if (!t.pending()) {
+		return;
+	}
+	Timer *prev(t.prev);
+	Timer *next(t.next);
+	prev->next = next;
+	next->prev = prev;
+	t.next = NULL;
+	t.prev = NULL;
+	--count;
+	if (prev == next && level0_head(prev)) {
+		occupied &= ~(1ULL << (prev - slot[0]));
+	}
+}
+
+Timer * TimerWheel::advance(uint64_t now)
+{
+	if (!count) {
+		tick = now + 1;
+		return NULL;
+	}
+	Timer *expired(NULL);
+	for (; tick<=now && count; ++tick) {
+		uint32_t index(tick & TIMER_MASK);
+		if (index == 0) {
+			// a level 0 round is done, bring the next slot
+			// of each level that has also come round down
+			for (int l(1); l<TIMER_LEVELS; ++l) {
+				uint32_t li((tick >> (TIMER_SLOT_BITS * l))
+						& TIMER_MASK);
+				cascade(l, li);
+				if (li != 0) {
+					break;
+				}
+			}
+		}
+		if (!(occupied & (1ULL << index))) {
+			continue;
+		}
+		Timer &head(slot[0][index]);
+		while (head.next != &head) {
+			Timer *t(head.next);
+			head.next = t->next;
+			t->prev = NULL;
+			t->next = expired;
+			expired = t;
+			--count;
+		}
+		head.prev = &head;
+		occupied &= ~(1ULL << index);
+	}
+	if (!count && tick <= now) {
+		tick = now + 1;
+	}
+	return expired;
+}
+
+int TimerWheel::next_timeout(uint64_t now) const
+{
+	if (!count) {
+		return -1;
+	}
+	uint64_t later(occupied >> (tick & TIMER_MASK));
+	// without a level 0 timer, wake when this round is done to
+	// bring the next timers down
+	uint64_t next(later ? tick + __builtin_ctzll(later)
+			: (tick | TIMER_MASK) + 1);
+	return next <= now ? 0 : next - now;
+}
+
+void TimerWheel::place(Timer &t)
+{
+	uint64_t expires(t.expires < tick ? tick : t.expires);
+	uint64_t delta(expires - tick);
+	if (delta >= TIMER_SPAN) {
+		// too far off, wait in the last slot that's in reach
+		expires = tick + TIMER_SPAN - 1;
+		delta = TIMER_SPAN - 1;
+	}
+	int level(0);
+	while (delta >= (1ULL << (TIMER_SLOT_BITS * (level + 1)))) {
+		++level;
+	}
+	uint32_t index((expires >> (TIMER_SLOT_BITS * level)) & TIMER_MASK);
+	Timer &head(slot[level][index]);
+	t.next = &head;
+	t.prev = head.prev;
+	head.prev->next = &t;
+	head.prev = &t;
+	if (level == 0) {
+		occupied |= 1ULL << index;
+	}
+}
+
+void TimerWheel::cascade(int level, uint32_t index)
+{
+	Timer &head(slot[level][index]);
+	Timer *t(head.next);
+	head.next = &head;
+	head.prev = &head;
+	while (t != &head) {
+		Timer *next(t->next);
+		place(*t);
+		t = next;
+	}
+}
+
+bool TimerWheel::level0_head(const Timer *t) const
+{
+	return t >= slot[0] && t < slot[0] + TIMER_SLOTS;
+}
@@ -0,0 +1,80 @@
+#ifndef QBRT_TIMER_H
+#define QBRT_TIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct CodeFrame;
+
+/** Milliseconds on the monotonic clock */
+uint64_t clock_ms();
+
+/**
+ * A deadline for a waiting frame
+ *
+ * The list links are in the timer so adding one to a wheel or
+ * cancelling it never allocates or searches.
+ */
+struct Timer
+{
+	Timer *next;
+	Timer *prev;
+	uint64_t expires;
+	CodeFrame *frame;
+
+	Timer()
+	: next(NULL)
+	, prev(NULL)
+	, expires(0)
+	, frame(NULL)
+	{}
+
+	bool pending() const { return prev != NULL; }
+};
+
+#define TIMER_LEVELS	4
+#define TIMER_SLOT_BITS	6
+#define TIMER_SLOTS	(1 << TIMER_SLOT_BITS)
+#define TIMER_MASK	(TIMER_SLOTS - 1)
+
+/**
+ * A worker's timers, in a hierarchical wheel with 1ms ticks
+ *
+ * Each level has 64 slots and each slot is 64 times as wide as a
+ * slot in the level below, so 4 levels reach about 4.6 hours out.
+ * Timers further away wait in the last level until they're closer.
+ * When the wheel reaches a slot in a higher level, its timers move
+ * down to where they expire, so adding, cancelling and expiring a
+ * timer each take constant time.
+ */
+struct TimerWheel
+{
+	TimerWheel();
+
+	/** Expire a timer ms after now */
+	void add(Timer &, uint64_t now, uint32_t ms);
+	void cancel(Timer &);
+	/**
+	 * Move the wheel up to now
+	 * Return the timers that expired, linked by next.
+	 */
+	Timer * advance(uint64_t now);
+	/** ms until the next timer could expire or -1 if there are none */
+	int next_timeout(uint64_t now) const;
+
+	uint32_t count;
+
+private:
+	void place(Timer &);
+	void cascade(int level, uint32_t index);
+	bool level0_head(const Timer *) const;
+
+	/** The next tick to expire */
+	uint64_t tick;
+	/** Head of each slot's circular list */
+	Timer slot[TIMER_LEVELS][TIMER_SLOTS];
+	/** Bit for each level 0 slot that has timers */
+	uint64_t occupied;
+};
+
+#endif
@@ -1,10 +1,27 @@
 #include "qbrt/type.h"
 #include "qbrt/module.h"
 #include <string.h>
+#include <new>
 
 using namespace std;
 
 
+Construct * Construct::create(const Module &m, const ConstructResource &cr)
+{
+	size_t size(sizeof(Construct) + cr.fld_count * sizeof(qbrt_value));
+	Construct *cons = new (::operator new(size)) Construct(m, cr);
+	new (cons->fields()) qbrt_value[cr.fld_count];
+	return cons;
+}
+
+Tuple * Tuple::create(uint8_t size)
+{
+	size_t bytes(sizeof(Tuple) + size * sizeof(qbrt_value));
+	Tuple *tup = new (::operator new(bytes)) Tuple(size);
+	new (tup->data()) qbrt_value[size];
+	return tup;
+}
+
 const DataTypeResource * Construct::datatype() const
 {
 	return mod.resource.ptr< DataTypeResource >(resource.datatype_idx);
@@ -15,8 +32,23 @@ const char * Construct::name() const
 	return fetch_string(mod.resource, resource.name_idx);
 }
 
-bool Construct::compare(const Construct &a, const Construct &b)
+int16_t Construct::field_index(const char *field_name) const
+{
+	for (int i(0); i<resource.fld_count; ++i) {
+		const char *fname;
+		fname = fetch_string(mod.resource, resource.fields[i].name_idx);
+		if (strcmp(fname, field_name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int Construct::compare(const Construct &a, const Construct &b)
 {
+	if (&a.resource == &b.resource) {
+		return 0;
+	}
 	if (a.mod.name < b.mod.name) {
 		return -1;
 	}
@@ -69,19 +101,37 @@ void load_construct_value_types(ostringstream &out, const Construct &c)
 }
 
 
+const Module *List::s_module = NULL;
+const ConstructResource *List::s_node = NULL;
+const Type *List::s_type = NULL;
+qbrt_value List::s_empty;
+
+void List::init(const Module &m)
+{
+	s_module = &m;
+	s_node = find_construct(m, "Node");
+	s_type = indexed_datatype(m, s_node->datatype_idx);
+	Module::load_construct(s_empty, m, "Empty");
+}
+
+void List::cons(qbrt_value &result, const qbrt_value &item
+		, const qbrt_value &tail)
+{
+	Construct *node(Construct::create(*s_module, *s_node));
+	node->value(0) = item;
+	node->value(1) = tail;
+	qbrt_value::construct(result, s_type, node);
+}
+
 void List::push(qbrt_value &head, const qbrt_value &item)
 {
-	qbrt_value tmp(head);
-	Module::load_construct(head, head.data.cons->mod, "Node");
-	head.data.cons->value(0) = item;
-	head.data.cons->value(1) = tmp;
+	List::cons(head, item, qbrt_value(head));
 }
 
 void List::head(qbrt_value &result, const qbrt_value &head)
 {
-	if (head.type->id != VT_LIST) {
-		cerr <<"head arg not a list: "<< (int) head.type->id << endl;
-		// set failure in result
+	if (head.type->id != VT_LIST || List::empty(*head.data.cons)) {
+		qbrt_value::fail(result, FAIL_TYPE("list", "head", 0));
 		return;
 	}
 	result = head.data.cons->value(0);
@@ -93,16 +143,13 @@ void List::is_empty(qbrt_value &result, const qbrt_value &head)
 		qbrt_value::fail(result, FAIL_TYPE("list", "is_empty", 0));
 		return;
 	}
-	bool empty(strcmp(head.data.cons->name(), "Empty") == 0);
-	qbrt_value::b(result, empty);
+	qbrt_value::b(result, List::empty(*head.data.cons));
 }
 
 void List::pop(qbrt_value &result, const qbrt_value &head)
 {
-	if (head.type->id != VT_LIST) {
+	if (head.type->id != VT_LIST || List::empty(*head.data.cons)) {
 		qbrt_value::fail(result, FAIL_TYPE("list", "pop", 0));
-		cerr <<"head arg not a construct: "<< (int)head.type->id<< endl;
-		// set failure in result
 		return;
 	}
 	result = head.data.cons->value(1);
@@ -110,15 +157,11 @@ void List::pop(qbrt_value &result, const qbrt_value &head)
 
 void List::reverse(qbrt_value &result, const qbrt_value &head)
 {
-	Module::load_construct(result, head.data.cons->mod, "Empty");
-	qbrt_value next(head);
-	qbrt_value check;
-	qbrt_value item;
-	List::is_empty(check, next);
-	while (!check.data.b) {
-		List::head(item, next);
-		List::push(result, item);
-		List::pop(next, next);
-		List::is_empty(check, next);
+	qbrt_value reversed(s_empty);
+	const qbrt_value *next(&head);
+	while (!List::empty(*next->data.cons)) {
+		List::push(reversed, next->data.cons->value(0));
+		next = &next->data.cons->value(1);
 	}
+	result = reversed;
 }
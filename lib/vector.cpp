@@ -0,0 +1,519 @@
+#include "qbrt/vector.h"
+#include <memory>
+#include <new>
+
+using namespace std;
+
+#define VECTOR_BITS	5
+#define VECTOR_WIDTH	32
+/** Nodes this full are left alone when rebalancing a concat */
+#define VECTOR_INVARIANT	1
+/** Extra nodes a rebalanced level may have over the optimal count */
+#define VECTOR_EXTRAS	2
+
+
+/**
+ * Trie node with its slots stored inline
+ *
+ * Leaves hold values. Internal nodes hold child pointers followed
+ * by the cumulative size of the children so far. The node is raw
+ * memory, so values are constructed in their slots, not assigned.
+ */
+struct VectorNode
+{
+	uint32_t edit;
+	uint32_t count;
+
+	qbrt_value * values() { return (qbrt_value *) (this + 1); }
+	const qbrt_value * values() const
+	{
+		return (const qbrt_value *) (this + 1);
+	}
+	VectorNode ** child() { return (VectorNode **) (this + 1); }
+	VectorNode * const * child() const
+	{
+		return (VectorNode * const *) (this + 1);
+	}
+	uint32_t * sizes() { return (uint32_t *) (child() + VECTOR_WIDTH); }
+	const uint32_t * sizes() const
+	{
+		return (const uint32_t *) (child() + VECTOR_WIDTH);
+	}
+};
+
+static VectorNode * vector_alloc(int shift, uint32_t edit)
+{
+	size_t size(sizeof(VectorNode));
+	if (shift == 0) {
+		size += VECTOR_WIDTH * sizeof(qbrt_value);
+	} else {
+		size += VECTOR_WIDTH * (sizeof(VectorNode *) + sizeof(uint32_t));
+	}
+	VectorNode *n = (VectorNode *) ::operator new(size);
+	n->edit = edit;
+	n->count = 0;
+	return n;
+}
+
+/** Number of values below a node */
+static inline uint32_t vector_node_size(const VectorNode *n, int shift)
+{
+	return shift == 0 ? n->count : n->sizes()[n->count - 1];
+}
+
+/** Recompute the cumulative child sizes starting at the given child */
+static void vector_update_sizes(VectorNode *n, int shift, uint32_t from)
+{
+	uint32_t total(from ? n->sizes()[from - 1] : 0);
+	for (uint32_t i(from); i<n->count; ++i) {
+		total += vector_node_size(n->child()[i], shift - VECTOR_BITS);
+		n->sizes()[i] = total;
+	}
+}
+
+/**
+ * Find the child that holds an index and make the index relative
+ * to that child. A child can't hold more than 1 << shift values,
+ * so i >> shift is never past the right child.
+ */
+static inline uint32_t vector_find_child(const VectorNode *n, int shift
+		, uint32_t &i)
+{
+	uint32_t c(i >> shift);
+	const uint32_t *sizes(n->sizes());
+	while (sizes[c] <= i) {
+		++c;
+	}
+	if (c) {
+		i -= sizes[c - 1];
+	}
+	return c;
+}
+
+/** Get a version of the node that the edit can change */
+static VectorNode * vector_editable(VectorNode *n, int shift, uint32_t edit)
+{
+	if (edit && n->edit == edit) {
+		return n;
+	}
+	VectorNode *copy(vector_alloc(shift, edit));
+	copy->count = n->count;
+	if (shift == 0) {
+		uninitialized_copy(n->values(), n->values() + n->count
+				, copy->values());
+	} else {
+		memcpy(copy->child(), n->child(), n->count * sizeof(VectorNode *));
+		memcpy(copy->sizes(), n->sizes(), n->count * sizeof(uint32_t));
+	}
+	return copy;
+}
+
+/** Create a node at the shift with the leaf along its left edge */
+static VectorNode * vector_path(int shift, VectorNode *leaf, uint32_t edit)
+{
+	if (shift == 0) {
+		return leaf;
+	}
+	VectorNode *n(vector_alloc(shift, edit));
+	n->child()[0] = vector_path(shift - VECTOR_BITS, leaf, edit);
+	n->sizes()[0] = leaf->count;
+	n->count = 1;
+	return n;
+}
+
+/**
+ * Add a leaf after the last leaf below this node
+ * Return NULL if there's no room below the node.
+ */
+static VectorNode * vector_push_leaf(VectorNode *n, int shift
+		, VectorNode *leaf, uint32_t edit)
+{
+	if (shift > VECTOR_BITS) {
+		VectorNode *last(n->child()[n->count - 1]);
+		VectorNode *pushed(vector_push_leaf(last, shift - VECTOR_BITS
+					, leaf, edit));
+		if (pushed) {
+			n = vector_editable(n, shift, edit);
+			n->child()[n->count - 1] = pushed;
+			n->sizes()[n->count - 1] += leaf->count;
+			return n;
+		}
+	}
+	if (n->count == VECTOR_WIDTH) {
+		return NULL;
+	}
+	n = vector_editable(n, shift, edit);
+	uint32_t total(vector_node_size(n, shift));
+	n->child()[n->count] = vector_path(shift - VECTOR_BITS, leaf, edit);
+	n->sizes()[n->count] = total + leaf->count;
+	++n->count;
+	return n;
+}
+
+static VectorNode * vector_set(VectorNode *n, int shift, uint32_t i
+		, const qbrt_value &val, uint32_t edit)
+{
+	n = vector_editable(n, shift, edit);
+	if (shift == 0) {
+		n->values()[i] = val;
+		return n;
+	}
+	uint32_t c(vector_find_child(n, shift, i));
+	n->child()[c] = vector_set(n->child()[c], shift - VECTOR_BITS, i
+			, val, edit);
+	return n;
+}
+
+/** Copy the values from..to below a node into new nodes */
+static VectorNode * vector_slice(VectorNode *n, int shift
+		, uint32_t from, uint32_t to)
+{
+	if (from == 0 && to == vector_node_size(n, shift)) {
+		return n;
+	}
+	VectorNode *result(vector_alloc(shift, 0));
+	if (shift == 0) {
+		result->count = to - from;
+		uninitialized_copy(n->values() + from, n->values() + to
+				, result->values());
+		return result;
+	}
+
+	uint32_t first_offset(from);
+	uint32_t last_offset(to - 1);
+	uint32_t first(vector_find_child(n, shift, first_offset));
+	uint32_t last(vector_find_child(n, shift, last_offset));
+	int child_shift(shift - VECTOR_BITS);
+	for (uint32_t c(first); c<=last; ++c) {
+		VectorNode *child(n->child()[c]);
+		uint32_t child_from(c == first ? first_offset : 0);
+		uint32_t child_to(c == last ? last_offset + 1
+				: vector_node_size(child, child_shift));
+		result->child()[result->count++] = vector_slice(child
+				, child_shift, child_from, child_to);
+	}
+	vector_update_sizes(result, shift, 0);
+	return result;
+}
+
+/**
+ * Plan how to redistribute slots among the nodes of one level
+ * so it doesn't have many more nodes than it needs
+ * Return the new number of nodes.
+ */
+static uint32_t vector_concat_plan(uint32_t *count, uint32_t len)
+{
+	uint32_t total(0);
+	for (uint32_t i(0); i<len; ++i) {
+		total += count[i];
+	}
+	uint32_t optimal((total + VECTOR_WIDTH - 1) / VECTOR_WIDTH);
+	uint32_t i(0);
+	while (optimal + VECTOR_EXTRAS < len) {
+		while (count[i] > VECTOR_WIDTH - VECTOR_INVARIANT) {
+			++i;
+		}
+		// spread the slots of node i over the nodes after it
+		uint32_t remaining(count[i]);
+		do {
+			uint32_t size(remaining + count[i + 1]);
+			if (size > VECTOR_WIDTH) {
+				size = VECTOR_WIDTH;
+			}
+			remaining = remaining + count[i + 1] - size;
+			count[i] = size;
+			++i;
+		} while (remaining > 0);
+		for (uint32_t j(i); j<len-1; ++j) {
+			count[j] = count[j + 1];
+		}
+		--len;
+		--i;
+	}
+	return len;
+}
+
+/**
+ * Merge the nodes of the left, centre and right nodes, which are all
+ * at the shift, and return a node one level up that holds them
+ * either of left or right may be NULL. The last child of left and
+ * first child of right are already merged into centre.
+ */
+static VectorNode * vector_rebalance(const VectorNode *left
+		, const VectorNode *centre, const VectorNode *right, int shift)
+{
+	VectorNode *all[3 * VECTOR_WIDTH];
+	uint32_t count[3 * VECTOR_WIDTH];
+	uint32_t len(0);
+	if (left) {
+		for (uint32_t i(0); i<left->count-1; ++i) {
+			all[len++] = left->child()[i];
+		}
+	}
+	for (uint32_t i(0); i<centre->count; ++i) {
+		all[len++] = centre->child()[i];
+	}
+	if (right) {
+		for (uint32_t i(1); i<right->count; ++i) {
+			all[len++] = right->child()[i];
+		}
+	}
+	for (uint32_t i(0); i<len; ++i) {
+		count[i] = all[i]->count;
+	}
+	uint32_t planned(vector_concat_plan(count, len));
+
+	int child_shift(shift - VECTOR_BITS);
+	VectorNode *merged[3 * VECTOR_WIDTH];
+	uint32_t src(0);
+	uint32_t offset(0);
+	for (uint32_t k(0); k<planned; ++k) {
+		if (offset == 0 && all[src]->count == count[k]) {
+			merged[k] = all[src++];
+			continue;
+		}
+		VectorNode *n(vector_alloc(child_shift, 0));
+		while (n->count < count[k]) {
+			const VectorNode *from(all[src]);
+			uint32_t copied(count[k] - n->count);
+			if (copied > from->count - offset) {
+				copied = from->count - offset;
+			}
+			if (child_shift == 0) {
+				uninitialized_copy(from->values() + offset
+						, from->values() + offset + copied
+						, n->values() + n->count);
+			} else {
+				memcpy(n->child() + n->count, from->child() + offset
+						, copied * sizeof(VectorNode *));
+			}
+			n->count += copied;
+			offset += copied;
+			if (offset == from->count) {
+				++src;
+				offset = 0;
+			}
+		}
+		if (child_shift > 0) {
+			vector_update_sizes(n, child_shift, 0);
+		}
+		merged[k] = n;
+	}
+
+	VectorNode *top(vector_alloc(shift + VECTOR_BITS, 0));
+	for (uint32_t k(0); k<planned; k+=VECTOR_WIDTH) {
+		VectorNode *n(vector_alloc(shift, 0));
+		n->count = planned - k < VECTOR_WIDTH ? planned - k : VECTOR_WIDTH;
+		memcpy(n->child(), merged + k, n->count * sizeof(VectorNode *));
+		vector_update_sizes(n, shift, 0);
+		top->child()[top->count++] = n;
+	}
+	vector_update_sizes(top, shift + VECTOR_BITS, 0);
+	return top;
+}
+
+/**
+ * Join two trees
+ * Return a node one level above the taller tree.
+ */
+static VectorNode * vector_concat(const VectorNode *left, int lshift
+		, const VectorNode *right, int rshift)
+{
+	if (lshift > rshift) {
+		VectorNode *centre(vector_concat(left->child()[left->count - 1]
+					, lshift - VECTOR_BITS, right, rshift));
+		return vector_rebalance(left, centre, NULL, lshift);
+	}
+	if (lshift < rshift) {
+		VectorNode *centre(vector_concat(left, lshift
+					, right->child()[0], rshift - VECTOR_BITS));
+		return vector_rebalance(NULL, centre, right, rshift);
+	}
+	if (lshift > 0) {
+		VectorNode *centre(vector_concat(left->child()[left->count - 1]
+					, lshift - VECTOR_BITS, right->child()[0]
+					, rshift - VECTOR_BITS));
+		return vector_rebalance(left, centre, right, lshift);
+	}
+
+	VectorNode *n(vector_alloc(VECTOR_BITS, 0));
+	if (left->count + right->count <= VECTOR_WIDTH) {
+		VectorNode *leaf(vector_alloc(0, 0));
+		uninitialized_copy(left->values(), left->values() + left->count
+				, leaf->values());
+		uninitialized_copy(right->values()
+				, right->values() + right->count
+				, leaf->values() + left->count);
+		leaf->count = left->count + right->count;
+		n->child()[n->count++] = leaf;
+	} else {
+		n->child()[n->count++] = const_cast< VectorNode * >(left);
+		n->child()[n->count++] = const_cast< VectorNode * >(right);
+	}
+	vector_update_sizes(n, VECTOR_BITS, 0);
+	return n;
+}
+
+
+uint32_t Vector::tail_offset() const
+{
+	return tail ? count - tail->count : count;
+}
+
+const qbrt_value * Vector::get(uint32_t i) const
+{
+	if (i >= count) {
+		return NULL;
+	}
+	uint32_t offset(tail_offset());
+	if (i >= offset) {
+		return &tail->values()[i - offset];
+	}
+	const VectorNode *n(root);
+	for (int s(shift); s > 0; s -= VECTOR_BITS) {
+		n = n->child()[vector_find_child(n, s, i)];
+	}
+	return &n->values()[i];
+}
+
+void Vector::push_leaf(VectorNode *leaf)
+{
+	if (!root) {
+		root = leaf;
+		shift = 0;
+		return;
+	}
+	VectorNode *pushed(NULL);
+	if (shift > 0) {
+		pushed = vector_push_leaf(root, shift, leaf, edit);
+	}
+	if (pushed) {
+		root = pushed;
+		return;
+	}
+	// no room left in the trie, add a level above the root
+	VectorNode *top(vector_alloc(shift + VECTOR_BITS, edit));
+	top->child()[0] = root;
+	top->child()[1] = vector_path(shift, leaf, edit);
+	top->count = 2;
+	shift += VECTOR_BITS;
+	vector_update_sizes(top, shift, 0);
+	root = top;
+}
+
+void Vector::push_in_place(const qbrt_value &val)
+{
+	if (!tail || tail->count == VECTOR_WIDTH) {
+		if (tail) {
+			push_leaf(tail);
+		}
+		tail = vector_alloc(0, edit);
+	} else {
+		tail = vector_editable(tail, 0, edit);
+	}
+	new (&tail->values()[tail->count++]) qbrt_value(val);
+	++count;
+}
+
+void Vector::set_in_place(uint32_t i, const qbrt_value &val)
+{
+	uint32_t offset(tail_offset());
+	if (i >= offset) {
+		tail = vector_editable(tail, 0, edit);
+		tail->values()[i - offset] = val;
+	} else {
+		root = vector_set(root, shift, i, val, edit);
+	}
+}
+
+Vector * Vector::push(const Vector &v, const qbrt_value &val)
+{
+	Vector *result(new Vector(v));
+	result->edit = 0;
+	result->push_in_place(val);
+	return result;
+}
+
+Vector * Vector::set(const Vector &v, uint32_t i, const qbrt_value &val)
+{
+	Vector *result(new Vector(v));
+	result->edit = 0;
+	result->set_in_place(i, val);
+	return result;
+}
+
+Vector * Vector::slice(const Vector &v, uint32_t start, uint32_t end)
+{
+	Vector *result(new Vector());
+	if (end > v.count) {
+		end = v.count;
+	}
+	if (start >= end) {
+		return result;
+	}
+
+	uint32_t offset(v.tail_offset());
+	if (start < offset) {
+		uint32_t trie_end(end < offset ? end : offset);
+		result->root = vector_slice(v.root, v.shift, start, trie_end);
+		result->shift = v.shift;
+		while (result->shift > 0 && result->root->count == 1) {
+			result->root = result->root->child()[0];
+			result->shift -= VECTOR_BITS;
+		}
+		result->count = trie_end - start;
+	}
+	if (end > offset) {
+		uint32_t from(start > offset ? start - offset : 0);
+		result->tail = vector_slice(v.tail, 0, from, end - offset);
+		result->count += result->tail->count;
+	}
+	return result;
+}
+
+Vector * Vector::concat(const Vector &a, const Vector &b)
+{
+	Vector *result(new Vector(a));
+	result->edit = 0;
+	if (b.count == 0) {
+		return result;
+	}
+	if (a.count == 0) {
+		*result = b;
+		result->edit = 0;
+		return result;
+	}
+	if (!b.root) {
+		for (uint32_t i(0); i<b.tail->count; ++i) {
+			result->push_in_place(b.tail->values()[i]);
+		}
+		return result;
+	}
+
+	if (result->tail) {
+		result->push_leaf(result->tail);
+		result->tail = NULL;
+	}
+	VectorNode *root(vector_concat(result->root, result->shift
+				, b.root, b.shift));
+	int shift((result->shift > b.shift ? result->shift : b.shift)
+			+ VECTOR_BITS);
+	while (shift > 0 && root->count == 1) {
+		root = root->child()[0];
+		shift -= VECTOR_BITS;
+	}
+	result->root = root;
+	result->shift = shift;
+	result->tail = b.tail;
+	result->count = a.count + b.count;
+	return result;
+}
+
+static uint32_t g_next_edit = 0;
+
+Vector * Vector::transient(const Vector &v)
+{
+	Vector *result(new Vector(v));
+	result->edit = __sync_add_and_fetch(&g_next_edit, 1);
+	return result;
+}